@@ -0,0 +1,332 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+/**
+ * Host side of datagram encryption (see main/aead.h).
+ *
+ * Without -b, receives datagrams on the given port, checks and decrypts
+ * sealed ones, and prints them. Datagrams that are not sealed are printed
+ * as received, datagrams that do not authenticate are reported.
+ *
+ * With -b, runs the benchmark of main/aead.c with software AES, and prints
+ * the cycles used per datagram. On x86, cycles are counted with the time
+ * stamp counter.
+ *
+ * With -t, seals and opens the fragments of a record, and checks that
+ * every fragment is sealed under a nonce of its own.
+ *
+ * The key is given in hexadecimal, as written into NVS on the device.
+ *
+ * Build (mbedTLS development files required):
+ *   gcc -O2 -Wall -I main -o aead_tool host/aead_tool.c main/aead.c main/frame.c \
+ *       main/fragment.c -lmbedcrypto
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "aead.h"
+#include "fragment.h"
+#include "frame.h"
+
+#define DEFAULT_PORT 44444
+
+#define DEFAULT_ITERATIONS 1000
+
+#define MAX_DATAGRAM 1500
+
+// Fragment check: a record of CHECK_RECORD_LENGTH payload bytes, in
+// datagrams of CHECK_MAX_DATAGRAM bytes.
+#define CHECK_RECORD_LENGTH 600
+#define CHECK_MAX_DATAGRAM 256
+
+/**
+ * Returns the cycle counter, or nanoseconds where there is none.
+ */
+static uint32_t cycles(void) {
+
+#if defined(__x86_64__) || defined(__i386__)
+	return (uint32_t)__rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+#endif
+
+}
+
+/**
+ * Parses a hexadecimal key. Returns its length in bytes, or 0 on error.
+ */
+static uint8_t parse_key(const char *text, uint8_t *key) {
+
+	size_t length = strlen(text);
+	if (length % 2 != 0 || length / 2 > AEAD_KEY_MAX_LENGTH) {
+		return 0;
+	}
+	for (size_t i = 0; i < length / 2; i++) {
+		unsigned int value;
+		if (sscanf(&text[2 * i], "%2x", &value) != 1) {
+			return 0;
+		}
+		key[i] = (uint8_t)value;
+	}
+	return (uint8_t)(length / 2);
+
+}
+
+static int benchmark(aead_t *aead, const char *mode_name, uint16_t iterations) {
+
+	aead_bench_result_t results[AEAD_BENCH_LENGTHS];
+
+	if (!aead_benchmark(aead, cycles, iterations, results)) {
+		fprintf(stderr, "Benchmark failed\n");
+		return 1;
+	}
+	printf("AES-%s, software, %u iterations\n", mode_name, iterations);
+	printf("payload  seal cycles  open cycles  seal bytes/cycle\n");
+	for (uint8_t i = 0; i < AEAD_BENCH_LENGTHS; i++) {
+		printf("%7u  %11u  %11u  %16.3f\n", results[i].payload_length,
+			   results[i].seal_cycles, results[i].open_cycles,
+			   results[i].seal_cycles > 0 ?
+					   (double)results[i].payload_length / results[i].seal_cycles : 0.0);
+	}
+	return 0;
+
+}
+
+/**
+ * Seals the first two fragments of a record whose payload is all zeros.
+ * Both fragments have the same length and plaintext: with a reused nonce,
+ * their ciphertexts would be identical. Then checks that both open, and
+ * that a fragment whose index has been modified does not authenticate.
+ */
+static int check_fragments(aead_t *aead, const char *mode_name) {
+
+	uint8_t frame[FRAME_HEADER_LENGTH + CHECK_RECORD_LENGTH];
+	uint8_t fragments[2][CHECK_MAX_DATAGRAM];
+	uint8_t sealed[2][CHECK_MAX_DATAGRAM + AEAD_OVERHEAD];
+	uint8_t opened[CHECK_MAX_DATAGRAM];
+	uint16_t fragment_lengths[2];
+	uint16_t sealed_lengths[2];
+	uint16_t opened_length;
+
+	static const uint8_t salt[AEAD_SALT_LENGTH] = { 1, 2, 3, 4, 5, 6 };
+	aead_set_salt(aead, salt);
+	frame_header_t header = {
+		.version = FRAME_VERSION,
+		.type = FRAME_DATA,
+		.flags = 0,
+		.stream_id = 1,
+		.seq = 7,
+	};
+	memset(frame, 0, sizeof(frame));
+	frame_encode_header(&header, frame);
+	if (fragment_count(CHECK_RECORD_LENGTH, CHECK_MAX_DATAGRAM) < 3) {
+		fprintf(stderr, "Fragment check: not enough fragments\n");
+		return 1;
+	}
+	for (uint16_t i = 0; i < 2; i++) {
+		fragment_lengths[i] = fragment_build(frame, sizeof(frame), CHECK_MAX_DATAGRAM,
+				                             i, fragments[i]);
+		if (fragment_lengths[i] == 0 ||
+			!aead_seal(aead, fragments[i], fragment_lengths[i], sealed[i], &sealed_lengths[i])) {
+			fprintf(stderr, "Fragment check: fragment %u not sealed\n", i);
+			return 1;
+		}
+	}
+	// The fragment header is in clear, the ciphertext follows the salt. The
+	// tags differ anyway, as the fragment headers are authenticated.
+	uint16_t offset = FRAGMENT_OVERHEAD + AEAD_SALT_LENGTH;
+	uint16_t ciphertext_length = fragment_lengths[0] - FRAGMENT_OVERHEAD;
+	if (memcmp(&sealed[0][offset], &sealed[1][offset], ciphertext_length) == 0) {
+		printf("AES-%s, fragments sealed under the same nonce: FAILED\n", mode_name);
+		return 1;
+	}
+	for (uint16_t i = 0; i < 2; i++) {
+		if (!aead_open(aead, sealed[i], sealed_lengths[i], opened, &opened_length) ||
+			opened_length != fragment_lengths[i] ||
+			memcmp(opened, fragments[i], opened_length) != 0) {
+			printf("AES-%s, fragment %u not opened: FAILED\n", mode_name, i);
+			return 1;
+		}
+	}
+	sealed[1][FRAME_HEADER_LENGTH + 1] ^= 1;
+	if (aead_open(aead, sealed[1], sealed_lengths[1], opened, &opened_length)) {
+		printf("AES-%s, modified fragment index authenticated: FAILED\n", mode_name);
+		return 1;
+	}
+	printf("AES-%s, fragments sealed under different nonces: OK\n", mode_name);
+	return 0;
+
+}
+
+/**
+ * Receives datagrams on sock forever, and prints them.
+ */
+static void serve(int sock, aead_t *aead, bool hex) {
+
+	uint8_t buffer[MAX_DATAGRAM];
+	uint8_t opened[MAX_DATAGRAM];
+	struct sockaddr_in from;
+	socklen_t from_length;
+	frame_header_t header;
+	uint32_t rejected = 0;
+
+	while (true) {
+		from_length = sizeof(from);
+		ssize_t length = recvfrom(sock, buffer, sizeof(buffer), 0,
+				                  (struct sockaddr *)&from, &from_length);
+		if (length < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("recvfrom");
+			return;
+		}
+		if (!frame_decode_header(buffer, (uint16_t)length, &header)) {
+			printf("%s:%d - %zd bytes, no header\n", inet_ntoa(from.sin_addr),
+				   ntohs(from.sin_port), length);
+			continue;
+		}
+		const uint8_t *frame = buffer;
+		uint16_t frame_length = (uint16_t)length;
+		const char *status = "clear";
+		if ((header.flags & FRAME_FLAG_ENCRYPTED) != 0) {
+			if (!aead_open(aead, buffer, (uint16_t)length, opened, &frame_length)) {
+				rejected++;
+				printf("%s:%d - type %d, stream %d, seq %u, %zd bytes, "
+					   "authentication failure (%u)\n",
+					   inet_ntoa(from.sin_addr), ntohs(from.sin_port),
+					   header.type, header.stream_id, header.seq, length, rejected);
+				continue;
+			}
+			frame = opened;
+			status = "authenticated";
+		}
+		printf("%s:%d - type %d, stream %d, epoch %u, seq %u, %u payload bytes, %s\n",
+			   inet_ntoa(from.sin_addr), ntohs(from.sin_port),
+			   header.type, header.stream_id, header.epoch, header.seq,
+			   frame_length - FRAME_HEADER_LENGTH, status);
+		if (hex) {
+			for (uint16_t i = FRAME_HEADER_LENGTH; i < frame_length; i++) {
+				printf("%02x%s", frame[i],
+					   (i - FRAME_HEADER_LENGTH) % 32 == 31 || i == frame_length - 1 ? "\n" : "");
+			}
+		}
+	}
+
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s -k hex_key [-c] [-p port] [-x] | -k hex_key [-c] -b [iterations] |\n"
+			"       -k hex_key [-c] -t\n"
+			"  -c  AES-CCM instead of AES-GCM\n"
+			"  -x  print payloads in hexadecimal\n", name);
+}
+
+int main(int argc, char *argv[]) {
+
+	uint8_t key[AEAD_KEY_MAX_LENGTH];
+	uint8_t key_length = 0;
+	aead_mode_t mode = AEAD_GCM;
+	uint16_t port = DEFAULT_PORT;
+	bool bench = false;
+	bool check = false;
+	bool hex = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "k:cp:xbt")) != -1) {
+		switch (opt) {
+		case 'k':
+			key_length = parse_key(optarg, key);
+			break;
+		case 'c':
+			mode = AEAD_CCM;
+			break;
+		case 'p':
+			port = (uint16_t)atoi(optarg);
+			break;
+		case 'x':
+			hex = true;
+			break;
+		case 'b':
+			bench = true;
+			break;
+		case 't':
+			check = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	aead_t aead;
+	if (key_length == 0 || !aead_init(&aead, mode, key, key_length)) {
+		fprintf(stderr, "Invalid key: 16, 24 or 32 bytes expected\n");
+		usage(argv[0]);
+		return 2;
+	}
+	if (bench) {
+		uint16_t iterations = optind < argc ? (uint16_t)atoi(argv[optind]) : DEFAULT_ITERATIONS;
+		int rs = benchmark(&aead, mode == AEAD_GCM ? "GCM" : "CCM", iterations);
+		aead_free(&aead);
+		return rs;
+	}
+	if (check) {
+		int rs = check_fragments(&aead, mode == AEAD_GCM ? "GCM" : "CCM");
+		aead_free(&aead);
+		return rs;
+	}
+
+	int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock < 0) {
+		perror("socket");
+		return 1;
+	}
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	if (bind(sock, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		perror("bind");
+		close(sock);
+		return 1;
+	}
+	printf("Waiting for datagrams on port %d\n", port);
+	serve(sock, &aead, hex);
+	close(sock);
+	aead_free(&aead);
+	return 1;
+
+}
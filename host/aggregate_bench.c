@@ -0,0 +1,195 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+
+
+/**
+ * Cost and data reduction of windowed aggregation (main/aggregate.c).
+ *
+ * A signal (sine wave with a period of 60 s, amplitude 1000, plus noise)
+ * is sampled at -r samples per second, and aggregated over windows of -w
+ * ms, tumbling and sliding with 2, 4 and 8 panes. With -t, samples whose
+ * magnitude is over the threshold are also sent raw. The records are
+ * decoded and checked. The report gives, per configuration, the time per
+ * sample, the records given, and the reduction of datagrams and bytes
+ * (frame header included) against one datagram per sample.
+ *
+ * Build:
+ *   gcc -O2 -Wall -I main -o aggregate_bench host/aggregate_bench.c \
+ *       main/aggregate.c main/frame.c -lm
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aggregate.h"
+#include "frame.h"
+
+// Bytes of a sample sent alone.
+#define RAW_SAMPLE_LENGTH 4
+
+typedef struct {
+	uint64_t records;
+	uint64_t bytes;
+	uint64_t summarized;       // Samples counted by tumbling window summaries.
+	uint64_t errors;
+} sink_state_t;
+
+static uint64_t random_state = 1;
+
+static uint32_t random_u32(void) {
+
+	// xorshift64*
+	random_state ^= random_state >> 12;
+	random_state ^= random_state << 25;
+	random_state ^= random_state >> 27;
+	return (uint32_t)((random_state * 2685821657736338717ULL) >> 32);
+
+}
+
+static double elapsed_s(const struct timespec *start) {
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+
+}
+
+/**
+ * Stands for producer_push(): decodes and checks the record.
+ */
+static bool sink(void *target, const uint8_t *buffer, uint32_t length) {
+
+	sink_state_t *state = (sink_state_t *)target;
+	aggregate_record_t record;
+	state->records++;
+	state->bytes += FRAME_HEADER_LENGTH + length;
+	if (!aggregate_decode(buffer, length, &record)) {
+		state->errors++;
+		return true;
+	}
+	if (record.kind == AGGREGATE_KIND_SUMMARY) {
+		if (record.min > record.mean || record.mean > record.max ||
+			record.value < record.min || record.value > record.max) {
+			state->errors++;
+		}
+		if ((record.flags & AGGREGATE_FLAG_SLIDING) == 0) {
+			state->summarized += record.count;
+		}
+	}
+	return true;
+
+}
+
+static void usage(const char *name) {
+
+	fprintf(stderr,
+			"Usage: %s [options]\n"
+			"  -r rate    samples per second (default 1000)\n"
+			"  -w ms      window length (default 1000)\n"
+			"  -t value   raw passthrough of samples whose magnitude is over value (default: none)\n"
+			"  -n count   samples per configuration (default 10000000)\n",
+			name);
+
+}
+
+int main(int argc, char *argv[]) {
+
+	double rate = 1000.0;
+	uint32_t window_ms = 1000;
+	int32_t threshold = -1;
+	uint32_t count = 10000000;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "r:w:t:n:")) != -1) {
+		switch (opt) {
+		case 'r': rate = atof(optarg); break;
+		case 'w': window_ms = (uint32_t)atoi(optarg); break;
+		case 't': threshold = atoi(optarg); break;
+		case 'n': count = (uint32_t)atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (rate <= 0.0 || window_ms < AGGREGATE_MAX_PANES || count == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	// Samples are computed once, so that only aggregation is timed.
+	int32_t *values = malloc(sizeof(int32_t) * count);
+	uint32_t *times = malloc(sizeof(uint32_t) * count);
+	if (values == NULL || times == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		double t_s = i / rate;
+		times[i] = (uint32_t)(uint64_t)(t_s * 1000.0);
+		values[i] = (int32_t)(1000.0 * sin(2.0 * M_PI * t_s / 60.0)) +
+				    (int32_t)(random_u32() % 101) - 50;
+	}
+
+	static const uint8_t PANES[] = { 1, 2, 4, 8 };
+	printf("%8s %10s %10s %12s %12s %12s %8s\n", "panes", "ns/sample", "summaries",
+		   "raw records", "datagrams /", "bytes /", "errors");
+	for (uint8_t c = 0; c < sizeof(PANES); c++) {
+		aggregate_config_t config = {
+			.window_ms = window_ms,
+			.panes = PANES[c],
+			.passthrough = threshold >= 0,
+			.low = -threshold,
+			.high = threshold,
+		};
+		sink_state_t state = { 0 };
+		aggregate_t aggregate;
+		if (!aggregate_init(&aggregate, &config, sink, &state)) {
+			fprintf(stderr, "Invalid configuration\n");
+			return 1;
+		}
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (uint32_t i = 0; i < count; i++) {
+			aggregate_add(&aggregate, values[i], times[i]);
+		}
+		// Last window.
+		aggregate_poll(&aggregate, times[count - 1] + window_ms);
+		double s = elapsed_s(&start);
+
+		aggregate_stats_t stats;
+		aggregate_get_stats(&aggregate, &stats);
+		if (PANES[c] == 1 && state.summarized != count) {
+			state.errors++;
+		}
+		uint64_t raw_bytes = (uint64_t)count * (FRAME_HEADER_LENGTH + RAW_SAMPLE_LENGTH);
+		printf("%8u %10.1f %10u %12u %12.1f %12.1f %8llu\n", PANES[c], s * 1e9 / count,
+			   stats.summaries, stats.raw, (double)count / state.records,
+			   (double)raw_bytes / state.bytes, (unsigned long long)state.errors);
+	}
+	free(values);
+	free(times);
+	return 0;
+
+}
@@ -0,0 +1,1017 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+
+/**
+ * Collector for a fleet of senders.
+ *
+ * Worker threads (-j) own one UDP socket each, all bound to the same port
+ * with SO_REUSEPORT: the kernel spreads the senders over the workers, the
+ * datagrams of a sender always landing on the same worker. Every worker
+ * receives batches of datagrams with recvmmsg(), answers time requests,
+ * reassembles fragmented records (see host/reassembly.h), keeps counters
+ * per sender address and stream, and appends data records to its own
+ * memory-mapped segment file.
+ *
+ * Segments are time partitioned: a worker starts a new segment at every
+ * partition boundary (-P), or when the current one is full (-S). When a
+ * segment is closed, its index is written next to it: one entry per
+ * record, sorted by device (sender address and port), stream and
+ * reception time, so that the records of a device over a time range are
+ * found with a binary search. Files are named <partition start>-<worker>
+ * with .seg and .idx extensions, and use host byte order.
+ *
+ * With -r, prints the records of a device (-a address:port, -s stream)
+ * received in a time range (-f, -u, Unix time in seconds) from the
+ * segments of a directory.
+ *
+ * With -t, runs a benchmark on the loopback interface for the given
+ * duration: generator threads (-g) send data frames with sendmmsg(), each
+ * from its own set of sockets (-c), as fast as possible.
+ *
+ * Every report (-i) gives datagrams per second, and datagrams per second
+ * per core: datagrams divided by the CPU time of the workers.
+ *
+ * Reliable streams are not acknowledged.
+ *
+ * Build:
+ *   gcc -O2 -Wall -I main -I host -o collector host/collector.c \
+ *       host/reassembly.c main/fragment.c main/frame.c -lpthread
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fragment.h"
+#include "frame.h"
+#include "reassembly.h"
+
+#define DEFAULT_PORT 44444
+
+#define MAX_WORKERS 64
+#define MAX_BATCH 256
+#define MAX_DATAGRAM 1500
+
+// Socket receive buffer of the workers.
+#define RECEIVE_BUFFER_SIZE (8 * 1024 * 1024)
+
+// Sender and stream counters, per worker.
+#define DEVICE_TABLE_SIZE 65536
+
+// Reassembly bounds, per worker.
+#define REASSEMBLY_MAX_RECORDS 256
+#define REASSEMBLY_MAX_BYTES (32 * 1024 * 1024)
+#define REASSEMBLY_TIMEOUT_US 5000000
+
+#define SEGMENT_MAGIC "UDPSEG1"
+#define INDEX_MAGIC "UDPIDX1"
+
+// Benchmark.
+#define MAX_GENERATORS 64
+#define GENERATOR_BATCH 64
+
+// Segment file header.
+typedef struct {
+	char magic[8];
+	uint64_t start_us;    // Partition start.
+	uint64_t end_us;      // Partition end.
+	uint32_t worker;
+	uint32_t reserved;
+} segment_header_t;
+
+// Record in a segment: this header, then the frame, padded to 8 bytes.
+typedef struct {
+	uint32_t size;          // Header, frame and padding.
+	uint32_t frame_length;
+	uint64_t received_us;
+	uint32_t addr;          // Sender IPv4 address, network byte order.
+	uint16_t port;          // Sender port, host byte order.
+	uint8_t stream_id;
+	uint8_t reserved;
+} record_header_t;
+
+// Index file header, followed by the entries.
+typedef struct {
+	char magic[8];
+	uint64_t start_us;
+	uint64_t end_us;
+	uint64_t count;
+} index_header_t;
+
+typedef struct {
+	uint32_t addr;
+	uint16_t port;
+	uint8_t stream_id;
+	uint8_t reserved;
+	uint64_t received_us;
+	uint64_t offset;        // Of the record in the segment.
+} index_entry_t;
+
+typedef struct {
+	bool used;
+	uint32_t addr;
+	uint16_t port;
+	uint8_t stream_id;
+	uint32_t epoch;
+	uint32_t next_seq;
+	uint64_t datagrams;
+	uint64_t lost;          // Sequence number gaps.
+} device_t;
+
+typedef struct {
+	pthread_t thread;
+	uint32_t id;
+	int sock;
+	reassembly_t *reassembly;
+	device_t *devices;
+	uint32_t device_count;
+	// Current segment.
+	int segment_fd;
+	uint8_t *segment;
+	uint64_t segment_used;
+	uint64_t partition_start_us;
+	index_entry_t *index;
+	uint64_t index_count;
+	uint64_t index_capacity;
+	// Counters, read by the main thread.
+	uint64_t datagrams;
+	uint64_t bytes;
+	uint64_t records;
+	uint64_t batches;
+	uint64_t cpu_ns;
+	uint64_t errors;
+} worker_t;
+
+typedef struct {
+	pthread_t thread;
+	uint32_t id;
+	uint16_t port;
+	uint32_t senders;
+	uint16_t record_length;
+	uint64_t sent;
+} generator_t;
+
+static const char *directory = ".";
+static uint64_t partition_us = 60000000;
+static uint64_t segment_size = 64 * 1024 * 1024;
+static uint32_t batch_size = 64;
+
+static volatile bool stopping = false;
+
+static uint64_t realtime_us(void) {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+}
+
+static uint64_t thread_cpu_ns(void) {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+}
+
+static void stop_handler(int signal) {
+	stopping = true;
+}
+
+//========================================
+// Segments.
+
+static void segment_path(char *path, size_t size, uint64_t start_us, uint32_t worker,
+		                 const char *extension) {
+	snprintf(path, size, "%s/%llu-%u.%s", directory,
+			 (unsigned long long)(start_us / 1000000), worker, extension);
+}
+
+static int compare_entries(const void *a, const void *b) {
+
+	const index_entry_t *ea = a;
+	const index_entry_t *eb = b;
+	if (ea->addr != eb->addr) {
+		return ea->addr < eb->addr ? -1 : 1;
+	}
+	if (ea->port != eb->port) {
+		return ea->port < eb->port ? -1 : 1;
+	}
+	if (ea->stream_id != eb->stream_id) {
+		return ea->stream_id < eb->stream_id ? -1 : 1;
+	}
+	if (ea->received_us != eb->received_us) {
+		return ea->received_us < eb->received_us ? -1 : 1;
+	}
+	return ea->offset < eb->offset ? -1 : (ea->offset > eb->offset);
+
+}
+
+/**
+ * Truncates the current segment to its used length, unmaps it, and writes
+ * its index.
+ */
+static void close_segment(worker_t *worker) {
+
+	if (worker->segment == NULL) {
+		return;
+	}
+	segment_header_t *header = (segment_header_t *)worker->segment;
+	header->end_us = worker->partition_start_us + partition_us;
+	munmap(worker->segment, segment_size);
+	if (ftruncate(worker->segment_fd, worker->segment_used) < 0) {
+		perror("ftruncate");
+	}
+	close(worker->segment_fd);
+	worker->segment = NULL;
+
+	qsort(worker->index, worker->index_count, sizeof(index_entry_t), compare_entries);
+	char path[512];
+	segment_path(path, sizeof(path), worker->partition_start_us, worker->id, "idx");
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		perror(path);
+		worker->index_count = 0;
+		return;
+	}
+	index_header_t index_header = {
+		.magic = INDEX_MAGIC,
+		.start_us = worker->partition_start_us,
+		.end_us = worker->partition_start_us + partition_us,
+		.count = worker->index_count,
+	};
+	if (fwrite(&index_header, sizeof(index_header), 1, file) != 1 ||
+		fwrite(worker->index, sizeof(index_entry_t), worker->index_count, file) !=
+			worker->index_count) {
+		perror(path);
+	}
+	fclose(file);
+	worker->index_count = 0;
+
+}
+
+/**
+ * Opens a new segment for the partition of now_us. A partition can have
+ * several segments if they fill up: their start time is then the time of
+ * their first record. Returns false on error.
+ */
+static bool open_segment(worker_t *worker, uint64_t now_us) {
+
+	uint64_t start_us = now_us - now_us % partition_us;
+	if (start_us <= worker->partition_start_us) {
+		// Same partition, the previous segment is full.
+		start_us = now_us;
+	}
+	char path[512];
+	segment_path(path, sizeof(path), start_us, worker->id, "seg");
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(path);
+		return false;
+	}
+	if (ftruncate(fd, segment_size) < 0) {
+		perror("ftruncate");
+		close(fd);
+		return false;
+	}
+	uint8_t *segment = mmap(NULL, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (segment == MAP_FAILED) {
+		perror("mmap");
+		close(fd);
+		return false;
+	}
+	segment_header_t *header = (segment_header_t *)segment;
+	memcpy(header->magic, SEGMENT_MAGIC, sizeof(header->magic));
+	header->start_us = start_us;
+	header->end_us = 0;
+	header->worker = worker->id;
+	worker->segment_fd = fd;
+	worker->segment = segment;
+	worker->segment_used = sizeof(segment_header_t);
+	worker->partition_start_us = start_us;
+	return true;
+
+}
+
+/**
+ * Appends a record made of two parts to the segment of the worker, and
+ * adds it to the index.
+ */
+static void append_record(worker_t *worker, const struct sockaddr_in *from,
+		                  uint8_t stream_id, uint64_t received_us,
+						  const uint8_t *part1, uint32_t length1,
+						  const uint8_t *part2, uint32_t length2) {
+
+	uint32_t size = (sizeof(record_header_t) + length1 + length2 + 7) & ~7u;
+	if (size > segment_size - sizeof(segment_header_t)) {
+		worker->errors++;
+		return;
+	}
+	if (worker->segment != NULL &&
+		(received_us >= worker->partition_start_us + partition_us ||
+		 worker->segment_used + size > segment_size)) {
+		close_segment(worker);
+	}
+	if (worker->segment == NULL && !open_segment(worker, received_us)) {
+		worker->errors++;
+		return;
+	}
+	if (worker->index_count == worker->index_capacity) {
+		uint64_t capacity = worker->index_capacity > 0 ? 2 * worker->index_capacity : 4096;
+		index_entry_t *index = realloc(worker->index, capacity * sizeof(index_entry_t));
+		if (index == NULL) {
+			worker->errors++;
+			return;
+		}
+		worker->index = index;
+		worker->index_capacity = capacity;
+	}
+	uint8_t *record = &worker->segment[worker->segment_used];
+	record_header_t header = {
+		.size = size,
+		.frame_length = length1 + length2,
+		.received_us = received_us,
+		.addr = from->sin_addr.s_addr,
+		.port = ntohs(from->sin_port),
+		.stream_id = stream_id,
+	};
+	memcpy(record, &header, sizeof(header));
+	memcpy(&record[sizeof(header)], part1, length1);
+	if (length2 > 0) {
+		memcpy(&record[sizeof(header) + length1], part2, length2);
+	}
+	index_entry_t *entry = &worker->index[worker->index_count++];
+	entry->addr = header.addr;
+	entry->port = header.port;
+	entry->stream_id = stream_id;
+	entry->reserved = 0;
+	entry->received_us = received_us;
+	entry->offset = worker->segment_used;
+	worker->segment_used += size;
+	worker->records++;
+
+}
+
+//========================================
+// Workers.
+
+/**
+ * Returns the counters of a sender and stream, or NULL if the table is
+ * full.
+ */
+static device_t *find_device(worker_t *worker, uint32_t addr, uint16_t port,
+		                     uint8_t stream_id) {
+
+	uint32_t hash = (addr * 2654435761u) ^ ((uint32_t)port << 8 | stream_id) * 40503u;
+	for (uint32_t i = 0; i < DEVICE_TABLE_SIZE; i++) {
+		device_t *device = &worker->devices[(hash + i) % DEVICE_TABLE_SIZE];
+		if (!device->used) {
+			if (worker->device_count >= DEVICE_TABLE_SIZE / 2) {
+				return NULL;
+			}
+			device->used = true;
+			device->addr = addr;
+			device->port = port;
+			device->stream_id = stream_id;
+			worker->device_count++;
+			return device;
+		}
+		if (device->addr == addr && device->port == port && device->stream_id == stream_id) {
+			return device;
+		}
+	}
+	return NULL;
+
+}
+
+static void count_datagram(worker_t *worker, const struct sockaddr_in *from,
+		                   const frame_header_t *header) {
+
+	device_t *device = find_device(worker, from->sin_addr.s_addr, ntohs(from->sin_port),
+			                       header->stream_id);
+	if (device == NULL) {
+		return;
+	}
+	if (device->datagrams > 0 && device->epoch == header->epoch &&
+		frame_seq_before(device->next_seq, header->seq)) {
+		device->lost += header->seq - device->next_seq;
+	}
+	if (device->datagrams == 0 || device->epoch != header->epoch ||
+		!frame_seq_before(header->seq, device->next_seq)) {
+		device->next_seq = header->seq + 1;
+	}
+	device->epoch = header->epoch;
+	device->datagrams++;
+
+}
+
+static void answer_time_request(worker_t *worker, const frame_header_t *header,
+		                        const struct sockaddr_in *from, uint64_t t2) {
+
+	uint8_t buffer[FRAME_TIME_RESPONSE_LENGTH];
+	frame_time_response_t response = {
+		.header = {
+			.version = FRAME_VERSION,
+			.type = FRAME_TIME_RESPONSE,
+			.flags = 0,
+			.stream_id = header->stream_id,
+			.seq = header->seq,
+		},
+		.t1_us = header->timestamp_us,
+		.t2_us = t2,
+	};
+	response.t3_us = realtime_us();
+	response.header.timestamp_us = response.t3_us;
+	frame_encode_time_response(&response, buffer);
+	if (sendto(worker->sock, buffer, sizeof(buffer), 0,
+			   (const struct sockaddr *)from, sizeof(*from)) < 0) {
+		worker->errors++;
+	}
+
+}
+
+static void process_datagram(worker_t *worker, const uint8_t *buffer, uint16_t length,
+		                     const struct sockaddr_in *from, uint64_t received_us) {
+
+	frame_header_t header;
+	const uint8_t *record;
+	uint32_t record_length;
+
+	if (!frame_decode_header(buffer, length, &header)) {
+		worker->errors++;
+		return;
+	}
+	if (header.type == FRAME_TIME_REQUEST) {
+		answer_time_request(worker, &header, from, received_us);
+		return;
+	}
+	if ((header.flags & FRAME_FLAG_FRAGMENT) == 0) {
+		count_datagram(worker, from, &header);
+		append_record(worker, from, header.stream_id, received_us,
+				      buffer, length, NULL, 0);
+		return;
+	}
+	reassembly_rs_t rs = reassembly_add(worker->reassembly, buffer, length, received_us,
+			                            &header, &record, &record_length);
+	if (rs == REASSEMBLY_COMPLETE) {
+		uint8_t frame_header[FRAME_HEADER_LENGTH];
+		frame_encode_header(&header, frame_header);
+		count_datagram(worker, from, &header);
+		append_record(worker, from, header.stream_id, received_us,
+				      frame_header, FRAME_HEADER_LENGTH, record, record_length);
+	} else if (rs != REASSEMBLY_INCOMPLETE) {
+		worker->errors++;
+	}
+
+}
+
+static void *worker_thread(void *arg) {
+
+	worker_t *worker = arg;
+	uint8_t (*buffers)[MAX_DATAGRAM] = malloc(MAX_BATCH * MAX_DATAGRAM);
+	struct sockaddr_in addresses[MAX_BATCH];
+	struct iovec iovecs[MAX_BATCH];
+	struct mmsghdr messages[MAX_BATCH];
+
+	if (buffers == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return NULL;
+	}
+	for (uint32_t i = 0; i < batch_size; i++) {
+		iovecs[i].iov_base = buffers[i];
+		iovecs[i].iov_len = MAX_DATAGRAM;
+	}
+	while (!stopping) {
+		for (uint32_t i = 0; i < batch_size; i++) {
+			memset(&messages[i].msg_hdr, 0, sizeof(struct msghdr));
+			messages[i].msg_hdr.msg_name = &addresses[i];
+			messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+			messages[i].msg_hdr.msg_iov = &iovecs[i];
+			messages[i].msg_hdr.msg_iovlen = 1;
+		}
+		// Blocks for the first datagram only, at most for the receive
+		// timeout, so that stopping is checked.
+		int count = recvmmsg(worker->sock, messages, batch_size, MSG_WAITFORONE, NULL);
+		if (count < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				perror("recvmmsg");
+				break;
+			}
+			__atomic_store_n(&worker->cpu_ns, thread_cpu_ns(), __ATOMIC_RELAXED);
+			continue;
+		}
+		uint64_t received_us = realtime_us();
+		uint64_t bytes = 0;
+		for (int i = 0; i < count; i++) {
+			process_datagram(worker, buffers[i], (uint16_t)messages[i].msg_len,
+					         &addresses[i], received_us);
+			bytes += messages[i].msg_len;
+		}
+		__atomic_add_fetch(&worker->datagrams, count, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&worker->bytes, bytes, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&worker->batches, 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&worker->cpu_ns, thread_cpu_ns(), __ATOMIC_RELAXED);
+	}
+	close_segment(worker);
+	free(buffers);
+	return NULL;
+
+}
+
+static int open_worker_socket(uint16_t port) {
+
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0) {
+		perror("socket");
+		return -1;
+	}
+	int one = 1;
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+		perror("SO_REUSEPORT");
+		close(sock);
+		return -1;
+	}
+	int size = RECEIVE_BUFFER_SIZE;
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	struct timeval timeout = { .tv_sec = 0, .tv_usec = 100000 };
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		close(sock);
+		return -1;
+	}
+	return sock;
+
+}
+
+//========================================
+// Benchmark generators.
+
+static void *generator_thread(void *arg) {
+
+	generator_t *generator = arg;
+	int *socks = calloc(generator->senders, sizeof(int));
+	uint32_t *seqs = calloc(generator->senders, sizeof(uint32_t));
+	uint8_t (*frames)[MAX_DATAGRAM] = malloc(GENERATOR_BATCH * MAX_DATAGRAM);
+	struct iovec iovecs[GENERATOR_BATCH];
+	struct mmsghdr messages[GENERATOR_BATCH];
+	if (socks == NULL || seqs == NULL || frames == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return NULL;
+	}
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(generator->port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	for (uint32_t i = 0; i < generator->senders; i++) {
+		socks[i] = socket(AF_INET, SOCK_DGRAM, 0);
+		if (socks[i] < 0 || connect(socks[i], (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			perror("generator socket");
+			return NULL;
+		}
+	}
+	memset(messages, 0, sizeof(messages));
+	uint16_t frame_length = FRAME_HEADER_LENGTH + generator->record_length;
+	for (uint32_t i = 0; i < GENERATOR_BATCH; i++) {
+		memset(frames[i], 0, MAX_DATAGRAM);
+		iovecs[i].iov_base = frames[i];
+		iovecs[i].iov_len = frame_length;
+		messages[i].msg_hdr.msg_iov = &iovecs[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	uint32_t sender = 0;
+	while (!stopping) {
+		// One batch per sender, in turn.
+		for (uint32_t i = 0; i < GENERATOR_BATCH; i++) {
+			frame_header_t header = {
+				.version = FRAME_VERSION,
+				.type = FRAME_DATA,
+				.stream_id = 1,
+				.seq = seqs[sender]++,
+				.epoch = 1,
+				.timestamp_us = realtime_us(),
+			};
+			frame_encode_header(&header, frames[i]);
+		}
+		int sent = sendmmsg(socks[sender], messages, GENERATOR_BATCH, 0);
+		if (sent > 0) {
+			generator->sent += sent;
+			// Datagrams not sent are skipped, as lost.
+		}
+		sender = (sender + 1) % generator->senders;
+	}
+	for (uint32_t i = 0; i < generator->senders; i++) {
+		close(socks[i]);
+	}
+	free(frames);
+	free(seqs);
+	free(socks);
+	return NULL;
+
+}
+
+//========================================
+// Range reads.
+
+static bool entry_before(const index_entry_t *entry, uint32_t addr, uint16_t port,
+		                 uint8_t stream_id, uint64_t time_us) {
+
+	index_entry_t key = {
+		.addr = addr,
+		.port = port,
+		.stream_id = stream_id,
+		.received_us = time_us,
+		.offset = 0,
+	};
+	return compare_entries(entry, &key) < 0;
+
+}
+
+/**
+ * Prints the records of a device from one segment. Returns the number of
+ * records printed.
+ */
+static uint64_t read_segment(const char *index_path, uint32_t addr, uint16_t port,
+		                     uint8_t stream_id, uint64_t from_us, uint64_t until_us) {
+
+	int index_fd = open(index_path, O_RDONLY);
+	if (index_fd < 0) {
+		perror(index_path);
+		return 0;
+	}
+	struct stat index_stat;
+	fstat(index_fd, &index_stat);
+	if ((size_t)index_stat.st_size < sizeof(index_header_t)) {
+		close(index_fd);
+		return 0;
+	}
+	uint8_t *index_map = mmap(NULL, index_stat.st_size, PROT_READ, MAP_PRIVATE, index_fd, 0);
+	close(index_fd);
+	if (index_map == MAP_FAILED) {
+		perror("mmap");
+		return 0;
+	}
+	const index_header_t *index_header = (const index_header_t *)index_map;
+	const index_entry_t *entries = (const index_entry_t *)&index_map[sizeof(index_header_t)];
+	uint64_t count = index_header->count;
+	if (memcmp(index_header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+		sizeof(index_header_t) + count * sizeof(index_entry_t) > (size_t)index_stat.st_size ||
+		index_header->end_us < from_us || index_header->start_us > until_us) {
+		munmap(index_map, index_stat.st_size);
+		return 0;
+	}
+
+	// First entry not before (device, stream, from_us).
+	uint64_t low = 0;
+	uint64_t high = count;
+	while (low < high) {
+		uint64_t middle = low + (high - low) / 2;
+		if (entry_before(&entries[middle], addr, port, stream_id, from_us)) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	uint64_t printed = 0;
+	if (low < count) {
+		char segment_file[512];
+		snprintf(segment_file, sizeof(segment_file), "%.*s.seg",
+				 (int)(strlen(index_path) - 4), index_path);
+		int segment_fd = open(segment_file, O_RDONLY);
+		struct stat segment_stat;
+		uint8_t *segment = MAP_FAILED;
+		if (segment_fd >= 0 && fstat(segment_fd, &segment_stat) == 0 && segment_stat.st_size > 0) {
+			segment = mmap(NULL, segment_stat.st_size, PROT_READ, MAP_PRIVATE, segment_fd, 0);
+		}
+		if (segment_fd >= 0) {
+			close(segment_fd);
+		}
+		if (segment == MAP_FAILED) {
+			perror(segment_file);
+		} else {
+			for (uint64_t i = low; i < count; i++) {
+				const index_entry_t *entry = &entries[i];
+				if (entry->addr != addr || entry->port != port || entry->stream_id != stream_id ||
+					entry->received_us > until_us) {
+					break;
+				}
+				if (entry->offset + sizeof(record_header_t) > (uint64_t)segment_stat.st_size) {
+					break;
+				}
+				record_header_t record;
+				memcpy(&record, &segment[entry->offset], sizeof(record));
+				frame_header_t header;
+				if (!frame_decode_header(&segment[entry->offset + sizeof(record)],
+						                 record.frame_length > UINT16_MAX ? UINT16_MAX : record.frame_length,
+										 &header)) {
+					continue;
+				}
+				printf("%llu.%06llu - type %d, stream %d, epoch %u, seq %u, %u bytes\n",
+					   (unsigned long long)(record.received_us / 1000000),
+					   (unsigned long long)(record.received_us % 1000000),
+					   header.type, header.stream_id, header.epoch, header.seq,
+					   record.frame_length);
+				printed++;
+			}
+			munmap(segment, segment_stat.st_size);
+		}
+	}
+	munmap(index_map, index_stat.st_size);
+	return printed;
+
+}
+
+static int compare_names(const void *a, const void *b) {
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int read_range(const char *device, uint8_t stream_id, uint64_t from_s, uint64_t until_s) {
+
+	char address[64];
+	const char *colon = strchr(device, ':');
+	if (colon == NULL || colon - device >= (int)sizeof(address)) {
+		fprintf(stderr, "Device must be address:port\n");
+		return 2;
+	}
+	memcpy(address, device, colon - device);
+	address[colon - device] = '\0';
+	struct in_addr in;
+	if (inet_aton(address, &in) == 0) {
+		fprintf(stderr, "Incorrect address: %s\n", address);
+		return 2;
+	}
+	uint16_t port = (uint16_t)atoi(colon + 1);
+
+	DIR *dir = opendir(directory);
+	if (dir == NULL) {
+		perror(directory);
+		return 1;
+	}
+	// Segments are visited in time order. Their names start with the same
+	// number of digits.
+	char **names = NULL;
+	size_t name_count = 0;
+	struct dirent *dirent;
+	while ((dirent = readdir(dir)) != NULL) {
+		size_t length = strlen(dirent->d_name);
+		if (length < 5 || strcmp(&dirent->d_name[length - 4], ".idx") != 0) {
+			continue;
+		}
+		char **new_names = realloc(names, (name_count + 1) * sizeof(char *));
+		if (new_names == NULL) {
+			break;
+		}
+		names = new_names;
+		names[name_count++] = strdup(dirent->d_name);
+	}
+	closedir(dir);
+	qsort(names, name_count, sizeof(char *), compare_names);
+	uint64_t printed = 0;
+	for (size_t i = 0; i < name_count; i++) {
+		char path[512];
+		snprintf(path, sizeof(path), "%s/%s", directory, names[i]);
+		printed += read_segment(path, in.s_addr, port, stream_id,
+				                from_s * 1000000, until_s * 1000000 + 999999);
+		free(names[i]);
+	}
+	free(names);
+	fflush(stdout);
+	fprintf(stderr, "%llu records\n", (unsigned long long)printed);
+	return 0;
+
+}
+
+//========================================
+// Reports.
+
+static void report(worker_t *workers, uint32_t worker_count, double interval_s,
+		           uint64_t *previous_datagrams, uint64_t *previous_cpu_ns) {
+
+	uint64_t datagrams = 0;
+	uint64_t cpu_ns = 0;
+	uint64_t records = 0;
+	uint64_t batches = 0;
+	uint64_t errors = 0;
+	uint32_t devices = 0;
+	for (uint32_t i = 0; i < worker_count; i++) {
+		datagrams += __atomic_load_n(&workers[i].datagrams, __ATOMIC_RELAXED);
+		cpu_ns += __atomic_load_n(&workers[i].cpu_ns, __ATOMIC_RELAXED);
+		records += __atomic_load_n(&workers[i].records, __ATOMIC_RELAXED);
+		batches += __atomic_load_n(&workers[i].batches, __ATOMIC_RELAXED);
+		errors += __atomic_load_n(&workers[i].errors, __ATOMIC_RELAXED);
+		devices += workers[i].device_count;
+	}
+	uint64_t delta = datagrams - *previous_datagrams;
+	double cpu_s = (cpu_ns - *previous_cpu_ns) / 1e9;
+	printf("%.0f datagrams/s, %.0f datagrams/s per core (%.2f cores), "
+		   "%.1f datagrams per batch, %llu records, %u streams, %llu errors\n",
+		   delta / interval_s, cpu_s > 0.0 ? delta / cpu_s : 0.0, cpu_s / interval_s,
+		   batches > 0 ? (double)datagrams / batches : 0.0,
+		   (unsigned long long)records, devices, (unsigned long long)errors);
+	fflush(stdout);
+	*previous_datagrams = datagrams;
+	*previous_cpu_ns = cpu_ns;
+
+}
+
+static void usage(const char *name) {
+
+	fprintf(stderr,
+			"Usage: %s [options]\n"
+			"  -p port    UDP port (default 44444)\n"
+			"  -j count   worker threads (default 4)\n"
+			"  -b count   datagrams per recvmmsg() batch (default 64)\n"
+			"  -d dir     segment directory (default .)\n"
+			"  -P s       partition length (default 60)\n"
+			"  -S MB      segment size (default 64)\n"
+			"  -i s       report period (default 1)\n"
+			"  -t s       benchmark on loopback for this duration\n"
+			"  -g count   benchmark generator threads (default 2)\n"
+			"  -c count   benchmark senders per generator (default 64)\n"
+			"  -l bytes   benchmark record length (default 64)\n"
+			"  -r         range read: -a address:port [-s stream] [-f from] [-u until]\n",
+			name);
+
+}
+
+int main(int argc, char *argv[]) {
+
+	uint16_t port = DEFAULT_PORT;
+	uint32_t worker_count = 4;
+	double report_s = 1.0;
+	double benchmark_s = 0.0;
+	uint32_t generator_count = 2;
+	uint32_t senders = 64;
+	uint16_t record_length = 64;
+	bool range_read = false;
+	const char *device = NULL;
+	uint8_t stream_id = 1;
+	uint64_t from_s = 0;
+	uint64_t until_s = UINT64_MAX / 1000000 - 1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "p:j:b:d:P:S:i:t:g:c:l:ra:s:f:u:")) != -1) {
+		switch (opt) {
+		case 'p': port = (uint16_t)atoi(optarg); break;
+		case 'j': worker_count = (uint32_t)atoi(optarg); break;
+		case 'b': batch_size = (uint32_t)atoi(optarg); break;
+		case 'd': directory = optarg; break;
+		case 'P': partition_us = (uint64_t)(atof(optarg) * 1e6); break;
+		case 'S': segment_size = (uint64_t)atoi(optarg) * 1024 * 1024; break;
+		case 'i': report_s = atof(optarg); break;
+		case 't': benchmark_s = atof(optarg); break;
+		case 'g': generator_count = (uint32_t)atoi(optarg); break;
+		case 'c': senders = (uint32_t)atoi(optarg); break;
+		case 'l': record_length = (uint16_t)atoi(optarg); break;
+		case 'r': range_read = true; break;
+		case 'a': device = optarg; break;
+		case 's': stream_id = (uint8_t)atoi(optarg); break;
+		case 'f': from_s = strtoull(optarg, NULL, 0); break;
+		case 'u': until_s = strtoull(optarg, NULL, 0); break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if (range_read) {
+		if (device == NULL) {
+			usage(argv[0]);
+			return 2;
+		}
+		return read_range(device, stream_id, from_s, until_s);
+	}
+	if (worker_count == 0 || worker_count > MAX_WORKERS || batch_size == 0 ||
+		batch_size > MAX_BATCH || partition_us == 0 || segment_size < 4096 ||
+		report_s <= 0.0 || generator_count > MAX_GENERATORS || senders == 0 ||
+		record_length > MAX_DATAGRAM - FRAME_HEADER_LENGTH) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+
+	static worker_t workers[MAX_WORKERS];
+	for (uint32_t i = 0; i < worker_count; i++) {
+		worker_t *worker = &workers[i];
+		worker->id = i;
+		worker->sock = open_worker_socket(port);
+		worker->reassembly = reassembly_create(REASSEMBLY_MAX_RECORDS, REASSEMBLY_MAX_BYTES,
+				                               REASSEMBLY_TIMEOUT_US);
+		worker->devices = calloc(DEVICE_TABLE_SIZE, sizeof(device_t));
+		if (worker->sock < 0 || worker->reassembly == NULL || worker->devices == NULL) {
+			return 1;
+		}
+	}
+	for (uint32_t i = 0; i < worker_count; i++) {
+		pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]);
+	}
+	printf("Collecting on port %d, %u workers, segments in %s\n", port, worker_count, directory);
+
+	static generator_t generators[MAX_GENERATORS];
+	if (benchmark_s > 0.0) {
+		for (uint32_t i = 0; i < generator_count; i++) {
+			generators[i].id = i;
+			generators[i].port = port;
+			generators[i].senders = senders;
+			generators[i].record_length = record_length;
+			pthread_create(&generators[i].thread, NULL, generator_thread, &generators[i]);
+		}
+	}
+
+	struct timespec start;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	uint64_t previous_datagrams = 0;
+	uint64_t previous_cpu_ns = 0;
+	uint64_t first_cpu_ns = 0;
+	for (uint32_t i = 0; i < worker_count; i++) {
+		first_cpu_ns += __atomic_load_n(&workers[i].cpu_ns, __ATOMIC_RELAXED);
+	}
+	previous_cpu_ns = first_cpu_ns;
+	double elapsed_s = 0.0;
+	while (!stopping) {
+		usleep((useconds_t)(report_s * 1e6));
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		double interval_s = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9 - elapsed_s;
+		elapsed_s += interval_s;
+		report(workers, worker_count, interval_s, &previous_datagrams, &previous_cpu_ns);
+		if (benchmark_s > 0.0 && elapsed_s >= benchmark_s) {
+			stopping = true;
+		}
+	}
+
+	uint64_t sent = 0;
+	if (benchmark_s > 0.0) {
+		for (uint32_t i = 0; i < generator_count; i++) {
+			pthread_join(generators[i].thread, NULL);
+			sent += generators[i].sent;
+		}
+	}
+	uint64_t datagrams = 0;
+	uint64_t cpu_ns = 0;
+	uint64_t lost = 0;
+	for (uint32_t i = 0; i < worker_count; i++) {
+		pthread_join(workers[i].thread, NULL);
+		datagrams += workers[i].datagrams;
+		cpu_ns += workers[i].cpu_ns;
+		for (uint32_t j = 0; j < DEVICE_TABLE_SIZE; j++) {
+			lost += workers[i].devices[j].lost;
+		}
+		reassembly_destroy(workers[i].reassembly);
+		free(workers[i].devices);
+		free(workers[i].index);
+		close(workers[i].sock);
+	}
+	double cpu_s = (cpu_ns - first_cpu_ns) / 1e9;
+	printf("Total: %llu datagrams in %.1f s, %.0f datagrams/s, %.0f datagrams/s per core, "
+		   "%llu lost (sequence gaps)",
+		   (unsigned long long)datagrams, elapsed_s, datagrams / elapsed_s,
+		   cpu_s > 0.0 ? datagrams / cpu_s : 0.0, (unsigned long long)lost);
+	if (benchmark_s > 0.0) {
+		printf(", %llu sent", (unsigned long long)sent);
+	}
+	printf("\n");
+	return 0;
+
+}
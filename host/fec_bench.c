@@ -0,0 +1,296 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+/**
+ * Recovery and cost of forward error correction (main/fec.c,
+ * host/fec_decoder.c).
+ *
+ * Data frames of -s bytes are protected by blocks, with XOR and
+ * Reed-Solomon parity, for several k and m, and go through a lossy link
+ * modeled as a Gilbert-Elliott channel: in the good state no datagram is
+ * lost, in the bad state all of them are, bursts of losses being -b
+ * datagrams long on average, for an average loss rate of -l percent.
+ * Parity frames go through the same link. Rebuilt frames are checked
+ * against the ones sent. The report gives, per configuration, the time
+ * to encode a data frame, the overhead in bytes, and the rate of data
+ * frames lost before and after decoding.
+ *
+ * Build:
+ *   gcc -O2 -Wall -I main -I host -o fec_bench host/fec_bench.c \
+ *       host/fec_decoder.c main/fec.c main/frame.c
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fec.h"
+#include "fec_decoder.h"
+#include "frame.h"
+
+#define STREAM_ID 1
+#define EPOCH 7
+#define MAX_FRAME_LENGTH 1472
+#define DECODER_HISTORY 1024
+#define DECODER_BLOCKS 64
+
+typedef struct {
+	const char *name;
+	fec_scheme_t scheme;
+	uint8_t k;
+	uint8_t m;
+} config_t;
+
+typedef struct {
+	double p_good_bad;
+	double p_bad_good;
+	bool bad;
+} channel_t;
+
+static uint64_t random_state = 1;
+
+static uint32_t random_u32(void) {
+
+	// xorshift64*
+	random_state ^= random_state >> 12;
+	random_state ^= random_state << 25;
+	random_state ^= random_state >> 27;
+	return (uint32_t)((random_state * 2685821657736338717ULL) >> 32);
+
+}
+
+static double random_unit(void) {
+	return random_u32() / 4294967296.0;
+}
+
+/**
+ * Returns true if the next datagram is lost.
+ */
+static bool channel_lose(channel_t *channel) {
+
+	if (channel->bad) {
+		channel->bad = random_unit() >= channel->p_bad_good;
+	} else {
+		channel->bad = random_unit() < channel->p_good_bad;
+	}
+	return channel->bad;
+
+}
+
+static double elapsed_s(const struct timespec *start) {
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+
+}
+
+/**
+ * Writes data frame seq, with a payload derived from seq, so that rebuilt
+ * frames can be checked.
+ */
+static uint16_t make_frame(uint32_t seq, uint16_t length, uint8_t *buffer) {
+
+	frame_header_t header = {
+		.version = FRAME_VERSION,
+		.type = FRAME_DATA,
+		.flags = 0,
+		.stream_id = STREAM_ID,
+		.seq = seq,
+		.epoch = EPOCH,
+		.timestamp_us = (uint64_t)seq * 1000,
+	};
+	frame_encode_header(&header, buffer);
+	// Lengths vary, so that padding is exercised.
+	uint16_t frame_length = length - (uint16_t)(seq % 4);
+	uint32_t x = seq * 2654435761u;
+	for (uint16_t i = FRAME_HEADER_LENGTH; i < frame_length; i++) {
+		x = x * 1103515245u + 12345u;
+		buffer[i] = (uint8_t)(x >> 24);
+	}
+	return frame_length;
+
+}
+
+static bool check_frame(const uint8_t *frame, uint16_t length, uint16_t frame_length) {
+
+	frame_header_t header;
+	uint8_t expected[MAX_FRAME_LENGTH];
+	if (!frame_decode_header(frame, length, &header)) {
+		return false;
+	}
+	uint16_t expected_length = make_frame(header.seq, frame_length, expected);
+	return length == expected_length && memcmp(frame, expected, length) == 0;
+
+}
+
+static void usage(const char *name) {
+
+	fprintf(stderr,
+			"Usage: %s [options]\n"
+			"  -l percent average loss rate (default 5)\n"
+			"  -b length  average length of loss bursts (default 2)\n"
+			"  -s bytes   data frame length, header included (default 100)\n"
+			"  -n count   data frames per configuration (default 1000000)\n",
+			name);
+
+}
+
+int main(int argc, char *argv[]) {
+
+	double loss = 5.0;
+	double burst = 2.0;
+	uint32_t frame_length = 100;
+	uint32_t count = 1000000;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "l:b:s:n:")) != -1) {
+		switch (opt) {
+		case 'l': loss = atof(optarg); break;
+		case 'b': burst = atof(optarg); break;
+		case 's': frame_length = (uint32_t)atoi(optarg); break;
+		case 'n': count = (uint32_t)atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (loss < 0.0 || loss >= 100.0 || burst < 1.0 ||
+		frame_length < FRAME_HEADER_LENGTH + 4 || frame_length > MAX_FRAME_LENGTH ||
+		count == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	static const config_t CONFIGS[] = {
+		{ "none", 0, 0, 0 },
+		{ "XOR", FEC_XOR, 4, 1 },
+		{ "XOR", FEC_XOR, 8, 1 },
+		{ "XOR", FEC_XOR, 16, 1 },
+		{ "RS", FEC_RS, 4, 2 },
+		{ "RS", FEC_RS, 8, 2 },
+		{ "RS", FEC_RS, 8, 4 },
+		{ "RS", FEC_RS, 16, 4 },
+	};
+	// Bad state: mean duration burst, and loss / 100 of the time.
+	double p_bad_good = 1.0 / burst;
+	double p_good_bad = loss / 100.0 * p_bad_good / (1.0 - loss / 100.0);
+
+	uint8_t frame[MAX_FRAME_LENGTH];
+	uint8_t parity_frame[FEC_PARITY_LENGTH(FEC_MAX_K, MAX_FRAME_LENGTH)];
+	static uint8_t parity[FEC_MAX_M * (FEC_SYMBOL_OVERHEAD + MAX_FRAME_LENGTH)];
+
+	printf("%-5s %3s %3s %10s %10s %10s %10s %8s\n", "", "k", "m", "ns/frame", "overhead",
+		   "lost", "residual", "errors");
+	for (uint8_t c = 0; c < sizeof(CONFIGS) / sizeof(CONFIGS[0]); c++) {
+		const config_t *config = &CONFIGS[c];
+		bool protect = config->k != 0;
+		fec_encoder_t encoder;
+		if (protect && !fec_encoder_init(&encoder, config->scheme, config->k, config->m,
+				                         MAX_FRAME_LENGTH, parity)) {
+			fprintf(stderr, "Invalid configuration\n");
+			return 1;
+		}
+
+		// Encoding alone, timed, less the time to make the frames.
+		double encode_ns = 0.0;
+		if (protect) {
+			struct timespec start;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (uint32_t seq = 0; seq < count; seq++) {
+				make_frame(seq, (uint16_t)frame_length, frame);
+			}
+			double make_s = elapsed_s(&start);
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (uint32_t seq = 0; seq < count; seq++) {
+				uint16_t length = make_frame(seq, (uint16_t)frame_length, frame);
+				if (fec_encoder_add(&encoder, seq, frame, length, 0)) {
+					for (uint8_t j = 0; j < config->m; j++) {
+						fec_encoder_build(&encoder, STREAM_ID, j, parity_frame);
+					}
+					fec_encoder_reset(&encoder);
+				}
+			}
+			encode_ns = (elapsed_s(&start) - make_s) * 1e9 / count;
+			if (encode_ns < 0.0) {
+				encode_ns = 0.0;
+			}
+			fec_encoder_reset(&encoder);
+		}
+
+		// Transmission.
+		fec_decoder_t *decoder = fec_decoder_create(DECODER_HISTORY, DECODER_BLOCKS);
+		if (decoder == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			return 1;
+		}
+		channel_t channel = { p_good_bad, p_bad_good, false };
+		random_state = 1;
+		uint64_t data_bytes = 0;
+		uint64_t parity_bytes = 0;
+		uint64_t lost = 0;
+		uint64_t delivered = 0;
+		uint64_t errors = 0;
+		for (uint32_t seq = 0; seq < count; seq++) {
+			uint16_t length = make_frame(seq, (uint16_t)frame_length, frame);
+			data_bytes += length;
+			bool full = protect && fec_encoder_add(&encoder, seq, frame, length, 0);
+			if (channel_lose(&channel)) {
+				lost++;
+			} else {
+				delivered++;
+				fec_decoder_add(decoder, frame, length);
+			}
+			if (!full && !(protect && seq == count - 1)) {
+				continue;
+			}
+			for (uint8_t j = 0; j < config->m; j++) {
+				uint16_t parity_length = fec_encoder_build(&encoder, STREAM_ID, j, parity_frame);
+				parity_bytes += parity_length;
+				if (channel_lose(&channel)) {
+					continue;
+				}
+				// Stamped by the sender.
+				frame_put_u32(&parity_frame[FRAME_EPOCH_OFFSET], EPOCH);
+				fec_decoder_add(decoder, parity_frame, parity_length);
+				const uint8_t *rebuilt;
+				uint16_t rebuilt_length;
+				while (fec_decoder_next(decoder, &rebuilt, &rebuilt_length)) {
+					delivered++;
+					if (!check_frame(rebuilt, rebuilt_length, (uint16_t)frame_length)) {
+						errors++;
+					}
+				}
+			}
+			fec_encoder_reset(&encoder);
+		}
+		fec_decoder_destroy(decoder);
+
+		printf("%-5s %3u %3u %10.1f %9.1f%% %9.3f%% %9.3f%% %8llu\n", config->name,
+			   config->k, config->m, encode_ns, 100.0 * parity_bytes / data_bytes,
+			   100.0 * lost / count, 100.0 * (count - delivered) / count,
+			   (unsigned long long)errors);
+	}
+	return 0;
+
+}
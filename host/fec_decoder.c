@@ -0,0 +1,433 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fec.h"
+#include "fec_decoder.h"
+#include "frame.h"
+
+// Longest data frame kept.
+#define MAX_FRAME_LENGTH 1500
+#define MAX_SYMBOL_LENGTH (FEC_SYMBOL_OVERHEAD + MAX_FRAME_LENGTH)
+#define STREAMS 256
+
+typedef struct {
+	bool used;
+	uint32_t epoch;
+	uint32_t seq;
+	uint16_t length;
+	uint8_t data[MAX_FRAME_LENGTH];
+} frame_entry_t;
+
+typedef struct {
+	bool used;
+	uint64_t age;             // Order of creation, for eviction.
+	uint8_t stream_id;
+	uint32_t epoch;
+	uint32_t first_seq;
+	fec_scheme_t scheme;
+	uint8_t k;
+	uint8_t m;
+	uint8_t offsets[FEC_MAX_K];
+	uint8_t received;         // Bit j set when parity frame j has been received.
+	uint16_t symbol_length;
+	uint8_t symbols[FEC_MAX_M][MAX_SYMBOL_LENGTH];
+} block_t;
+
+struct fec_decoder {
+	uint32_t history;
+	uint32_t max_blocks;
+	uint64_t next_age;
+	frame_entry_t *frames[STREAMS];   // history entries per stream, by seq.
+	block_t *blocks;
+	// Frames rebuilt by the last call to fec_decoder_add().
+	const frame_entry_t *rebuilt[FEC_MAX_M];
+	uint8_t rebuilt_count;
+	uint8_t rebuilt_next;
+	fec_decoder_stats_t stats;
+};
+
+static frame_entry_t *find_frame(fec_decoder_t *decoder, uint8_t stream_id,
+		                         uint32_t epoch, uint32_t seq) {
+
+	if (decoder->frames[stream_id] == NULL) {
+		return NULL;
+	}
+	frame_entry_t *entry = &decoder->frames[stream_id][seq % decoder->history];
+	if (!entry->used || entry->epoch != epoch || entry->seq != seq) {
+		return NULL;
+	}
+	return entry;
+
+}
+
+static frame_entry_t *store_frame(fec_decoder_t *decoder, uint8_t stream_id,
+		                          uint32_t epoch, uint32_t seq,
+								  const uint8_t *frame, uint16_t length) {
+
+	if (decoder->frames[stream_id] == NULL) {
+		decoder->frames[stream_id] = calloc(decoder->history, sizeof(frame_entry_t));
+		if (decoder->frames[stream_id] == NULL) {
+			return NULL;
+		}
+	}
+	frame_entry_t *entry = &decoder->frames[stream_id][seq % decoder->history];
+	entry->used = true;
+	entry->epoch = epoch;
+	entry->seq = seq;
+	entry->length = length;
+	memcpy(entry->data, frame, length);
+	return entry;
+
+}
+
+/**
+ * Writes the symbol of a data frame, padded to symbol_length.
+ */
+static void make_symbol(const frame_entry_t *entry, uint8_t *symbol, uint16_t symbol_length) {
+
+	memset(symbol, 0, symbol_length);
+	symbol[0] = (uint8_t)(entry->length >> 8);
+	symbol[1] = (uint8_t)entry->length;
+	uint16_t length = entry->length;
+	if (FEC_SYMBOL_OVERHEAD + length > symbol_length) {
+		length = symbol_length - FEC_SYMBOL_OVERHEAD;
+	}
+	memcpy(&symbol[FEC_SYMBOL_OVERHEAD], entry->data, length);
+
+}
+
+/**
+ * Inverts the n x n matrix a in place, by Gauss-Jordan elimination.
+ * Returns false if it is singular.
+ */
+static bool invert(uint8_t a[FEC_MAX_M][FEC_MAX_M], uint8_t n) {
+
+	uint8_t inverse[FEC_MAX_M][FEC_MAX_M] = { 0 };
+	for (uint8_t i = 0; i < n; i++) {
+		inverse[i][i] = 1;
+	}
+	for (uint8_t column = 0; column < n; column++) {
+		uint8_t pivot = column;
+		while (pivot < n && a[pivot][column] == 0) {
+			pivot++;
+		}
+		if (pivot == n) {
+			return false;
+		}
+		if (pivot != column) {
+			for (uint8_t c = 0; c < n; c++) {
+				uint8_t t = a[pivot][c];
+				a[pivot][c] = a[column][c];
+				a[column][c] = t;
+				t = inverse[pivot][c];
+				inverse[pivot][c] = inverse[column][c];
+				inverse[column][c] = t;
+			}
+		}
+		uint8_t scale = fec_gf_inv(a[column][column]);
+		for (uint8_t c = 0; c < n; c++) {
+			a[column][c] = fec_gf_mul(a[column][c], scale);
+			inverse[column][c] = fec_gf_mul(inverse[column][c], scale);
+		}
+		for (uint8_t row = 0; row < n; row++) {
+			uint8_t factor = a[row][column];
+			if (row == column || factor == 0) {
+				continue;
+			}
+			for (uint8_t c = 0; c < n; c++) {
+				a[row][c] ^= fec_gf_mul(factor, a[column][c]);
+				inverse[row][c] ^= fec_gf_mul(factor, inverse[column][c]);
+			}
+		}
+	}
+	memcpy(a, inverse, sizeof(inverse));
+	return true;
+
+}
+
+/**
+ * Rebuilds the missing data frames of a block if enough parity frames have
+ * been received. Returns true if the block is complete.
+ */
+static bool try_block(fec_decoder_t *decoder, block_t *block) {
+
+	uint8_t missing[FEC_MAX_K];
+	uint8_t missing_count = 0;
+	const frame_entry_t *present[FEC_MAX_K];
+	for (uint8_t i = 0; i < block->k; i++) {
+		present[i] = find_frame(decoder, block->stream_id, block->epoch,
+				                block->first_seq + block->offsets[i]);
+		if (present[i] == NULL) {
+			missing[missing_count++] = i;
+		}
+	}
+	if (missing_count == 0) {
+		return true;
+	}
+	uint8_t rows[FEC_MAX_M];
+	uint8_t row_count = 0;
+	for (uint8_t j = 0; j < block->m && row_count < missing_count; j++) {
+		if ((block->received & (1 << j)) != 0) {
+			rows[row_count++] = j;
+		}
+	}
+	if (row_count < missing_count) {
+		return false;
+	}
+
+	// Removes the received data symbols from the parity symbols used.
+	uint8_t symbol[MAX_SYMBOL_LENGTH];
+	for (uint8_t i = 0; i < block->k; i++) {
+		if (present[i] == NULL) {
+			continue;
+		}
+		make_symbol(present[i], symbol, block->symbol_length);
+		for (uint8_t r = 0; r < row_count; r++) {
+			fec_gf_mul_add(block->symbols[rows[r]], symbol,
+					       fec_coefficient(block->scheme, block->m, rows[r], i),
+						   block->symbol_length);
+		}
+	}
+	// What is left is the missing symbols multiplied by the coefficient
+	// matrix of the parity frames used.
+	uint8_t matrix[FEC_MAX_M][FEC_MAX_M];
+	for (uint8_t r = 0; r < row_count; r++) {
+		for (uint8_t c = 0; c < missing_count; c++) {
+			matrix[r][c] = fec_coefficient(block->scheme, block->m, rows[r], missing[c]);
+		}
+	}
+	if (!invert(matrix, missing_count)) {
+		decoder->stats.invalid++;
+		return true;
+	}
+	for (uint8_t c = 0; c < missing_count; c++) {
+		memset(symbol, 0, block->symbol_length);
+		for (uint8_t r = 0; r < row_count; r++) {
+			fec_gf_mul_add(symbol, block->symbols[rows[r]], matrix[c][r], block->symbol_length);
+		}
+		uint16_t length = (uint16_t)(symbol[0] << 8 | symbol[1]);
+		if (FEC_SYMBOL_OVERHEAD + length > block->symbol_length) {
+			decoder->stats.invalid++;
+			continue;
+		}
+		uint32_t seq = block->first_seq + block->offsets[missing[c]];
+		const frame_entry_t *entry = store_frame(decoder, block->stream_id, block->epoch,
+				                                 seq, &symbol[FEC_SYMBOL_OVERHEAD], length);
+		if (entry != NULL && decoder->rebuilt_count < FEC_MAX_M) {
+			decoder->rebuilt[decoder->rebuilt_count++] = entry;
+			decoder->stats.recovered++;
+		}
+	}
+	return true;
+
+}
+
+static void complete_block(fec_decoder_t *decoder, block_t *block) {
+
+	block->used = false;
+	decoder->stats.blocks++;
+
+}
+
+static block_t *find_block(fec_decoder_t *decoder, const fec_parity_t *parity) {
+
+	block_t *oldest = NULL;
+	for (uint32_t b = 0; b < decoder->max_blocks; b++) {
+		block_t *block = &decoder->blocks[b];
+		if (!block->used) {
+			if (oldest == NULL || oldest->used) {
+				oldest = block;
+			}
+			continue;
+		}
+		if (block->stream_id == parity->header.stream_id &&
+			block->epoch == parity->header.epoch &&
+			block->first_seq == parity->header.seq) {
+			return block;
+		}
+		if (oldest == NULL || (oldest->used && block->age < oldest->age)) {
+			oldest = block;
+		}
+	}
+	if (oldest->used) {
+		decoder->stats.given_up++;
+	}
+	memset(oldest, 0, offsetof(block_t, symbols));
+	oldest->used = true;
+	oldest->age = decoder->next_age++;
+	oldest->stream_id = parity->header.stream_id;
+	oldest->epoch = parity->header.epoch;
+	oldest->first_seq = parity->header.seq;
+	oldest->scheme = parity->scheme;
+	oldest->k = parity->k;
+	oldest->m = parity->m;
+	memcpy(oldest->offsets, parity->offsets, parity->k);
+	return oldest;
+
+}
+
+static fec_decoder_rs_t add_parity(fec_decoder_t *decoder, const uint8_t *frame,
+		                           uint16_t length) {
+
+	fec_parity_t parity;
+	if (!fec_decode_parity(frame, length, &parity) ||
+		parity.symbol_length > MAX_SYMBOL_LENGTH) {
+		decoder->stats.invalid++;
+		return FEC_DECODER_INVALID;
+	}
+	block_t *block = find_block(decoder, &parity);
+	if (block->scheme != parity.scheme || block->k != parity.k || block->m != parity.m ||
+		memcmp(block->offsets, parity.offsets, parity.k) != 0) {
+		decoder->stats.invalid++;
+		return FEC_DECODER_INVALID;
+	}
+	if ((block->received & (1 << parity.index)) != 0) {
+		decoder->stats.duplicates++;
+		return FEC_DECODER_DUPLICATE;
+	}
+	// Symbols are zero padded: the longest parity frame gives the length.
+	if (parity.symbol_length > block->symbol_length) {
+		for (uint8_t j = 0; j < block->m; j++) {
+			if ((block->received & (1 << j)) != 0) {
+				memset(&block->symbols[j][block->symbol_length], 0,
+					   parity.symbol_length - block->symbol_length);
+			}
+		}
+		block->symbol_length = parity.symbol_length;
+	}
+	memcpy(block->symbols[parity.index], parity.symbol, parity.symbol_length);
+	memset(&block->symbols[parity.index][parity.symbol_length], 0,
+		   block->symbol_length - parity.symbol_length);
+	block->received |= 1 << parity.index;
+	decoder->stats.parity++;
+	if (try_block(decoder, block)) {
+		complete_block(decoder, block);
+	}
+	return FEC_DECODER_PARITY;
+
+}
+
+static fec_decoder_rs_t add_data(fec_decoder_t *decoder, const frame_header_t *header,
+		                         const uint8_t *frame, uint16_t length) {
+
+	if (length > MAX_FRAME_LENGTH) {
+		return FEC_DECODER_IGNORED;
+	}
+	if (find_frame(decoder, header->stream_id, header->epoch, header->seq) != NULL) {
+		decoder->stats.duplicates++;
+		return FEC_DECODER_DUPLICATE;
+	}
+	if (store_frame(decoder, header->stream_id, header->epoch, header->seq,
+			        frame, length) == NULL) {
+		return FEC_DECODER_IGNORED;
+	}
+	decoder->stats.data++;
+	for (uint32_t b = 0; b < decoder->max_blocks; b++) {
+		block_t *block = &decoder->blocks[b];
+		if (!block->used || block->stream_id != header->stream_id ||
+			block->epoch != header->epoch) {
+			continue;
+		}
+		uint32_t offset = header->seq - block->first_seq;
+		if (offset > UINT8_MAX || memchr(block->offsets, (int)offset, block->k) == NULL) {
+			continue;
+		}
+		if (try_block(decoder, block)) {
+			complete_block(decoder, block);
+		}
+	}
+	return FEC_DECODER_DATA;
+
+}
+
+fec_decoder_t *fec_decoder_create(uint32_t history, uint32_t max_blocks) {
+
+	if (history == 0 || max_blocks == 0) {
+		return NULL;
+	}
+	fec_decoder_t *decoder = calloc(1, sizeof(fec_decoder_t));
+	if (decoder == NULL) {
+		return NULL;
+	}
+	decoder->history = history;
+	decoder->max_blocks = max_blocks;
+	decoder->blocks = calloc(max_blocks, sizeof(block_t));
+	if (decoder->blocks == NULL) {
+		free(decoder);
+		return NULL;
+	}
+	return decoder;
+
+}
+
+void fec_decoder_destroy(fec_decoder_t *decoder) {
+
+	if (decoder == NULL) {
+		return;
+	}
+	for (uint32_t s = 0; s < STREAMS; s++) {
+		free(decoder->frames[s]);
+	}
+	free(decoder->blocks);
+	free(decoder);
+
+}
+
+fec_decoder_rs_t fec_decoder_add(fec_decoder_t *decoder, const uint8_t *frame,
+		                         uint16_t length) {
+
+	decoder->rebuilt_count = 0;
+	decoder->rebuilt_next = 0;
+	frame_header_t header;
+	if (!frame_decode_header(frame, length, &header)) {
+		return FEC_DECODER_IGNORED;
+	}
+	if (header.type == FRAME_PARITY) {
+		return add_parity(decoder, frame, length);
+	}
+	// Reliable frames and fragments are not protected.
+	if (header.type != FRAME_DATA ||
+		(header.flags & (FRAME_FLAG_RELIABLE | FRAME_FLAG_FRAGMENT)) != 0) {
+		return FEC_DECODER_IGNORED;
+	}
+	return add_data(decoder, &header, frame, length);
+
+}
+
+bool fec_decoder_next(fec_decoder_t *decoder, const uint8_t **frame, uint16_t *length) {
+
+	if (decoder->rebuilt_next == decoder->rebuilt_count) {
+		return false;
+	}
+	const frame_entry_t *entry = decoder->rebuilt[decoder->rebuilt_next++];
+	*frame = entry->data;
+	*length = entry->length;
+	return true;
+
+}
+
+void fec_decoder_get_stats(const fec_decoder_t *decoder, fec_decoder_stats_t *stats) {
+	*stats = decoder->stats;
+}
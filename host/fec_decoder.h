@@ -0,0 +1,88 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef HOST_FEC_DECODER_H_
+#define HOST_FEC_DECODER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fec.h"
+#include "frame.h"
+
+// Host side of forward error correction: rebuilds the data frames lost
+// in a block from its parity frames (see main/fec.h).
+//
+// The last data frames of every stream are kept, by boot epoch and
+// sequence number, fragments and reliable frames excepted, as they are
+// not protected. A parity frame is kept with its block until the block
+// is complete: all its data frames have been received or rebuilt. A block
+// is rebuilt as soon as it misses no more data frames than parity frames
+// have been received. Frames arriving after they have been rebuilt are
+// reported as duplicates. Memory is bounded: when a new block would
+// exceed max_blocks, the oldest one is given up.
+//
+// Not thread safe.
+
+typedef enum {
+	FEC_DECODER_DATA,       // Data frame stored.
+	FEC_DECODER_PARITY,     // Parity frame stored.
+	FEC_DECODER_DUPLICATE,  // Data frame already received or rebuilt.
+	FEC_DECODER_IGNORED,    // Not a frame protected by FEC.
+	FEC_DECODER_INVALID,    // Invalid parity frame.
+} fec_decoder_rs_t;
+
+typedef struct {
+	uint64_t data;            // Data frames stored.
+	uint64_t parity;          // Parity frames stored.
+	uint64_t recovered;       // Data frames rebuilt.
+	uint64_t blocks;          // Blocks complete.
+	uint64_t given_up;        // Blocks dropped with data frames missing.
+	uint64_t duplicates;
+	uint64_t invalid;
+} fec_decoder_stats_t;
+
+typedef struct fec_decoder fec_decoder_t;
+
+/**
+ * Returns a new decoder keeping the last history data frames of every
+ * stream, and at most max_blocks incomplete blocks, or NULL if out of
+ * memory.
+ */
+fec_decoder_t *fec_decoder_create(uint32_t history, uint32_t max_blocks);
+
+void fec_decoder_destroy(fec_decoder_t *decoder);
+
+/**
+ * Processes a received frame. Rebuilt data frames are then given by
+ * fec_decoder_next().
+ */
+fec_decoder_rs_t fec_decoder_add(fec_decoder_t *decoder, const uint8_t *frame,
+		                         uint16_t length);
+
+/**
+ * Provides the next data frame rebuilt by the last call to
+ * fec_decoder_add(). The frame stays valid until the next call to
+ * fec_decoder_add(). Returns false if there is none.
+ */
+bool fec_decoder_next(fec_decoder_t *decoder, const uint8_t **frame, uint16_t *length);
+
+void fec_decoder_get_stats(const fec_decoder_t *decoder, fec_decoder_stats_t *stats);
+
+#endif /* HOST_FEC_DECODER_H_ */
@@ -0,0 +1,514 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+
+// Fleet simulator: runs thousands of virtual senders, each one a complete
+// copy of the application (supervisor, connect_wifi, send_datagram and
+// pipeline tasks, see host/sim) with its own Wi-Fi link, device ID and
+// load, against a real collector, in real time. Reports compare the load
+// offered by the devices with the load that actually left them, so that
+// receivers can be sized.
+//
+// Every device is an instance of the simulation kernel (see sim.h). The
+// application and the Wi-Fi, network and NVS models keep their state in
+// static variables: they are linked into one relocatable object whose .data
+// and .bss sections are renamed fleet_data and fleet_bss (see README.md),
+// so that the state of a device is two contiguous blocks, about 40 KB. When
+// the kernel switches to another device, the blocks are saved to the save
+// area of the previous device, and loaded from the one of the next device.
+// Tasks, queues and timers are kernel objects, separate already.
+//
+// The kernel is single-threaded: the devices are spread over worker
+// processes (-j), each one running its own kernel. At every report period,
+// workers send their counters to the parent through a pipe, and the parent
+// prints their sum.
+//
+// Every device sends from its own UDP socket: for the collector, the source
+// port identifies the device. Without -a, the remote host is the modelled
+// one, and the simulation runs as fast as possible.
+//
+// See README.md for the build commands.
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+
+#include "esp_log.h"
+
+#include "send_path.h"
+
+#include "sim.h"
+
+#include "fleet_device.h"
+
+#define MAX_WORKERS 64
+
+// Per-device state, see the header.
+extern uint8_t __start_fleet_data[];
+extern uint8_t __stop_fleet_data[];
+extern uint8_t __start_fleet_bss[];
+extern uint8_t __stop_fleet_bss[];
+
+typedef struct {
+	uint32_t devices;
+	uint32_t remote_address;    // Collector, 0 port: modelled remote host.
+	uint16_t remote_port;
+	uint32_t workers;
+	double duration_s;
+	double report_s;
+	double rate;                // Records per second and per device.
+	double spread;              // Device rates are uniform in rate x [1 - spread, 1 + spread].
+	uint32_t record_length;
+	bool reliable;
+	double boot_s;              // Devices boot uniformly over this time.
+	double loss_p;
+	double connect_fail_p;
+	uint32_t link_mtbf_s;
+	uint32_t stack_kb;
+	uint64_t seed;
+} options_t;
+
+// Sent by the workers at every report period. Counters are totals since
+// the start.
+typedef struct {
+	uint32_t devices;
+	uint32_t up;                // Devices with an IP address.
+	double target_rate;         // Sum of the device rates, records per second.
+	uint64_t offered;           // Records generated.
+	uint64_t rejected;          // Records refused by the producer API.
+	uint64_t sent;              // Datagrams accepted by the transport.
+	uint64_t dropped;           // Datagrams dropped by the send path.
+	uint64_t link_down;         // Datagrams sent while the link was down.
+	uint64_t lost;              // Datagrams lost by the Wi-Fi model.
+	uint64_t delivered;         // Datagrams sent to the collector.
+	uint64_t remote_errors;     // Datagrams the host failed to send.
+	uint64_t connects;
+	uint64_t failures;
+	uint64_t drops;
+	uint64_t events;
+	uint64_t max_lag_us;
+	double virtual_s;
+	double cpu_s;
+} counters_t;
+
+static options_t options = {
+	.devices = 100,
+	.workers = 1,
+	.duration_s = 60.0,
+	.report_s = 10.0,
+	.rate = 1.0,
+	.spread = 0.5,
+	.record_length = 32,
+	.boot_s = 10.0,
+	.loss_p = 0.01,
+	.connect_fail_p = 0.1,
+	.link_mtbf_s = 600,
+	.stack_kb = 16,
+	.seed = 1,
+};
+
+// Save areas: one per instance, instance 0 being the worker itself.
+static uint8_t *states = NULL;
+static size_t data_size;
+static size_t state_size;
+
+static void usage(const char *name) {
+
+	fprintf(stderr,
+			"Usage: %s [options]\n"
+			"  -n count   devices (default 100)\n"
+			"  -a address:port\n"
+			"             collector (default: modelled remote host, not in real time)\n"
+			"  -j count   worker processes (default 1)\n"
+			"  -d s       duration, in seconds (default 60)\n"
+			"  -i s       report period, in seconds (default 10)\n"
+			"  -r rate    records per second and per device (default 1)\n"
+			"  -p spread  device rates are uniform in rate x [1 - spread, 1 + spread] (default 0.5)\n"
+			"  -b bytes   record length, %d to %d (default 32)\n"
+			"  -R         reliable records\n"
+			"  -u s       devices boot uniformly over this time (default 10)\n"
+			"  -l p       Wi-Fi datagram loss probability (default 0.01)\n"
+			"  -f p       association failure probability (default 0.1)\n"
+			"  -m s       mean time between link losses, per device (default 600, 0: never)\n"
+			"  -k KB      task stack size (default 16)\n"
+			"  -S seed    random seed (default 1)\n",
+			name, FLEET_RECORD_HEADER, CONFIG_UDPSENDER_PRODUCER_MAX_RECORD);
+
+}
+
+static double cpu_time_s(void) {
+
+	struct timespec now;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+
+}
+
+static double wall_time_s(void) {
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+
+}
+
+/**
+ * Instance switch hook.
+ */
+static void switch_state(uint32_t from, uint32_t to) {
+
+	uint8_t *state = &states[(size_t)from * state_size];
+	memcpy(state, __start_fleet_data, data_size);
+	memcpy(state + data_size, __start_fleet_bss, state_size - data_size);
+	state = &states[(size_t)to * state_size];
+	memcpy(__start_fleet_data, state, data_size);
+	memcpy(__start_fleet_bss, state + data_size, state_size - data_size);
+
+}
+
+/**
+ * Allocates the save areas, all of them holding the initial state.
+ */
+static bool init_states(uint32_t instances) {
+
+	data_size = (size_t)(__stop_fleet_data - __start_fleet_data);
+	state_size = data_size + (size_t)(__stop_fleet_bss - __start_fleet_bss);
+	states = malloc((size_t)instances * state_size);
+	if (states == NULL) {
+		return false;
+	}
+	for (uint32_t i = 0; i < instances; i++) {
+		memcpy(&states[(size_t)i * state_size], __start_fleet_data, data_size);
+		memcpy(&states[(size_t)i * state_size + data_size], __start_fleet_bss,
+			   state_size - data_size);
+	}
+	sim_instance_switch_hook = switch_state;
+	return true;
+
+}
+
+static void collect(uint32_t count, double target_rate, counters_t *counters) {
+
+	sim_kernel_stats_t kernel;
+	fleet_device_stats_t device;
+	send_path_stats_t send_path;
+	sim_wifi_stats_t wifi;
+	sim_net_stats_t net;
+
+	memset(counters, 0, sizeof(counters_t));
+	counters->devices = count;
+	counters->target_rate = target_rate;
+	for (uint32_t i = 1; i <= count; i++) {
+		sim_set_instance(i);
+		fleet_device_get_stats(&device);
+		send_path_get_stats(&send_path);
+		sim_wifi_get_stats(&wifi);
+		sim_net_get_stats(&net);
+		counters->up += sim_wifi_is_up() ? 1 : 0;
+		counters->offered += device.offered;
+		counters->rejected += device.rejected;
+		counters->sent += send_path.sent + send_path.retried;
+		counters->dropped += send_path.dropped;
+		counters->link_down += net.link_down;
+		counters->lost += net.lost;
+		counters->delivered += net.delivered;
+		counters->remote_errors += net.remote_errors;
+		counters->connects += wifi.connects;
+		counters->failures += wifi.failures;
+		counters->drops += wifi.drops;
+	}
+	sim_set_instance(0);
+	sim_kernel_get_stats(&kernel);
+	counters->events = kernel.events;
+	counters->max_lag_us = kernel.max_lag_us;
+	counters->virtual_s = sim_now_us() / 1e6;
+	counters->cpu_s = cpu_time_s();
+
+}
+
+/**
+ * Runs devices first to first + count - 1, and writes their counters to fd
+ * at every report period.
+ */
+static void run_worker(uint32_t worker, uint32_t first, uint32_t count, int fd) {
+
+	// One host socket per device.
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	if (!init_states(count + 1)) {
+		fprintf(stderr, "Worker %u: out of memory\n", worker);
+		exit(1);
+	}
+	sim_random_seed(options.seed + worker);
+	sim_kernel_config.log_level = ESP_LOG_NONE;
+	sim_kernel_config.stack_size = options.stack_kb * 1024;
+	sim_kernel_config.realtime = options.remote_port != 0;
+	double target_rate = 0.0;
+	for (uint32_t i = 0; i < count; i++) {
+		fleet_device_config_t config = {
+			.device_id = first + i,
+			.rate = options.rate * (1.0 + options.spread * (2.0 * sim_random_unit() - 1.0)),
+			.record_length = options.record_length,
+			.reliable = options.reliable,
+		};
+		target_rate += config.rate;
+		sim_set_instance(i + 1);
+		sim_wifi_config.connect_fail_p = options.connect_fail_p;
+		sim_wifi_config.link_mtbf_s = options.link_mtbf_s;
+		sim_net_config.loss_p = options.loss_p;
+		sim_net_config.remote_address = options.remote_address;
+		sim_net_config.remote_port = options.remote_port;
+		fleet_device_start(&config, sim_random_range(0, (uint64_t)(options.boot_s * 1e6)));
+	}
+	sim_set_instance(0);
+
+	counters_t counters;
+	uint64_t end_us = (uint64_t)(options.duration_s * 1e6);
+	uint64_t step_us = (uint64_t)(options.report_s * 1e6);
+	while (sim_now_us() < end_us) {
+		uint64_t next_us = sim_now_us() + step_us;
+		sim_run(next_us < end_us ? next_us : end_us);
+		collect(count, target_rate, &counters);
+		if (write(fd, &counters, sizeof(counters)) != sizeof(counters)) {
+			exit(1);
+		}
+	}
+	exit(0);
+
+}
+
+static void add_counters(counters_t *sum, const counters_t *counters) {
+
+	sum->devices += counters->devices;
+	sum->up += counters->up;
+	sum->target_rate += counters->target_rate;
+	sum->offered += counters->offered;
+	sum->rejected += counters->rejected;
+	sum->sent += counters->sent;
+	sum->dropped += counters->dropped;
+	sum->link_down += counters->link_down;
+	sum->lost += counters->lost;
+	sum->delivered += counters->delivered;
+	sum->remote_errors += counters->remote_errors;
+	sum->connects += counters->connects;
+	sum->failures += counters->failures;
+	sum->drops += counters->drops;
+	sum->events += counters->events;
+	if (counters->max_lag_us > sum->max_lag_us) {
+		sum->max_lag_us = counters->max_lag_us;
+	}
+	// Workers run side by side: the slowest one gives the virtual time.
+	if (sum->virtual_s == 0.0 || counters->virtual_s < sum->virtual_s) {
+		sum->virtual_s = counters->virtual_s;
+	}
+	sum->cpu_s += counters->cpu_s;
+
+}
+
+static void report(const counters_t *now, const counters_t *last, double wall_s,
+		           double period_s) {
+
+	printf("%8.1f s  up %u/%u  offered %.0f rec/s (target %.0f)  sent %.0f dgram/s  "
+		   "delivered %.0f dgram/s  rejected %llu  dropped %llu  "
+		   "lag %.1f ms  cpu %.0f%%\n",
+		   wall_s, now->up, now->devices, (now->offered - last->offered) / period_s,
+		   now->target_rate,
+		   (now->sent - last->sent) / period_s,
+		   (now->delivered - last->delivered) / period_s,
+		   (unsigned long long)(now->rejected - last->rejected),
+		   (unsigned long long)(now->dropped - last->dropped),
+		   now->max_lag_us / 1e3, 100.0 * (now->cpu_s - last->cpu_s) / period_s);
+	fflush(stdout);
+
+}
+
+static void summary(const counters_t *total, double wall_s) {
+
+	printf("--- %u devices, %u workers, %.3f s virtual, %.3f s wall, %.3f s CPU\n",
+		   total->devices, options.workers, total->virtual_s, wall_s, total->cpu_s);
+	printf("records: %llu offered (%.0f per second), %llu rejected\n",
+		   (unsigned long long)total->offered,
+		   total->virtual_s > 0.0 ? total->offered / total->virtual_s : 0.0,
+		   (unsigned long long)total->rejected);
+	printf("datagrams: %llu sent, %llu dropped, %llu while down, %llu lost, "
+		   "%llu delivered (%.0f per second, %.2f per record), %llu host errors\n",
+		   (unsigned long long)total->sent, (unsigned long long)total->dropped,
+		   (unsigned long long)total->link_down, (unsigned long long)total->lost,
+		   (unsigned long long)total->delivered, wall_s > 0.0 ? total->delivered / wall_s : 0.0,
+		   total->offered > 0 ? (double)total->delivered / total->offered : 0.0,
+		   (unsigned long long)total->remote_errors);
+	printf("wifi: %llu connects, %llu failures, %llu drops\n",
+		   (unsigned long long)total->connects, (unsigned long long)total->failures,
+		   (unsigned long long)total->drops);
+	printf("kernel: %llu events (%.0f per CPU second), max lag %.1f ms\n",
+		   (unsigned long long)total->events,
+		   total->cpu_s > 0.0 ? total->events / total->cpu_s : 0.0,
+		   total->max_lag_us / 1e3);
+	fflush(stdout);
+
+}
+
+static bool parse_address(const char *text) {
+
+	char host[64];
+	const char *colon = strchr(text, ':');
+	if (colon == NULL || colon - text >= (long)sizeof(host)) {
+		return false;
+	}
+	memcpy(host, text, colon - text);
+	host[colon - text] = '\0';
+	struct in_addr address;
+	if (inet_pton(AF_INET, host, &address) != 1) {
+		return false;
+	}
+	options.remote_address = ntohl(address.s_addr);
+	options.remote_port = (uint16_t)atoi(colon + 1);
+	return options.remote_port != 0;
+
+}
+
+int main(int argc, char **argv) {
+
+	int option;
+
+	while ((option = getopt(argc, argv, "n:a:j:d:i:r:p:b:Ru:l:f:m:k:S:")) != -1) {
+		switch (option) {
+		case 'n': options.devices = (uint32_t)atoi(optarg); break;
+		case 'a':
+			if (!parse_address(optarg)) {
+				fprintf(stderr, "Invalid collector address: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'j': options.workers = (uint32_t)atoi(optarg); break;
+		case 'd': options.duration_s = atof(optarg); break;
+		case 'i': options.report_s = atof(optarg); break;
+		case 'r': options.rate = atof(optarg); break;
+		case 'p': options.spread = atof(optarg); break;
+		case 'b': options.record_length = (uint32_t)atoi(optarg); break;
+		case 'R': options.reliable = true; break;
+		case 'u': options.boot_s = atof(optarg); break;
+		case 'l': options.loss_p = atof(optarg); break;
+		case 'f': options.connect_fail_p = atof(optarg); break;
+		case 'm': options.link_mtbf_s = (uint32_t)atoi(optarg); break;
+		case 'k': options.stack_kb = (uint32_t)atoi(optarg); break;
+		case 'S': options.seed = strtoull(optarg, NULL, 0); break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (options.devices == 0 || options.workers == 0 || options.workers > MAX_WORKERS ||
+		options.workers > options.devices) {
+		fprintf(stderr, "Devices and workers must be positive, with at most %d workers, "
+				"and no more workers than devices\n", MAX_WORKERS);
+		return 1;
+	}
+	if (options.record_length < FLEET_RECORD_HEADER ||
+		options.record_length > CONFIG_UDPSENDER_PRODUCER_MAX_RECORD) {
+		fprintf(stderr, "Record length must be in %d..%d\n", FLEET_RECORD_HEADER,
+				CONFIG_UDPSENDER_PRODUCER_MAX_RECORD);
+		return 1;
+	}
+	if (options.report_s <= 0.0 || options.duration_s <= 0.0 || options.spread < 0.0 ||
+		options.spread > 1.0) {
+		fprintf(stderr, "Invalid duration, report period or spread\n");
+		return 1;
+	}
+
+	int pipes[MAX_WORKERS];
+	pid_t pids[MAX_WORKERS];
+	uint32_t first = 0;
+	for (uint32_t worker = 0; worker < options.workers; worker++) {
+		uint32_t count = (options.devices - first) / (options.workers - worker);
+		int fds[2];
+		if (pipe(fds) < 0) {
+			perror("pipe");
+			return 1;
+		}
+		fflush(stdout);
+		pids[worker] = fork();
+		if (pids[worker] < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (pids[worker] == 0) {
+			close(fds[0]);
+			run_worker(worker, first, count, fds[1]);
+		}
+		close(fds[1]);
+		pipes[worker] = fds[0];
+		first += count;
+	}
+
+	double start_s = wall_time_s();
+	double last_s = start_s;
+	counters_t last;
+	counters_t total;
+	memset(&last, 0, sizeof(last));
+	memset(&total, 0, sizeof(total));
+	bool running = true;
+	while (running) {
+		counters_t sum;
+		memset(&sum, 0, sizeof(sum));
+		for (uint32_t worker = 0; worker < options.workers; worker++) {
+			counters_t counters;
+			if (read(pipes[worker], &counters, sizeof(counters)) != sizeof(counters)) {
+				running = false;
+				break;
+			}
+			add_counters(&sum, &counters);
+		}
+		if (!running) {
+			break;
+		}
+		double now_s = wall_time_s();
+		report(&sum, &last, now_s - start_s, now_s - last_s);
+		last = sum;
+		last_s = now_s;
+		total = sum;
+	}
+	int failed = 0;
+	for (uint32_t worker = 0; worker < options.workers; worker++) {
+		int status;
+		waitpid(pids[worker], &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			failed++;
+		}
+	}
+	summary(&total, last_s - start_s);
+	if (failed > 0) {
+		fprintf(stderr, "%d worker(s) failed\n", failed);
+		return 1;
+	}
+	return 0;
+
+}
@@ -0,0 +1,138 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "nvs_flash.h"
+
+#include "connect_wifi.h"
+#include "link_state.h"
+#include "pipeline.h"
+#include "producer.h"
+#include "reactor.h"
+#include "send_datagram.h"
+#include "seq_store.h"
+#include "supervisor.h"
+#include "transport.h"
+
+#include "sim.h"
+
+#include "fleet_device.h"
+
+#define LOAD_STREAM_ID 1
+
+#define MAX_RECORD CONFIG_UDPSENDER_PRODUCER_MAX_RECORD
+
+static const char *TAG = "FLEET";
+
+static fleet_device_config_t config;
+
+static fleet_device_stats_t stats;
+
+static producer_source_t *source;
+
+/**
+ * Pushes records at the rate of the device, with a 1 ms granularity. The
+ * first record is sent after a random fraction of the period, so that the
+ * devices of the fleet do not send in step.
+ */
+static void load_task(void *parameters) {
+
+	uint8_t record[MAX_RECORD];
+	uint32_t counter = 0;
+
+	source = producer_register_source(LOAD_STREAM_ID, config.reliable,
+			                          TRAFFIC_CLASS_NORMAL, PRODUCER_TASK);
+	if (source == NULL || config.rate <= 0.0) {
+		if (source == NULL) {
+			ESP_LOGE(TAG, "Error from producer_register_source");
+		}
+		while (true) {
+			vTaskDelay(portMAX_DELAY);
+		}
+	}
+	uint64_t period_us = (uint64_t)(1e6 / config.rate);
+	if (period_us == 0) {
+		period_us = 1;
+	}
+	uint64_t due_us = sim_now_us() + sim_random_range(0, period_us - 1);
+	memset(record, 0, sizeof(record));
+	memcpy(record, &config.device_id, sizeof(config.device_id));
+	while (true) {
+		while (due_us <= sim_now_us()) {
+			memcpy(&record[4], &counter, sizeof(counter));
+			counter++;
+			stats.offered++;
+			if (!producer_push(source, record, config.record_length)) {
+				stats.rejected++;
+			}
+			due_us += period_us;
+		}
+		uint64_t delay_ms = (due_us - sim_now_us() + 999) / 1000;
+		vTaskDelay(pdMS_TO_TICKS(delay_ms));
+	}
+
+}
+
+/**
+ * Initialization done by app_main(), see udp_sender.c.
+ */
+static void boot_event(void *arg, uint64_t tag) {
+
+	ESP_ERROR_CHECK(nvs_flash_init());
+	// The simulator configuration also builds the raw transport.
+	transport_set(&transport_udp);
+	seq_store_init();
+	link_state_init();
+	ESP_ERROR_CHECK(esp_netif_init());
+	ESP_ERROR_CHECK(esp_event_loop_create_default());
+#if CONFIG_UDPSENDER_REACTOR
+	xTaskCreate(reactor_task, "reactor", CONFIG_UDPSENDER_REACTOR_STACK_SIZE, NULL, 5, NULL);
+#else
+	xTaskCreate(supervisor_task, "supervisor", CONFIG_UDPSENDER_SUPERVISOR_STACK_SIZE, NULL, 5, NULL);
+	xTaskCreate(connect_wifi_task, "connect_wifi", CONFIG_UDPSENDER_CONNECT_WIFI_STACK_SIZE, NULL, 5, NULL);
+	xTaskCreate(send_datagram_task, "send_datagram", CONFIG_UDPSENDER_SEND_DATAGRAM_STACK_SIZE, NULL, 5, NULL);
+#endif
+	xTaskCreate(pipeline_task, "pipeline", CONFIG_UDPSENDER_PIPELINE_STACK_SIZE, NULL, 5, NULL);
+	xTaskCreate(load_task, "load", 2000, NULL, 5, NULL);
+
+}
+
+void fleet_device_start(const fleet_device_config_t *device_config, uint64_t boot_us) {
+
+	config = *device_config;
+	memset(&stats, 0, sizeof(fleet_device_stats_t));
+	sim_wifi_init();
+	sim_net_init();
+	sim_schedule(boot_us, boot_event, NULL, 0);
+
+}
+
+void fleet_device_get_stats(fleet_device_stats_t *device_stats) {
+	*device_stats = stats;
+}
@@ -0,0 +1,55 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef FLEET_FLEET_DEVICE_H_
+#define FLEET_FLEET_DEVICE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// One virtual device of the fleet simulator: the application tasks, and a
+// load task pushing records through the producer API. Its state is part of
+// the per-device state swapped by fleet.c: the functions below apply to the
+// current instance.
+
+// First bytes of every record: device ID, then record counter, both little
+// endian.
+#define FLEET_RECORD_HEADER 8
+
+typedef struct {
+	uint32_t device_id;
+	double rate;              // Records per second.
+	uint32_t record_length;   // At least FLEET_RECORD_HEADER.
+	bool reliable;
+} fleet_device_config_t;
+
+typedef struct {
+	uint64_t offered;         // Records generated by the load task.
+	uint64_t rejected;        // Records refused by the producer API.
+} fleet_device_stats_t;
+
+/**
+ * Starts the device at virtual time boot_us: initialization done by
+ * app_main(), then the load task.
+ */
+void fleet_device_start(const fleet_device_config_t *config, uint64_t boot_us);
+
+void fleet_device_get_stats(fleet_device_stats_t *stats);
+
+#endif /* FLEET_FLEET_DEVICE_H_ */
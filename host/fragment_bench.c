@@ -0,0 +1,224 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+
+/**
+ * Throughput of fragmentation (main/fragment.c) and reassembly
+ * (host/reassembly.c), for records of 1 KB to 64 KB.
+ *
+ * For every record length, records are fragmented into datagrams of at
+ * most -m bytes, fragments are lost with probability -l, and the
+ * fragments of -w consecutive records are shuffled together, then
+ * reassembled and checked. The
+ * report gives, per record length, the fragment count, the fragmentation
+ * and reassembly throughput in payload MB/s, and the ratio of records
+ * delivered.
+ *
+ * Build:
+ *   gcc -O2 -Wall -I main -I host -o fragment_bench host/fragment_bench.c \
+ *       host/reassembly.c main/fragment.c main/frame.c
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fragment.h"
+#include "frame.h"
+#include "reassembly.h"
+
+#define MIN_RECORD 1024
+#define MAX_RECORD 65536
+
+// Longest datagram of the transports.
+#define MAX_DATAGRAM 1472
+
+// Reassembly bounds.
+#define MAX_RECORDS 32
+#define MAX_BYTES (4 * 1024 * 1024)
+#define TIMEOUT_US 2000000
+
+typedef struct {
+	uint16_t length;
+	uint8_t data[MAX_DATAGRAM];
+} datagram_t;
+
+static uint64_t random_state = 1;
+
+static uint32_t random_u32(void) {
+
+	// xorshift64*
+	random_state ^= random_state >> 12;
+	random_state ^= random_state << 25;
+	random_state ^= random_state >> 27;
+	return (uint32_t)((random_state * 2685821657736338717ULL) >> 32);
+
+}
+
+static double random_unit(void) {
+	return random_u32() / 4294967296.0;
+}
+
+static double elapsed_s(const struct timespec *start) {
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+
+}
+
+static void usage(const char *name) {
+
+	fprintf(stderr,
+			"Usage: %s [options]\n"
+			"  -m bytes   longest datagram (default 1472)\n"
+			"  -l p       fragment loss probability (default 0)\n"
+			"  -w count   records whose fragments are shuffled together (default 1: no reordering)\n"
+			"  -n MB      payload per record length (default 64)\n",
+			name);
+
+}
+
+int main(int argc, char *argv[]) {
+
+	uint16_t max_datagram = MAX_DATAGRAM;
+	double loss_p = 0.0;
+	uint32_t window = 1;
+	uint32_t total_mb = 64;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "m:l:w:n:")) != -1) {
+		switch (opt) {
+		case 'm': max_datagram = (uint16_t)atoi(optarg); break;
+		case 'l': loss_p = atof(optarg); break;
+		case 'w': window = (uint32_t)atoi(optarg); break;
+		case 'n': total_mb = (uint32_t)atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (max_datagram <= FRAGMENT_OVERHEAD || max_datagram > MAX_DATAGRAM || window == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	uint8_t *frame = malloc(FRAME_HEADER_LENGTH + MAX_RECORD);
+	uint16_t max_count = fragment_count(MAX_RECORD, max_datagram);
+	datagram_t *datagrams = malloc(sizeof(datagram_t) * (size_t)max_count * window);
+	if (frame == NULL || datagrams == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	printf("%8s %9s %14s %16s %10s %8s %8s\n", "record", "fragments", "fragment MB/s",
+		   "reassembly MB/s", "delivered", "dropped", "errors");
+	for (uint32_t record_length = MIN_RECORD; record_length <= MAX_RECORD; record_length *= 2) {
+		reassembly_t *reassembly = reassembly_create(MAX_RECORDS, MAX_BYTES, TIMEOUT_US);
+		uint64_t records = (uint64_t)total_mb * 1024 * 1024 / record_length;
+		uint16_t count = fragment_count(record_length, max_datagram);
+		uint64_t errors = 0;
+		double fragment_s = 0.0;
+		double reassembly_s = 0.0;
+		uint64_t now_us = 0;
+		uint32_t seq = 0;
+		uint64_t done = 0;
+		while (done < records) {
+			// Fragment a batch of records, so that fragments of different
+			// records can be reordered.
+			uint32_t batch = 0;
+			uint32_t pending = 0;
+			struct timespec start;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			while (batch < window && done + batch < records) {
+				frame_header_t header = {
+					.version = FRAME_VERSION,
+					.type = FRAME_DATA,
+					.stream_id = 1,
+					.seq = seq + batch,
+					.epoch = 1,
+				};
+				frame_encode_header(&header, frame);
+				// Payload content depends on the sequence number, for the check.
+				memset(&frame[FRAME_HEADER_LENGTH], (uint8_t)header.seq, record_length);
+				for (uint16_t index = 0; index < count; index++) {
+					datagram_t *datagram = &datagrams[pending++];
+					datagram->length = fragment_build(frame, FRAME_HEADER_LENGTH + record_length,
+							                          max_datagram, index, datagram->data);
+				}
+				batch++;
+			}
+			fragment_s += elapsed_s(&start);
+
+			// Lose and reorder (not timed).
+			uint32_t kept = 0;
+			for (uint32_t i = 0; i < pending; i++) {
+				if (random_unit() >= loss_p) {
+					datagrams[kept++] = datagrams[i];
+				}
+			}
+			for (uint32_t i = 0; window > 1 && i + 1 < kept; i++) {
+				uint32_t j = i + random_u32() % (kept - i);
+				datagram_t swap = datagrams[i];
+				datagrams[i] = datagrams[j];
+				datagrams[j] = swap;
+			}
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (uint32_t i = 0; i < kept; i++) {
+				frame_header_t header;
+				const uint8_t *record;
+				uint32_t length;
+				// 10 us between fragments.
+				now_us += 10;
+				reassembly_rs_t rs = reassembly_add(reassembly, datagrams[i].data,
+						                            datagrams[i].length, now_us,
+													&header, &record, &length);
+				if (rs == REASSEMBLY_COMPLETE) {
+					if (length != record_length || record[0] != (uint8_t)header.seq ||
+						record[length - 1] != (uint8_t)header.seq) {
+						errors++;
+					}
+				} else if (rs != REASSEMBLY_INCOMPLETE) {
+					errors++;
+				}
+			}
+			reassembly_s += elapsed_s(&start);
+			seq += batch;
+			done += batch;
+		}
+		reassembly_stats_t stats;
+		reassembly_get_stats(reassembly, &stats);
+		double mb = (double)records * record_length / (1024 * 1024);
+		printf("%8u %9u %14.0f %16.0f %9.2f%% %8llu %8llu\n", record_length, count,
+			   fragment_s > 0.0 ? mb / fragment_s : 0.0,
+			   reassembly_s > 0.0 ? mb / reassembly_s : 0.0,
+			   100.0 * stats.completed / records,
+			   (unsigned long long)(stats.expired + stats.evicted), (unsigned long long)errors);
+		reassembly_destroy(reassembly);
+	}
+	free(datagrams);
+	free(frame);
+	return 0;
+
+}
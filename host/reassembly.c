@@ -0,0 +1,292 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fragment.h"
+#include "frame.h"
+#include "reassembly.h"
+
+typedef struct {
+	uint8_t stream_id;
+	uint32_t epoch;
+	uint32_t seq;
+} record_key_t;
+
+typedef struct {
+	bool used;
+	record_key_t key;
+	uint64_t first_us;        // Reception of the first fragment.
+	frame_header_t header;    // Header of fragment 0, once received.
+	uint32_t record_length;
+	uint16_t count;
+	uint16_t received;        // Distinct fragments received.
+	uint32_t received_bytes;
+	uint8_t *bitmap;          // One bit per fragment.
+	uint8_t *data;
+} entry_t;
+
+struct reassembly {
+	uint32_t max_records;
+	size_t max_bytes;
+	uint64_t timeout_us;
+	entry_t *entries;
+	// Last record reassembled, returned by reassembly_add().
+	uint8_t *complete;
+	// Keys of the last records reassembled, for duplicate detection.
+	record_key_t recent[REASSEMBLY_RECENT_RECORDS];
+	uint32_t recent_count;
+	reassembly_stats_t stats;
+};
+
+static bool same_key(const record_key_t *a, const record_key_t *b) {
+	return a->stream_id == b->stream_id && a->epoch == b->epoch && a->seq == b->seq;
+}
+
+static size_t entry_size(uint32_t record_length, uint16_t count) {
+	return (size_t)record_length + (count + 7) / 8;
+}
+
+static void free_entry(reassembly_t *reassembly, entry_t *entry) {
+
+	reassembly->stats.buffered_bytes -= entry_size(entry->record_length, entry->count);
+	free(entry->bitmap);
+	free(entry->data);
+	entry->bitmap = NULL;
+	entry->data = NULL;
+	entry->used = false;
+
+}
+
+/**
+ * Returns the oldest incomplete record, or NULL.
+ */
+static entry_t *oldest_entry(reassembly_t *reassembly) {
+
+	entry_t *oldest = NULL;
+	for (uint32_t i = 0; i < reassembly->max_records; i++) {
+		entry_t *entry = &reassembly->entries[i];
+		if (entry->used && (oldest == NULL || entry->first_us < oldest->first_us)) {
+			oldest = entry;
+		}
+	}
+	return oldest;
+
+}
+
+static bool is_recent(const reassembly_t *reassembly, const record_key_t *key) {
+
+	uint32_t count = reassembly->recent_count < REASSEMBLY_RECENT_RECORDS ?
+			         reassembly->recent_count : REASSEMBLY_RECENT_RECORDS;
+	for (uint32_t i = 0; i < count; i++) {
+		if (same_key(&reassembly->recent[i], key)) {
+			return true;
+		}
+	}
+	return false;
+
+}
+
+/**
+ * Returns a free entry for a new record, evicting the oldest ones if
+ * needed to stay within bounds, or NULL if out of memory.
+ */
+static entry_t *new_entry(reassembly_t *reassembly, const record_key_t *key,
+		                  const fragment_header_t *fragment, uint64_t now_us) {
+
+	size_t size = entry_size(fragment->record_length, fragment->count);
+	entry_t *entry = NULL;
+	while (true) {
+		entry = NULL;
+		for (uint32_t i = 0; i < reassembly->max_records; i++) {
+			if (!reassembly->entries[i].used) {
+				entry = &reassembly->entries[i];
+				break;
+			}
+		}
+		if (entry != NULL && reassembly->stats.buffered_bytes + size <= reassembly->max_bytes) {
+			break;
+		}
+		free_entry(reassembly, oldest_entry(reassembly));
+		reassembly->stats.evicted++;
+	}
+	entry->bitmap = calloc((fragment->count + 7) / 8, 1);
+	entry->data = malloc(fragment->record_length > 0 ? fragment->record_length : 1);
+	if (entry->bitmap == NULL || entry->data == NULL) {
+		free(entry->bitmap);
+		free(entry->data);
+		entry->bitmap = NULL;
+		entry->data = NULL;
+		return NULL;
+	}
+	entry->used = true;
+	entry->key = *key;
+	entry->first_us = now_us;
+	entry->record_length = fragment->record_length;
+	entry->count = fragment->count;
+	entry->received = 0;
+	entry->received_bytes = 0;
+	reassembly->stats.buffered_bytes += size;
+	if (reassembly->stats.buffered_bytes > reassembly->stats.max_buffered_bytes) {
+		reassembly->stats.max_buffered_bytes = reassembly->stats.buffered_bytes;
+	}
+	return entry;
+
+}
+
+reassembly_t *reassembly_create(uint32_t max_records, size_t max_bytes,
+		                        uint64_t timeout_us) {
+
+	if (max_records == 0) {
+		return NULL;
+	}
+	reassembly_t *reassembly = calloc(1, sizeof(reassembly_t));
+	if (reassembly == NULL) {
+		return NULL;
+	}
+	reassembly->entries = calloc(max_records, sizeof(entry_t));
+	if (reassembly->entries == NULL) {
+		free(reassembly);
+		return NULL;
+	}
+	reassembly->max_records = max_records;
+	reassembly->max_bytes = max_bytes;
+	reassembly->timeout_us = timeout_us;
+	return reassembly;
+
+}
+
+void reassembly_destroy(reassembly_t *reassembly) {
+
+	for (uint32_t i = 0; i < reassembly->max_records; i++) {
+		if (reassembly->entries[i].used) {
+			free_entry(reassembly, &reassembly->entries[i]);
+		}
+	}
+	free(reassembly->entries);
+	free(reassembly->complete);
+	free(reassembly);
+
+}
+
+void reassembly_expire(reassembly_t *reassembly, uint64_t now_us) {
+
+	for (uint32_t i = 0; i < reassembly->max_records; i++) {
+		entry_t *entry = &reassembly->entries[i];
+		if (entry->used && now_us - entry->first_us > reassembly->timeout_us) {
+			free_entry(reassembly, entry);
+			reassembly->stats.expired++;
+		}
+	}
+
+}
+
+reassembly_rs_t reassembly_add(reassembly_t *reassembly, const uint8_t *frame,
+		                       uint16_t frame_length, uint64_t now_us,
+							   frame_header_t *header, const uint8_t **record,
+							   uint32_t *record_length) {
+
+	frame_header_t frame_header;
+	fragment_header_t fragment;
+
+	reassembly_expire(reassembly, now_us);
+	if (!frame_decode_header(frame, frame_length, &frame_header) ||
+		(frame_header.flags & FRAME_FLAG_FRAGMENT) == 0 ||
+		!fragment_decode_header(frame, frame_length, &fragment)) {
+		reassembly->stats.invalid++;
+		return REASSEMBLY_INVALID;
+	}
+	if (entry_size(fragment.record_length, fragment.count) > reassembly->max_bytes) {
+		reassembly->stats.invalid++;
+		return REASSEMBLY_TOO_LONG;
+	}
+	record_key_t key = {
+		.stream_id = frame_header.stream_id,
+		.epoch = frame_header.epoch,
+		.seq = frame_header.seq,
+	};
+	entry_t *entry = NULL;
+	for (uint32_t i = 0; i < reassembly->max_records; i++) {
+		if (reassembly->entries[i].used && same_key(&reassembly->entries[i].key, &key)) {
+			entry = &reassembly->entries[i];
+			break;
+		}
+	}
+	if (entry == NULL) {
+		if (is_recent(reassembly, &key)) {
+			reassembly->stats.duplicates++;
+			return REASSEMBLY_DUPLICATE;
+		}
+		entry = new_entry(reassembly, &key, &fragment, now_us);
+		if (entry == NULL) {
+			reassembly->stats.invalid++;
+			return REASSEMBLY_TOO_LONG;
+		}
+	}
+	if (fragment.count != entry->count || fragment.record_length != entry->record_length) {
+		reassembly->stats.invalid++;
+		return REASSEMBLY_INVALID;
+	}
+	uint8_t mask = (uint8_t)(1 << (fragment.index % 8));
+	if ((entry->bitmap[fragment.index / 8] & mask) != 0) {
+		reassembly->stats.duplicates++;
+		return REASSEMBLY_DUPLICATE;
+	}
+	uint32_t length = frame_length - FRAGMENT_OVERHEAD;
+	memcpy(&entry->data[fragment.offset], &frame[FRAGMENT_OVERHEAD], length);
+	entry->bitmap[fragment.index / 8] |= mask;
+	entry->received++;
+	entry->received_bytes += length;
+	if (fragment.index == 0) {
+		entry->header = frame_header;
+		entry->header.flags &= ~FRAME_FLAG_FRAGMENT;
+	}
+	reassembly->stats.fragments++;
+	if (entry->received < entry->count) {
+		return REASSEMBLY_INCOMPLETE;
+	}
+	if (entry->received_bytes != entry->record_length) {
+		// Fragments overlap, or leave holes.
+		free_entry(reassembly, entry);
+		reassembly->stats.invalid++;
+		return REASSEMBLY_INVALID;
+	}
+
+	// Hand the record over, and remember it for duplicate detection.
+	free(reassembly->complete);
+	reassembly->complete = entry->data;
+	entry->data = NULL;
+	*header = entry->header;
+	*record = reassembly->complete;
+	*record_length = entry->record_length;
+	reassembly->recent[reassembly->recent_count % REASSEMBLY_RECENT_RECORDS] = key;
+	reassembly->recent_count++;
+	free_entry(reassembly, entry);
+	reassembly->stats.completed++;
+	return REASSEMBLY_COMPLETE;
+
+}
+
+void reassembly_get_stats(const reassembly_t *reassembly, reassembly_stats_t *stats) {
+	*stats = reassembly->stats;
+}
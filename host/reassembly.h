@@ -0,0 +1,93 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef HOST_REASSEMBLY_H_
+#define HOST_REASSEMBLY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "frame.h"
+
+// Host side of fragmentation: reassembles the records sent as fragments
+// (see main/fragment.h).
+//
+// Fragments of a record are identified by stream, boot epoch and sequence
+// number, and can be received in any order. Memory is bounded: at most
+// max_records records are reassembled at the same time, holding at most
+// max_bytes bytes. When a new record would exceed a bound, the oldest
+// incomplete records are dropped (evicted). Incomplete records are also
+// dropped when their first fragment is older than the timeout. Fragments
+// of a record already reassembled are reported as duplicates, as long as
+// the record is among the last REASSEMBLY_RECENT_RECORDS ones.
+//
+// Not thread safe.
+
+#define REASSEMBLY_RECENT_RECORDS 64
+
+typedef enum {
+	REASSEMBLY_INCOMPLETE,  // Fragment stored, record not complete yet.
+	REASSEMBLY_COMPLETE,    // Record complete.
+	REASSEMBLY_DUPLICATE,   // Fragment already received.
+	REASSEMBLY_INVALID,     // Fragment inconsistent with its record.
+	REASSEMBLY_TOO_LONG,    // Record longer than the memory bound.
+} reassembly_rs_t;
+
+typedef struct {
+	uint64_t fragments;       // Fragments stored.
+	uint64_t completed;       // Records reassembled.
+	uint64_t duplicates;      // Fragments received twice.
+	uint64_t invalid;         // Fragments rejected as inconsistent or too long.
+	uint64_t expired;         // Incomplete records dropped on timeout.
+	uint64_t evicted;         // Incomplete records dropped to stay within bounds.
+	size_t buffered_bytes;    // Memory held by incomplete records.
+	size_t max_buffered_bytes;
+} reassembly_stats_t;
+
+typedef struct reassembly reassembly_t;
+
+/**
+ * Returns a new reassembly context, or NULL if out of memory.
+ */
+reassembly_t *reassembly_create(uint32_t max_records, size_t max_bytes,
+		                        uint64_t timeout_us);
+
+void reassembly_destroy(reassembly_t *reassembly);
+
+/**
+ * Processes a frame with FRAME_FLAG_FRAGMENT set, received at now_us. When
+ * the record is complete, provides its header (the one of its first
+ * fragment, without FRAME_FLAG_FRAGMENT), and its payload, which stays
+ * valid until the next call.
+ */
+reassembly_rs_t reassembly_add(reassembly_t *reassembly, const uint8_t *frame,
+		                       uint16_t frame_length, uint64_t now_us,
+							   frame_header_t *header, const uint8_t **record,
+							   uint32_t *record_length);
+
+/**
+ * Drops the incomplete records older than the timeout. Also done by
+ * reassembly_add().
+ */
+void reassembly_expire(reassembly_t *reassembly, uint64_t now_us);
+
+void reassembly_get_stats(const reassembly_t *reassembly, reassembly_stats_t *stats);
+
+#endif /* HOST_REASSEMBLY_H_ */
@@ -0,0 +1,255 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+/**
+ * Cost of record encoding (main/record.h).
+ *
+ * Four ways of building the payload of a datagram are timed:
+ * - the ASCII message of the send_datagram task before record schemas: a
+ *   fixed text whose three counter digits are patched in place
+ * - the same fields as the sensor_sample record, formatted as text with
+ *   snprintf(), which is what a hand-built payload grows into
+ * - the sensor_sample record, encoded by a loop over its field
+ *   descriptors, as a generic encoder would do at run time
+ * - the sensor_sample record, encoded by the generated function
+ * Every generated record is decoded back and checked. The report gives,
+ * per method, the time per record and the payload length.
+ *
+ * Build:
+ *   gcc -O2 -Wall -I main -o record_bench host/record_bench.c main/record.c
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "record.h"
+
+#define BUFFER_LENGTH 256
+
+// Ring of input records, so that encoding is not timed on constants.
+#define INPUTS 1024
+
+static uint64_t random_state = 1;
+
+// Keeps results alive.
+static volatile uint32_t sink;
+
+static uint32_t random_u32(void) {
+
+	// xorshift64*
+	random_state ^= random_state >> 12;
+	random_state ^= random_state << 25;
+	random_state ^= random_state >> 27;
+	return (uint32_t)((random_state * 2685821657736338717ULL) >> 32);
+
+}
+
+static double elapsed_s(const struct timespec *start) {
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+
+}
+
+/**
+ * The payload of the send_datagram task, as it was built by hand.
+ */
+static uint16_t encode_ascii_counter(uint8_t counter, char *payload) {
+
+	payload[18] = (char)('0' + counter % 10);
+	payload[17] = (char)('0' + (counter / 10) % 10);
+	payload[16] = (char)('0' + (counter / 100) % 10);
+	return 20;
+
+}
+
+static uint16_t encode_text(const record_sensor_sample_t *record, char *text) {
+
+	return (uint16_t)snprintf(text, BUFFER_LENGTH,
+			"%" PRIu32 ",%u,%" PRId32 ",%u,%" PRIu32 ",%d,%d,%d,%.3f,%u",
+			record->sample_ms, record->sensor_id, record->temperature_mc,
+			record->humidity_pm, record->pressure_pa, record->accel_x_mg,
+			record->accel_y_mg, record->accel_z_mg, (double)record->battery_v,
+			record->status);
+
+}
+
+/**
+ * Run time encoder: walks the descriptors, fields being read from the C
+ * record at offsets given alongside.
+ */
+static uint16_t encode_generic(const record_schema_t *schema, const size_t *c_offsets,
+		                       const void *record, uint8_t *buffer) {
+
+	const uint8_t *c_record = (const uint8_t *)record;
+	buffer[0] = schema->id;
+	for (uint8_t i = 0; i < schema->field_count; i++) {
+		const record_field_t *field = &schema->fields[i];
+		const void *value = &c_record[c_offsets[i]];
+		uint8_t *out = &buffer[field->offset];
+		switch (field->type) {
+		case RECORD_TYPE_u8: case RECORD_TYPE_i8:
+			record_put_u8(out, *(const uint8_t *)value);
+			break;
+		case RECORD_TYPE_u16: case RECORD_TYPE_i16:
+			record_put_u16(out, *(const uint16_t *)value);
+			break;
+		case RECORD_TYPE_u32: case RECORD_TYPE_i32: case RECORD_TYPE_f32:
+			record_put_u32(out, *(const uint32_t *)value);
+			break;
+		case RECORD_TYPE_u64: case RECORD_TYPE_i64:
+			record_put_u64(out, *(const uint64_t *)value);
+			break;
+		}
+	}
+	return schema->length;
+
+}
+
+static void usage(const char *name) {
+
+	fprintf(stderr,
+			"Usage: %s [options]\n"
+			"  -n count   records per method (default 10000000)\n",
+			name);
+
+}
+
+int main(int argc, char *argv[]) {
+
+	uint32_t count = 10000000;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n': count = (uint32_t)atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (count == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	static record_sensor_sample_t inputs[INPUTS];
+	for (uint32_t i = 0; i < INPUTS; i++) {
+		inputs[i] = (record_sensor_sample_t) {
+			.sample_ms = random_u32(),
+			.sensor_id = (uint16_t)random_u32(),
+			.temperature_mc = (int32_t)(random_u32() % 80000) - 20000,
+			.humidity_pm = (uint16_t)(random_u32() % 1000),
+			.pressure_pa = 90000 + random_u32() % 20000,
+			.accel_x_mg = (int16_t)random_u32(),
+			.accel_y_mg = (int16_t)random_u32(),
+			.accel_z_mg = (int16_t)random_u32(),
+			.battery_v = 3.0f + (float)(random_u32() % 1200) / 1000.0f,
+			.status = (uint8_t)random_u32(),
+		};
+	}
+	const record_schema_t *schema = record_find_schema(RECORD_SENSOR_SAMPLE_ID);
+	static const size_t C_OFFSETS[] = {
+		offsetof(record_sensor_sample_t, sample_ms),
+		offsetof(record_sensor_sample_t, sensor_id),
+		offsetof(record_sensor_sample_t, temperature_mc),
+		offsetof(record_sensor_sample_t, humidity_pm),
+		offsetof(record_sensor_sample_t, pressure_pa),
+		offsetof(record_sensor_sample_t, accel_x_mg),
+		offsetof(record_sensor_sample_t, accel_y_mg),
+		offsetof(record_sensor_sample_t, accel_z_mg),
+		offsetof(record_sensor_sample_t, battery_v),
+		offsetof(record_sensor_sample_t, status),
+	};
+	if (schema == NULL || schema->field_count != sizeof(C_OFFSETS) / sizeof(C_OFFSETS[0])) {
+		fprintf(stderr, "Schema mismatch\n");
+		return 1;
+	}
+
+	static const char *METHODS[] = { "ascii counter", "snprintf", "descriptors", "generated" };
+	uint8_t buffer[BUFFER_LENGTH];
+	memcpy(buffer, "This is message 000.", 20);
+	printf("%-14s %10s %8s %8s\n", "", "ns/record", "bytes", "errors");
+	for (uint8_t m = 0; m < sizeof(METHODS) / sizeof(METHODS[0]); m++) {
+		uint16_t length = 0;
+		uint32_t check = 0;
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (uint32_t i = 0; i < count; i++) {
+			const record_sensor_sample_t *input = &inputs[i % INPUTS];
+			switch (m) {
+			case 0:
+				length = encode_ascii_counter((uint8_t)i, (char *)buffer);
+				break;
+			case 1:
+				length = encode_text(input, (char *)buffer);
+				break;
+			case 2:
+				length = encode_generic(schema, C_OFFSETS, input, buffer);
+				break;
+			default:
+				length = record_sensor_sample_encode(input, buffer);
+				break;
+			}
+			check += buffer[i % length];
+		}
+		double s = elapsed_s(&start);
+		sink = check;
+
+		// Round trip of the binary encodings.
+		uint64_t errors = 0;
+		if (m >= 2) {
+			for (uint32_t i = 0; i < INPUTS; i++) {
+				record_sensor_sample_t decoded;
+				if (m == 2) {
+					encode_generic(schema, C_OFFSETS, &inputs[i], buffer);
+				} else {
+					record_sensor_sample_encode(&inputs[i], buffer);
+				}
+				// Compared encoded, as the C record has padding.
+				uint8_t again[RECORD_SENSOR_SAMPLE_LENGTH];
+				if (!record_sensor_sample_decode(buffer, length, &decoded)) {
+					errors++;
+					continue;
+				}
+				record_sensor_sample_encode(&decoded, again);
+				if (memcmp(again, buffer, sizeof(again)) != 0 ||
+					decoded.battery_v != inputs[i].battery_v) {
+					errors++;
+				}
+			}
+		}
+		printf("%-14s %10.2f %8u %8llu\n", METHODS[m], s * 1e9 / count, length,
+			   (unsigned long long)errors);
+	}
+	char text[BUFFER_LENGTH];
+	record_sensor_sample_encode(&inputs[0], buffer);
+	if (record_format(buffer, RECORD_SENSOR_SAMPLE_LENGTH, text, sizeof(text)) > 0) {
+		printf("\n%s\n", text);
+	}
+	return 0;
+
+}
@@ -0,0 +1,37 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+
+#ifndef SIM_LWIP_IP_ADDR_H_
+#define SIM_LWIP_IP_ADDR_H_
+
+// IPv4 only, addresses in network byte order, as lwIP.
+
+#include "lwip/arch.h"
+
+typedef struct {
+	u32_t addr;
+} ip_addr_t;
+
+/**
+ * Returns 1 if text is a valid address, 0 otherwise.
+ */
+int ipaddr_aton(const char *text, ip_addr_t *address);
+
+#endif /* SIM_LWIP_IP_ADDR_H_ */
@@ -0,0 +1,77 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+
+#ifndef SIM_LWIP_PBUF_H_
+#define SIM_LWIP_PBUF_H_
+
+// pbuf subset, implemented by the simulator (see sim_lwip.c). Header
+// lengths are the ones of the ESP-IDF configuration.
+
+#include "lwip/arch.h"
+#include "lwip/err.h"
+
+#define PBUF_LINK_ENCAPSULATION_HLEN 0
+#define PBUF_LINK_HLEN 14
+#define PBUF_IP_HLEN 20
+#define PBUF_TRANSPORT_HLEN 8
+
+#define PBUF_FLAG_IS_CUSTOM 0x02
+
+typedef enum {
+	PBUF_TRANSPORT = PBUF_LINK_ENCAPSULATION_HLEN + PBUF_LINK_HLEN + PBUF_IP_HLEN +
+			         PBUF_TRANSPORT_HLEN,
+	PBUF_IP = PBUF_LINK_ENCAPSULATION_HLEN + PBUF_LINK_HLEN + PBUF_IP_HLEN,
+	PBUF_LINK = PBUF_LINK_ENCAPSULATION_HLEN + PBUF_LINK_HLEN,
+	PBUF_RAW_TX = PBUF_LINK_ENCAPSULATION_HLEN,
+	PBUF_RAW = 0
+} pbuf_layer;
+
+typedef enum {
+	PBUF_RAM,
+	PBUF_ROM,
+	PBUF_REF,
+	PBUF_POOL
+} pbuf_type;
+
+struct pbuf {
+	struct pbuf *next;
+	void *payload;
+	u16_t tot_len;
+	u16_t len;
+	u8_t type_internal;
+	u8_t flags;
+	u16_t ref;
+};
+
+typedef void (*pbuf_free_custom_fn)(struct pbuf *p);
+
+struct pbuf_custom {
+	struct pbuf pbuf;
+	pbuf_free_custom_fn custom_free_function;
+};
+
+struct pbuf *pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type);
+struct pbuf *pbuf_alloced_custom(pbuf_layer layer, u16_t length, pbuf_type type,
+		                         struct pbuf_custom *p, void *payload_mem,
+								 u16_t payload_mem_len);
+u8_t pbuf_free(struct pbuf *p);
+u16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, u16_t len, u16_t offset);
+
+#endif /* SIM_LWIP_PBUF_H_ */
@@ -0,0 +1,63 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef SIM_LWIP_SOCKETS_H_
+#define SIM_LWIP_SOCKETS_H_
+
+// Socket API subset, implemented by the simulator (see sim_net.c). Types
+// and constants are the ones of the host.
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+// As lwipopts.h does on the target.
+#include "sdkconfig.h"
+
+int sim_socket(int domain, int type, int protocol);
+int sim_connect(int sock, const struct sockaddr *address, socklen_t address_length);
+ssize_t sim_send(int sock, const void *data, size_t length, int flags);
+ssize_t sim_sendto(int sock, const void *data, size_t length, int flags,
+		           const struct sockaddr *address, socklen_t address_length);
+ssize_t sim_recv(int sock, void *buffer, size_t length, int flags);
+ssize_t sim_recvfrom(int sock, void *buffer, size_t length, int flags,
+		             struct sockaddr *address, socklen_t *address_length);
+int sim_setsockopt(int sock, int level, int name, const void *value, socklen_t length);
+int sim_fcntl(int sock, int command, ...);
+int sim_select(int count, fd_set *read_set, fd_set *write_set, fd_set *except_set,
+		       struct timeval *timeout);
+int sim_close(int sock);
+int sim_inet_aton(const char *text, void *address);
+
+#define socket sim_socket
+#define connect sim_connect
+#define send sim_send
+#define sendto sim_sendto
+#define recv sim_recv
+#define recvfrom sim_recvfrom
+#define setsockopt sim_setsockopt
+#define fcntl sim_fcntl
+#define select sim_select
+#define close sim_close
+#define inet_aton sim_inet_aton
+
+#endif /* SIM_LWIP_SOCKETS_H_ */
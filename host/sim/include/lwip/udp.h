@@ -0,0 +1,52 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+
+#ifndef SIM_LWIP_UDP_H_
+#define SIM_LWIP_UDP_H_
+
+// Raw UDP API subset, implemented by the simulator over its sockets (see
+// sim_lwip.c). Must be called from the tcpip thread, as with lwIP.
+
+#include "lwip/arch.h"
+#include "lwip/err.h"
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+
+struct udp_pcb;
+
+typedef void (*udp_recv_fn)(void *arg, struct udp_pcb *pcb, struct pbuf *p,
+		                    const ip_addr_t *addr, u16_t port);
+
+struct udp_pcb {
+	u8_t tos;
+	int sock;                  // Simulator socket.
+	ip_addr_t remote_ip;
+	u16_t remote_port;
+	udp_recv_fn recv;
+	void *recv_arg;
+};
+
+struct udp_pcb *udp_new(void);
+void udp_remove(struct udp_pcb *pcb);
+err_t udp_connect(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port);
+err_t udp_send(struct udp_pcb *pcb, struct pbuf *p);
+void udp_recv(struct udp_pcb *pcb, udp_recv_fn recv, void *recv_arg);
+
+#endif /* SIM_LWIP_UDP_H_ */
@@ -0,0 +1,86 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef SIM_SDKCONFIG_H_
+#define SIM_SDKCONFIG_H_
+
+// Configuration used by the simulator. Keep in sync with the UdpSender
+// section of sdkconfig. Reactor mode is selected at build time, with
+// -DCONFIG_UDPSENDER_REACTOR=1.
+
+#define CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ 160
+
+#define CONFIG_UDPSENDER_WIFI_SSID "myssid"
+#define CONFIG_UDPSENDER_WIFI_PASSWORD "mypassword"
+#define CONFIG_UDPSENDER_RETRY_PERIOD_MS 10000
+#define CONFIG_UDPSENDER_IPV4_ADDR "192.168.1.10"
+#define CONFIG_UDPSENDER_PORT 44444
+#define CONFIG_UDPSENDER_WIFI_SSID_2 ""
+#define CONFIG_UDPSENDER_WIFI_PASSWORD_2 ""
+#define CONFIG_UDPSENDER_WIFI_SSID_3 ""
+#define CONFIG_UDPSENDER_WIFI_PASSWORD_3 ""
+#define CONFIG_UDPSENDER_ROAM_RSSI_PERIOD_MS 1000
+#define CONFIG_UDPSENDER_ROAM_THRESHOLD_DBM -70
+#define CONFIG_UDPSENDER_ROAM_HYSTERESIS_DB 8
+#define CONFIG_UDPSENDER_ROAM_SCAN_INTERVAL_MS 10000
+#define CONFIG_UDPSENDER_ROAM_FAILURE_PENALTY_DB 10
+#define CONFIG_UDPSENDER_PRODUCER_MAX_SOURCES 4
+#define CONFIG_UDPSENDER_PRODUCER_RING_SLOTS 8
+// Records longer than a datagram, sent as fragments, are pushed with a
+// larger maximum record length, given at build time.
+#ifndef CONFIG_UDPSENDER_PRODUCER_MAX_RECORD
+#define CONFIG_UDPSENDER_PRODUCER_MAX_RECORD 64
+#endif
+#define CONFIG_UDPSENDER_SEND_RETRY_DEPTH 4
+#define CONFIG_UDPSENDER_SEND_RETRY_MAX_DATAGRAM 512
+#define CONFIG_UDPSENDER_SEND_BUFFER_SIZE 8192
+#define CONFIG_UDPSENDER_TRANSPORT_UDP 1
+// Built for -Z. The simulator selects UDP at start.
+#define CONFIG_UDPSENDER_TRANSPORT_RAW 1
+#define CONFIG_UDPSENDER_RAW_SLOTS 8
+#define CONFIG_UDPSENDER_RAW_SLOT_SIZE 1472
+#define CONFIG_UDPSENDER_TC_URGENT_DSCP 48
+#define CONFIG_UDPSENDER_TC_NORMAL_DSCP 0
+#define CONFIG_UDPSENDER_TC_BULK_DSCP 8
+#define CONFIG_UDPSENDER_TC_NORMAL_WEIGHT 4
+#define CONFIG_UDPSENDER_TC_BULK_WEIGHT 1
+#define CONFIG_UDPSENDER_TIME_SYNC_PERIOD_MS 10000
+#define CONFIG_UDPSENDER_TIME_SYNC_WAIT_MS 50
+// Off in sdkconfig. The simulator records the trace for -T, without
+// dumping it on errors.
+#define CONFIG_UDPSENDER_TRACE 1
+#define CONFIG_UDPSENDER_TRACE_RECORDS 512
+#define CONFIG_UDPSENDER_RELIABLE_WINDOW 16
+#define CONFIG_UDPSENDER_RELIABLE_MAX_PAYLOAD 256
+#define CONFIG_UDPSENDER_RELIABLE_MAX_STREAMS 2
+#define CONFIG_UDPSENDER_RELIABLE_INITIAL_RTO_MS 300
+#define CONFIG_UDPSENDER_RELIABLE_MAX_RETRIES 8
+#define CONFIG_UDPSENDER_FEC_XOR 1
+#define CONFIG_UDPSENDER_FEC_K 8
+#define CONFIG_UDPSENDER_FEC_MAX_LENGTH 256
+#define CONFIG_UDPSENDER_FEC_STREAMS 2
+#define CONFIG_UDPSENDER_FEC_FLUSH_MS 100
+#define CONFIG_UDPSENDER_SEQ_BLOCK 1024
+#define CONFIG_UDPSENDER_REACTOR_STACK_SIZE 4608
+#define CONFIG_UDPSENDER_SUPERVISOR_STACK_SIZE 4096
+#define CONFIG_UDPSENDER_CONNECT_WIFI_STACK_SIZE 4608
+#define CONFIG_UDPSENDER_SEND_DATAGRAM_STACK_SIZE 4608
+#define CONFIG_UDPSENDER_PIPELINE_STACK_SIZE 5120
+
+#endif /* SIM_SDKCONFIG_H_ */
@@ -0,0 +1,353 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef SIM_SIM_H_
+#define SIM_SIM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "latency_stats.h"
+
+// Deterministic virtual-time simulator.
+//
+// Tasks run as coroutines on a single host thread. A task runs until it
+// blocks (queue receive, delay, select...), and the scheduler then resumes
+// the next ready task, in FIFO order. When no task is ready, the virtual
+// clock jumps to the next event: timer expiry, receive timeout, Wi-Fi or
+// network event. Processing takes no virtual time. Given the same seed and
+// the same options, a run always produces the same results.
+
+// Scheduled event.
+typedef void (*sim_event_fn_t)(void *arg, uint64_t tag);
+
+// Tasks blocked on an object are linked from it.
+typedef struct sim_task sim_task_t;
+typedef struct {
+	sim_task_t *first;
+} sim_wait_list_t;
+
+/**
+ * Returns the virtual time, in microseconds.
+ */
+uint64_t sim_now_us(void);
+
+/**
+ * Returns true if called from a task, false if called from an event or
+ * before the start of the simulation.
+ */
+bool sim_in_task(void);
+
+/**
+ * Calls fn(arg, tag) at virtual time time_us. Events with the same time are
+ * processed in scheduling order.
+ */
+void sim_schedule(uint64_t time_us, sim_event_fn_t fn, void *arg, uint64_t tag);
+
+/**
+ * Blocks the current task until the wait list is notified, or until
+ * deadline_us (UINT64_MAX: no deadline). wait_list may be NULL. Returns
+ * false on timeout. Must be called from a task.
+ */
+bool sim_block(sim_wait_list_t *wait_list, uint64_t deadline_us);
+
+/**
+ * Makes ready all the tasks blocked on the wait list.
+ */
+void sim_notify(sim_wait_list_t *wait_list);
+
+/**
+ * Runs the simulation until the virtual clock reaches end_us, or until
+ * nothing can happen anymore.
+ */
+void sim_run(uint64_t end_us);
+
+/**
+ * Seeded pseudo-random generator (xorshift64*).
+ */
+void sim_random_seed(uint64_t seed);
+uint64_t sim_random(void);
+
+/**
+ * Returns a value uniformly distributed in [0, 1).
+ */
+double sim_random_unit(void);
+
+/**
+ * Returns true with probability p.
+ */
+bool sim_random_hit(double p);
+
+/**
+ * Returns a value uniformly distributed in [min, max].
+ */
+uint64_t sim_random_range(uint64_t min, uint64_t max);
+
+// Kernel settings, set before sim_run().
+typedef struct {
+	int log_level;            // esp_log_level_t: logs above it are discarded.
+	double queue_full_p;      // Probability of an injected queue full error.
+	double clock_drift_ppm;   // Drift of the device clock (esp_timer).
+	uint32_t stack_size;      // Of tasks created afterwards, in bytes, 0: 128 KB.
+	bool realtime;            // The virtual clock does not run ahead of the wall clock.
+} sim_kernel_config_t;
+
+extern sim_kernel_config_t sim_kernel_config;
+
+typedef struct {
+	uint64_t switches;        // Task resumptions.
+	uint64_t events;          // Events processed.
+	uint64_t timer_fires;     // Timer expirations.
+	uint64_t queue_sends;     // Items queued.
+	uint64_t queue_full;      // Send operations failed on a full queue.
+	uint64_t injected_full;   // Send operations failed by fault injection.
+	uint64_t max_lag_us;      // Real time only: highest delay behind the wall clock.
+	uint32_t timers;          // Timers created.
+} sim_kernel_stats_t;
+
+void sim_kernel_get_stats(sim_kernel_stats_t *stats);
+
+typedef struct {
+	const char *owner;        // Registered name, or name of the task that created the queue.
+	uint32_t length;
+	uint32_t item_size;       // Bytes.
+	uint32_t high_water;      // Highest number of waiting items.
+	uint64_t sends;
+	uint64_t full;
+	uint64_t injected_full;
+	latency_stats_t wait;     // From send to receive.
+} sim_queue_info_t;
+
+/**
+ * Provides information about the index-th queue created. Returns false if
+ * there is no such queue.
+ */
+bool sim_queue_info(uint32_t index, sim_queue_info_t *info);
+
+typedef struct {
+	const char *name;
+	uint32_t instance;
+	uint64_t switches;
+	uint32_t stack_used;      // Bytes.
+	uint32_t stack_depth;     // Given to xTaskCreate(): bytes on ESP-IDF.
+} sim_task_info_t;
+
+bool sim_task_info(uint32_t index, sim_task_info_t *info);
+
+/**
+ * Called for every item successfully queued, including from timer
+ * handlers, so that the simulation can observe messages.
+ */
+typedef void (*sim_queue_hook_t)(const void *queue, const void *item);
+
+extern sim_queue_hook_t sim_queue_send_hook;
+
+// Instances. Several copies of the application can run in the same
+// simulation (see host/fleet). Every task, timer and event belongs to the
+// instance that was current when it was created, or scheduled. Before
+// running code of another instance, the kernel calls the switch hook, which
+// is expected to swap the state of the application. Instance 0 is the
+// default one.
+typedef void (*sim_instance_hook_t)(uint32_t from, uint32_t to);
+
+extern sim_instance_hook_t sim_instance_switch_hook;
+
+/**
+ * Makes an instance current, calling the switch hook if it changes.
+ */
+void sim_set_instance(uint32_t instance);
+
+uint32_t sim_instance(void);
+
+// Wi-Fi model (sim_wifi.c). Several access points of the first network
+// can be heard, each with its own RSSI, which can vary linearly over time,
+// with random fluctuations. An access point is not heard below the
+// sensitivity. After esp_wifi_connect(), association with the access point
+// given by the configuration (or the strongest one) takes a random time
+// and fails with a given probability. Once associated, the IP address is
+// obtained after a random time. The link is then lost after an
+// exponentially distributed time, or when the RSSI falls below the
+// sensitivity. A scan takes a fixed time.
+#define SIM_WIFI_MAX_APS 4
+
+typedef struct {
+	double connect_fail_p;
+	uint32_t connect_min_ms;
+	uint32_t connect_max_ms;
+	uint32_t dhcp_min_ms;
+	uint32_t dhcp_max_ms;
+	uint32_t link_mtbf_s;     // Mean time between link losses, 0: never.
+	uint8_t ap_count;         // Access point i starts at -50 - 10 x i dBm.
+	uint32_t scan_ms;
+	double rssi_noise_db;     // Amplitude of RSSI fluctuations.
+} sim_wifi_config_t;
+
+extern sim_wifi_config_t sim_wifi_config;
+
+typedef struct {
+	uint32_t connects;        // Calls to esp_wifi_connect().
+	uint32_t failures;        // Failed associations.
+	uint32_t leases;          // IP addresses obtained.
+	uint32_t drops;           // Link losses.
+	uint32_t disconnects;     // Calls to esp_wifi_disconnect() while up.
+	uint32_t scans;
+	uint32_t associations[SIM_WIFI_MAX_APS];  // Successful, per access point.
+	uint64_t up_us;           // Total time with an IP address.
+	latency_stats_t outage;   // From link loss or disconnection to new IP address.
+} sim_wifi_stats_t;
+
+void sim_wifi_init(void);
+
+/**
+ * Loses the link, if it is up.
+ */
+void sim_wifi_drop(void);
+
+/**
+ * Makes all the access points available or not. When they become
+ * unavailable, the link is lost and associations fail.
+ */
+void sim_wifi_set_ap(bool available);
+
+/**
+ * Moves the RSSI of an access point linearly to rssi_dbm, in ramp_s
+ * seconds.
+ */
+void sim_wifi_set_rssi(uint8_t ap, double rssi_dbm, double ramp_s);
+
+/**
+ * Returns true if an IP address has been obtained and the link is up.
+ */
+bool sim_wifi_is_up(void);
+
+void sim_wifi_get_stats(sim_wifi_stats_t *stats);
+
+// Network and remote host model (sim_net.c). Datagrams are lost with a
+// given probability in each direction, and delivered after a random delay.
+// The remote host answers time requests and acknowledges reliable data
+// frames, its clock is ahead of the virtual clock by a fixed offset. It
+// tracks streams from their first sequence number received, and again
+// when the boot epoch of the sender changes.
+// When a remote port is given, the remote host is a real one instead: every
+// socket is backed by a host UDP socket, datagrams are sent to the remote
+// host as soon as they have passed the Wi-Fi model, and datagrams received
+// from it are delivered without delay. Real time pacing should then be set
+// (see sim_kernel_config_t).
+typedef struct {
+	double loss_p;
+	uint32_t delay_min_us;
+	uint32_t delay_max_us;
+	double send_enomem_p;     // Probability of an injected ENOMEM on send.
+	uint32_t send_cost_us;    // Time taken by a send call, in the calling task.
+	uint32_t remote_address;  // Real remote host, in host byte order.
+	uint16_t remote_port;     // Real remote host, 0: modelled remote host.
+} sim_net_config_t;
+
+extern sim_net_config_t sim_net_config;
+
+// Streams tracked by the remote host.
+#define SIM_NET_MAX_STREAMS 8
+
+typedef struct {
+	uint64_t received;
+	uint64_t duplicates;
+	uint64_t lost;            // Sequence numbers skipped and never received.
+	uint64_t recovered;       // Data frames rebuilt from parity frames, with FEC.
+	uint32_t restarts;        // Changes of boot epoch.
+	latency_stats_t latency;  // One-way, for time synced frames.
+} sim_net_stream_stats_t;
+
+// WMM access categories.
+typedef enum {
+	SIM_NET_AC_BK,
+	SIM_NET_AC_BE,
+	SIM_NET_AC_VI,
+	SIM_NET_AC_VO,
+	SIM_NET_AC_COUNT
+} sim_net_ac_t;
+
+typedef struct {
+	uint64_t sends;           // Send calls.
+	uint64_t injected_enomem;
+	uint64_t link_down;       // Datagrams sent while the link was down.
+	uint64_t lost;            // Datagrams lost on the way, both directions.
+	uint64_t delivered;       // Datagrams received by the remote host, or sent to the real one.
+	uint64_t remote_errors;   // Datagrams the host failed to send to the real remote host.
+	uint64_t acks;            // ACK frames sent by the remote host.
+	uint64_t time_responses;  // Time responses sent by the remote host.
+	uint64_t received;        // Datagrams received by the device.
+	uint64_t fragments;       // Fragments received by the remote host.
+	uint64_t reassembled;     // Records reassembled from them.
+	uint64_t access_categories[SIM_NET_AC_COUNT];  // Datagrams sent, by category.
+	sim_net_stream_stats_t streams[SIM_NET_MAX_STREAMS];
+} sim_net_stats_t;
+
+void sim_net_init(void);
+
+void sim_net_get_stats(sim_net_stats_t *stats);
+
+/**
+ * Returns the remote host time corresponding to the current virtual time.
+ */
+uint64_t sim_net_remote_now_us(void);
+
+typedef void (*sim_net_receive_hook_t)(const uint8_t *data, uint16_t length, void *arg);
+
+/**
+ * Datagrams received by the socket are given to hook, by the event
+ * delivering them, instead of being queued. Used by the raw lwIP API model
+ * (sim_lwip.c).
+ */
+void sim_net_set_receive_hook(int sock, sim_net_receive_hook_t hook, void *arg);
+
+/**
+ * Real remote host: delivers the datagrams it has sent to the socket.
+ * Otherwise, does nothing.
+ */
+void sim_net_poll(int sock);
+
+// Raw lwIP API model (sim_lwip.c). The tcpip thread is modelled by events
+// run one after the other: every callback takes the send cost of the
+// network model (sim_net_config_t), and the mailbox holds a limited number
+// of callbacks. Calls with tcpip_api_call() are run at once.
+typedef struct {
+	uint64_t callbacks;       // Callbacks run.
+	uint64_t mailbox_full;    // Callbacks rejected.
+	uint32_t mailbox_high_water;
+} sim_lwip_stats_t;
+
+void sim_lwip_get_stats(sim_lwip_stats_t *stats);
+
+// NVS model (sim_nvs.c). 32-bit values are kept in RAM. A commit blocks
+// the calling task for a fixed time.
+typedef struct {
+	uint32_t commit_us;
+	uint32_t write_limit;  // Writes accepted before they fail, 0: no limit.
+} sim_nvs_config_t;
+
+extern sim_nvs_config_t sim_nvs_config;
+
+typedef struct {
+	uint32_t writes;          // Values written.
+	uint32_t commits;
+} sim_nvs_stats_t;
+
+void sim_nvs_get_stats(sim_nvs_stats_t *stats);
+
+#endif /* SIM_SIM_H_ */
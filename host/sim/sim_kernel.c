@@ -0,0 +1,960 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "xtensa/hal.h"
+
+#include "sim.h"
+
+// Host stacks are much larger than the ESP32 ones: printf() alone needs
+// several kilobytes.
+#define DEFAULT_STACK_SIZE (128 * 1024)
+#define STACK_PAINT 0xa5
+
+#define NO_DEADLINE UINT64_MAX
+
+typedef enum {
+	TASK_READY,
+	TASK_RUNNING,
+	TASK_BLOCKED,
+} task_state_t;
+
+struct sim_task {
+	const char *name;
+	TaskFunction_t function;
+	void *parameters;
+	ucontext_t context;
+	uint8_t *stack;
+	uint32_t stack_size;
+	uint32_t stack_depth;        // Requested.
+	uint32_t instance;
+	task_state_t state;
+	bool woken;                  // Result of the last sim_block().
+	uint64_t block_count;        // Identifies a sim_block() call.
+	sim_wait_list_t *wait_list;
+	sim_task_t *next_waiting;
+	sim_task_t *next_ready;
+	uint64_t switches;
+};
+
+struct sim_queue {
+	const char *owner;
+	uint8_t *items;
+	uint64_t *sent_us;           // Time each item was queued.
+	uint32_t length;
+	uint32_t item_size;
+	uint32_t count;
+	uint32_t first;
+	struct sim_queue *set;       // Queue set the queue belongs to, if any.
+	sim_wait_list_t receivers;
+	sim_wait_list_t senders;
+	sim_queue_info_t info;
+};
+
+struct sim_semaphore {
+	bool taken;
+	sim_wait_list_t waiters;
+};
+
+struct sim_event_group {
+	EventBits_t bits;
+	sim_wait_list_t waiters;
+};
+
+struct sim_timer {
+	const char *name;
+	TickType_t period;
+	bool auto_reload;
+	void *id;
+	TimerCallbackFunction_t callback;
+	bool active;
+	uint64_t generation;         // Invalidates pending expirations.
+};
+
+typedef struct {
+	uint64_t time_us;
+	uint64_t order;
+	sim_event_fn_t fn;
+	void *arg;
+	uint64_t tag;
+	uint32_t instance;
+} event_t;
+
+sim_kernel_config_t sim_kernel_config = {
+	.log_level = ESP_LOG_ERROR,
+	.queue_full_p = 0.0,
+	.clock_drift_ppm = 0.0,
+	.stack_size = 0,
+	.realtime = false,
+};
+
+sim_queue_hook_t sim_queue_send_hook = NULL;
+
+sim_instance_hook_t sim_instance_switch_hook = NULL;
+
+static sim_kernel_stats_t stats;
+
+static uint64_t now_us = 0;
+
+static ucontext_t scheduler_context;
+static sim_task_t *current = NULL;
+static sim_task_t *ready_first = NULL;
+static sim_task_t *ready_last = NULL;
+
+// Tasks and queues are never deleted: arrays of pointers, grown as needed.
+static sim_task_t **tasks = NULL;
+static uint32_t task_count = 0;
+static uint32_t task_capacity = 0;
+
+static struct sim_queue **queues = NULL;
+static uint32_t queue_count = 0;
+static uint32_t queue_capacity = 0;
+
+// Instance whose code is running, or about to run.
+static uint32_t instance = 0;
+
+// Real-time pacing: monotonic time corresponding to the virtual time 0.
+static bool wall_started = false;
+static uint64_t wall_origin_ns = 0;
+
+// Binary min-heap of events, ordered by time then by scheduling order.
+static event_t *events = NULL;
+static uint32_t event_count = 0;
+static uint32_t event_capacity = 0;
+static uint64_t event_order = 0;
+
+static uint64_t random_state = 0x9e3779b97f4a7c15ULL;
+
+static void fatal(const char *message) {
+
+	fprintf(stderr, "sim: %s\n", message);
+	exit(2);
+
+}
+
+/**
+ * Adds a pointer to an array of pointers, grown as needed.
+ */
+static void append(void ***array, uint32_t *count, uint32_t *capacity, void *pointer) {
+
+	if (*count == *capacity) {
+		*capacity = *capacity == 0 ? 16 : *capacity * 2;
+		*array = realloc(*array, *capacity * sizeof(void *));
+		if (*array == NULL) {
+			fatal("out of memory");
+		}
+	}
+	(*array)[(*count)++] = pointer;
+
+}
+
+// --- Instances --------------------------------------------------------------
+
+void sim_set_instance(uint32_t next) {
+
+	if (next != instance && sim_instance_switch_hook != NULL) {
+		sim_instance_switch_hook(instance, next);
+	}
+	instance = next;
+
+}
+
+uint32_t sim_instance(void) {
+	return instance;
+}
+
+// --- Events -----------------------------------------------------------------
+
+static bool event_before(const event_t *a, const event_t *b) {
+
+	if (a->time_us != b->time_us) {
+		return a->time_us < b->time_us;
+	}
+	return a->order < b->order;
+
+}
+
+void sim_schedule(uint64_t time_us, sim_event_fn_t fn, void *arg, uint64_t tag) {
+
+	if (time_us < now_us) {
+		time_us = now_us;
+	}
+	if (event_count == event_capacity) {
+		event_capacity = event_capacity == 0 ? 256 : event_capacity * 2;
+		events = realloc(events, event_capacity * sizeof(event_t));
+		if (events == NULL) {
+			fatal("out of memory");
+		}
+	}
+	uint32_t i = event_count++;
+	event_t event = { time_us, event_order++, fn, arg, tag, instance };
+	while (i > 0) {
+		uint32_t parent = (i - 1) / 2;
+		if (!event_before(&event, &events[parent])) {
+			break;
+		}
+		events[i] = events[parent];
+		i = parent;
+	}
+	events[i] = event;
+
+}
+
+static event_t pop_event(void) {
+
+	event_t top = events[0];
+	event_t last = events[--event_count];
+	uint32_t i = 0;
+	while (true) {
+		uint32_t child = 2 * i + 1;
+		if (child >= event_count) {
+			break;
+		}
+		if (child + 1 < event_count && event_before(&events[child + 1], &events[child])) {
+			child++;
+		}
+		if (!event_before(&events[child], &last)) {
+			break;
+		}
+		events[i] = events[child];
+		i = child;
+	}
+	if (event_count > 0) {
+		events[i] = last;
+	}
+	return top;
+
+}
+
+// --- Scheduling -------------------------------------------------------------
+
+static void make_ready(sim_task_t *task, bool woken) {
+
+	task->state = TASK_READY;
+	task->woken = woken;
+	task->wait_list = NULL;
+	task->next_ready = NULL;
+	if (ready_last == NULL) {
+		ready_first = task;
+	} else {
+		ready_last->next_ready = task;
+	}
+	ready_last = task;
+
+}
+
+static void unlink_waiting(sim_task_t *task) {
+
+	if (task->wait_list == NULL) {
+		return;
+	}
+	sim_task_t **link = &task->wait_list->first;
+	while (*link != NULL) {
+		if (*link == task) {
+			*link = task->next_waiting;
+			break;
+		}
+		link = &(*link)->next_waiting;
+	}
+
+}
+
+static void block_timeout(void *arg, uint64_t tag) {
+
+	sim_task_t *task = (sim_task_t *)arg;
+	if (task->state != TASK_BLOCKED || task->block_count != tag) {
+		// Woken up before the deadline.
+		return;
+	}
+	unlink_waiting(task);
+	make_ready(task, false);
+
+}
+
+bool sim_block(sim_wait_list_t *wait_list, uint64_t deadline_us) {
+
+	if (current == NULL) {
+		fatal("blocking call outside of a task");
+	}
+	sim_task_t *task = current;
+	task->state = TASK_BLOCKED;
+	task->block_count++;
+	task->wait_list = wait_list;
+	if (wait_list != NULL) {
+		task->next_waiting = wait_list->first;
+		wait_list->first = task;
+	}
+	if (deadline_us != NO_DEADLINE) {
+		sim_schedule(deadline_us, block_timeout, task, task->block_count);
+	}
+	swapcontext(&task->context, &scheduler_context);
+	return task->woken;
+
+}
+
+void sim_notify(sim_wait_list_t *wait_list) {
+
+	sim_task_t *task = wait_list->first;
+	wait_list->first = NULL;
+	while (task != NULL) {
+		sim_task_t *next = task->next_waiting;
+		make_ready(task, true);
+		task = next;
+	}
+
+}
+
+static void task_entry(void) {
+
+	current->function(current->parameters);
+	fatal("task function returned");
+
+}
+
+static uint64_t wall_now_ns(void) {
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+
+}
+
+/**
+ * Real-time pacing: waits until the wall clock reaches the virtual time
+ * time_us. When the simulation is late, records the lag instead.
+ */
+static void wait_wall_clock(uint64_t time_us) {
+
+	if (!wall_started) {
+		wall_origin_ns = wall_now_ns() - now_us * 1000;
+		wall_started = true;
+	}
+	uint64_t target_ns = wall_origin_ns + time_us * 1000;
+	uint64_t wall_ns = wall_now_ns();
+	if (wall_ns >= target_ns) {
+		uint64_t lag_us = (wall_ns - target_ns) / 1000;
+		if (lag_us > stats.max_lag_us) {
+			stats.max_lag_us = lag_us;
+		}
+		return;
+	}
+	struct timespec target;
+	target.tv_sec = (time_t)(target_ns / 1000000000);
+	target.tv_nsec = (long)(target_ns % 1000000000);
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &target, NULL);
+
+}
+
+void sim_run(uint64_t end_us) {
+
+	while (true) {
+		// Events due now first: they may make tasks ready.
+		while (event_count > 0 && events[0].time_us <= now_us) {
+			event_t event = pop_event();
+			stats.events++;
+			sim_set_instance(event.instance);
+			event.fn(event.arg, event.tag);
+		}
+		if (ready_first != NULL) {
+			current = ready_first;
+			ready_first = current->next_ready;
+			if (ready_first == NULL) {
+				ready_last = NULL;
+			}
+			current->state = TASK_RUNNING;
+			current->switches++;
+			stats.switches++;
+			sim_set_instance(current->instance);
+			swapcontext(&scheduler_context, &current->context);
+			current = NULL;
+			continue;
+		}
+		// Nothing to do now, jump to the next event.
+		if (event_count == 0 || events[0].time_us > end_us) {
+			break;
+		}
+		if (sim_kernel_config.realtime) {
+			wait_wall_clock(events[0].time_us);
+		}
+		now_us = events[0].time_us;
+	}
+	// Nothing can happen before end_us, or nothing can happen at all: every
+	// task is blocked forever.
+	if (now_us < end_us) {
+		now_us = end_us;
+	}
+
+}
+
+uint64_t sim_now_us(void) {
+	return now_us;
+}
+
+bool sim_in_task(void) {
+	return current != NULL;
+}
+
+void sim_kernel_get_stats(sim_kernel_stats_t *kernel_stats) {
+	*kernel_stats = stats;
+}
+
+bool sim_queue_info(uint32_t index, sim_queue_info_t *info) {
+
+	if (index >= queue_count) {
+		return false;
+	}
+	*info = queues[index]->info;
+	return true;
+
+}
+
+/**
+ * The stack grows downwards: counts the bytes still painted at the bottom.
+ */
+static uint32_t stack_untouched(const sim_task_t *task) {
+
+	uint32_t untouched = 0;
+	while (untouched < task->stack_size && task->stack[untouched] == STACK_PAINT) {
+		untouched++;
+	}
+	return untouched;
+
+}
+
+bool sim_task_info(uint32_t index, sim_task_info_t *info) {
+
+	if (index >= task_count) {
+		return false;
+	}
+	sim_task_t *task = tasks[index];
+	info->name = task->name;
+	info->instance = task->instance;
+	info->switches = task->switches;
+	info->stack_used = task->stack_size - stack_untouched(task);
+	info->stack_depth = task->stack_depth;
+	return true;
+
+}
+
+// --- Randomness -------------------------------------------------------------
+
+void sim_random_seed(uint64_t seed) {
+	random_state = seed != 0 ? seed : 0x9e3779b97f4a7c15ULL;
+}
+
+uint64_t sim_random(void) {
+
+	random_state ^= random_state >> 12;
+	random_state ^= random_state << 25;
+	random_state ^= random_state >> 27;
+	return random_state * 0x2545f4914f6cdd1dULL;
+
+}
+
+double sim_random_unit(void) {
+	return (double)(sim_random() >> 11) / (double)(1ULL << 53);
+}
+
+bool sim_random_hit(double p) {
+	return p > 0.0 && sim_random_unit() < p;
+}
+
+uint64_t sim_random_range(uint64_t min, uint64_t max) {
+
+	if (max <= min) {
+		return min;
+	}
+	return min + sim_random() % (max - min + 1);
+
+}
+
+// --- Tasks ------------------------------------------------------------------
+
+static uint64_t ticks_to_deadline(TickType_t ticks) {
+
+	if (ticks == portMAX_DELAY) {
+		return NO_DEADLINE;
+	}
+	return now_us + (uint64_t)ticks * 1000;
+
+}
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth,
+		               void *parameters, UBaseType_t priority, TaskHandle_t *handle) {
+
+	(void)priority;
+	sim_task_t *task = calloc(1, sizeof(sim_task_t));
+	if (task == NULL) {
+		return pdFAIL;
+	}
+	task->name = name;
+	task->function = function;
+	task->parameters = parameters;
+	task->stack_depth = stack_depth;
+	task->instance = instance;
+	task->stack_size = sim_kernel_config.stack_size != 0 ? sim_kernel_config.stack_size
+			                                             : DEFAULT_STACK_SIZE;
+	task->stack = malloc(task->stack_size);
+	if (task->stack == NULL) {
+		free(task);
+		return pdFAIL;
+	}
+	memset(task->stack, STACK_PAINT, task->stack_size);
+	append((void ***)&tasks, &task_count, &task_capacity, task);
+	getcontext(&task->context);
+	task->context.uc_stack.ss_sp = task->stack;
+	task->context.uc_stack.ss_size = task->stack_size;
+	task->context.uc_link = NULL;
+	makecontext(&task->context, task_entry, 0);
+	make_ready(task, false);
+	if (handle != NULL) {
+		*handle = task;
+	}
+	return pdPASS;
+
+}
+
+void vTaskDelay(TickType_t ticks) {
+	sim_block(NULL, ticks_to_deadline(ticks));
+}
+
+TickType_t xTaskGetTickCount(void) {
+	return (TickType_t)(now_us / 1000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+	return current;
+}
+
+char *pcTaskGetTaskName(TaskHandle_t task) {
+
+	if (task == NULL) {
+		task = current;
+	}
+	return task != NULL ? (char *)task->name : "sim";
+
+}
+
+TaskHandle_t xTaskGetHandle(const char *name) {
+
+	for (uint32_t i = 0; i < task_count; i++) {
+		if (tasks[i]->instance == instance && strcmp(tasks[i]->name, name) == 0) {
+			return tasks[i];
+		}
+	}
+	return NULL;
+
+}
+
+/**
+ * Host stacks are much larger: the high-water mark is given against the
+ * requested depth, 0 if the host use exceeds it.
+ */
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+
+	if (task == NULL) {
+		task = current;
+	}
+	uint32_t used = task->stack_size - stack_untouched(task);
+	return used < task->stack_depth ? task->stack_depth - used : 0;
+
+}
+
+// --- Queues -----------------------------------------------------------------
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+
+	if (length == 0) {
+		return NULL;
+	}
+	struct sim_queue *queue = calloc(1, sizeof(struct sim_queue));
+	if (queue == NULL) {
+		return NULL;
+	}
+	queue->items = malloc((size_t)length * item_size);
+	queue->sent_us = malloc((size_t)length * sizeof(uint64_t));
+	if (queue->items == NULL || queue->sent_us == NULL) {
+		free(queue->items);
+		free(queue->sent_us);
+		free(queue);
+		return NULL;
+	}
+	append((void ***)&queues, &queue_count, &queue_capacity, queue);
+	queue->owner = current != NULL ? current->name : "main";
+	queue->length = length;
+	queue->item_size = item_size;
+	queue->info.owner = queue->owner;
+	queue->info.length = length;
+	queue->info.item_size = item_size;
+	latency_stats_reset(&queue->info.wait);
+	return queue;
+
+}
+
+/**
+ * Appends an item, without fault injection. The queue must not be full.
+ */
+static void queue_append(struct sim_queue *queue, const void *item) {
+
+	uint32_t last = (queue->first + queue->count) % queue->length;
+	memcpy(&queue->items[last * queue->item_size], item, queue->item_size);
+	queue->sent_us[last] = now_us;
+	queue->count++;
+	if (queue->count > queue->info.high_water) {
+		queue->info.high_water = queue->count;
+	}
+	queue->info.sends++;
+
+}
+
+static bool queue_push(struct sim_queue *queue, const void *item) {
+
+	if (sim_random_hit(sim_kernel_config.queue_full_p)) {
+		queue->info.injected_full++;
+		stats.injected_full++;
+		return false;
+	}
+	if (queue->count == queue->length) {
+		queue->info.full++;
+		stats.queue_full++;
+		return false;
+	}
+	queue_append(queue, item);
+	if (queue->set != NULL) {
+		// As with FreeRTOS, the set is sized for all the items of its
+		// members: it cannot be full.
+		queue_append(queue->set, &queue);
+		sim_notify(&queue->set->receivers);
+	}
+	stats.queue_sends++;
+	if (sim_queue_send_hook != NULL) {
+		sim_queue_send_hook(queue, item);
+	}
+	sim_notify(&queue->receivers);
+	return true;
+
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait) {
+
+	uint64_t deadline_us = ticks_to_deadline(ticks_to_wait);
+	while (true) {
+		if (queue_push(queue, item)) {
+			return pdTRUE;
+		}
+		if (ticks_to_wait == 0 || current == NULL || queue->count < queue->length) {
+			// Injected errors are not retried.
+			return errQUEUE_FULL;
+		}
+		if (!sim_block(&queue->senders, deadline_us)) {
+			return errQUEUE_FULL;
+		}
+	}
+
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait) {
+	return xQueueSend(queue, item, ticks_to_wait);
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item,
+		                     BaseType_t *higher_priority_task_woken) {
+
+	if (higher_priority_task_woken != NULL) {
+		*higher_priority_task_woken = pdFALSE;
+	}
+	return queue_push(queue, item) ? pdTRUE : errQUEUE_FULL;
+
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait) {
+
+	uint64_t deadline_us = ticks_to_deadline(ticks_to_wait);
+	while (queue->count == 0) {
+		if (ticks_to_wait == 0 || !sim_block(&queue->receivers, deadline_us)) {
+			return pdFALSE;
+		}
+	}
+	memcpy(buffer, &queue->items[queue->first * queue->item_size], queue->item_size);
+	latency_stats_add(&queue->info.wait, (uint32_t)(now_us - queue->sent_us[queue->first]));
+	queue->first = (queue->first + 1) % queue->length;
+	queue->count--;
+	sim_notify(&queue->senders);
+	return pdTRUE;
+
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait) {
+
+	uint64_t deadline_us = ticks_to_deadline(ticks_to_wait);
+	while (queue->count == 0) {
+		if (ticks_to_wait == 0 || !sim_block(&queue->receivers, deadline_us)) {
+			return pdFALSE;
+		}
+	}
+	memcpy(buffer, &queue->items[queue->first * queue->item_size], queue->item_size);
+	return pdTRUE;
+
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+	return queue->count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue) {
+	return queue->length - queue->count;
+}
+
+void vQueueAddToRegistry(QueueHandle_t queue, const char *name) {
+
+	queue->owner = name;
+	queue->info.owner = name;
+
+}
+
+QueueSetHandle_t xQueueCreateSet(UBaseType_t length) {
+	return xQueueCreate(length, sizeof(struct sim_queue *));
+}
+
+BaseType_t xQueueAddToSet(QueueSetMemberHandle_t member, QueueSetHandle_t set) {
+
+	if (member->set != NULL || member->count > 0) {
+		return pdFAIL;
+	}
+	member->set = set;
+	return pdPASS;
+
+}
+
+QueueSetMemberHandle_t xQueueSelectFromSet(QueueSetHandle_t set, TickType_t ticks_to_wait) {
+
+	struct sim_queue *member;
+	if (xQueueReceive(set, &member, ticks_to_wait) != pdTRUE) {
+		return NULL;
+	}
+	return member;
+
+}
+
+// --- Semaphores -------------------------------------------------------------
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+	return calloc(1, sizeof(struct sim_semaphore));
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait) {
+
+	uint64_t deadline_us = ticks_to_deadline(ticks_to_wait);
+	while (semaphore->taken) {
+		if (ticks_to_wait == 0 || !sim_block(&semaphore->waiters, deadline_us)) {
+			return pdFALSE;
+		}
+	}
+	semaphore->taken = true;
+	return pdTRUE;
+
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+
+	semaphore->taken = false;
+	sim_notify(&semaphore->waiters);
+	return pdTRUE;
+
+}
+
+// --- Event groups ---------------------------------------------------------
+
+EventGroupHandle_t xEventGroupCreate(void) {
+	return calloc(1, sizeof(struct sim_event_group));
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+
+	group->bits |= bits;
+	sim_notify(&group->waiters);
+	return group->bits;
+
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+
+	EventBits_t previous = group->bits;
+	group->bits &= ~bits;
+	return previous;
+
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+	return group->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+		                        BaseType_t clear_on_exit, BaseType_t wait_for_all,
+								TickType_t ticks_to_wait) {
+
+	uint64_t deadline_us = ticks_to_deadline(ticks_to_wait);
+	while (true) {
+		EventBits_t current = group->bits;
+		bool satisfied = wait_for_all ? (current & bits) == bits : (current & bits) != 0;
+		if (satisfied) {
+			if (clear_on_exit) {
+				group->bits &= ~bits;
+			}
+			return current;
+		}
+		if (ticks_to_wait == 0 || !sim_block(&group->waiters, deadline_us)) {
+			return group->bits;
+		}
+	}
+
+}
+
+// --- Timers -----------------------------------------------------------------
+
+static void timer_expired(void *arg, uint64_t tag) {
+
+	struct sim_timer *timer = (struct sim_timer *)arg;
+	if (!timer->active || timer->generation != tag) {
+		// Stopped or restarted since.
+		return;
+	}
+	if (timer->auto_reload) {
+		sim_schedule(now_us + (uint64_t)timer->period * 1000, timer_expired, timer,
+				     timer->generation);
+	} else {
+		timer->active = false;
+	}
+	stats.timer_fires++;
+	timer->callback(timer);
+
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t auto_reload,
+		                   void *timer_id, TimerCallbackFunction_t callback) {
+
+	if (period == 0) {
+		return NULL;
+	}
+	struct sim_timer *timer = calloc(1, sizeof(struct sim_timer));
+	if (timer == NULL) {
+		return NULL;
+	}
+	timer->name = name;
+	timer->period = period;
+	timer->auto_reload = auto_reload != pdFALSE;
+	timer->id = timer_id;
+	timer->callback = callback;
+	stats.timers++;
+	return timer;
+
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks_to_wait) {
+
+	(void)ticks_to_wait;
+	timer->active = true;
+	timer->generation++;
+	sim_schedule(now_us + (uint64_t)timer->period * 1000, timer_expired, timer,
+			     timer->generation);
+	return pdPASS;
+
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks_to_wait) {
+
+	(void)ticks_to_wait;
+	timer->active = false;
+	timer->generation++;
+	return pdPASS;
+
+}
+
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t ticks_to_wait) {
+	return xTimerStart(timer, ticks_to_wait);
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticks_to_wait) {
+
+	if (period == 0) {
+		return pdFAIL;
+	}
+	timer->period = period;
+	return xTimerStart(timer, ticks_to_wait);
+
+}
+
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer) {
+	return timer->active ? pdTRUE : pdFALSE;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer) {
+	return timer->id;
+}
+
+// --- ESP-IDF system services --------------------------------------------------
+
+int64_t esp_timer_get_time(void) {
+	return (int64_t)now_us + (int64_t)((double)now_us * sim_kernel_config.clock_drift_ppm * 1e-6);
+}
+
+unsigned xthal_get_ccount(void) {
+	return (unsigned)(now_us * CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ);
+}
+
+uint32_t esp_random(void) {
+	return (uint32_t)(sim_random() >> 32);
+}
+
+uint32_t esp_get_free_heap_size(void) {
+	return 200000;
+}
+
+void sim_log(esp_log_level_t level, const char *tag, const char *format, ...) {
+
+	static const char letters[] = "NEWIDV";
+	if ((int)level > sim_kernel_config.log_level) {
+		return;
+	}
+	printf("%c (%llu) %s: ", letters[level], (unsigned long long)(now_us / 1000), tag);
+	va_list args;
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	printf("\n");
+
+}
@@ -0,0 +1,320 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+#include "lwip/priv/tcpip_priv.h"
+#include "lwip/sockets.h"
+#include "lwip/tcpip.h"
+#include "lwip/udp.h"
+
+#include "sim.h"
+
+// Mailbox depth of the tcpip thread (CONFIG_LWIP_TCPIP_RECVMBOX_SIZE).
+#define MAILBOX_DEPTH 32
+
+#define MAX_PCBS 4
+
+#define MAX_DATAGRAM 1472
+
+// Real remote host: period at which datagrams are taken from it.
+#define REMOTE_POLL_US 1000
+
+struct tcpip_callback_msg {
+	tcpip_callback_fn function;
+	void *ctx;
+};
+
+static struct udp_pcb *pcbs[MAX_PCBS];
+
+// The tcpip thread is busy until then.
+static uint64_t busy_until_us = 0;
+
+// Callbacks posted and not run yet.
+static uint32_t mailbox_count = 0;
+
+static bool polling = false;
+
+static sim_lwip_stats_t stats;
+
+// --- pbufs ------------------------------------------------------------------
+
+struct pbuf *pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type) {
+
+	struct pbuf *p = malloc(sizeof(struct pbuf) + layer + length);
+	if (p == NULL) {
+		return NULL;
+	}
+	memset(p, 0, sizeof(struct pbuf));
+	p->payload = (uint8_t *)(p + 1) + layer;
+	p->tot_len = length;
+	p->len = length;
+	p->type_internal = (u8_t)type;
+	p->ref = 1;
+	return p;
+
+}
+
+struct pbuf *pbuf_alloced_custom(pbuf_layer layer, u16_t length, pbuf_type type,
+		                         struct pbuf_custom *p, void *payload_mem,
+								 u16_t payload_mem_len) {
+
+	if ((uint32_t)layer + length > payload_mem_len) {
+		return NULL;
+	}
+	p->pbuf.next = NULL;
+	p->pbuf.payload = payload_mem != NULL ? (uint8_t *)payload_mem + layer : NULL;
+	p->pbuf.tot_len = length;
+	p->pbuf.len = length;
+	p->pbuf.type_internal = (u8_t)type;
+	p->pbuf.flags = PBUF_FLAG_IS_CUSTOM;
+	p->pbuf.ref = 1;
+	return &p->pbuf;
+
+}
+
+u8_t pbuf_free(struct pbuf *p) {
+
+	u8_t count = 0;
+	while (p != NULL && --p->ref == 0) {
+		struct pbuf *next = p->next;
+		if ((p->flags & PBUF_FLAG_IS_CUSTOM) != 0) {
+			((struct pbuf_custom *)p)->custom_free_function(p);
+		} else {
+			free(p);
+		}
+		count++;
+		p = next;
+	}
+	return count;
+
+}
+
+u16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, u16_t len, u16_t offset) {
+
+	u16_t copied = 0;
+	for (; p != NULL && copied < len; p = p->next) {
+		if (offset >= p->len) {
+			offset -= p->len;
+			continue;
+		}
+		u16_t length = p->len - offset;
+		if (length > len - copied) {
+			length = len - copied;
+		}
+		memcpy((uint8_t *)dataptr + copied, (const uint8_t *)p->payload + offset, length);
+		copied += length;
+		offset = 0;
+	}
+	return copied;
+
+}
+
+// --- tcpip thread -----------------------------------------------------------
+
+static void run_callback(void *arg, uint64_t tag) {
+
+	struct tcpip_callback_msg *msg = (struct tcpip_callback_msg *)arg;
+	mailbox_count--;
+	stats.callbacks++;
+	msg->function(msg->ctx);
+
+}
+
+struct tcpip_callback_msg *tcpip_callbackmsg_new(tcpip_callback_fn function, void *ctx) {
+
+	struct tcpip_callback_msg *msg = malloc(sizeof(struct tcpip_callback_msg));
+	if (msg != NULL) {
+		msg->function = function;
+		msg->ctx = ctx;
+	}
+	return msg;
+
+}
+
+void tcpip_callbackmsg_delete(struct tcpip_callback_msg *msg) {
+	free(msg);
+}
+
+/**
+ * The callback is run when the tcpip thread has completed the previous
+ * ones, and the time it takes.
+ */
+err_t tcpip_callbackmsg_trycallback(struct tcpip_callback_msg *msg) {
+
+	if (mailbox_count == MAILBOX_DEPTH) {
+		stats.mailbox_full++;
+		return ERR_MEM;
+	}
+	mailbox_count++;
+	if (mailbox_count > stats.mailbox_high_water) {
+		stats.mailbox_high_water = mailbox_count;
+	}
+	uint64_t start_us = busy_until_us > sim_now_us() ? busy_until_us : sim_now_us();
+	busy_until_us = start_us + sim_net_config.send_cost_us;
+	sim_schedule(busy_until_us, run_callback, msg, 0);
+	return ERR_OK;
+
+}
+
+err_t tcpip_api_call(tcpip_api_call_fn fn, struct tcpip_api_call_data *call) {
+
+	call->err = fn(call);
+	return call->err;
+
+}
+
+void sim_lwip_get_stats(sim_lwip_stats_t *lwip_stats) {
+	*lwip_stats = stats;
+}
+
+// --- UDP --------------------------------------------------------------------
+
+int ipaddr_aton(const char *text, ip_addr_t *address) {
+
+	struct in_addr in;
+	if (inet_aton(text, &in) == 0) {
+		return 0;
+	}
+	address->addr = in.s_addr;
+	return 1;
+
+}
+
+/**
+ * Called by the event delivering the datagram, as lwIP calls the receive
+ * callback from the tcpip thread.
+ */
+static void deliver(const uint8_t *data, uint16_t length, void *arg) {
+
+	struct udp_pcb *pcb = (struct udp_pcb *)arg;
+	if (pcb->recv == NULL) {
+		return;
+	}
+	struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, length, PBUF_RAM);
+	if (p == NULL) {
+		return;
+	}
+	memcpy(p->payload, data, length);
+	pcb->recv(pcb->recv_arg, pcb, p, &pcb->remote_ip, pcb->remote_port);
+
+}
+
+static void poll_remote(void *arg, uint64_t tag) {
+
+	for (uint8_t i = 0; i < MAX_PCBS; i++) {
+		if (pcbs[i] != NULL) {
+			sim_net_poll(pcbs[i]->sock);
+		}
+	}
+	sim_schedule(sim_now_us() + REMOTE_POLL_US, poll_remote, NULL, 0);
+
+}
+
+struct udp_pcb *udp_new(void) {
+
+	for (uint8_t i = 0; i < MAX_PCBS; i++) {
+		if (pcbs[i] != NULL) {
+			continue;
+		}
+		struct udp_pcb *pcb = calloc(1, sizeof(struct udp_pcb));
+		if (pcb == NULL) {
+			return NULL;
+		}
+		pcb->sock = sim_socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+		if (pcb->sock < 0) {
+			free(pcb);
+			return NULL;
+		}
+		sim_net_set_receive_hook(pcb->sock, deliver, pcb);
+		pcbs[i] = pcb;
+		if (sim_net_config.remote_port != 0 && !polling) {
+			polling = true;
+			sim_schedule(sim_now_us() + REMOTE_POLL_US, poll_remote, NULL, 0);
+		}
+		return pcb;
+	}
+	return NULL;
+
+}
+
+void udp_remove(struct udp_pcb *pcb) {
+
+	for (uint8_t i = 0; i < MAX_PCBS; i++) {
+		if (pcbs[i] == pcb) {
+			pcbs[i] = NULL;
+		}
+	}
+	sim_close(pcb->sock);
+	free(pcb);
+
+}
+
+err_t udp_connect(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port) {
+
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = ipaddr->addr;
+	address.sin_port = htons(port);
+	if (sim_connect(pcb->sock, (const struct sockaddr *)&address, sizeof(address)) < 0) {
+		return ERR_VAL;
+	}
+	pcb->remote_ip = *ipaddr;
+	pcb->remote_port = port;
+	return ERR_OK;
+
+}
+
+/**
+ * Errors of the network model are mapped as lwIP would report them.
+ */
+err_t udp_send(struct udp_pcb *pcb, struct pbuf *p) {
+
+	uint8_t buffer[MAX_DATAGRAM];
+	if (p->tot_len > MAX_DATAGRAM) {
+		return ERR_VAL;
+	}
+	u16_t length = pbuf_copy_partial(p, buffer, p->tot_len, 0);
+	int tos = pcb->tos;
+	sim_setsockopt(pcb->sock, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+	if (sim_send(pcb->sock, buffer, length, 0) < 0) {
+		switch (errno) {
+		case ENOMEM: return ERR_MEM;
+		case EHOSTUNREACH: return ERR_RTE;
+		default: return ERR_VAL;
+		}
+	}
+	return ERR_OK;
+
+}
+
+void udp_recv(struct udp_pcb *pcb, udp_recv_fn recv, void *recv_arg) {
+
+	pcb->recv = recv;
+	pcb->recv_arg = recv_arg;
+
+}
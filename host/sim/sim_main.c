@@ -0,0 +1,696 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+// Runs the supervisor, connect_wifi, send_datagram and pipeline tasks on
+// a virtual clock, against a simulated Wi-Fi link and remote host.
+//
+// A load task pushes records through the producer API at a given rate,
+// with a given traffic class, or samples of a sine wave through an
+// aggregator (see aggregate.h). A second load task can push urgent
+// records, on their own stream.
+// Faults are injected at random (queue full, ENOMEM on send, association
+// failures, link losses, datagram losses), and can be scripted. A script
+// line is "<time_s> <command> [<value>...]", commands being:
+//   drop            loses the link
+//   ap_down         makes the access points unavailable
+//   ap_up           makes the access points available again
+//   rssi <ap> <dBm> [<ramp_s>]
+//                   moves the RSSI of an access point (0 to 3) linearly
+//   loss <p>        sets the datagram loss probability
+//   qfull <p>       sets the queue full probability
+//   enomem <p>      sets the send ENOMEM probability
+//   fail <p>        sets the association failure probability
+//   rate <r>        sets the load, in records per second
+//   urgent <r>      sets the urgent load, in records per second
+// Lines starting with # are ignored.
+//
+// Timer handlers and Wi-Fi event handlers run in the context of the
+// simulator: in the trace, they belong to the "sim" task.
+//
+// See README.md for the build command.
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "nvs_flash.h"
+
+#include "aggregate.h"
+#include "connect_wifi.h"
+#include "link_state.h"
+#include "latency_stats.h"
+#include "messages.h"
+#include "pipeline.h"
+#include "producer.h"
+#include "reactor.h"
+#include "reliable.h"
+#include "roaming.h"
+#include "send_datagram.h"
+#include "send_path.h"
+#include "seq_store.h"
+#include "supervisor.h"
+#include "time_sync.h"
+#include "trace.h"
+#include "transport.h"
+
+#include "sim.h"
+
+#define LOAD_STREAM_ID 1
+#define URGENT_STREAM_ID 2
+
+#define MAX_RECORD CONFIG_UDPSENDER_PRODUCER_MAX_RECORD
+
+#define MAX_ERRORS 64
+
+#define MAX_SCRIPT_LINES 256
+
+typedef enum {
+	CMD_DROP,
+	CMD_AP_DOWN,
+	CMD_AP_UP,
+	CMD_LOSS,
+	CMD_QFULL,
+	CMD_ENOMEM,
+	CMD_FAIL,
+	CMD_RATE,
+	CMD_URGENT,
+	CMD_RSSI,
+} command_t;
+
+typedef struct {
+	command_t command;
+	double value;
+	double value2;
+	double value3;
+} script_line_t;
+
+static const char *COMMANDS[] = {
+	"drop", "ap_down", "ap_up", "loss", "qfull", "enomem", "fail", "rate",
+	"urgent", "rssi",
+};
+
+static script_line_t script[MAX_SCRIPT_LINES];
+
+typedef struct {
+	const char *name;
+	uint8_t stream_id;
+	double rate;              // Records per second.
+	bool reliable;
+	traffic_class_t traffic_class;
+	producer_source_t *source;
+	bool aggregated;          // Samples go through the aggregator.
+	aggregate_config_t aggregate_config;
+	aggregate_t aggregate;
+	uint64_t offered;
+	uint64_t rejected;
+} load_t;
+
+static load_t load = {
+	.name = "load",
+	.stream_id = LOAD_STREAM_ID,
+	.rate = 100.0,
+	.reliable = false,
+	.traffic_class = TRAFFIC_CLASS_NORMAL,
+	.aggregate_config = {
+		.window_ms = 1000,
+		.panes = 1,
+	},
+};
+
+static load_t urgent_load = {
+	.name = "urgent load",
+	.stream_id = URGENT_STREAM_ID,
+	.rate = 0.0,
+	.reliable = false,
+	.traffic_class = TRAFFIC_CLASS_URGENT,
+};
+
+static uint32_t record_length = 32;
+
+static const char *CLASS_NAMES[TRAFFIC_CLASS_COUNT] = {
+	"urgent", "normal", "bulk",
+};
+
+static uint64_t errors[MAX_ERRORS];
+
+static void usage(const char *name) {
+
+	fprintf(stderr,
+			"Usage: %s [options]\n"
+			"  -S seed    random seed (default 1)\n"
+			"  -d s       virtual duration, in seconds (default 86400)\n"
+			"  -i s       report period, in virtual seconds (default: end only)\n"
+			"  -r rate    load, in records per second (default 100)\n"
+			"  -b bytes   record length (default 32)\n"
+			"  -R         reliable load\n"
+			"  -c class   traffic class of the load: 0 urgent, 1 normal, 2 bulk (default 1)\n"
+			"  -A ms      the load is made of samples, aggregated over windows of ms\n"
+			"  -W panes   panes of a sliding aggregation window (default 1: tumbling)\n"
+			"  -H value   samples whose magnitude is over value are also sent raw\n"
+			"  -u rate    urgent load, in records per second (default 0)\n"
+			"  -l p       datagram loss probability (default 0.01)\n"
+			"  -q p       queue full probability (default 0)\n"
+			"  -e p       send ENOMEM probability (default 0)\n"
+			"  -k us      time taken by a send call (default 0)\n"
+			"  -w us      time taken by an NVS commit (default 0)\n"
+			"  -N count   NVS writes accepted before they fail (default 0: no limit)\n"
+			"  -L         loopback transport: datagrams are discarded before the network\n"
+			"  -Z         raw lwIP transport: sends are run by the tcpip thread model\n"
+			"  -f p       association failure probability (default 0.1)\n"
+			"  -m s       mean time between link losses (default 3600, 0: never)\n"
+			"  -a count   access points, 1 to 4, at -50, -60, -70, -80 dBm (default 1)\n"
+			"  -D ppm     device clock drift (default 20)\n"
+			"  -s file    fault script\n"
+			"  -v level   log level, 0 (none) to 5 (verbose) (default 1)\n"
+			"  -T         print the trace at the end (see trace_convert)\n",
+			name);
+
+}
+
+/**
+ * Counts the internal errors reported to the supervisor.
+ */
+static void observe_queue(const void *queue, const void *item) {
+
+	if (queue != sv_input_queue) {
+		return;
+	}
+	const message_t *message = (const message_t *)item;
+	if (message->message == SV_INTERNAL_ERROR &&
+		message->sv_internal_error.error < MAX_ERRORS) {
+		errors[message->sv_internal_error.error]++;
+	}
+
+}
+
+static void script_event(void *arg, uint64_t tag) {
+
+	const script_line_t *line = (const script_line_t *)arg;
+	printf("%10.3f script: %s %g", sim_now_us() / 1e6, COMMANDS[line->command], line->value);
+	if (line->command == CMD_RSSI) {
+		printf(" %g %g", line->value2, line->value3);
+	}
+	printf("\n");
+	switch (line->command) {
+	case CMD_DROP:
+		sim_wifi_drop();
+		break;
+	case CMD_AP_DOWN:
+		sim_wifi_set_ap(false);
+		break;
+	case CMD_AP_UP:
+		sim_wifi_set_ap(true);
+		break;
+	case CMD_LOSS:
+		sim_net_config.loss_p = line->value;
+		break;
+	case CMD_QFULL:
+		sim_kernel_config.queue_full_p = line->value;
+		break;
+	case CMD_ENOMEM:
+		sim_net_config.send_enomem_p = line->value;
+		break;
+	case CMD_FAIL:
+		sim_wifi_config.connect_fail_p = line->value;
+		break;
+	case CMD_RATE:
+		load.rate = line->value;
+		break;
+	case CMD_URGENT:
+		urgent_load.rate = line->value;
+		break;
+	case CMD_RSSI:
+		sim_wifi_set_rssi((uint8_t)line->value, line->value2, line->value3);
+		break;
+	}
+
+}
+
+static bool load_script(const char *path) {
+
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		perror(path);
+		return false;
+	}
+	char text[128];
+	uint32_t count = 0;
+	uint32_t line_number = 0;
+	while (fgets(text, sizeof(text), file) != NULL) {
+		line_number++;
+		double time_s;
+		char command[16];
+		double value = 0.0;
+		double value2 = 0.0;
+		double value3 = 0.0;
+		if (text[0] == '#' || text[0] == '\n') {
+			continue;
+		}
+		if (sscanf(text, "%lf %15s %lf %lf %lf", &time_s, command, &value, &value2,
+				   &value3) < 2) {
+			fprintf(stderr, "%s:%u: syntax error\n", path, line_number);
+			fclose(file);
+			return false;
+		}
+		uint8_t i;
+		for (i = 0; i < sizeof(COMMANDS) / sizeof(COMMANDS[0]); i++) {
+			if (strcmp(command, COMMANDS[i]) == 0) {
+				break;
+			}
+		}
+		if (i == sizeof(COMMANDS) / sizeof(COMMANDS[0]) || count == MAX_SCRIPT_LINES) {
+			fprintf(stderr, "%s:%u: unknown command or script too long\n", path, line_number);
+			fclose(file);
+			return false;
+		}
+		script[count].command = (command_t)i;
+		script[count].value = value;
+		script[count].value2 = value2;
+		script[count].value3 = value3;
+		sim_schedule((uint64_t)(time_s * 1e6), script_event, &script[count], 0);
+		count++;
+	}
+	fclose(file);
+	return true;
+
+}
+
+/**
+ * Aggregator sink.
+ */
+static bool push_aggregate(void *target, const uint8_t *record, uint32_t length) {
+	return producer_push((producer_source_t *)target, record, length);
+}
+
+/**
+ * Sine wave with a period of 60 s and an amplitude of 1000, plus noise.
+ */
+static int32_t sample_value(void) {
+	return (int32_t)(1000.0 * sin(2.0 * M_PI * sim_now_us() / 60e6)) +
+		   (int32_t)sim_random_range(0, 100) - 50;
+}
+
+/**
+ * Pushes records at the rate of the load given as parameter, with a 1 ms
+ * granularity.
+ */
+static void load_task(void *parameters) {
+
+	load_t *self = (load_t *)parameters;
+	uint8_t record[MAX_RECORD];
+	uint64_t due_us = sim_now_us();
+	uint32_t counter = 0;
+
+	self->source = producer_register_source(self->stream_id, self->reliable,
+			                                self->traffic_class, PRODUCER_TASK);
+	if (self->source == NULL) {
+		ESP_LOGE("LOAD", "Error from producer_register_source");
+		while (true) {
+			vTaskDelay(portMAX_DELAY);
+		}
+	}
+	if (self->aggregated &&
+		!aggregate_init(&self->aggregate, &self->aggregate_config, push_aggregate,
+				        self->source)) {
+		ESP_LOGE("LOAD", "Invalid aggregation configuration");
+		self->aggregated = false;
+	}
+	memset(record, 0, sizeof(record));
+	while (true) {
+		if (self->rate <= 0.0) {
+			vTaskDelay(pdMS_TO_TICKS(1000));
+			due_us = sim_now_us();
+			continue;
+		}
+		uint64_t period_us = (uint64_t)(1e6 / self->rate);
+		if (period_us == 0) {
+			period_us = 1;
+		}
+		while (due_us <= sim_now_us()) {
+			self->offered++;
+			if (self->aggregated) {
+				aggregate_add(&self->aggregate, sample_value(), (uint32_t)(sim_now_us() / 1000));
+				due_us += period_us;
+				continue;
+			}
+			memcpy(record, &counter, sizeof(counter));
+			counter++;
+			if (!producer_push(self->source, record, record_length)) {
+				self->rejected++;
+			}
+			due_us += period_us;
+		}
+		uint64_t delay_ms = (due_us - sim_now_us() + 999) / 1000;
+		vTaskDelay(pdMS_TO_TICKS(delay_ms));
+	}
+
+}
+
+/**
+ * Initialization done by app_main(), see udp_sender.c.
+ */
+static void start_application(void) {
+
+	ESP_ERROR_CHECK(nvs_flash_init());
+	seq_store_init();
+	link_state_init();
+	ESP_ERROR_CHECK(esp_netif_init());
+	ESP_ERROR_CHECK(esp_event_loop_create_default());
+#if CONFIG_UDPSENDER_REACTOR
+	xTaskCreate(reactor_task, "reactor", CONFIG_UDPSENDER_REACTOR_STACK_SIZE, NULL, 5, NULL);
+#else
+	xTaskCreate(supervisor_task, "supervisor", CONFIG_UDPSENDER_SUPERVISOR_STACK_SIZE, NULL, 5, NULL);
+	xTaskCreate(connect_wifi_task, "connect_wifi", CONFIG_UDPSENDER_CONNECT_WIFI_STACK_SIZE, NULL, 5, NULL);
+	xTaskCreate(send_datagram_task, "send_datagram", CONFIG_UDPSENDER_SEND_DATAGRAM_STACK_SIZE, NULL, 5, NULL);
+#endif
+	xTaskCreate(pipeline_task, "pipeline", CONFIG_UDPSENDER_PIPELINE_STACK_SIZE, NULL, 5, NULL);
+	// Aggregation (-A) is the deepest use of the load task.
+	xTaskCreate(load_task, "load", 4096, &load, 5, NULL);
+	xTaskCreate(load_task, "urgent_load", 2000, &urgent_load, 5, NULL);
+
+}
+
+static void print_latency(const char *name, const latency_stats_t *stats) {
+
+	if (stats->count == 0) {
+		printf("  %-22s no sample\n", name);
+		return;
+	}
+	printf("  %-22s count %u  mean %u  p50 %u  p99 %u  max %u (us)\n", name,
+		   stats->count, latency_stats_mean(stats), latency_stats_percentile(stats, 50),
+		   latency_stats_percentile(stats, 99), stats->max_us);
+
+}
+
+static void print_load(const load_t *self) {
+
+	producer_stats_t producer;
+
+	printf("%s: %llu offered, %llu rejected\n", self->name,
+		   (unsigned long long)self->offered, (unsigned long long)self->rejected);
+	if (self->aggregated) {
+		aggregate_stats_t aggregate;
+		aggregate_get_stats(&self->aggregate, &aggregate);
+		uint32_t records = aggregate.summaries + aggregate.raw;
+		printf("  aggregated: %u samples  %u summaries  %u raw  %u rejected  "
+			   "%.1f samples per record\n",
+			   aggregate.samples, aggregate.summaries, aggregate.raw, aggregate.sink_failures,
+			   records > 0 ? (double)aggregate.samples / records : 0.0);
+	}
+	if (self->source != NULL) {
+		producer_get_stats(self->source, &producer);
+		printf("  pushed %u  overruns %u  sent %u  queued %u  dropped %u\n", producer.pushed,
+			   producer.overruns, producer.sent, producer.queued, producer.dropped);
+		print_latency("push to send", &producer.latency);
+		print_latency("pipeline wait", &producer.pipeline_wait);
+		print_latency("connect_wifi queue", &producer.queue_wait);
+		print_latency("send call", &producer.send_time);
+	}
+
+}
+
+static void report(double wall_s) {
+
+	sim_kernel_stats_t kernel;
+	sim_wifi_stats_t wifi;
+	sim_net_stats_t net;
+	send_path_stats_t send_path;
+	time_sync_stats_t time_sync;
+	producer_stats_t producer;
+	reliable_stats_t reliable;
+	roaming_stats_t roaming;
+	seq_store_stats_t seq_store;
+	sim_nvs_stats_t nvs;
+	cw_datagram_stats_t datagrams;
+	double virtual_s = sim_now_us() / 1e6;
+
+	sim_kernel_get_stats(&kernel);
+	sim_wifi_get_stats(&wifi);
+	roaming_get_stats(&roaming);
+	sim_net_get_stats(&net);
+	send_path_get_stats(&send_path);
+	time_sync_get_stats(&time_sync);
+	seq_store_get_stats(&seq_store);
+	sim_nvs_get_stats(&nvs);
+	connect_wifi_get_datagram_stats(&datagrams);
+
+	printf("--- %.3f s virtual, %.3f s wall (x%.0f)\n", virtual_s, wall_s,
+		   wall_s > 0.0 ? virtual_s / wall_s : 0.0);
+	printf("kernel: %llu switches, %llu events, %llu timer fires, %llu messages, "
+		   "%llu queue full, %llu injected\n",
+		   (unsigned long long)kernel.switches, (unsigned long long)kernel.events,
+		   (unsigned long long)kernel.timer_fires, (unsigned long long)kernel.queue_sends,
+		   (unsigned long long)kernel.queue_full, (unsigned long long)kernel.injected_full);
+	uint32_t queue_bytes = 0;
+	uint32_t queue_count = 0;
+	sim_queue_info_t queue;
+	for (uint32_t i = 0; sim_queue_info(i, &queue); i++) {
+		printf("  queue %-15s length %u  high water %u  sends %llu  full %llu  injected %llu  "
+			   "wait us p50 %u  p99 %u  max %u\n",
+			   queue.owner, queue.length, queue.high_water, (unsigned long long)queue.sends,
+			   (unsigned long long)queue.full, (unsigned long long)queue.injected_full,
+			   latency_stats_percentile(&queue.wait, 50),
+			   latency_stats_percentile(&queue.wait, 99), queue.wait.max_us);
+		queue_bytes += queue.length * queue.item_size;
+		queue_count++;
+	}
+	uint32_t stack_bytes = 0;
+	uint32_t task_count = 0;
+	sim_task_info_t task;
+	for (uint32_t i = 0; sim_task_info(i, &task); i++) {
+		printf("  task %-15s switches %llu  stack %u bytes, %u requested\n", task.name,
+			   (unsigned long long)task.switches, task.stack_used, task.stack_depth);
+		stack_bytes += task.stack_depth;
+		task_count++;
+	}
+	printf("  footprint: %u tasks, %u stack bytes requested, %u queues, %u item bytes, "
+		   "%u timers\n", task_count, stack_bytes, queue_count, queue_bytes,
+		   kernel.timers);
+#if CONFIG_UDPSENDER_REACTOR
+	reactor_stats_t reactor;
+	reactor_get_stats(&reactor);
+	printf("reactor: %u messages, %u timer expiries\n", reactor.messages,
+		   reactor.timer_expiries);
+	print_latency("timer lateness", &reactor.timer_lateness);
+#endif
+	printf("internal errors:");
+	bool any_error = false;
+	for (uint32_t i = 0; i < MAX_ERRORS; i++) {
+		if (errors[i] > 0) {
+			printf(" %u: %llu", i, (unsigned long long)errors[i]);
+			any_error = true;
+		}
+	}
+	printf("%s\n", any_error ? "" : " none");
+	printf("wifi: %u connects, %u failures, %u leases, %u drops, %u disconnects, "
+		   "%u scans, up %.1f%%\n",
+		   wifi.connects, wifi.failures, wifi.leases, wifi.drops, wifi.disconnects,
+		   wifi.scans, virtual_s > 0.0 ? 100.0 * wifi.up_us / 1e6 / virtual_s : 0.0);
+	printf("  associations per access point:");
+	for (uint8_t i = 0; i < sim_wifi_config.ap_count; i++) {
+		printf(" %u", wifi.associations[i]);
+	}
+	printf("\n");
+	print_latency("outage", &wifi.outage);
+	printf("roaming: %u scans, %u background, %u connects, %u failures, %u roams, "
+		   "%u losses, RSSI %d dBm\n",
+		   roaming.scans, roaming.background_scans, roaming.connects, roaming.failures,
+		   roaming.roams, roaming.losses, roaming.rssi);
+	print_latency("roam interruption", &roaming.roam_interruption);
+	print_latency("loss interruption", &roaming.loss_interruption);
+	print_load(&load);
+	if (urgent_load.offered > 0) {
+		print_load(&urgent_load);
+	}
+	printf("traffic classes:\n");
+	for (traffic_class_t tc = 0; tc < TRAFFIC_CLASS_COUNT; tc++) {
+		producer_get_class_stats(tc, &producer);
+		if (producer.pushed > 0) {
+			print_latency(CLASS_NAMES[tc], &producer.latency);
+		}
+	}
+	printf("datagrams: sent %u  queued %u  dropped %u  rejected %u  expired %u\n",
+		   datagrams.completed[CW_DATAGRAM_SENT], datagrams.completed[CW_DATAGRAM_QUEUED],
+		   datagrams.completed[CW_DATAGRAM_DROPPED], datagrams.completed[CW_DATAGRAM_REJECTED],
+		   datagrams.completed[CW_DATAGRAM_EXPIRED]);
+	print_latency("connect_wifi queue", &datagrams.queue_wait);
+	print_latency("send call", &datagrams.send_time);
+	printf("send path: sent %u  queued %u  retried %u  dropped %u  delayed %u  opened %u  "
+		   "ENOMEM %u  ENOBUFS %u  EAGAIN %u  EHOSTUNREACH %u  other %u\n",
+		   send_path.sent, send_path.queued, send_path.retried, send_path.dropped,
+		   send_path.delayed, send_path.opened, send_path.errors[SEND_PATH_ERRNO_ENOMEM],
+		   send_path.errors[SEND_PATH_ERRNO_ENOBUFS], send_path.errors[SEND_PATH_ERRNO_EAGAIN],
+		   send_path.errors[SEND_PATH_ERRNO_EHOSTUNREACH], send_path.errors[SEND_PATH_ERRNO_OTHER]);
+	if (transport_get() == &transport_loopback) {
+		transport_loopback_stats_t loopback;
+		transport_loopback_get_stats(&loopback);
+		printf("loopback: %u datagrams  %u bytes\n", loopback.datagrams, loopback.bytes);
+	}
+	if (transport_get() == &transport_raw) {
+		transport_raw_stats_t raw;
+		transport_raw_get_stats(&raw);
+		sim_lwip_stats_t lwip;
+		sim_lwip_get_stats(&lwip);
+		printf("raw: sent %u  pool empty %u  mailbox full %u  send errors %u  "
+			   "tcpip callbacks %llu  mailbox high water %u\n",
+			   raw.sent, raw.pool_empty, raw.mailbox_full, raw.send_errors,
+			   (unsigned long long)lwip.callbacks, lwip.mailbox_high_water);
+		print_latency("raw completion", &raw.completion);
+	}
+	if (reliable_get_stats(LOAD_STREAM_ID, &reliable)) {
+		printf("reliable: in flight %u  sent %u  retransmits %u  acked %u  expired %u  "
+			   "window full %u  srtt %u ms  rto %u ms\n",
+			   reliable.in_flight, reliable.sent, reliable.retransmits, reliable.acked,
+			   reliable.expired, reliable.window_full, reliable.srtt_ms, reliable.rto_ms);
+	}
+	printf("sequence numbers: epoch %u  %u reservations  %u errors  %u failed streams  "
+		   "NVS %u writes  %u commits  %.1f commits per hour\n",
+		   seq_store.epoch, seq_store.reservations, seq_store.errors, seq_store.failed, nvs.writes,
+		   nvs.commits, virtual_s > 0.0 ? nvs.commits * 3600.0 / virtual_s : 0.0);
+	printf("time sync: %u requests  %u samples  %u rejected  drift %d ppb  delay %u us\n",
+		   time_sync.requests, time_sync.samples, time_sync.rejected, time_sync.drift_ppb,
+		   time_sync.delay_us);
+	printf("network: %llu sends, %llu injected ENOMEM, %llu while down, %llu lost, "
+		   "%llu delivered, %llu ACKs, %llu time responses, %llu received\n",
+		   (unsigned long long)net.sends, (unsigned long long)net.injected_enomem,
+		   (unsigned long long)net.link_down, (unsigned long long)net.lost,
+		   (unsigned long long)net.delivered, (unsigned long long)net.acks,
+		   (unsigned long long)net.time_responses, (unsigned long long)net.received);
+	if (net.fragments > 0) {
+		printf("  fragments: %llu received, %llu records reassembled\n",
+			   (unsigned long long)net.fragments, (unsigned long long)net.reassembled);
+	}
+	printf("  access categories: BK %llu  BE %llu  VI %llu  VO %llu\n",
+		   (unsigned long long)net.access_categories[SIM_NET_AC_BK],
+		   (unsigned long long)net.access_categories[SIM_NET_AC_BE],
+		   (unsigned long long)net.access_categories[SIM_NET_AC_VI],
+		   (unsigned long long)net.access_categories[SIM_NET_AC_VO]);
+	for (uint8_t i = 0; i < SIM_NET_MAX_STREAMS; i++) {
+		const sim_net_stream_stats_t *stream = &net.streams[i];
+		if (stream->received == 0) {
+			continue;
+		}
+		printf("  stream %u: received %llu  duplicates %llu  lost %llu  recovered %llu  "
+			   "restarts %u\n", i,
+			   (unsigned long long)stream->received, (unsigned long long)stream->duplicates,
+			   (unsigned long long)stream->lost, (unsigned long long)stream->recovered,
+			   stream->restarts);
+		print_latency("one-way", &stream->latency);
+	}
+	fflush(stdout);
+
+}
+
+int main(int argc, char **argv) {
+
+	uint64_t seed = 1;
+	double duration_s = 86400.0;
+	double report_s = 0.0;
+	const char *script_path = NULL;
+	bool dump_trace = false;
+	int option;
+
+	sim_kernel_config.clock_drift_ppm = 20.0;
+	transport_set(&transport_udp);
+	while ((option = getopt(argc, argv, "S:d:i:r:b:Rc:A:W:H:u:l:q:e:k:w:N:LZf:m:a:D:s:v:T")) != -1) {
+		switch (option) {
+		case 'S': seed = strtoull(optarg, NULL, 0); break;
+		case 'd': duration_s = atof(optarg); break;
+		case 'i': report_s = atof(optarg); break;
+		case 'r': load.rate = atof(optarg); break;
+		case 'b': record_length = (uint32_t)atoi(optarg); break;
+		case 'R': load.reliable = true; break;
+		case 'c': load.traffic_class = (traffic_class_t)atoi(optarg); break;
+		case 'A':
+			load.aggregated = true;
+			load.aggregate_config.window_ms = (uint32_t)atoi(optarg);
+			break;
+		case 'W': load.aggregate_config.panes = (uint8_t)atoi(optarg); break;
+		case 'H':
+			load.aggregate_config.passthrough = true;
+			load.aggregate_config.high = atoi(optarg);
+			load.aggregate_config.low = -load.aggregate_config.high;
+			break;
+		case 'u': urgent_load.rate = atof(optarg); break;
+		case 'l': sim_net_config.loss_p = atof(optarg); break;
+		case 'q': sim_kernel_config.queue_full_p = atof(optarg); break;
+		case 'e': sim_net_config.send_enomem_p = atof(optarg); break;
+		case 'k': sim_net_config.send_cost_us = (uint32_t)atoi(optarg); break;
+		case 'w': sim_nvs_config.commit_us = (uint32_t)atoi(optarg); break;
+		case 'N': sim_nvs_config.write_limit = (uint32_t)atoi(optarg); break;
+		case 'L': transport_set(&transport_loopback); break;
+		case 'Z': transport_set(&transport_raw); break;
+		case 'f': sim_wifi_config.connect_fail_p = atof(optarg); break;
+		case 'm': sim_wifi_config.link_mtbf_s = (uint32_t)atoi(optarg); break;
+		case 'a': sim_wifi_config.ap_count = (uint8_t)atoi(optarg); break;
+		case 'D': sim_kernel_config.clock_drift_ppm = atof(optarg); break;
+		case 's': script_path = optarg; break;
+		case 'v': sim_kernel_config.log_level = atoi(optarg); break;
+		case 'T': dump_trace = true; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (load.traffic_class >= TRAFFIC_CLASS_COUNT) {
+		fprintf(stderr, "Traffic class must be in 0..%d\n", TRAFFIC_CLASS_COUNT - 1);
+		return 1;
+	}
+	if (record_length == 0 || record_length > MAX_RECORD) {
+		fprintf(stderr, "Record length must be in 1..%d\n", MAX_RECORD);
+		return 1;
+	}
+
+	sim_random_seed(seed);
+	sim_wifi_init();
+	sim_net_init();
+	sim_queue_send_hook = observe_queue;
+	if (script_path != NULL && !load_script(script_path)) {
+		return 1;
+	}
+	start_application();
+
+	struct timespec start;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	uint64_t end_us = (uint64_t)(duration_s * 1e6);
+	uint64_t step_us = report_s > 0.0 ? (uint64_t)(report_s * 1e6) : end_us;
+	while (sim_now_us() < end_us) {
+		uint64_t next_us = sim_now_us() + step_us;
+		sim_run(next_us < end_us ? next_us : end_us);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		report((now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9);
+	}
+	if (dump_trace) {
+		trace_dump_uart();
+	}
+	return 0;
+
+}
@@ -0,0 +1,786 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lwip/sockets.h"
+
+#if CONFIG_UDPSENDER_FEC
+#include "fec_decoder.h"
+#endif
+#include "frame.h"
+#include "latency_stats.h"
+#include "reassembly.h"
+#include "sim.h"
+
+#define MAX_SOCKETS 8
+
+// lwIP socket descriptors do not start at 0.
+#define FIRST_SOCKET 54
+
+// Receive mailbox depth of a UDP socket (CONFIG_LWIP_UDP_RECVMBOX_SIZE).
+#define RX_DEPTH 6
+
+#define MAX_DATAGRAM 1472
+
+// Remote host time, when the virtual time is 0.
+#define REMOTE_OFFSET_US 1600000000000000ULL
+
+// Processing time of a time request by the remote host.
+#define REMOTE_TURNAROUND_US 50
+
+// FEC decoder of the remote host: data frames kept per stream, and
+// incomplete blocks.
+#define FEC_HISTORY 256
+#define FEC_MAX_BLOCKS 16
+
+// Reassembly of fragmented records by the remote host.
+#define REASSEMBLY_MAX_RECORDS 16
+#define REASSEMBLY_MAX_BYTES (1024 * 1024)
+#define REASSEMBLY_TIMEOUT_US 5000000
+
+// Real remote host: period at which a blocked receiver checks the host
+// socket.
+#define REMOTE_POLL_US 1000
+
+typedef struct packet {
+	struct packet *next;
+	uint16_t length;
+	uint8_t data[];
+} packet_t;
+
+typedef struct {
+	bool used;
+	bool connected;
+	int flags;
+	int tos;                   // IP_TOS option.
+	uint64_t id;               // Unique, tags deliveries to this socket.
+	int host_sock;             // Real remote host: socket of the host, otherwise -1.
+	packet_t *rx_first;
+	packet_t *rx_last;
+	uint32_t rx_count;
+	sim_net_receive_hook_t receive_hook;  // Set: datagrams are not queued.
+	void *receive_arg;
+} sim_socket_t;
+
+// Remote host view of a stream.
+typedef struct {
+	bool seen;
+	uint32_t epoch;            // Boot epoch of the sender.
+	uint32_t next_seq;         // Highest sequence number received, plus one.
+	uint64_t recent;           // Bit k: next_seq - 1 - k received.
+	uint32_t cum;              // Reliable streams: cumulative ACK.
+	uint64_t window;           // Reliable streams: bit j: cum + j received.
+} remote_stream_t;
+
+sim_net_config_t sim_net_config = {
+	.loss_p = 0.01,
+	.delay_min_us = 1000,
+	.delay_max_us = 5000,
+	.send_enomem_p = 0.0,
+	.send_cost_us = 0,
+	.remote_address = 0,
+	.remote_port = 0,
+};
+
+static sim_net_stats_t stats;
+
+static sim_socket_t sockets[MAX_SOCKETS];
+static uint64_t socket_ids = 0;
+
+static remote_stream_t remote_streams[SIM_NET_MAX_STREAMS];
+
+// Tasks blocked in select() or recv().
+static sim_wait_list_t rx_waiters;
+
+// Host socket API, for the real remote host (see the end of the file).
+static int host_open(void);
+static bool host_send(int sock, const void *data, size_t length);
+static ssize_t host_receive(int sock, void *buffer, size_t length);
+static void host_close(int sock);
+
+static packet_t *new_packet(const void *data, size_t length) {
+
+	packet_t *packet = malloc(sizeof(packet_t) + length);
+	if (packet == NULL) {
+		abort();
+	}
+	packet->next = NULL;
+	packet->length = (uint16_t)length;
+	memcpy(packet->data, data, length);
+	return packet;
+
+}
+
+static sim_socket_t *get_socket(int sock) {
+
+	if (sock < FIRST_SOCKET || sock >= FIRST_SOCKET + MAX_SOCKETS ||
+		!sockets[sock - FIRST_SOCKET].used) {
+		return NULL;
+	}
+	return &sockets[sock - FIRST_SOCKET];
+
+}
+
+/**
+ * Returns the WMM access category of a datagram, from the TOS value of the
+ * socket, as the Wi-Fi driver does: the user priority is the precedence.
+ */
+static sim_net_ac_t access_category(int tos) {
+
+	switch ((tos >> 5) & 0x07) {
+	case 1:
+	case 2:
+		return SIM_NET_AC_BK;
+	case 4:
+	case 5:
+		return SIM_NET_AC_VI;
+	case 6:
+	case 7:
+		return SIM_NET_AC_VO;
+	default:
+		return SIM_NET_AC_BE;
+	}
+
+}
+
+static uint64_t link_delay_us(void) {
+	return sim_random_range(sim_net_config.delay_min_us, sim_net_config.delay_max_us);
+}
+
+static void rx_append(sim_socket_t *socket, packet_t *packet) {
+
+	if (socket->receive_hook != NULL) {
+		stats.received++;
+		socket->receive_hook(packet->data, packet->length, socket->receive_arg);
+		free(packet);
+		return;
+	}
+	if (socket->rx_last == NULL) {
+		socket->rx_first = packet;
+	} else {
+		socket->rx_last->next = packet;
+	}
+	socket->rx_last = packet;
+	socket->rx_count++;
+	stats.received++;
+	sim_notify(&rx_waiters);
+
+}
+
+static void device_delivery(void *arg, uint64_t tag) {
+
+	packet_t *packet = (packet_t *)arg;
+	sim_socket_t *socket = NULL;
+	for (uint8_t i = 0; i < MAX_SOCKETS; i++) {
+		if (sockets[i].used && sockets[i].id == tag) {
+			socket = &sockets[i];
+		}
+	}
+	// The socket may have been closed, or the link lost, meanwhile.
+	if (socket == NULL || !sim_wifi_is_up() || socket->rx_count == RX_DEPTH) {
+		stats.lost++;
+		free(packet);
+		return;
+	}
+	rx_append(socket, packet);
+
+}
+
+/**
+ * Moves the datagrams received from the real remote host to the receive
+ * queue of the socket. Only downlink losses are modelled.
+ */
+static void pull_remote(sim_socket_t *socket) {
+
+	uint8_t buffer[MAX_DATAGRAM];
+	while (socket->host_sock >= 0 && socket->rx_count < RX_DEPTH) {
+		ssize_t length = host_receive(socket->host_sock, buffer, sizeof(buffer));
+		if (length < 0) {
+			return;
+		}
+		if (!sim_wifi_is_up() || sim_random_hit(sim_net_config.loss_p)) {
+			stats.lost++;
+			continue;
+		}
+		rx_append(socket, new_packet(buffer, (size_t)length));
+	}
+
+}
+
+/**
+ * Sends a frame from the remote host to the device.
+ */
+static void send_to_device(uint64_t socket_id, const uint8_t *data, uint16_t length,
+		                   uint64_t departure_us) {
+
+	if (sim_random_hit(sim_net_config.loss_p)) {
+		stats.lost++;
+		return;
+	}
+	sim_schedule(departure_us + link_delay_us(), device_delivery,
+			     new_packet(data, length), socket_id);
+
+}
+
+static void track_stream(const frame_header_t *header) {
+
+	sim_net_stream_stats_t *stream_stats = &stats.streams[header->stream_id];
+	remote_stream_t *stream = &remote_streams[header->stream_id];
+	if (!stream->seen || stream->epoch != header->epoch) {
+		// Sequence numbers go on across restarts of the sender, but
+		// datagrams sent before the restart may never come.
+		if (stream->seen) {
+			stream_stats->restarts++;
+		}
+		stream->seen = true;
+		stream->epoch = header->epoch;
+		stream->next_seq = header->seq;
+		stream->recent = 0;
+		stream->cum = header->seq;
+		stream->window = 0;
+	}
+	if (!frame_seq_before(header->seq, stream->next_seq)) {
+		uint32_t skipped = header->seq - stream->next_seq;
+		stream_stats->lost += skipped;
+		stream->recent = skipped + 1 >= 64 ? 0 : stream->recent << (skipped + 1);
+		stream->recent |= 1;
+		stream->next_seq = header->seq + 1;
+		stream_stats->received++;
+		return;
+	}
+	uint32_t age = stream->next_seq - 1 - header->seq;
+	if (age < 64 && (stream->recent & (1ULL << age)) != 0) {
+		stream_stats->duplicates++;
+		return;
+	}
+	// Late arrival, counted as lost when skipped.
+	if (age < 64) {
+		stream->recent |= 1ULL << age;
+	}
+	if (stream_stats->lost > 0) {
+		stream_stats->lost--;
+	}
+	stream_stats->received++;
+
+}
+
+#if CONFIG_UDPSENDER_FEC
+static fec_decoder_t *fec_decoder = NULL;
+
+/**
+ * Gives a frame to the FEC decoder, and counts the data frames it rebuilds
+ * as received. Returns false if the frame must not be processed further: a
+ * parity frame, or a data frame already rebuilt.
+ */
+static bool fec_receive(const uint8_t *data, uint16_t length) {
+
+	fec_decoder_rs_t rs = fec_decoder_add(fec_decoder, data, length);
+	const uint8_t *frame;
+	uint16_t frame_length;
+	while (fec_decoder_next(fec_decoder, &frame, &frame_length)) {
+		frame_header_t header;
+		if (frame_decode_header(frame, frame_length, &header) &&
+			header.stream_id < SIM_NET_MAX_STREAMS) {
+			track_stream(&header);
+			stats.streams[header.stream_id].recovered++;
+		}
+	}
+	if (rs == FEC_DECODER_DUPLICATE) {
+		frame_header_t header;
+		if (frame_decode_header(data, length, &header) &&
+			header.stream_id < SIM_NET_MAX_STREAMS) {
+			stats.streams[header.stream_id].duplicates++;
+		}
+		return false;
+	}
+	return rs != FEC_DECODER_PARITY && rs != FEC_DECODER_INVALID;
+
+}
+#endif
+
+// Created with the first fragment.
+static reassembly_t *reassembly = NULL;
+
+/**
+ * Gives a fragment to the reassembly. Returns true and provides the header
+ * of the record once it is complete.
+ */
+static bool reassemble(const uint8_t *data, uint16_t length, frame_header_t *header) {
+
+	if (reassembly == NULL) {
+		reassembly = reassembly_create(REASSEMBLY_MAX_RECORDS, REASSEMBLY_MAX_BYTES,
+				                       REASSEMBLY_TIMEOUT_US);
+		if (reassembly == NULL) {
+			abort();
+		}
+	}
+	stats.fragments++;
+	const uint8_t *record;
+	uint32_t record_length;
+	reassembly_rs_t rs = reassembly_add(reassembly, data, length, sim_now_us(), header,
+			                            &record, &record_length);
+	if (rs != REASSEMBLY_COMPLETE) {
+		return false;
+	}
+	stats.reassembled++;
+	return true;
+
+}
+
+static void acknowledge(uint64_t socket_id, const frame_header_t *header) {
+
+	remote_stream_t *stream = &remote_streams[header->stream_id];
+	if (frame_seq_before(header->seq, stream->cum)) {
+		// Already acknowledged: the ACK was lost, send it again.
+	} else {
+		uint32_t offset = header->seq - stream->cum;
+		if (offset >= 64) {
+			// The sender gave up on the oldest missing datagrams.
+			uint32_t shift = offset - 63;
+			stream->window = shift >= 64 ? 0 : stream->window >> shift;
+			stream->cum += shift;
+			offset = 63;
+		}
+		stream->window |= 1ULL << offset;
+		while ((stream->window & 1) != 0) {
+			stream->window >>= 1;
+			stream->cum++;
+		}
+	}
+	frame_ack_t ack;
+	ack.header.version = FRAME_VERSION;
+	ack.header.type = FRAME_ACK;
+	ack.header.flags = 0;
+	ack.header.stream_id = header->stream_id;
+	ack.header.seq = stream->cum;
+	ack.header.epoch = header->epoch;
+	ack.header.timestamp_us = sim_net_remote_now_us();
+	ack.bitmap = (uint32_t)(stream->window >> 1);
+	uint8_t buffer[FRAME_ACK_LENGTH];
+	frame_encode_ack(&ack, buffer);
+	stats.acks++;
+	send_to_device(socket_id, buffer, FRAME_ACK_LENGTH, sim_now_us());
+
+}
+
+static void answer_time_request(uint64_t socket_id, const frame_header_t *header) {
+
+	frame_time_response_t response;
+	response.header = *header;
+	response.header.type = FRAME_TIME_RESPONSE;
+	response.header.flags = 0;
+	response.t1_us = header->timestamp_us;
+	response.t2_us = sim_net_remote_now_us();
+	response.t3_us = response.t2_us + REMOTE_TURNAROUND_US;
+	response.header.timestamp_us = response.t3_us;
+	uint8_t buffer[FRAME_TIME_RESPONSE_LENGTH];
+	frame_encode_time_response(&response, buffer);
+	stats.time_responses++;
+	send_to_device(socket_id, buffer, FRAME_TIME_RESPONSE_LENGTH,
+			       sim_now_us() + REMOTE_TURNAROUND_US);
+
+}
+
+/**
+ * Processing of a datagram by the remote host.
+ */
+static void remote_delivery(void *arg, uint64_t tag) {
+
+	packet_t *packet = (packet_t *)arg;
+	frame_header_t header;
+	stats.delivered++;
+#if CONFIG_UDPSENDER_FEC
+	if (!fec_receive(packet->data, packet->length)) {
+		free(packet);
+		return;
+	}
+#endif
+	bool valid = frame_decode_header(packet->data, packet->length, &header);
+	if (valid && header.type == FRAME_DATA && (header.flags & FRAME_FLAG_FRAGMENT) != 0) {
+		// A fragmented record is processed once complete.
+		valid = reassemble(packet->data, packet->length, &header);
+	}
+	if (valid) {
+		if (header.type == FRAME_TIME_REQUEST) {
+			answer_time_request(tag, &header);
+		} else if (header.type == FRAME_DATA && header.stream_id < SIM_NET_MAX_STREAMS) {
+			track_stream(&header);
+			if ((header.flags & FRAME_FLAG_TIME_SYNCED) != 0) {
+				int64_t latency_us = (int64_t)(sim_net_remote_now_us() - header.timestamp_us);
+				if (latency_us >= 0) {
+					latency_stats_add(&stats.streams[header.stream_id].latency,
+							          (uint32_t)latency_us);
+				}
+			}
+			if ((header.flags & FRAME_FLAG_RELIABLE) != 0) {
+				acknowledge(tag, &header);
+			}
+		}
+	}
+	free(packet);
+
+}
+
+void sim_net_init(void) {
+
+	memset(&stats, 0, sizeof(sim_net_stats_t));
+	memset(remote_streams, 0, sizeof(remote_streams));
+	if (reassembly != NULL) {
+		reassembly_destroy(reassembly);
+		reassembly = NULL;
+	}
+	for (uint8_t i = 0; i < SIM_NET_MAX_STREAMS; i++) {
+		latency_stats_reset(&stats.streams[i].latency);
+	}
+#if CONFIG_UDPSENDER_FEC
+	fec_decoder_destroy(fec_decoder);
+	fec_decoder = fec_decoder_create(FEC_HISTORY, FEC_MAX_BLOCKS);
+	if (fec_decoder == NULL) {
+		abort();
+	}
+#endif
+
+}
+
+void sim_net_get_stats(sim_net_stats_t *net_stats) {
+	*net_stats = stats;
+}
+
+uint64_t sim_net_remote_now_us(void) {
+	return sim_now_us() + REMOTE_OFFSET_US;
+}
+
+int sim_socket(int domain, int type, int protocol) {
+
+	if (domain != AF_INET || type != SOCK_DGRAM) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (uint8_t i = 0; i < MAX_SOCKETS; i++) {
+		if (!sockets[i].used) {
+			memset(&sockets[i], 0, sizeof(sim_socket_t));
+			sockets[i].host_sock = -1;
+			if (sim_net_config.remote_port != 0) {
+				sockets[i].host_sock = host_open();
+				if (sockets[i].host_sock < 0) {
+					return -1;
+				}
+			}
+			sockets[i].used = true;
+			sockets[i].id = ++socket_ids;
+			return FIRST_SOCKET + i;
+		}
+	}
+	errno = ENFILE;
+	return -1;
+
+}
+
+int sim_connect(int sock, const struct sockaddr *address, socklen_t address_length) {
+
+	sim_socket_t *socket = get_socket(sock);
+	if (socket == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+	socket->connected = true;
+	return 0;
+
+}
+
+ssize_t sim_send(int sock, const void *data, size_t length, int flags) {
+
+	sim_socket_t *socket = get_socket(sock);
+	stats.sends++;
+	if (sim_net_config.send_cost_us > 0 && sim_in_task()) {
+		// Models the time spent in lwIP and in the Wi-Fi driver. Sends from
+		// the simulated tcpip thread are accounted for by sim_lwip.c.
+		sim_block(NULL, sim_now_us() + sim_net_config.send_cost_us);
+	}
+	if (socket == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+	if (!socket->connected) {
+		errno = EDESTADDRREQ;
+		return -1;
+	}
+	if (length > MAX_DATAGRAM) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	if (sim_random_hit(sim_net_config.send_enomem_p)) {
+		stats.injected_enomem++;
+		errno = ENOMEM;
+		return -1;
+	}
+	if (!sim_wifi_is_up()) {
+		stats.link_down++;
+		errno = EHOSTUNREACH;
+		return -1;
+	}
+	stats.access_categories[access_category(socket->tos)]++;
+	if (sim_random_hit(sim_net_config.loss_p)) {
+		stats.lost++;
+		return (ssize_t)length;
+	}
+	if (socket->host_sock >= 0) {
+		// The datagram leaves the host now: the network model stops here.
+		if (host_send(socket->host_sock, data, length)) {
+			stats.delivered++;
+		} else {
+			stats.remote_errors++;
+		}
+		return (ssize_t)length;
+	}
+	sim_schedule(sim_now_us() + link_delay_us(), remote_delivery,
+			     new_packet(data, length), socket->id);
+	return (ssize_t)length;
+
+}
+
+ssize_t sim_sendto(int sock, const void *data, size_t length, int flags,
+		           const struct sockaddr *address, socklen_t address_length) {
+
+	sim_socket_t *socket = get_socket(sock);
+	if (socket != NULL) {
+		socket->connected = true;
+	}
+	return sim_send(sock, data, length, flags);
+
+}
+
+ssize_t sim_recv(int sock, void *buffer, size_t length, int flags) {
+
+	sim_socket_t *socket = get_socket(sock);
+	if (socket == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+	pull_remote(socket);
+	while (socket->rx_count == 0) {
+		if ((flags & MSG_DONTWAIT) != 0 || (socket->flags & O_NONBLOCK) != 0) {
+			errno = EAGAIN;
+			return -1;
+		}
+		sim_block(&rx_waiters, socket->host_sock >= 0 ? sim_now_us() + REMOTE_POLL_US
+				                                       : UINT64_MAX);
+		if (!socket->used) {
+			errno = EBADF;
+			return -1;
+		}
+		pull_remote(socket);
+	}
+	packet_t *packet = socket->rx_first;
+	socket->rx_first = packet->next;
+	if (socket->rx_first == NULL) {
+		socket->rx_last = NULL;
+	}
+	socket->rx_count--;
+	size_t copied = packet->length < length ? packet->length : length;
+	memcpy(buffer, packet->data, copied);
+	free(packet);
+	return (ssize_t)copied;
+
+}
+
+ssize_t sim_recvfrom(int sock, void *buffer, size_t length, int flags,
+		             struct sockaddr *address, socklen_t *address_length) {
+	return sim_recv(sock, buffer, length, flags);
+}
+
+int sim_setsockopt(int sock, int level, int name, const void *value, socklen_t length) {
+
+	sim_socket_t *socket = get_socket(sock);
+	if (socket == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+	if (level == IPPROTO_IP && name == IP_TOS && length >= sizeof(int)) {
+		socket->tos = *(const int *)value;
+	}
+	return 0;
+
+}
+
+int sim_fcntl(int sock, int command, ...) {
+
+	sim_socket_t *socket = get_socket(sock);
+	if (socket == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+	if (command == F_GETFL) {
+		return socket->flags;
+	}
+	if (command == F_SETFL) {
+		va_list args;
+		va_start(args, command);
+		socket->flags = va_arg(args, int);
+		va_end(args);
+		return 0;
+	}
+	errno = EINVAL;
+	return -1;
+
+}
+
+int sim_select(int count, fd_set *read_set, fd_set *write_set, fd_set *except_set,
+		       struct timeval *timeout) {
+
+	uint64_t deadline_us = UINT64_MAX;
+	if (timeout != NULL) {
+		deadline_us = sim_now_us() + (uint64_t)timeout->tv_sec * 1000000 + timeout->tv_usec;
+	}
+	fd_set requested;
+	FD_ZERO(&requested);
+	if (read_set != NULL) {
+		requested = *read_set;
+	}
+	while (true) {
+		int ready = 0;
+		bool remote = false;
+		fd_set result;
+		FD_ZERO(&result);
+		for (int sock = FIRST_SOCKET; sock < count && sock < FIRST_SOCKET + MAX_SOCKETS; sock++) {
+			sim_socket_t *socket = get_socket(sock);
+			if (!FD_ISSET(sock, &requested) || socket == NULL) {
+				continue;
+			}
+			if (socket->host_sock >= 0) {
+				pull_remote(socket);
+				remote = true;
+			}
+			if (socket->rx_count > 0) {
+				FD_SET(sock, &result);
+				ready++;
+			}
+		}
+		if (ready > 0 || sim_now_us() >= deadline_us) {
+			if (read_set != NULL) {
+				*read_set = result;
+			}
+			if (write_set != NULL) {
+				FD_ZERO(write_set);
+			}
+			if (except_set != NULL) {
+				FD_ZERO(except_set);
+			}
+			return ready;
+		}
+		uint64_t poll_us = sim_now_us() + REMOTE_POLL_US;
+		sim_block(&rx_waiters, remote && poll_us < deadline_us ? poll_us : deadline_us);
+	}
+
+}
+
+int sim_close(int sock) {
+
+	sim_socket_t *socket = get_socket(sock);
+	if (socket == NULL) {
+		errno = EBADF;
+		return -1;
+	}
+	while (socket->rx_first != NULL) {
+		packet_t *packet = socket->rx_first;
+		socket->rx_first = packet->next;
+		free(packet);
+	}
+	if (socket->host_sock >= 0) {
+		host_close(socket->host_sock);
+	}
+	socket->used = false;
+	return 0;
+
+}
+
+void sim_net_set_receive_hook(int sock, sim_net_receive_hook_t hook, void *arg) {
+
+	sim_socket_t *socket = get_socket(sock);
+	if (socket != NULL) {
+		socket->receive_hook = hook;
+		socket->receive_arg = arg;
+	}
+
+}
+
+void sim_net_poll(int sock) {
+
+	sim_socket_t *socket = get_socket(sock);
+	if (socket != NULL) {
+		pull_remote(socket);
+	}
+
+}
+
+#undef inet_aton
+
+int sim_inet_aton(const char *text, void *address) {
+	return inet_aton(text, (struct in_addr *)address);
+}
+
+#undef socket
+#undef connect
+#undef send
+#undef recv
+#undef close
+
+/**
+ * Opens a non-blocking host socket, connected to the real remote host. Its
+ * local port identifies the device.
+ */
+static int host_open(void) {
+
+	int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	if (sock < 0) {
+		return -1;
+	}
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(sim_net_config.remote_address);
+	address.sin_port = htons(sim_net_config.remote_port);
+	if (connect(sock, (const struct sockaddr *)&address, sizeof(address)) < 0) {
+		int error = errno;
+		close(sock);
+		errno = error;
+		return -1;
+	}
+	return sock;
+
+}
+
+static bool host_send(int sock, const void *data, size_t length) {
+	return send(sock, data, length, 0) == (ssize_t)length;
+}
+
+static ssize_t host_receive(int sock, void *buffer, size_t length) {
+	return recv(sock, buffer, length, 0);
+}
+
+static void host_close(int sock) {
+	close(sock);
+}
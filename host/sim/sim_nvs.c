@@ -0,0 +1,162 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "nvs.h"
+#include "nvs_flash.h"
+
+#include "sim.h"
+
+#define MAX_NAMESPACES 4
+#define MAX_ENTRIES 64
+
+// Key length, as with ESP-IDF, including the terminating null character.
+#define KEY_LENGTH 16
+
+typedef struct {
+	bool used;
+	nvs_handle_t handle;
+	char key[KEY_LENGTH];
+	uint32_t value;
+} entry_t;
+
+sim_nvs_config_t sim_nvs_config = {
+	.commit_us = 0,
+	.write_limit = 0,
+};
+
+static sim_nvs_stats_t stats;
+
+// Handle n is namespaces[n - 1].
+static char namespaces[MAX_NAMESPACES][KEY_LENGTH];
+static uint32_t namespace_count = 0;
+
+static entry_t entries[MAX_ENTRIES];
+
+static entry_t *find_entry(nvs_handle_t handle, const char *key) {
+
+	for (uint32_t i = 0; i < MAX_ENTRIES; i++) {
+		if (entries[i].used && entries[i].handle == handle &&
+			strcmp(entries[i].key, key) == 0) {
+			return &entries[i];
+		}
+	}
+	return NULL;
+
+}
+
+esp_err_t nvs_flash_init(void) {
+
+	memset(&stats, 0, sizeof(sim_nvs_stats_t));
+	return ESP_OK;
+
+}
+
+esp_err_t nvs_flash_erase(void) {
+
+	memset(entries, 0, sizeof(entries));
+	namespace_count = 0;
+	return ESP_OK;
+
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle) {
+
+	if (strlen(name) >= KEY_LENGTH) {
+		return ESP_ERR_NVS_KEY_TOO_LONG;
+	}
+	for (uint32_t i = 0; i < namespace_count; i++) {
+		if (strcmp(namespaces[i], name) == 0) {
+			*out_handle = i + 1;
+			return ESP_OK;
+		}
+	}
+	if (open_mode == NVS_READONLY) {
+		return ESP_ERR_NVS_NOT_FOUND;
+	}
+	if (namespace_count == MAX_NAMESPACES) {
+		return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+	}
+	strcpy(namespaces[namespace_count], name);
+	namespace_count++;
+	*out_handle = namespace_count;
+	return ESP_OK;
+
+}
+
+void nvs_close(nvs_handle_t handle) {
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value) {
+
+	entry_t *entry = find_entry(handle, key);
+	if (entry == NULL) {
+		return ESP_ERR_NVS_NOT_FOUND;
+	}
+	*out_value = entry->value;
+	return ESP_OK;
+
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value) {
+
+	if (strlen(key) >= KEY_LENGTH) {
+		return ESP_ERR_NVS_KEY_TOO_LONG;
+	}
+	entry_t *entry = find_entry(handle, key);
+	for (uint32_t i = 0; entry == NULL && i < MAX_ENTRIES; i++) {
+		if (!entries[i].used) {
+			entry = &entries[i];
+			entry->used = true;
+			entry->handle = handle;
+			strcpy(entry->key, key);
+		}
+	}
+	if (entry == NULL ||
+		(sim_nvs_config.write_limit != 0 && stats.writes >= sim_nvs_config.write_limit)) {
+		return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+	}
+	entry->value = value;
+	stats.writes++;
+	return ESP_OK;
+
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length) {
+	// Blobs are not modeled.
+	return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+
+	stats.commits++;
+	if (sim_nvs_config.commit_us > 0 && sim_in_task()) {
+		// Models the flash write, during which the calling task is blocked.
+		sim_block(NULL, sim_now_us() + sim_nvs_config.commit_us);
+	}
+	return ESP_OK;
+
+}
+
+void sim_nvs_get_stats(sim_nvs_stats_t *nvs_stats) {
+	*nvs_stats = stats;
+}
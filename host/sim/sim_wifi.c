@@ -0,0 +1,507 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_wifi.h"
+#include "sdkconfig.h"
+
+#include "latency_stats.h"
+#include "sim.h"
+
+#define MAX_HANDLERS 8
+
+// Delay between esp_wifi_start() and WIFI_EVENT_STA_START.
+#define START_DELAY_US 5000
+
+// Access points are not heard below this RSSI.
+#define SENSITIVITY_DBM -90.0
+
+// While the RSSI of an access point varies, the link is checked with this
+// period.
+#define RADIO_CHECK_PERIOD_US 100000
+
+// Disconnection reasons.
+#define REASON_ASSOC_LEAVE 8
+#define REASON_4WAY_HANDSHAKE_TIMEOUT 15
+#define REASON_BEACON_TIMEOUT 200
+#define REASON_NO_AP_FOUND 201
+
+typedef enum {
+	LINK_IDLE,
+	LINK_ASSOCIATING,
+	LINK_ASSOCIATED,     // Waiting for an IP address.
+	LINK_UP,
+} link_state_t;
+
+typedef struct {
+	bool available;
+	// The RSSI goes linearly from from_rssi at from_us to to_rssi at to_us.
+	double from_rssi;
+	double to_rssi;
+	uint64_t from_us;
+	uint64_t to_us;
+} ap_t;
+
+typedef struct {
+	esp_event_base_t base;
+	int32_t id;
+	esp_event_handler_t handler;
+	void *arg;
+} handler_t;
+
+esp_event_base_t const WIFI_EVENT = "WIFI_EVENT";
+esp_event_base_t const IP_EVENT = "IP_EVENT";
+
+sim_wifi_config_t sim_wifi_config = {
+	.connect_fail_p = 0.1,
+	.connect_min_ms = 50,
+	.connect_max_ms = 500,
+	.dhcp_min_ms = 20,
+	.dhcp_max_ms = 300,
+	.link_mtbf_s = 3600,
+	.ap_count = 1,
+	.scan_ms = 1500,
+	.rssi_noise_db = 2.0,
+};
+
+static handler_t handlers[MAX_HANDLERS];
+static uint8_t handler_count = 0;
+
+static sim_wifi_stats_t stats;
+
+static ap_t aps[SIM_WIFI_MAX_APS];
+
+static bool started = false;
+static link_state_t link_state = LINK_IDLE;
+// Access point given by the configuration, -1 if none.
+static int8_t configured_ap = -1;
+// Access point of the current association.
+static uint8_t link_ap = 0;
+static bool radio_check_scheduled = false;
+
+static bool scanning = false;
+static wifi_ap_record_t scan_records[SIM_WIFI_MAX_APS];
+static uint16_t scan_count = 0;
+// Incremented each time the link state is reset, so that pending events
+// of a previous association are ignored.
+static uint64_t generation = 0;
+static uint64_t up_since_us;
+static uint64_t lost_at_us;
+static bool outage_pending = false;
+
+static ip_event_got_ip_t got_ip = {
+	.ip_info = {
+		.ip = { 0x0a01a8c0 },          // 192.168.1.10, network byte order.
+		.netmask = { 0x00ffffff },
+		.gw = { 0x0101a8c0 },
+	},
+};
+
+static wifi_event_sta_disconnected_t disconnected;
+
+/**
+ * Calls the handlers registered for the event, as the default event loop
+ * task would do.
+ */
+static void dispatch(esp_event_base_t base, int32_t id, void *data) {
+
+	for (uint8_t i = 0; i < handler_count; i++) {
+		if (handlers[i].base == base &&
+			(handlers[i].id == ESP_EVENT_ANY_ID || handlers[i].id == id)) {
+			handlers[i].handler(handlers[i].arg, base, id, data);
+		}
+	}
+
+}
+
+static double ap_rssi(uint8_t index) {
+
+	const ap_t *ap = &aps[index];
+	uint64_t now_us = sim_now_us();
+	if (now_us >= ap->to_us) {
+		return ap->to_rssi;
+	}
+	return ap->from_rssi + (ap->to_rssi - ap->from_rssi) *
+			(double)(now_us - ap->from_us) / (double)(ap->to_us - ap->from_us);
+
+}
+
+static bool ap_heard(uint8_t index) {
+	return aps[index].available && ap_rssi(index) >= SENSITIVITY_DBM;
+}
+
+static void ap_bssid(uint8_t index, uint8_t *bssid) {
+
+	memset(bssid, 0, 6);
+	bssid[0] = 0x02;   // Locally administered.
+	bssid[5] = index + 1;
+
+}
+
+/**
+ * Describes an access point as a scan would, with a fluctuating RSSI.
+ */
+static void fill_record(uint8_t index, wifi_ap_record_t *record) {
+
+	memset(record, 0, sizeof(wifi_ap_record_t));
+	strncpy((char *)record->ssid, CONFIG_UDPSENDER_WIFI_SSID, sizeof(record->ssid) - 1);
+	ap_bssid(index, record->bssid);
+	record->primary = 1 + 5 * index;
+	double rssi = ap_rssi(index) +
+			      (2.0 * sim_random_unit() - 1.0) * sim_wifi_config.rssi_noise_db;
+	if (rssi > 0.0) {
+		rssi = 0.0;
+	}
+	if (rssi < -127.0) {
+		rssi = -127.0;
+	}
+	record->rssi = (int8_t)lround(rssi);
+	record->authmode = WIFI_AUTH_WPA2_PSK;
+
+}
+
+static void sta_start_event(void *arg, uint64_t tag) {
+	dispatch(WIFI_EVENT, WIFI_EVENT_STA_START, NULL);
+}
+
+static void disconnected_event(void *arg, uint64_t tag) {
+
+	if (tag != generation) {
+		return;
+	}
+	dispatch(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &disconnected);
+
+}
+
+/**
+ * Brings the link down, and posts WIFI_EVENT_STA_DISCONNECTED.
+ */
+static void link_down(uint8_t reason) {
+
+	if (link_state == LINK_UP) {
+		stats.up_us += sim_now_us() - up_since_us;
+		if (reason == REASON_ASSOC_LEAVE) {
+			stats.disconnects++;
+		} else {
+			stats.drops++;
+		}
+		lost_at_us = sim_now_us();
+		outage_pending = true;
+	}
+	link_state = LINK_IDLE;
+	generation++;
+	disconnected.reason = reason;
+	sim_schedule(sim_now_us(), disconnected_event, NULL, generation);
+
+}
+
+static void link_lost_event(void *arg, uint64_t tag) {
+
+	if (tag != generation || link_state != LINK_UP) {
+		return;
+	}
+	link_down(REASON_BEACON_TIMEOUT);
+
+}
+
+/**
+ * Loses the link when the RSSI of its access point falls below the
+ * sensitivity, as long as some RSSI varies.
+ */
+static void radio_check_event(void *arg, uint64_t tag) {
+
+	radio_check_scheduled = false;
+	if (link_state != LINK_IDLE && !ap_heard(link_ap)) {
+		link_down(REASON_BEACON_TIMEOUT);
+	}
+	for (uint8_t i = 0; i < sim_wifi_config.ap_count; i++) {
+		if (aps[i].to_us > sim_now_us()) {
+			radio_check_scheduled = true;
+			sim_schedule(sim_now_us() + RADIO_CHECK_PERIOD_US, radio_check_event, NULL, 0);
+			return;
+		}
+	}
+
+}
+
+static void scan_done_event(void *arg, uint64_t tag) {
+
+	scanning = false;
+	scan_count = 0;
+	for (uint8_t i = 0; i < sim_wifi_config.ap_count; i++) {
+		if (ap_heard(i)) {
+			fill_record(i, &scan_records[scan_count]);
+			scan_count++;
+		}
+	}
+	dispatch(WIFI_EVENT, WIFI_EVENT_SCAN_DONE, NULL);
+
+}
+
+static void got_ip_event(void *arg, uint64_t tag) {
+
+	if (tag != generation || link_state != LINK_ASSOCIATED) {
+		return;
+	}
+	link_state = LINK_UP;
+	up_since_us = sim_now_us();
+	stats.leases++;
+	if (outage_pending) {
+		latency_stats_add(&stats.outage, (uint32_t)(sim_now_us() - lost_at_us));
+		outage_pending = false;
+	}
+	if (sim_wifi_config.link_mtbf_s > 0) {
+		// Exponentially distributed link lifetime.
+		double lifetime_s = -log(1.0 - sim_random_unit()) * sim_wifi_config.link_mtbf_s;
+		sim_schedule(sim_now_us() + (uint64_t)(lifetime_s * 1e6), link_lost_event, NULL,
+				     generation);
+	}
+	dispatch(IP_EVENT, IP_EVENT_STA_GOT_IP, &got_ip);
+
+}
+
+static void associated_event(void *arg, uint64_t tag) {
+
+	if (tag != generation || link_state != LINK_ASSOCIATING) {
+		return;
+	}
+	bool heard = ap_heard(link_ap);
+	if (!heard || sim_random_hit(sim_wifi_config.connect_fail_p)) {
+		stats.failures++;
+		link_down(heard ? REASON_4WAY_HANDSHAKE_TIMEOUT : REASON_NO_AP_FOUND);
+		return;
+	}
+	stats.associations[link_ap]++;
+	link_state = LINK_ASSOCIATED;
+	uint64_t delay_ms = sim_random_range(sim_wifi_config.dhcp_min_ms,
+			                             sim_wifi_config.dhcp_max_ms);
+	sim_schedule(sim_now_us() + delay_ms * 1000, got_ip_event, NULL, generation);
+
+}
+
+void sim_wifi_init(void) {
+
+	memset(&stats, 0, sizeof(sim_wifi_stats_t));
+	latency_stats_reset(&stats.outage);
+	if (sim_wifi_config.ap_count < 1) {
+		sim_wifi_config.ap_count = 1;
+	}
+	if (sim_wifi_config.ap_count > SIM_WIFI_MAX_APS) {
+		sim_wifi_config.ap_count = SIM_WIFI_MAX_APS;
+	}
+	for (uint8_t i = 0; i < SIM_WIFI_MAX_APS; i++) {
+		aps[i].available = i < sim_wifi_config.ap_count;
+		aps[i].from_rssi = -50.0 - 10.0 * i;
+		aps[i].to_rssi = aps[i].from_rssi;
+		aps[i].from_us = 0;
+		aps[i].to_us = 0;
+	}
+
+}
+
+esp_err_t esp_event_loop_create_default(void) {
+	return ESP_OK;
+}
+
+esp_err_t esp_event_handler_register(esp_event_base_t event_base, int32_t event_id,
+		                             esp_event_handler_t handler, void *arg) {
+
+	if (handler_count == MAX_HANDLERS) {
+		return ESP_ERR_NO_MEM;
+	}
+	handlers[handler_count].base = event_base;
+	handlers[handler_count].id = event_id;
+	handlers[handler_count].handler = handler;
+	handlers[handler_count].arg = arg;
+	handler_count++;
+	return ESP_OK;
+
+}
+
+esp_err_t esp_netif_init(void) {
+	return ESP_OK;
+}
+
+esp_netif_t *esp_netif_create_default_wifi_sta(void) {
+
+	static int netif;
+	return (esp_netif_t *)&netif;
+
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config) {
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode) {
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_config(esp_interface_t interface, wifi_config_t *config) {
+
+	configured_ap = -1;
+	if (config->sta.bssid_set) {
+		for (uint8_t i = 0; i < sim_wifi_config.ap_count; i++) {
+			uint8_t bssid[6];
+			ap_bssid(i, bssid);
+			if (memcmp(bssid, config->sta.bssid, 6) == 0) {
+				configured_ap = i;
+			}
+		}
+	}
+	return ESP_OK;
+
+}
+
+esp_err_t esp_wifi_start(void) {
+
+	// As with ESP-IDF, WIFI_EVENT_STA_START is posted only once.
+	if (!started) {
+		started = true;
+		sim_schedule(sim_now_us() + START_DELAY_US, sta_start_event, NULL, 0);
+	}
+	return ESP_OK;
+
+}
+
+esp_err_t esp_wifi_connect(void) {
+
+	if (!started) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	stats.connects++;
+	generation++;
+	link_state = LINK_ASSOCIATING;
+	if (configured_ap >= 0) {
+		link_ap = (uint8_t)configured_ap;
+	} else {
+		// Strongest access point.
+		link_ap = 0;
+		for (uint8_t i = 1; i < sim_wifi_config.ap_count; i++) {
+			if (ap_rssi(i) > ap_rssi(link_ap)) {
+				link_ap = i;
+			}
+		}
+	}
+	uint64_t delay_ms = sim_random_range(sim_wifi_config.connect_min_ms,
+			                             sim_wifi_config.connect_max_ms);
+	sim_schedule(sim_now_us() + delay_ms * 1000, associated_event, NULL, generation);
+	return ESP_OK;
+
+}
+
+esp_err_t esp_wifi_disconnect(void) {
+
+	if (link_state != LINK_IDLE) {
+		link_down(REASON_ASSOC_LEAVE);
+	}
+	return ESP_OK;
+
+}
+
+esp_err_t esp_wifi_scan_start(const wifi_scan_config_t *config, bool block) {
+
+	// All channels are scanned, and the scan never blocks.
+	if (!started || scanning || link_state == LINK_ASSOCIATING ||
+		link_state == LINK_ASSOCIATED) {
+		return ESP_ERR_WIFI_STATE;
+	}
+	scanning = true;
+	stats.scans++;
+	sim_schedule(sim_now_us() + (uint64_t)sim_wifi_config.scan_ms * 1000, scan_done_event,
+			     NULL, 0);
+	return ESP_OK;
+
+}
+
+esp_err_t esp_wifi_scan_get_ap_records(uint16_t *number, wifi_ap_record_t *ap_records) {
+
+	if (*number > scan_count) {
+		*number = scan_count;
+	}
+	memcpy(ap_records, scan_records, *number * sizeof(wifi_ap_record_t));
+	// As with ESP-IDF, the results are freed.
+	scan_count = 0;
+	return ESP_OK;
+
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info) {
+
+	if (link_state != LINK_ASSOCIATED && link_state != LINK_UP) {
+		return ESP_ERR_WIFI_NOT_CONNECT;
+	}
+	fill_record(link_ap, ap_info);
+	return ESP_OK;
+
+}
+
+void sim_wifi_drop(void) {
+
+	if (link_state == LINK_UP) {
+		link_down(REASON_BEACON_TIMEOUT);
+	}
+
+}
+
+void sim_wifi_set_ap(bool available) {
+
+	for (uint8_t i = 0; i < sim_wifi_config.ap_count; i++) {
+		aps[i].available = available;
+	}
+	if (!available) {
+		sim_wifi_drop();
+	}
+
+}
+
+void sim_wifi_set_rssi(uint8_t ap, double rssi_dbm, double ramp_s) {
+
+	if (ap >= sim_wifi_config.ap_count) {
+		return;
+	}
+	aps[ap].from_rssi = ap_rssi(ap);
+	aps[ap].from_us = sim_now_us();
+	aps[ap].to_rssi = rssi_dbm;
+	aps[ap].to_us = sim_now_us() + (uint64_t)(ramp_s * 1e6);
+	if (!radio_check_scheduled) {
+		radio_check_scheduled = true;
+		sim_schedule(sim_now_us(), radio_check_event, NULL, 0);
+	}
+
+}
+
+bool sim_wifi_is_up(void) {
+	return link_state == LINK_UP;
+}
+
+void sim_wifi_get_stats(sim_wifi_stats_t *wifi_stats) {
+
+	*wifi_stats = stats;
+	if (link_state == LINK_UP) {
+		wifi_stats->up_us += sim_now_us() - up_since_us;
+	}
+
+}
@@ -0,0 +1,356 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+/**
+ * Host side of time synchronization.
+ *
+ * Without option, answers time requests received on the given port, with
+ * the host time (CLOCK_REALTIME), and prints received data frames, with
+ * their one-way latency when their timestamp is synchronized. Fragmented
+ * records are reassembled (see host/reassembly.h), and printed once
+ * complete. Data frames lost and rebuilt from parity frames (see
+ * host/fec_decoder.h) are printed as recovered. Records of a known schema
+ * (see main/record_schemas.h) are printed field by field.
+ *
+ * With -t, checks the accuracy of time synchronization on the loopback
+ * interface: a responder thread is started, and the device side of time
+ * synchronization (main/time_sync.c) is run against it, with a simulated
+ * device clock that has an offset and a drift. Exit status is 1 if the
+ * final error is greater than the allowed one (-e).
+ *
+ * Build:
+ *   gcc -O2 -Wall -I main -I host -o time_sync_responder host/time_sync_responder.c \
+ *       host/reassembly.c host/fec_decoder.c main/fec.c main/fragment.c \
+ *       main/record.c main/time_sync.c main/frame.c -lpthread
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fec_decoder.h"
+#include "frame.h"
+#include "reassembly.h"
+#include "record.h"
+#include "time_sync.h"
+
+#define DEFAULT_PORT 44444
+
+// Reassembly bounds.
+#define REASSEMBLY_MAX_RECORDS 64
+#define REASSEMBLY_MAX_BYTES (16 * 1024 * 1024)
+#define REASSEMBLY_TIMEOUT_US 5000000
+#define FEC_HISTORY 1024
+#define FEC_MAX_BLOCKS 64
+
+// Simulated device clock, for the accuracy check.
+#define CHECK_OFFSET_US 1500000LL
+#define CHECK_DRIFT_PPM 40.0
+#define CHECK_EXCHANGES 40
+#define CHECK_PERIOD_US 200000
+
+static uint64_t realtime_us(void) {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+}
+
+/**
+ * Receives datagrams on sock forever, and answers time requests.
+ */
+static void serve(int sock, bool verbose) {
+
+	uint8_t buffer[1500];
+	uint8_t response_buffer[FRAME_TIME_RESPONSE_LENGTH];
+	struct sockaddr_in from;
+	socklen_t from_length;
+	frame_header_t header;
+	const uint8_t *record;
+	uint32_t record_length;
+	char text[256];
+
+	reassembly_t *reassembly = reassembly_create(REASSEMBLY_MAX_RECORDS,
+			                                     REASSEMBLY_MAX_BYTES,
+												 REASSEMBLY_TIMEOUT_US);
+	if (reassembly == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return;
+	}
+	fec_decoder_t *fec = fec_decoder_create(FEC_HISTORY, FEC_MAX_BLOCKS);
+	if (fec == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		reassembly_destroy(reassembly);
+		return;
+	}
+	while (true) {
+		from_length = sizeof(from);
+		ssize_t length = recvfrom(sock, buffer, sizeof(buffer), 0,
+				                  (struct sockaddr *)&from, &from_length);
+		uint64_t t2 = realtime_us();
+		if (length < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("recvfrom");
+			reassembly_destroy(reassembly);
+			fec_decoder_destroy(fec);
+			return;
+		}
+		if (!frame_decode_header(buffer, (uint16_t)length, &header)) {
+			if (verbose) {
+				printf("%s:%d - %zd bytes, no header\n", inet_ntoa(from.sin_addr),
+					   ntohs(from.sin_port), length);
+			}
+			continue;
+		}
+		if (header.type == FRAME_TIME_REQUEST) {
+			frame_time_response_t response = {
+				.header = {
+					.version = FRAME_VERSION,
+					.type = FRAME_TIME_RESPONSE,
+					.flags = 0,
+					.stream_id = header.stream_id,
+					.seq = header.seq,
+				},
+				.t1_us = header.timestamp_us,
+				.t2_us = t2,
+			};
+			response.t3_us = realtime_us();
+			response.header.timestamp_us = response.t3_us;
+			frame_encode_time_response(&response, response_buffer);
+			if (sendto(sock, response_buffer, sizeof(response_buffer), 0,
+					   (struct sockaddr *)&from, from_length) < 0) {
+				perror("sendto");
+			}
+			continue;
+		}
+		fec_decoder_rs_t fec_rs = fec_decoder_add(fec, buffer, (uint16_t)length);
+		const uint8_t *recovered;
+		uint16_t recovered_length;
+		while (fec_decoder_next(fec, &recovered, &recovered_length)) {
+			frame_header_t recovered_header;
+			if (verbose && frame_decode_header(recovered, recovered_length, &recovered_header)) {
+				printf("%s:%d - type %d, stream %d, epoch %u, seq %u, %u bytes, recovered\n",
+					   inet_ntoa(from.sin_addr), ntohs(from.sin_port),
+					   recovered_header.type, recovered_header.stream_id,
+					   recovered_header.epoch, recovered_header.seq, recovered_length);
+			}
+		}
+		if (fec_rs == FEC_DECODER_PARITY || fec_rs == FEC_DECODER_DUPLICATE ||
+			fec_rs == FEC_DECODER_INVALID) {
+			continue;
+		}
+		const uint8_t *payload = &buffer[FRAME_HEADER_LENGTH];
+		if ((header.flags & FRAME_FLAG_FRAGMENT) != 0) {
+			reassembly_rs_t rs = reassembly_add(reassembly, buffer, (uint16_t)length, t2,
+					                            &header, &record, &record_length);
+			if (rs != REASSEMBLY_COMPLETE) {
+				if (verbose && rs != REASSEMBLY_INCOMPLETE) {
+					printf("%s:%d - fragment rejected: %d\n", inet_ntoa(from.sin_addr),
+						   ntohs(from.sin_port), rs);
+				}
+				continue;
+			}
+			payload = record;
+			length = FRAME_HEADER_LENGTH + record_length;
+		}
+		if (verbose) {
+			printf("%s:%d - type %d, stream %d, epoch %u, seq %u, %zd bytes",
+				   inet_ntoa(from.sin_addr), ntohs(from.sin_port),
+				   header.type, header.stream_id, header.epoch, header.seq, length);
+			if ((header.flags & FRAME_FLAG_TIME_SYNCED) != 0) {
+				printf(", one-way latency %lld us",
+					   (long long)(t2 - header.timestamp_us));
+			}
+			if (header.type == FRAME_DATA && (header.flags & FRAME_FLAG_ENCRYPTED) == 0 &&
+				record_format(payload, (uint32_t)(length - FRAME_HEADER_LENGTH),
+						      text, sizeof(text)) > 0) {
+				printf(", %s", text);
+			}
+			printf("\n");
+		}
+	}
+
+}
+
+static int open_socket(uint16_t port, const char *address) {
+
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0) {
+		perror("socket");
+		return -1;
+	}
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = inet_addr(address);
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		close(sock);
+		return -1;
+	}
+	return sock;
+
+}
+
+static void *serve_thread(void *arg) {
+
+	serve(*(int *)arg, false);
+	return NULL;
+
+}
+
+/**
+ * Simulated device clock: local = real * (1 + drift) - offset.
+ */
+static uint64_t device_us(uint64_t start_real_us, uint64_t real_us) {
+
+	double elapsed = (double)(real_us - start_real_us);
+	return (uint64_t)((double)(start_real_us - CHECK_OFFSET_US) +
+			          elapsed * (1.0 + CHECK_DRIFT_PPM / 1e6));
+
+}
+
+static int check_accuracy(int64_t allowed_error_us) {
+
+	int server_sock = open_socket(0, "127.0.0.1");
+	if (server_sock < 0) {
+		return 1;
+	}
+	struct sockaddr_in server_addr;
+	socklen_t addr_length = sizeof(server_addr);
+	getsockname(server_sock, (struct sockaddr *)&server_addr, &addr_length);
+	pthread_t thread;
+	pthread_create(&thread, NULL, serve_thread, &server_sock);
+
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0 || connect(sock, (struct sockaddr *)&server_addr, addr_length) < 0) {
+		perror("client socket");
+		return 1;
+	}
+	struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	time_sync_init();
+	uint64_t start_us = realtime_us();
+	uint8_t request[FRAME_HEADER_LENGTH];
+	uint8_t buffer[FRAME_TIME_RESPONSE_LENGTH];
+	int64_t error_us = 0;
+	int64_t max_error_us = 0;
+
+	for (uint32_t i = 0; i < CHECK_EXCHANGES; i++) {
+		frame_header_t header = {
+			.version = FRAME_VERSION,
+			.type = FRAME_TIME_REQUEST,
+			.stream_id = TIME_SYNC_STREAM_ID,
+			.seq = i,
+		};
+		header.timestamp_us = device_us(start_us, realtime_us());
+		frame_encode_header(&header, request);
+		time_sync_request_sent(header.timestamp_us);
+		if (send(sock, request, sizeof(request), 0) < 0) {
+			perror("send");
+			return 1;
+		}
+		ssize_t length = recv(sock, buffer, sizeof(buffer), 0);
+		uint64_t t4 = device_us(start_us, realtime_us());
+		if (length < 0) {
+			perror("recv");
+			continue;
+		}
+		time_sync_process_response(buffer, (uint16_t)length, t4);
+		usleep(CHECK_PERIOD_US);
+
+		uint64_t real = realtime_us();
+		error_us = (int64_t)(time_sync_to_remote(device_us(start_us, real)) - real);
+		int64_t abs_error = error_us < 0 ? -error_us : error_us;
+		if (i >= CHECK_EXCHANGES / 2 && abs_error > max_error_us) {
+			max_error_us = abs_error;
+		}
+	}
+
+	time_sync_stats_t stats;
+	time_sync_get_stats(&stats);
+	printf("Samples: %u, rejected: %u, lowest delay: %u us\n",
+		   stats.samples, stats.rejected, stats.delay_us);
+	printf("Estimated drift: %.3f ppm (simulated: %.3f ppm)\n",
+		   stats.drift_ppb / 1000.0, CHECK_DRIFT_PPM);
+	printf("Final error: %lld us, max error over last %d exchanges: %lld us\n",
+		   (long long)error_us, CHECK_EXCHANGES / 2, (long long)max_error_us);
+	close(sock);
+	return max_error_us <= allowed_error_us ? 0 : 1;
+
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [-p port] [-q] | -t [-e allowed_error_us]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+
+	uint16_t port = DEFAULT_PORT;
+	bool check = false;
+	bool verbose = true;
+	int64_t allowed_error_us = 1000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:qte:")) != -1) {
+		switch (opt) {
+		case 'p':
+			port = (uint16_t)atoi(optarg);
+			break;
+		case 'q':
+			verbose = false;
+			break;
+		case 't':
+			check = true;
+			break;
+		case 'e':
+			allowed_error_us = atoll(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (check) {
+		return check_accuracy(allowed_error_us);
+	}
+	int sock = open_socket(port, "0.0.0.0");
+	if (sock < 0) {
+		return 1;
+	}
+	printf("Waiting for datagrams on port %d\n", port);
+	serve(sock, verbose);
+	return 1;
+
+}
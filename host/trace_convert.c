@@ -0,0 +1,425 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+/**
+ * Converts a trace dump (see main/trace_format.h) into Chrome trace event
+ * JSON, which can be opened with https://ui.perfetto.dev or
+ * chrome://tracing.
+ *
+ * Without -p, the dump is read from a console log (file or standard
+ * input), between the "TRACE BEGIN" and "TRACE END" lines. With -p, the
+ * dump is received over UDP, as FRAME_TRACE frames sent by the device.
+ *
+ * Every task is a thread. A message is a slice, from its dequeue to the
+ * next wait of the task, with sendto() calls nested in it. Message types
+ * and states are the values of message_type_t (main/messages.h) and of the
+ * state_t of the task. States are also given as counters.
+ *
+ * Build:
+ *   gcc -O2 -Wall -I main -o trace_convert host/trace_convert.c main/frame.c
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "frame.h"
+#include "trace_format.h"
+
+#define DEFAULT_PORT 44444
+
+// Largest dump accepted.
+#define MAX_DUMP (1024 * 1024)
+
+// Receive timeout, once the first trace frame has been received.
+#define RECEIVE_TIMEOUT_S 5
+
+#define MAX_TASK_ID 255
+
+typedef struct {
+	char name[TRACE_TASK_NAME_LENGTH + 1];
+	uint8_t depth;           // Open slices.
+} task_t;
+
+static task_t tasks[MAX_TASK_ID + 1];
+
+static const char *type_name(uint8_t type) {
+
+	switch (type) {
+	case TRACE_WAIT: return "wait";
+	case TRACE_DEQUEUE: return "dequeue";
+	case TRACE_STATE: return "state";
+	case TRACE_TIMER_START: return "timer start";
+	case TRACE_TIMER_EXPIRY: return "timer expiry";
+	case TRACE_WIFI_EVENT: return "wifi event";
+	case TRACE_SEND_BEGIN: return "sendto";
+	case TRACE_SEND_END: return "sendto end";
+	default: return "unknown";
+	}
+
+}
+
+/**
+ * Reads a dump from a console log. Returns its length, or 0 on error.
+ */
+static uint32_t read_log(FILE *file, uint8_t *dump) {
+
+	char line[512];
+	uint32_t length = 0;
+	uint32_t received = 0;
+	bool started = false;
+
+	while (fgets(line, sizeof(line), file) != NULL) {
+		// Lines may be prefixed by the monitor or by a timestamp.
+		char *text = strstr(line, "TRACE ");
+		if (text == NULL) {
+			continue;
+		}
+		if (sscanf(text, "TRACE BEGIN %u", &length) == 1) {
+			if (length > MAX_DUMP) {
+				fprintf(stderr, "Dump too long: %u bytes\n", length);
+				return 0;
+			}
+			started = true;
+			received = 0;
+			continue;
+		}
+		if (!started) {
+			continue;
+		}
+		if (strncmp(text, "TRACE END", 9) == 0) {
+			if (received != length) {
+				fprintf(stderr, "Incomplete dump: %u bytes out of %u\n", received, length);
+				return 0;
+			}
+			return length;
+		}
+		uint32_t offset;
+		int consumed;
+		if (sscanf(text, "TRACE %x %n", &offset, &consumed) != 1) {
+			continue;
+		}
+		const char *hex = text + consumed;
+		while (offset < length && hex[0] != '\0' && hex[1] != '\0' && hex[0] != '\n') {
+			unsigned int value;
+			if (sscanf(hex, "%2x", &value) != 1) {
+				break;
+			}
+			dump[offset++] = (uint8_t)value;
+			received++;
+			hex += 2;
+		}
+	}
+	fprintf(stderr, "No complete dump found\n");
+	return 0;
+
+}
+
+/**
+ * Receives a dump over UDP. Returns its length, or 0 on error.
+ */
+static uint32_t receive_dump(uint16_t port, uint8_t *dump) {
+
+	static bool chunks[MAX_DUMP / TRACE_CHUNK_LENGTH + 1];
+	uint8_t frame[FRAME_HEADER_LENGTH + TRACE_CHUNK_LENGTH];
+	uint32_t length = 0;
+	uint32_t chunk_count = 0;
+	uint32_t received = 0;
+
+	int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock < 0) {
+		perror("socket");
+		return 0;
+	}
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	if (bind(sock, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		perror("bind");
+		close(sock);
+		return 0;
+	}
+	fprintf(stderr, "Waiting for a trace on port %u\n", port);
+	while (chunk_count == 0 || received < chunk_count) {
+		ssize_t frame_length = recv(sock, frame, sizeof(frame), 0);
+		if (frame_length < 0) {
+			fprintf(stderr, "Timeout: %u chunks out of %u\n", received, chunk_count);
+			close(sock);
+			return 0;
+		}
+		frame_header_t header;
+		if (!frame_decode_header(frame, (uint16_t)frame_length, &header) ||
+			header.type != FRAME_TRACE || header.stream_id != TRACE_STREAM_ID) {
+			continue;
+		}
+		uint32_t offset = header.seq * TRACE_CHUNK_LENGTH;
+		uint32_t chunk_length = (uint32_t)frame_length - FRAME_HEADER_LENGTH;
+		if (header.seq > MAX_DUMP / TRACE_CHUNK_LENGTH || offset + chunk_length > MAX_DUMP) {
+			continue;
+		}
+		if (received == 0) {
+			// Once started, do not wait forever for lost chunks.
+			struct timeval timeout = { RECEIVE_TIMEOUT_S, 0 };
+			setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		}
+		if (chunks[header.seq]) {
+			continue;
+		}
+		chunks[header.seq] = true;
+		received++;
+		memcpy(&dump[offset], &frame[FRAME_HEADER_LENGTH], chunk_length);
+		if (header.seq == 0 && chunk_length >= TRACE_HEADER_LENGTH) {
+			uint8_t task_count = dump[5];
+			uint32_t record_count = frame_get_u32(&dump[12]);
+			length = TRACE_HEADER_LENGTH + task_count * TRACE_TASK_LENGTH +
+					 record_count * TRACE_RECORD_LENGTH;
+			if (length > MAX_DUMP) {
+				fprintf(stderr, "Dump too long: %u bytes\n", length);
+				close(sock);
+				return 0;
+			}
+			chunk_count = (length + TRACE_CHUNK_LENGTH - 1) / TRACE_CHUNK_LENGTH;
+		}
+	}
+	close(sock);
+	return length;
+
+}
+
+static void print_event(FILE *out, bool *first, const char *name, const char *phase,
+		                double ts_us, uint8_t task, const char *args) {
+
+	fprintf(out, "%s\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%u",
+			*first ? "" : ",", name, phase, ts_us, task);
+	if (phase[0] == 'i') {
+		fprintf(out, ",\"s\":\"t\"");
+	}
+	if (args != NULL) {
+		fprintf(out, ",\"args\":{%s}", args);
+	}
+	fprintf(out, "}");
+	*first = false;
+
+}
+
+/**
+ * Writes the JSON trace. Returns false if the dump is invalid.
+ */
+static bool convert(const uint8_t *dump, uint32_t length, FILE *out) {
+
+	if (length < TRACE_HEADER_LENGTH || memcmp(dump, TRACE_MAGIC, 4) != 0 ||
+		dump[4] != TRACE_VERSION) {
+		fprintf(stderr, "Not a trace dump, or unsupported version\n");
+		return false;
+	}
+	uint8_t task_count = dump[5];
+	uint16_t cpu_mhz = frame_get_u16(&dump[6]);
+	uint16_t tick_hz = frame_get_u16(&dump[8]);
+	uint32_t record_count = frame_get_u32(&dump[12]);
+	const uint8_t *task_entries = &dump[TRACE_HEADER_LENGTH];
+	const uint8_t *records = &task_entries[task_count * TRACE_TASK_LENGTH];
+	if (cpu_mhz == 0 || tick_hz == 0 ||
+		length < TRACE_HEADER_LENGTH + task_count * TRACE_TASK_LENGTH +
+		         record_count * TRACE_RECORD_LENGTH) {
+		fprintf(stderr, "Invalid trace header\n");
+		return false;
+	}
+
+	bool first = true;
+	char text[128];
+	fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	snprintf(text, sizeof(text), "\"name\":\"unknown\"");
+	print_event(out, &first, "thread_name", "M", 0.0, TRACE_UNKNOWN_TASK, text);
+	for (uint8_t i = 0; i < task_count; i++) {
+		const uint8_t *entry = &task_entries[i * TRACE_TASK_LENGTH];
+		task_t *task = &tasks[entry[0]];
+		memcpy(task->name, &entry[1], TRACE_TASK_NAME_LENGTH);
+		task->name[TRACE_TASK_NAME_LENGTH] = '\0';
+		snprintf(text, sizeof(text), "\"name\":\"%s\"", task->name);
+		print_event(out, &first, "thread_name", "M", 0.0, entry[0], text);
+	}
+
+	// 64-bit cycle count, the tick count telling how many times the 32-bit
+	// counter wrapped around between two records.
+	int64_t cycles = 0;
+	uint32_t previous_ccount = 0;
+	uint32_t previous_tick = 0;
+	double cycles_per_tick = cpu_mhz * 1e6 / tick_hz;
+	for (uint32_t i = 0; i < record_count; i++) {
+		const uint8_t *record = &records[i * TRACE_RECORD_LENGTH];
+		uint32_t ccount = frame_get_u32(&record[0]);
+		uint32_t tick = frame_get_u32(&record[4]);
+		uint8_t task_id = record[8];
+		uint8_t type = record[9];
+		uint16_t a = frame_get_u16(&record[10]);
+		uint32_t b = frame_get_u32(&record[12]);
+		if (i > 0) {
+			double expected = (double)(uint32_t)(tick - previous_tick) * cycles_per_tick;
+			int64_t delta = (int64_t)(uint32_t)(ccount - previous_ccount);
+			// Also handles small negative deltas, between the two cores.
+			int64_t wraps = (int64_t)((expected - (double)delta) / 4294967296.0 +
+					                  ((expected >= (double)delta) ? 0.5 : -0.5));
+			cycles += delta + wraps * 4294967296LL;
+		}
+		previous_ccount = ccount;
+		previous_tick = tick;
+		double ts_us = (double)cycles / cpu_mhz;
+		task_t *task = &tasks[task_id];
+
+		switch (type) {
+		case TRACE_WAIT:
+			while (task->depth > 0) {
+				print_event(out, &first, "message", "E", ts_us, task_id, NULL);
+				task->depth--;
+			}
+			break;
+		case TRACE_DEQUEUE:
+			while (task->depth > 0) {
+				print_event(out, &first, "message", "E", ts_us, task_id, NULL);
+				task->depth--;
+			}
+			snprintf(text, sizeof(text), "message %u", a);
+			print_event(out, &first, text, "B", ts_us, task_id, NULL);
+			task->depth++;
+			break;
+		case TRACE_STATE:
+			snprintf(text, sizeof(text), "state %u -> %u", b, a);
+			print_event(out, &first, text, "i", ts_us, task_id, NULL);
+			snprintf(text, sizeof(text), "\"state\":%u", a);
+			{
+				char name[64];
+				snprintf(name, sizeof(name), "%s state", task->name);
+				print_event(out, &first, name, "C", ts_us, task_id, text);
+			}
+			break;
+		case TRACE_TIMER_START:
+			snprintf(text, sizeof(text), "timer start %u", a);
+			{
+				char args[32];
+				snprintf(args, sizeof(args), "\"period_ms\":%u", b);
+				print_event(out, &first, text, "i", ts_us, task_id, args);
+			}
+			break;
+		case TRACE_TIMER_EXPIRY:
+			snprintf(text, sizeof(text), "timer expiry %u", a);
+			print_event(out, &first, text, "i", ts_us, task_id, NULL);
+			break;
+		case TRACE_WIFI_EVENT:
+			snprintf(text, sizeof(text), "%s %u", b == 1 ? "IP_EVENT" : "WIFI_EVENT", a);
+			print_event(out, &first, text, "i", ts_us, task_id, NULL);
+			break;
+		case TRACE_SEND_BEGIN:
+			snprintf(text, sizeof(text), "\"length\":%u", a);
+			print_event(out, &first, "sendto", "B", ts_us, task_id, text);
+			task->depth++;
+			break;
+		case TRACE_SEND_END:
+			if (task->depth == 0) {
+				// Begin record overwritten.
+				break;
+			}
+			snprintf(text, sizeof(text), "\"errno\":%u", b);
+			print_event(out, &first, "sendto", "E", ts_us, task_id, text);
+			task->depth--;
+			break;
+		default:
+			snprintf(text, sizeof(text), "%s %u %u", type_name(type), a, b);
+			print_event(out, &first, text, "i", ts_us, task_id, NULL);
+			break;
+		}
+	}
+	fprintf(out, "\n]}\n");
+	fprintf(stderr, "%u records, %.3f ms\n", record_count, (double)cycles / cpu_mhz / 1000.0);
+	return true;
+
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [-p port] [-o output.json] [log_file]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+
+	static uint8_t dump[MAX_DUMP];
+	const char *output_path = NULL;
+	uint16_t port = 0;
+	int option;
+
+	while ((option = getopt(argc, argv, "p:o:")) != -1) {
+		switch (option) {
+		case 'p':
+			port = (uint16_t)atoi(optarg);
+			if (port == 0) {
+				port = DEFAULT_PORT;
+			}
+			break;
+		case 'o':
+			output_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	uint32_t length;
+	if (port != 0) {
+		length = receive_dump(port, dump);
+	} else {
+		FILE *in = stdin;
+		if (optind < argc) {
+			in = fopen(argv[optind], "r");
+			if (in == NULL) {
+				perror(argv[optind]);
+				return 1;
+			}
+		}
+		length = read_log(in, dump);
+		if (in != stdin) {
+			fclose(in);
+		}
+	}
+	if (length == 0) {
+		return 1;
+	}
+
+	FILE *out = stdout;
+	if (output_path != NULL) {
+		out = fopen(output_path, "w");
+		if (out == NULL) {
+			perror(output_path);
+			return 1;
+		}
+	}
+	bool rs = convert(dump, length, out);
+	if (out != stdout) {
+		fclose(out);
+	}
+	return rs ? 0 : 1;
+
+}
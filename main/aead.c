@@ -0,0 +1,261 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aead.h"
+#include "fragment.h"
+#include "frame.h"
+
+// Header bytes authenticated as additional data: all but the timestamp. The
+// boot epoch is written at send time, but does not change during a boot.
+#define AAD_LENGTH FRAME_TIMESTAMP_OFFSET
+
+// The fragment header of a fragment is authenticated too.
+#define MAX_AAD_LENGTH (AAD_LENGTH + FRAGMENT_HEADER_LENGTH)
+
+// Flags written at send time, not authenticated.
+#define MUTABLE_FLAGS (FRAME_FLAG_RETRANSMIT | FRAME_FLAG_TIME_SYNCED)
+
+static bool is_fragment(const uint8_t *header) {
+	return (header[2] & FRAME_FLAG_FRAGMENT) != 0;
+}
+
+/**
+ * Returns the number of bytes left in clear in front of the salt: the
+ * header, followed by the fragment header for a fragment.
+ */
+static uint16_t clear_length(const uint8_t *header) {
+	return is_fragment(header) ? FRAGMENT_OVERHEAD : FRAME_HEADER_LENGTH;
+}
+
+/**
+ * header is followed by the fragment header for a fragment.
+ */
+static void build_nonce(const uint8_t *salt, const uint8_t *header, uint8_t *nonce) {
+
+	memcpy(nonce, salt, AEAD_SALT_LENGTH);
+	nonce[AEAD_SALT_LENGTH] = header[1];          // Type.
+	nonce[AEAD_SALT_LENGTH + 1] = header[3];      // Stream identifier.
+	memcpy(&nonce[AEAD_SALT_LENGTH + 2], &header[4], 4);  // Sequence number.
+	if (is_fragment(header)) {
+		// All fragments of a record carry its sequence number.
+		nonce[AEAD_SALT_LENGTH - 2] ^= header[FRAME_HEADER_LENGTH];      // Index.
+		nonce[AEAD_SALT_LENGTH - 1] ^= header[FRAME_HEADER_LENGTH + 1];
+	}
+
+}
+
+/**
+ * Returns the length of the additional data.
+ */
+static uint16_t build_aad(const uint8_t *header, uint8_t *aad) {
+
+	memcpy(aad, header, AAD_LENGTH);
+	aad[2] &= ~MUTABLE_FLAGS;
+	if (!is_fragment(header)) {
+		return AAD_LENGTH;
+	}
+	memcpy(&aad[AAD_LENGTH], &header[FRAME_HEADER_LENGTH], FRAGMENT_HEADER_LENGTH);
+	return MAX_AAD_LENGTH;
+
+}
+
+bool aead_init(aead_t *aead, aead_mode_t mode, const uint8_t *key, uint8_t key_length) {
+
+	int rs;
+
+	if (key_length != 16 && key_length != 24 && key_length != 32) {
+		return false;
+	}
+	aead->mode = mode;
+	memset(aead->salt, 0, AEAD_SALT_LENGTH);
+	if (mode == AEAD_GCM) {
+		mbedtls_gcm_init(&aead->gcm);
+		rs = mbedtls_gcm_setkey(&aead->gcm, MBEDTLS_CIPHER_ID_AES, key, key_length * 8);
+	} else {
+		mbedtls_ccm_init(&aead->ccm);
+		rs = mbedtls_ccm_setkey(&aead->ccm, MBEDTLS_CIPHER_ID_AES, key, key_length * 8);
+	}
+	if (rs != 0) {
+		aead_free(aead);
+		return false;
+	}
+	return true;
+
+}
+
+void aead_free(aead_t *aead) {
+
+	if (aead->mode == AEAD_GCM) {
+		mbedtls_gcm_free(&aead->gcm);
+	} else {
+		mbedtls_ccm_free(&aead->ccm);
+	}
+
+}
+
+void aead_set_salt(aead_t *aead, const uint8_t *salt) {
+	memcpy(aead->salt, salt, AEAD_SALT_LENGTH);
+}
+
+bool aead_seal(aead_t *aead, const uint8_t *frame, uint16_t frame_length,
+		       uint8_t *sealed, uint16_t *sealed_length) {
+
+	uint8_t nonce[AEAD_NONCE_LENGTH];
+	uint8_t aad[MAX_AAD_LENGTH];
+	int rs;
+
+	if (frame_length < FRAME_HEADER_LENGTH) {
+		return false;
+	}
+	uint16_t clear = clear_length(frame);
+	if (frame_length < clear) {
+		return false;
+	}
+	uint16_t payload_length = frame_length - clear;
+	uint8_t *salt = &sealed[clear];
+	uint8_t *ciphertext = &salt[AEAD_SALT_LENGTH];
+	uint8_t *tag = &ciphertext[payload_length];
+
+	memcpy(sealed, frame, clear);
+	sealed[2] |= FRAME_FLAG_ENCRYPTED;
+	memcpy(salt, aead->salt, AEAD_SALT_LENGTH);
+	build_nonce(aead->salt, sealed, nonce);
+	uint16_t aad_length = build_aad(sealed, aad);
+	if (aead->mode == AEAD_GCM) {
+		rs = mbedtls_gcm_crypt_and_tag(&aead->gcm, MBEDTLS_GCM_ENCRYPT, payload_length,
+				                       nonce, AEAD_NONCE_LENGTH, aad, aad_length,
+									   &frame[clear], ciphertext,
+									   AEAD_TAG_LENGTH, tag);
+	} else {
+		rs = mbedtls_ccm_encrypt_and_tag(&aead->ccm, payload_length,
+				                         nonce, AEAD_NONCE_LENGTH, aad, aad_length,
+										 &frame[clear], ciphertext,
+										 tag, AEAD_TAG_LENGTH);
+	}
+	if (rs != 0) {
+		return false;
+	}
+	*sealed_length = frame_length + AEAD_OVERHEAD;
+	return true;
+
+}
+
+bool aead_open(aead_t *aead, const uint8_t *sealed, uint16_t sealed_length,
+		       uint8_t *frame, uint16_t *frame_length) {
+
+	uint8_t nonce[AEAD_NONCE_LENGTH];
+	uint8_t aad[MAX_AAD_LENGTH];
+	int rs;
+
+	if (sealed_length < FRAME_HEADER_LENGTH + AEAD_OVERHEAD ||
+		(sealed[2] & FRAME_FLAG_ENCRYPTED) == 0) {
+		return false;
+	}
+	uint16_t clear = clear_length(sealed);
+	if (sealed_length < clear + AEAD_OVERHEAD) {
+		return false;
+	}
+	uint16_t payload_length = sealed_length - clear - AEAD_OVERHEAD;
+	const uint8_t *salt = &sealed[clear];
+	const uint8_t *ciphertext = &salt[AEAD_SALT_LENGTH];
+	const uint8_t *tag = &ciphertext[payload_length];
+
+	build_nonce(salt, sealed, nonce);
+	uint16_t aad_length = build_aad(sealed, aad);
+	if (aead->mode == AEAD_GCM) {
+		rs = mbedtls_gcm_auth_decrypt(&aead->gcm, payload_length,
+				                      nonce, AEAD_NONCE_LENGTH, aad, aad_length,
+									  tag, AEAD_TAG_LENGTH,
+									  ciphertext, &frame[clear]);
+	} else {
+		rs = mbedtls_ccm_auth_decrypt(&aead->ccm, payload_length,
+				                      nonce, AEAD_NONCE_LENGTH, aad, aad_length,
+									  ciphertext, &frame[clear],
+									  tag, AEAD_TAG_LENGTH);
+	}
+	if (rs != 0) {
+		return false;
+	}
+	memcpy(frame, sealed, clear);
+	frame[2] &= ~FRAME_FLAG_ENCRYPTED;
+	*frame_length = sealed_length - AEAD_OVERHEAD;
+	return true;
+
+}
+
+bool aead_benchmark(aead_t *aead, uint32_t (*cycles)(void), uint16_t iterations,
+		            aead_bench_result_t results[AEAD_BENCH_LENGTHS]) {
+
+	static const uint16_t lengths[AEAD_BENCH_LENGTHS] = { 16, 64, 256, 512, 1024 };
+	const uint16_t max_frame = FRAME_HEADER_LENGTH + 1024;
+	uint16_t sealed_length;
+	uint16_t opened_length;
+	bool rs = true;
+
+	// Not kept in static memory: the benchmark is run once, if ever.
+	uint8_t *frame = malloc(max_frame);
+	uint8_t *sealed = malloc(max_frame + AEAD_OVERHEAD);
+	uint8_t *opened = malloc(max_frame);
+	if (frame == NULL || sealed == NULL || opened == NULL) {
+		free(frame);
+		free(sealed);
+		free(opened);
+		return false;
+	}
+	memset(frame, 0x5a, max_frame);
+	frame_header_t header = {
+		.version = FRAME_VERSION,
+		.type = FRAME_DATA,
+		.flags = 0,
+		.stream_id = 0,
+		.seq = 0,
+	};
+	for (uint8_t i = 0; i < AEAD_BENCH_LENGTHS && rs; i++) {
+		uint16_t frame_length = FRAME_HEADER_LENGTH + lengths[i];
+		uint32_t seal_cycles = 0;
+		uint32_t open_cycles = 0;
+		for (uint16_t n = 0; n < iterations; n++) {
+			header.seq++;
+			frame_encode_header(&header, frame);
+			uint32_t start = cycles();
+			rs = aead_seal(aead, frame, frame_length, sealed, &sealed_length);
+			uint32_t middle = cycles();
+			rs = rs && aead_open(aead, sealed, sealed_length, opened, &opened_length);
+			uint32_t end = cycles();
+			if (!rs) {
+				break;
+			}
+			seal_cycles += middle - start;
+			open_cycles += end - middle;
+		}
+		results[i].payload_length = lengths[i];
+		results[i].seal_cycles = iterations > 0 ? seal_cycles / iterations : 0;
+		results[i].open_cycles = iterations > 0 ? open_cycles / iterations : 0;
+	}
+	free(frame);
+	free(sealed);
+	free(opened);
+	return rs;
+
+}
@@ -0,0 +1,130 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef MAIN_AEAD_H_
+#define MAIN_AEAD_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mbedtls/ccm.h"
+#include "mbedtls/gcm.h"
+
+// Authenticated encryption of frames, with AES-GCM or AES-CCM.
+//
+// A sealed frame is:
+//   header (20 bytes, FRAME_FLAG_ENCRYPTED set) | salt (6 bytes) |
+//   encrypted payload | tag (16 bytes)
+// The 12-byte nonce is the salt, followed by the type, the stream
+// identifier and the sequence number of the header. The salt is drawn at
+// random by the sender when it starts, so that nonces are not reused
+// across restarts. (type, stream identifier, sequence number) must be
+// unique for a given salt: a stream is either reliable or not.
+//
+// All fragments of a record (see fragment.h) carry its sequence number.
+// The fragment header of a fragment is therefore left in clear, between
+// the header and the salt, and authenticated, and the fragment index is
+// XORed into the last two bytes of the salt part of the nonce, so that
+// every fragment has a nonce of its own.
+//
+// The header is authenticated, except for its timestamp and its
+// retransmission and synchronized timestamp flags: they are written at
+// send time, and a retransmitted frame is sealed again into the same
+// bytes, with the same nonce.
+//
+// mbedTLS uses the AES accelerator of the ESP32 when
+// CONFIG_MBEDTLS_HARDWARE_AES is enabled, and software AES on the host.
+// This file does not depend on FreeRTOS or ESP-IDF, so that it can be used
+// by host tools.
+
+#define AEAD_KEY_MAX_LENGTH 32
+#define AEAD_SALT_LENGTH 6
+#define AEAD_TAG_LENGTH 16
+#define AEAD_NONCE_LENGTH 12
+
+// Bytes added to a frame by aead_seal().
+#define AEAD_OVERHEAD (AEAD_SALT_LENGTH + AEAD_TAG_LENGTH)
+
+typedef enum {
+	AEAD_GCM,
+	AEAD_CCM,
+} aead_mode_t;
+
+typedef struct {
+	aead_mode_t mode;
+	union {
+		mbedtls_gcm_context gcm;
+		mbedtls_ccm_context ccm;
+	};
+	uint8_t salt[AEAD_SALT_LENGTH];
+} aead_t;
+
+/**
+ * Initializes a context with a 128, 192 or 256-bit key. Returns false if
+ * the key is not accepted.
+ */
+bool aead_init(aead_t *aead, aead_mode_t mode, const uint8_t *key, uint8_t key_length);
+
+/**
+ * Frees the resources of a context.
+ */
+void aead_free(aead_t *aead);
+
+/**
+ * Sets the salt used by aead_seal().
+ */
+void aead_set_salt(aead_t *aead, const uint8_t *salt);
+
+/**
+ * Seals a frame (header and payload) into sealed, which must be able to
+ * hold frame_length + AEAD_OVERHEAD bytes. Returns false on error.
+ */
+bool aead_seal(aead_t *aead, const uint8_t *frame, uint16_t frame_length,
+		       uint8_t *sealed, uint16_t *sealed_length);
+
+/**
+ * Checks and decrypts a sealed frame into frame, which must be able to hold
+ * sealed_length - AEAD_OVERHEAD bytes. The encrypted flag of the header is
+ * cleared. Returns false if the frame is not sealed or does not
+ * authenticate.
+ */
+bool aead_open(aead_t *aead, const uint8_t *sealed, uint16_t sealed_length,
+		       uint8_t *frame, uint16_t *frame_length);
+
+//========================================
+// Benchmark.
+
+// Number of payload lengths measured by aead_benchmark().
+#define AEAD_BENCH_LENGTHS 5
+
+typedef struct {
+	uint16_t payload_length;
+	uint32_t seal_cycles;     // Per frame.
+	uint32_t open_cycles;     // Per frame.
+} aead_bench_result_t;
+
+/**
+ * Seals and opens frames with payloads of 16 to 1024 bytes, iterations
+ * times each, and measures the cycles used per frame with the given 32-bit
+ * cycle counter. Returns false on error.
+ */
+bool aead_benchmark(aead_t *aead, uint32_t (*cycles)(void), uint16_t iterations,
+		            aead_bench_result_t results[AEAD_BENCH_LENGTHS]);
+
+#endif /* MAIN_AEAD_H_ */
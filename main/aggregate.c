@@ -0,0 +1,207 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "aggregate.h"
+#include "frame.h"
+
+static void reset_pane(aggregate_pane_t *pane) {
+
+	pane->count = 0;
+	pane->min = INT32_MAX;
+	pane->max = INT32_MIN;
+	pane->sum = 0;
+	pane->last = 0;
+	pane->passthrough = false;
+
+}
+
+static void emit(aggregate_t *aggregate, const uint8_t *record, uint32_t length) {
+
+	if (!aggregate->sink(aggregate->target, record, length)) {
+		aggregate->stats.sink_failures++;
+	}
+
+}
+
+/**
+ * Summarizes the window ending with the current pane, and starts the next
+ * pane. Nothing is given for a window without sample.
+ */
+static void close_pane(aggregate_t *aggregate) {
+
+	uint8_t panes = aggregate->config.panes;
+	aggregate_pane_t window;
+	reset_pane(&window);
+	for (uint8_t i = 0; i < panes; i++) {
+		const aggregate_pane_t *pane = &aggregate->panes[i];
+		if (pane->count == 0) {
+			continue;
+		}
+		window.count += pane->count;
+		window.sum += pane->sum;
+		if (pane->min < window.min) {
+			window.min = pane->min;
+		}
+		if (pane->max > window.max) {
+			window.max = pane->max;
+		}
+		window.passthrough |= pane->passthrough;
+	}
+	uint32_t window_ms = aggregate->pane_ms * panes;
+	uint32_t end_ms = aggregate->pane_start_ms + aggregate->pane_ms;
+	if (window.count > 0) {
+		uint8_t record[AGGREGATE_SUMMARY_LENGTH];
+		record[0] = AGGREGATE_KIND_SUMMARY;
+		record[1] = (panes > 1 ? AGGREGATE_FLAG_SLIDING : 0) |
+				    (window.passthrough ? AGGREGATE_FLAG_PASSTHROUGH : 0);
+		frame_put_u32(&record[2], window.count);
+		frame_put_u32(&record[6], end_ms - window_ms);
+		frame_put_u32(&record[10], window_ms);
+		frame_put_u32(&record[14], (uint32_t)window.min);
+		frame_put_u32(&record[18], (uint32_t)window.max);
+		frame_put_u32(&record[22], (uint32_t)(int32_t)(window.sum / (int64_t)window.count));
+		// The last sample is in the most recent pane holding one.
+		for (uint8_t i = 0; i < panes; i++) {
+			const aggregate_pane_t *pane =
+					&aggregate->panes[(aggregate->current + panes - i) % panes];
+			if (pane->count > 0) {
+				frame_put_u32(&record[26], (uint32_t)pane->last);
+				break;
+			}
+		}
+		emit(aggregate, record, AGGREGATE_SUMMARY_LENGTH);
+		aggregate->stats.summaries++;
+	}
+	aggregate->pane_start_ms = end_ms;
+	aggregate->current = (aggregate->current + 1) % panes;
+	reset_pane(&aggregate->panes[aggregate->current]);
+
+}
+
+/**
+ * Closes the panes that ended before now_ms.
+ */
+static void advance(aggregate_t *aggregate, uint32_t now_ms) {
+
+	if (!aggregate->started) {
+		aggregate->started = true;
+		aggregate->pane_start_ms = now_ms;
+		return;
+	}
+	uint32_t steps = (now_ms - aggregate->pane_start_ms) / aggregate->pane_ms;
+	for (uint32_t i = 0; i < steps; i++) {
+		if (i >= aggregate->config.panes) {
+			// Every pane is empty now: skip the windows without sample.
+			aggregate->pane_start_ms += (steps - i) * aggregate->pane_ms;
+			return;
+		}
+		close_pane(aggregate);
+	}
+
+}
+
+bool aggregate_init(aggregate_t *aggregate, const aggregate_config_t *config,
+		            aggregate_sink_t sink, void *target) {
+
+	if (config->panes == 0 || config->panes > AGGREGATE_MAX_PANES ||
+		config->window_ms < config->panes) {
+		return false;
+	}
+	memset(aggregate, 0, sizeof(aggregate_t));
+	aggregate->config = *config;
+	aggregate->pane_ms = config->window_ms / config->panes;
+	aggregate->sink = sink;
+	aggregate->target = target;
+	for (uint8_t i = 0; i < AGGREGATE_MAX_PANES; i++) {
+		reset_pane(&aggregate->panes[i]);
+	}
+	return true;
+
+}
+
+void aggregate_add(aggregate_t *aggregate, int32_t value, uint32_t now_ms) {
+
+	advance(aggregate, now_ms);
+	aggregate->stats.samples++;
+	aggregate_pane_t *pane = &aggregate->panes[aggregate->current];
+	pane->count++;
+	pane->sum += value;
+	if (value < pane->min) {
+		pane->min = value;
+	}
+	if (value > pane->max) {
+		pane->max = value;
+	}
+	pane->last = value;
+	if (aggregate->config.passthrough &&
+		(value < aggregate->config.low || value > aggregate->config.high)) {
+		uint8_t record[AGGREGATE_RAW_LENGTH];
+		record[0] = AGGREGATE_KIND_RAW;
+		record[1] = 0;
+		frame_put_u32(&record[2], now_ms);
+		frame_put_u32(&record[6], (uint32_t)value);
+		emit(aggregate, record, AGGREGATE_RAW_LENGTH);
+		aggregate->stats.raw++;
+		pane->passthrough = true;
+	}
+
+}
+
+void aggregate_poll(aggregate_t *aggregate, uint32_t now_ms) {
+
+	if (aggregate->started) {
+		advance(aggregate, now_ms);
+	}
+
+}
+
+void aggregate_get_stats(const aggregate_t *aggregate, aggregate_stats_t *stats) {
+	*stats = aggregate->stats;
+}
+
+bool aggregate_decode(const uint8_t *buffer, uint32_t length, aggregate_record_t *record) {
+
+	memset(record, 0, sizeof(aggregate_record_t));
+	if (length == AGGREGATE_SUMMARY_LENGTH && buffer[0] == AGGREGATE_KIND_SUMMARY) {
+		record->kind = buffer[0];
+		record->flags = buffer[1];
+		record->count = frame_get_u32(&buffer[2]);
+		record->time_ms = frame_get_u32(&buffer[6]);
+		record->window_ms = frame_get_u32(&buffer[10]);
+		record->min = (int32_t)frame_get_u32(&buffer[14]);
+		record->max = (int32_t)frame_get_u32(&buffer[18]);
+		record->mean = (int32_t)frame_get_u32(&buffer[22]);
+		record->value = (int32_t)frame_get_u32(&buffer[26]);
+		return true;
+	}
+	if (length == AGGREGATE_RAW_LENGTH && buffer[0] == AGGREGATE_KIND_RAW) {
+		record->kind = buffer[0];
+		record->flags = buffer[1];
+		record->time_ms = frame_get_u32(&buffer[2]);
+		record->value = (int32_t)frame_get_u32(&buffer[6]);
+		return true;
+	}
+	return false;
+
+}
@@ -0,0 +1,160 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+
+#ifndef MAIN_AGGREGATE_H_
+#define MAIN_AGGREGATE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Windowed aggregation of samples, before the producer API.
+//
+// An aggregator takes the samples of one signal, and gives one summary
+// record per window: sample count, minimum, maximum, mean and last value.
+// Windows are tumbling, or sliding: a sliding window is made of panes, and
+// a summary of the last panes is given at the end of every pane. Every
+// pane has a fixed-size accumulator: memory and cost per sample do not
+// depend on the sample rate.
+//
+// Optionally, samples outside a band are also given at once as raw
+// records, so that excursions are not hidden by the summaries.
+//
+// Records are given to a sink, usually a wrapper of producer_push(), in
+// the following layouts (network byte order):
+//
+// Summary:
+//  0       1       2               6               10              14
+//  +-------+-------+---------------+---------------+---------------+
+//  | kind  | flags |     count     |   start ms    |   window ms   |
+//  +-------+-------+---------------+---------------+---------------+
+//  14              18              22              26              30
+//  +---------------+---------------+---------------+---------------+
+//  |      min      |      max      |     mean      |     last      |
+//  +---------------+---------------+---------------+---------------+
+//
+// Raw:
+//  0       1       2               6               10
+//  +-------+-------+---------------+---------------+
+//  | kind  | flags |    time ms    |     value     |
+//  +-------+-------+---------------+---------------+
+//
+// Times come from the caller, in milliseconds, and may wrap around. start
+// ms is the beginning of the window. The mean is rounded towards zero.
+//
+// An aggregator must be used by one task only. This file does not depend
+// on FreeRTOS or ESP-IDF, so that it can be used by host tools.
+
+#define AGGREGATE_MAX_PANES 8
+
+#define AGGREGATE_SUMMARY_LENGTH 30
+#define AGGREGATE_RAW_LENGTH 10
+
+// Record kinds.
+#define AGGREGATE_KIND_SUMMARY 1
+#define AGGREGATE_KIND_RAW 2
+
+// Summary flags.
+#define AGGREGATE_FLAG_SLIDING 0x01
+#define AGGREGATE_FLAG_PASSTHROUGH 0x02  // Some samples of the window were also sent raw.
+
+/**
+ * Gives a record to its destination. Returns false if the record could not
+ * be taken, it is then lost.
+ */
+typedef bool (*aggregate_sink_t)(void *target, const uint8_t *record, uint32_t length);
+
+typedef struct {
+	uint32_t window_ms;        // Window length.
+	uint8_t panes;             // 1: tumbling windows, more: sliding windows.
+	bool passthrough;          // Samples outside [low, high] are also sent raw.
+	int32_t low;
+	int32_t high;
+} aggregate_config_t;
+
+typedef struct {
+	uint32_t count;
+	int32_t min;
+	int32_t max;
+	int64_t sum;
+	int32_t last;
+	bool passthrough;
+} aggregate_pane_t;
+
+typedef struct {
+	uint32_t samples;
+	uint32_t summaries;
+	uint32_t raw;
+	uint32_t sink_failures;    // Records lost because the sink was full.
+} aggregate_stats_t;
+
+typedef struct {
+	aggregate_config_t config;
+	uint32_t pane_ms;
+	aggregate_sink_t sink;
+	void *target;
+	bool started;
+	uint32_t pane_start_ms;    // Start of the current pane.
+	uint8_t current;           // Index of the current pane.
+	aggregate_pane_t panes[AGGREGATE_MAX_PANES];
+	aggregate_stats_t stats;
+} aggregate_t;
+
+typedef struct {
+	uint8_t kind;
+	uint8_t flags;
+	uint32_t count;            // Summary only.
+	uint32_t time_ms;          // Summary: window start. Raw: sample time.
+	uint32_t window_ms;        // Summary only.
+	int32_t min;               // Summary only.
+	int32_t max;               // Summary only.
+	int32_t mean;              // Summary only.
+	int32_t value;             // Summary: last value. Raw: sample value.
+} aggregate_record_t;
+
+/**
+ * Initializes an aggregator. Returns false if the configuration is
+ * invalid: no pane, more than AGGREGATE_MAX_PANES panes, or a window
+ * shorter than one millisecond per pane.
+ */
+bool aggregate_init(aggregate_t *aggregate, const aggregate_config_t *config,
+		            aggregate_sink_t sink, void *target);
+
+/**
+ * Adds a sample. The windows that ended before now_ms are summarized
+ * first. Times must not go backwards.
+ */
+void aggregate_add(aggregate_t *aggregate, int32_t value, uint32_t now_ms);
+
+/**
+ * Summarizes the windows that ended before now_ms. To be called
+ * periodically when samples may stop, otherwise the last window is only
+ * summarized with the next sample.
+ */
+void aggregate_poll(aggregate_t *aggregate, uint32_t now_ms);
+
+void aggregate_get_stats(const aggregate_t *aggregate, aggregate_stats_t *stats);
+
+/**
+ * Decodes a record written by an aggregator. Returns false if it is not
+ * one.
+ */
+bool aggregate_decode(const uint8_t *buffer, uint32_t length, aggregate_record_t *record);
+
+#endif /* MAIN_AGGREGATE_H_ */
@@ -23,36 +23,114 @@
 #include "freertos/event_groups.h"
 #include "freertos/queue.h"
 #include "freertos/task.h"
-#include "freertos/timers.h"
 
 #include "lwip/errno.h"
-#include "lwip/sockets.h"
 
 #include "esp_system.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#if CONFIG_UDPSENDER_AEAD
+#include "nvs.h"
 
+#include "aead.h"
+#endif
+
+#include "connect_wifi.h"
+#if CONFIG_UDPSENDER_FEC
+#include "fec.h"
+#endif
+#include "fragment.h"
+#include "frame.h"
+#include "fsm_timer.h"
+#include "latency_stats.h"
+#include "link_state.h"
 #include "messages.h"
+#include "producer.h"
+#include "reliable.h"
+#include "roaming.h"
+#include "send_path.h"
+#include "seq_store.h"
+#include "time_sync.h"
+#include "trace.h"
 #include "send_datagram.h"
 #include "supervisor.h"
 #include "utilities.h"
 
-#define INPUT_QUEUE_LENGTH 3
-
 #define CONNECT_RETRY_PERIOD_MS CONFIG_UDPSENDER_RETRY_PERIOD_MS
 
-#define DEST_IPV4_ADDR CONFIG_UDPSENDER_IPV4_ADDR
-#define DEST_PORT CONFIG_UDPSENDER_PORT
+#define RSSI_PERIOD_MS CONFIG_UDPSENDER_ROAM_RSSI_PERIOD_MS
+
+// Maximum number of access points read from a scan.
+#define MAX_SCAN_RECORDS 16
+
+// While reliable datagrams are in flight, the transport is polled for ACK
+// frames with this period.
+#define RELIABLE_POLL_PERIOD_MS 20
+
+// Period used to log send path and reliable delivery counters, in datagrams.
+#define STATS_LOG_PERIOD 100
+
+#define PRODUCER_MAX_SOURCES CONFIG_UDPSENDER_PRODUCER_MAX_SOURCES
+
+// Maximum wait for a time response, after a time request has been sent.
+#define TIME_SYNC_WAIT_MS CONFIG_UDPSENDER_TIME_SYNC_WAIT_MS
+
+// NVS location of the encryption key.
+#define AEAD_KEY_NAMESPACE "udpsender"
+#define AEAD_KEY_NAME "aead_key"
+
+#ifdef CONFIG_UDPSENDER_AEAD_CCM
+#define AEAD_MODE AEAD_CCM
+#else
+#define AEAD_MODE AEAD_GCM
+#endif
+
+// Largest sealed datagram.
+#define MAX_SEALED_LENGTH 1472
+
+// Largest fragment, before sealing.
+#define MAX_FRAGMENT_LENGTH 1472
+
+#if CONFIG_UDPSENDER_FEC
+#ifdef CONFIG_UDPSENDER_FEC_RS
+#define FEC_SCHEME FEC_RS
+#define FEC_M CONFIG_UDPSENDER_FEC_M
+#else
+#define FEC_SCHEME FEC_XOR
+#define FEC_M 1
+#endif
+#define FEC_K CONFIG_UDPSENDER_FEC_K
+#define FEC_MAX_LENGTH CONFIG_UDPSENDER_FEC_MAX_LENGTH
+#define FEC_STREAMS CONFIG_UDPSENDER_FEC_STREAMS
+#define FEC_FLUSH_MS CONFIG_UDPSENDER_FEC_FLUSH_MS
+#endif
 
 static const char *TAG = "CW";
 
-// Input queue.
-QueueHandle_t cw_input_queue;
+// Tasks whose stack high-water mark is logged with the statistics.
+static const char *const task_names[] = {
+#if CONFIG_UDPSENDER_REACTOR
+	"reactor",
+#else
+	"supervisor",
+	"connect_wifi",
+	"send_datagram",
+#endif
+	"pipeline",
+};
+
+// Input queues, and the set they belong to. Control messages do not wait
+// behind datagrams, and are not rejected because of them.
+QueueHandle_t cw_input_queue = NULL;
+QueueHandle_t cw_data_queue = NULL;
+static QueueSetHandle_t queue_set;
 
 typedef enum {
 	CW_WAIT_CONNECT_MSG_ST,
 	CW_WAIT_STA_ST,
+	CW_WAIT_SCAN_ST,
 	CW_WAIT_IP_ST,
 	CW_WAIT_AND_CONNECT_ST,
 	CW_WAIT_DISCONNECT_MSG_ST,
@@ -61,12 +139,105 @@ typedef enum {
 
 static state_t current_state;
 
+// Reconnection timer.
+static fsm_timer_t timer;
+// Retransmissions and retries.
+static fsm_timer_t send_timer;
+// RSSI sampling, while connected.
+static fsm_timer_t rssi_timer;
+
+// The transport is opened once an IP address is obtained, or once the
+// station is started if it does not need one.
+static bool needs_ip;
+
+static uint32_t datagram_count = 0;
+
+// WIFI_EVENT_STA_START is posted once only.
+static bool sta_started = false;
+
+// A scan is in progress.
+static bool scanning = false;
+
+// A roam was decided, waiting for the disconnection from the current
+// access point.
+static bool roam_pending = false;
+static roaming_target_t roam_target;
+
+static wifi_ap_record_t scan_records[MAX_SCAN_RECORDS];
+
+#if CONFIG_UDPSENDER_AEAD
+static aead_t aead;
+
+// Sealed copy of the frame being sent.
+static uint8_t sealed_frame[MAX_SEALED_LENGTH];
+#endif
+
+// Fragment being sent.
+static uint8_t fragment_frame[MAX_FRAGMENT_LENGTH];
+
+#if CONFIG_UDPSENDER_FEC
+// Block being protected, per stream.
+typedef struct {
+	bool used;
+	uint8_t stream_id;
+	traffic_class_t traffic_class;
+	fec_encoder_t encoder;
+	uint8_t parity[FEC_M * (FEC_SYMBOL_OVERHEAD + FEC_MAX_LENGTH)];
+} fec_stream_t;
+
+typedef struct {
+	uint32_t protected;      // Data frames added to a block.
+	uint32_t unprotected;    // Data frames too long, or of a stream without encoder.
+	uint32_t blocks;         // Full blocks.
+	uint32_t flushed;        // Blocks sent before they were full.
+	uint32_t parity_sent;
+	uint32_t parity_dropped;
+} fec_stats_t;
+
+static fec_stream_t fec_streams[FEC_STREAMS];
+static fec_stats_t fec_stats;
+
+// Parity frame being sent.
+static uint8_t parity_frame[FEC_PARITY_LENGTH(FEC_MAX_K, FEC_MAX_LENGTH)];
+#endif
+
+// Last datagram handle given, incremented by the producer tasks.
+static cw_datagram_handle_t last_handle = 0;
+
+static cw_datagram_stats_t datagram_stats;
+
+// Datagrams being sent, or completed as queued and waiting for their
+// outcome (see messages.h). Each of them is held by the retry queue or the
+// retransmit window, except the one being sent: the table cannot be full.
+// Tags given to the send path and to the reliable delivery mode are
+// indexes in this table, plus one.
+#define PENDING_SLOTS (TRAFFIC_CLASS_COUNT * CONFIG_UDPSENDER_SEND_RETRY_DEPTH + \
+		               CONFIG_UDPSENDER_RELIABLE_MAX_STREAMS * CONFIG_UDPSENDER_RELIABLE_WINDOW + 1)
+
+typedef struct {
+	bool used;
+	bool orphan;                  // Completed as lost: the outcome is not reported.
+	uint16_t holders;             // Retry queue entries and window slots, plus one while sent.
+	cw_datagram_status_t status;  // Outcome so far: sent, unless a part was lost.
+	cw_datagram_handle_t handle;
+	cw_datagram_done_t done;
+	void *done_arg;
+	uint64_t enqueued_us;
+	uint64_t dequeued_us;
+} pending_t;
+
+static pending_t pending_datagrams[PENDING_SLOTS];
+
+// Station address of the last lease, written by the event handler.
+static uint32_t station_ip = 0;
+
 /**
  * Event handler for events generated by the Wi-Fi task and the LwIP task.
  */
 static void event_handler(void* arg, esp_event_base_t event_base,
                                 int32_t event_id, void* event_data) {
 
+	trace_record(TRACE_WIFI_EVENT, (uint16_t)event_id, event_base == IP_EVENT ? 1 : 0);
 	if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
 	    message_t message_to_send;
 	    message_to_send.message = CW_STA_OK;
@@ -77,6 +248,16 @@ static void event_handler(void* arg, esp_event_base_t event_base,
 	    }
 	    return;
 	}
+	if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_SCAN_DONE) {
+	    message_t message_to_send;
+	    message_to_send.message = CW_SCAN_DONE;
+	    message_to_send.no_payload.nothing = 0;
+	    BaseType_t rs = send_to_queue(cw_input_queue, &message_to_send, TAG);
+	    if (rs != pdTRUE) {
+	    	ESP_LOGE(TAG, "Error on sending message to myself - %d", rs);
+	    }
+	    return;
+	}
 	if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
 		// We were not able to connect, or we were connected and got disconnected.
 	    message_t message_to_send;
@@ -90,6 +271,8 @@ static void event_handler(void* arg, esp_event_base_t event_base,
 	}
 	if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
 		// We are connected, and got an IP address.
+		const ip_event_got_ip_t *got_ip = event_data;
+		__atomic_store_n(&station_ip, got_ip->ip_info.ip.addr, __ATOMIC_RELAXED);
 	    message_t message_to_send;
 	    message_to_send.message = CW_IP_OK;
 	    message_to_send.no_payload.nothing = 0;
@@ -139,81 +322,1073 @@ static bool init_wifi(void) {
 
 }
 
+static uint32_t now_ms(void) {
+	return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static uint64_t now_us(void) {
+	return (uint64_t)esp_timer_get_time();
+}
+
 /**
- * Event handler for the timer.
+ * Writes the boot epoch and the timestamp into the header of frame, and
+ * returns the timestamp. Time requests are stamped with local time, other
+ * frames with remote time once synchronized.
  */
-static void timer_handler(TimerHandle_t timer) {
+static uint64_t stamp_frame(uint8_t *frame, uint16_t frame_length) {
 
-	message_t message_to_send;
-	message_to_send.message = CW_TIMEOUT;
-	message_to_send.no_payload.nothing = 0;
-    BaseType_t rs = send_to_queue(cw_input_queue, &message_to_send, TAG);
-    if (rs != pdTRUE) {
-    	ESP_LOGE(TAG, "timer_handler - error on sending message to myself - %d", rs);
-    }
+	uint64_t local_us = now_us();
+	if (frame_length < FRAME_HEADER_LENGTH) {
+		return local_us;
+	}
+	frame_put_u32(&frame[FRAME_EPOCH_OFFSET], seq_store_epoch());
+	if (frame[1] == FRAME_TIME_REQUEST) {
+		frame_stamp(frame, local_us, false);
+		return local_us;
+	}
+	frame_stamp(frame, time_sync_to_remote(local_us), time_sync_is_synced());
+	return local_us;
 
 }
 
-void connect_wifi_task(void *pvParameters) {
+#if CONFIG_UDPSENDER_FEC
+/**
+ * Sends the parity frames of the current block of a stream, and starts a
+ * new block. Parity frames are stamped, not sealed.
+ */
+static void fec_send_parity(fec_stream_t *stream) {
 
-	// Delay used for xTicksToWait when calling xQueueReceive().
-	const TickType_t delay_60s = pdMS_TO_TICKS(60000);
+	for (uint8_t j = 0; j < FEC_M; j++) {
+		uint16_t length = fec_encoder_build(&stream->encoder, stream->stream_id, j,
+				                            parity_frame);
+		stamp_frame(parity_frame, length);
+		// The send path copies the frame if it has to be queued.
+		send_path_rs_t sp_rs = send_path_send(parity_frame, length, stream->traffic_class,
+				                              true, 0, now_ms());
+		if (sp_rs == SEND_PATH_DROPPED) {
+			fec_stats.parity_dropped++;
+		} else {
+			fec_stats.parity_sent++;
+		}
+	}
+	fec_encoder_reset(&stream->encoder);
+
+}
+
+/**
+ * Adds a data frame handed over to the send path to the block of its
+ * stream. frame is the frame as stamped, sent the bytes actually sent.
+ * Reliable frames and fragments are not protected.
+ */
+static void fec_protect(const uint8_t *frame, const uint8_t *sent, uint16_t sent_length,
+		                traffic_class_t traffic_class) {
+
+	if (frame[1] != FRAME_DATA ||
+		(frame[2] & (FRAME_FLAG_RELIABLE | FRAME_FLAG_FRAGMENT)) != 0) {
+		return;
+	}
+	uint8_t stream_id = frame[3];
+	uint32_t seq = frame_get_u32(&frame[4]);
+	fec_stream_t *stream = NULL;
+	for (uint8_t i = 0; i < FEC_STREAMS; i++) {
+		if (fec_streams[i].used && fec_streams[i].stream_id == stream_id) {
+			stream = &fec_streams[i];
+			break;
+		}
+		if (!fec_streams[i].used && stream == NULL) {
+			stream = &fec_streams[i];
+		}
+	}
+	if (stream == NULL) {
+		fec_stats.unprotected++;
+		return;
+	}
+	if (!stream->used) {
+		fec_encoder_init(&stream->encoder, FEC_SCHEME, FEC_K, FEC_M, FEC_MAX_LENGTH,
+				         stream->parity);
+		stream->used = true;
+		stream->stream_id = stream_id;
+	}
+	stream->traffic_class = traffic_class;
+	if (!fec_encoder_accepts(&stream->encoder, seq, sent_length) &&
+		fec_encoder_pending(&stream->encoder) > 0) {
+		fec_stats.flushed++;
+		fec_send_parity(stream);
+	}
+	if (!fec_encoder_accepts(&stream->encoder, seq, sent_length)) {
+		fec_stats.unprotected++;
+		return;
+	}
+	fec_stats.protected++;
+	if (fec_encoder_add(&stream->encoder, seq, sent, sent_length, now_ms())) {
+		fec_stats.blocks++;
+		fec_send_parity(stream);
+	}
 
-	// Delay used for xTicksToWait when calling xTimerStart().
-	const TickType_t delay_500ms = pdMS_TO_TICKS(500);
+}
 
-	TimerHandle_t timer = NULL;
+/**
+ * Sends the parity frames of the blocks started FEC_FLUSH_MS ago or more,
+ * or of all blocks if all is true.
+ */
+static void fec_flush(uint32_t now, bool all) {
 
-	struct sockaddr_in dest_addr;
-	int sock = 0;
+	for (uint8_t i = 0; i < FEC_STREAMS; i++) {
+		fec_stream_t *stream = &fec_streams[i];
+		if (!stream->used || fec_encoder_pending(&stream->encoder) == 0) {
+			continue;
+		}
+		if (all || now - stream->encoder.started_ms >= FEC_FLUSH_MS) {
+			fec_stats.flushed++;
+			fec_send_parity(stream);
+		}
+	}
 
-	BaseType_t fr_rs;  // Return status for FreeRTOS calls.
-	esp_err_t esp_rs;  // Return status for ESP-IDF calls.
+}
 
-	message_t received_message;
+/**
+ * Returns false if no block is pending. Otherwise, returns true and
+ * provides the delay before the first block has to be flushed.
+ */
+static bool fec_next_deadline(uint32_t now, uint32_t *delay_ms) {
+
+	bool pending = false;
+	for (uint8_t i = 0; i < FEC_STREAMS; i++) {
+		fec_stream_t *stream = &fec_streams[i];
+		if (!stream->used || fec_encoder_pending(&stream->encoder) == 0) {
+			continue;
+		}
+		uint32_t elapsed = now - stream->encoder.started_ms;
+		uint32_t delay = elapsed >= FEC_FLUSH_MS ? 0 : FEC_FLUSH_MS - elapsed;
+		if (!pending || delay < *delay_ms) {
+			*delay_ms = delay;
+		}
+		pending = true;
+	}
+	return pending;
+
+}
+#endif
+
+/**
+ * Completes a datagram: counts it, and tells its producer that its payload
+ * is not used anymore.
+ */
+static void datagram_done(const cw_send_datagram_t *datagram, cw_datagram_status_t status,
+		                  uint64_t dequeued_us) {
+
+	cw_datagram_completion_t completion = {
+		.handle = datagram->handle,
+		.status = status,
+		.enqueued_us = datagram->enqueued_us,
+		.dequeued_us = dequeued_us,
+		.completed_us = now_us(),
+	};
+	datagram_stats.completed[status]++;
+	latency_stats_add(&datagram_stats.queue_wait,
+			          (uint32_t)(completion.dequeued_us - completion.enqueued_us));
+	latency_stats_add(&datagram_stats.send_time,
+			          (uint32_t)(completion.completed_us - completion.dequeued_us));
+	if (datagram->done != NULL) {
+		datagram->done(datagram->done_arg, &completion);
+	}
+
+}
+
+static cw_datagram_status_t path_status(send_path_rs_t sp_rs) {
+
+	switch (sp_rs) {
+	case SEND_PATH_OK:
+		return CW_DATAGRAM_SENT;
+	case SEND_PATH_QUEUED:
+		return CW_DATAGRAM_QUEUED;
+	default:
+		return CW_DATAGRAM_DROPPED;
+	}
+
+}
+
+/**
+ * Returns the pending entry of a tag given by pending_begin().
+ */
+static pending_t *pending_entry(uint32_t tag) {
+	return &pending_datagrams[tag - 1];
+}
+
+/**
+ * Returns the tag of a new pending entry for the datagram, held while the
+ * datagram is being sent, or 0 if there is no free entry.
+ */
+static uint32_t pending_begin(const cw_send_datagram_t *datagram, uint64_t dequeued_us) {
+
+	for (uint32_t i = 0; i < PENDING_SLOTS; i++) {
+		pending_t *pending = &pending_datagrams[i];
+		if (pending->used) {
+			continue;
+		}
+		pending->used = true;
+		pending->orphan = false;
+		pending->holders = 1;
+		pending->status = CW_DATAGRAM_SENT;
+		pending->handle = datagram->handle;
+		pending->done = datagram->done;
+		pending->done_arg = datagram->done_arg;
+		pending->enqueued_us = datagram->enqueued_us;
+		pending->dequeued_us = dequeued_us;
+		return i + 1;
+	}
+	ESP_LOGW(TAG, "No pending entry, the outcome of datagram %u will not be reported",
+			 datagram->handle);
+	return 0;
+
+}
+
+/**
+ * Ends the send of a datagram, and completes it: as queued if a part of it
+ * is still held by the retry queue or the retransmit window, with the given
+ * status otherwise.
+ */
+static void pending_end(const cw_send_datagram_t *datagram, uint32_t tag,
+		                cw_datagram_status_t status, uint64_t dequeued_us) {
+
+	if (tag == 0) {
+		datagram_done(datagram, status, dequeued_us);
+		return;
+	}
+	pending_t *pending = pending_entry(tag);
+	pending->holders--;
+	if (pending->holders == 0) {
+		// Parts queued meanwhile, if any, have already reached their outcome.
+		pending->used = false;
+		if (status == CW_DATAGRAM_SENT || status == CW_DATAGRAM_QUEUED) {
+			status = pending->status;
+		}
+		datagram_done(datagram, status, dequeued_us);
+		return;
+	}
+	if (status == CW_DATAGRAM_SENT || status == CW_DATAGRAM_QUEUED) {
+		datagram_done(datagram, CW_DATAGRAM_QUEUED, dequeued_us);
+		return;
+	}
+	// Lost anyway: the outcome of the queued parts is not reported.
+	pending->orphan = true;
+	datagram_done(datagram, status, dequeued_us);
+
+}
+
+/**
+ * Counts the outcome of a part of a pending datagram. Once all parts have
+ * reached their outcome, completes the datagram, deferred.
+ */
+static void pending_outcome(uint32_t tag, cw_datagram_status_t status) {
+
+	pending_t *pending = pending_entry(tag);
+	if (status != CW_DATAGRAM_SENT) {
+		pending->status = status;
+	}
+	pending->holders--;
+	if (pending->holders > 0) {
+		return;
+	}
+	pending->used = false;
+	if (pending->orphan) {
+		return;
+	}
+	cw_datagram_completion_t completion = {
+		.handle = pending->handle,
+		.status = pending->status,
+		.deferred = true,
+		.enqueued_us = pending->enqueued_us,
+		.dequeued_us = pending->dequeued_us,
+		.completed_us = now_us(),
+	};
+	datagram_stats.completed[completion.status]++;
+	if (pending->done != NULL) {
+		pending->done(pending->done_arg, &completion);
+	}
+
+}
+
+/**
+ * Called by the send path when a queued datagram is sent or dropped.
+ */
+static void retry_done(uint32_t tag, bool sent) {
+	pending_outcome(tag, sent ? CW_DATAGRAM_SENT : CW_DATAGRAM_DROPPED);
+}
+
+/**
+ * Called by the reliable delivery mode when a datagram leaves the window.
+ */
+static void window_done(uint32_t tag, bool acked) {
+	pending_outcome(tag, acked ? CW_DATAGRAM_SENT : CW_DATAGRAM_EXPIRED);
+}
+
+/**
+ * Stamps a frame, and seals it if encryption is enabled. Provides the bytes
+ * to send, and the local time of the timestamp. Returns false on error.
+ */
+static bool seal_frame(uint8_t *frame, uint16_t frame_length, const uint8_t **data,
+		               uint16_t *data_length, uint64_t *sent_us) {
+
+	*sent_us = stamp_frame(frame, frame_length);
+	*data = frame;
+	*data_length = frame_length;
+#if CONFIG_UDPSENDER_AEAD
+	if (frame_length > MAX_SEALED_LENGTH - AEAD_OVERHEAD ||
+		!aead_seal(&aead, frame, frame_length, sealed_frame, data_length)) {
+		ESP_LOGE(TAG, "Error from aead_seal - %d", frame_length);
+		return false;
+	}
+	*data = sealed_frame;
+#endif
+	return true;
+
+}
+
+/**
+ * Stamps a frame, seals it if encryption is enabled, and hands it over to
+ * the send path. The bytes handed over are added to the FEC block of the
+ * stream if FEC is enabled. If the frame is queued, it holds the pending
+ * entry of its tag (0: none). Returns the send path status, and provides
+ * the local time of the timestamp if sent_us is not NULL.
+ */
+static send_path_rs_t send_frame(uint8_t *frame, uint16_t frame_length,
+		                         traffic_class_t traffic_class, bool retry,
+								 uint32_t tag, uint64_t *sent_us) {
+
+	const uint8_t *data;
+	uint16_t data_length;
+	uint64_t local_us;
+	if (!seal_frame(frame, frame_length, &data, &data_length, &local_us)) {
+		return SEND_PATH_DROPPED;
+	}
+	if (sent_us != NULL) {
+		*sent_us = local_us;
+	}
+	send_path_rs_t sp_rs = send_path_send(data, data_length, traffic_class, retry, tag, now_ms());
+	if (sp_rs == SEND_PATH_QUEUED && tag != 0) {
+		pending_entry(tag)->holders++;
+	}
+#if CONFIG_UDPSENDER_FEC
+	if (sp_rs != SEND_PATH_DROPPED && frame_length >= FRAME_HEADER_LENGTH) {
+		fec_protect(frame, data, data_length, traffic_class);
+	}
+#endif
+	return sp_rs;
+
+}
+
+/**
+ * Stamps a fragment, seals it if encryption is enabled, and sends it. A
+ * fragment is too long for the retry queue: on a transient error, the task
+ * waits for the backoff delay and sends it again. Fragments are not
+ * protected by FEC. Returns SEND_PATH_OK or SEND_PATH_DROPPED.
+ */
+static send_path_rs_t send_fragment(uint8_t *frame, uint16_t frame_length,
+		                            traffic_class_t traffic_class) {
+
+	const uint8_t *data;
+	uint16_t data_length;
+	uint64_t sent_us;
+	if (!seal_frame(frame, frame_length, &data, &data_length, &sent_us)) {
+		return SEND_PATH_DROPPED;
+	}
+	send_path_rs_t sp_rs;
+	uint32_t delay_ms;
+	uint8_t attempts = 0;
+	while ((sp_rs = send_path_try_send(data, data_length, traffic_class, attempts,
+			                           now_ms(), &delay_ms)) == SEND_PATH_BUSY) {
+		// Sealed data stays valid: nothing else is sealed meanwhile.
+		attempts++;
+		TickType_t ticks = pdMS_TO_TICKS(delay_ms);
+		vTaskDelay(ticks == 0 ? 1 : ticks);
+	}
+	return sp_rs;
+
+}
+
+#if CONFIG_UDPSENDER_AEAD
+/**
+ * Reads the key from NVS, and draws the salt of this boot. Returns false
+ * if there is no valid key.
+ */
+static bool init_aead(void) {
+
+	uint8_t key[AEAD_KEY_MAX_LENGTH];
+	size_t key_length = sizeof(key);
+	nvs_handle_t handle;
+
+	esp_err_t esp_rs = nvs_open(AEAD_KEY_NAMESPACE, NVS_READONLY, &handle);
+	if (esp_rs != ESP_OK) {
+		ESP_LOGE(TAG, "Error from nvs_open: %d", esp_rs);
+		return false;
+	}
+	esp_rs = nvs_get_blob(handle, AEAD_KEY_NAME, key, &key_length);
+	nvs_close(handle);
+	if (esp_rs != ESP_OK) {
+		ESP_LOGE(TAG, "Error from nvs_get_blob: %d", esp_rs);
+		return false;
+	}
+	bool rs = aead_init(&aead, AEAD_MODE, key, (uint8_t)key_length);
+	memset(key, 0, sizeof(key));
+	if (!rs) {
+		ESP_LOGE(TAG, "Invalid key length: %d", (int)key_length);
+		return false;
+	}
+	// Nonces must not be reused after a restart.
+	uint8_t salt[AEAD_SALT_LENGTH];
+	esp_fill_random(salt, sizeof(salt));
+	aead_set_salt(&aead, salt);
+	return true;
+
+}
+#endif
+
+/**
+ * Reads all frames waiting in the transport (ACK frames and time
+ * responses), and processes them.
+ */
+static void receive_frames(void) {
+
+	uint8_t buffer[FRAME_TIME_RESPONSE_LENGTH];
+	frame_header_t header;
+	frame_ack_t ack;
+
+	const transport_t *transport = send_path_transport();
+	if (transport == NULL || (transport->caps & TRANSPORT_CAP_RECEIVE) == 0) {
+		return;
+	}
+	while (true) {
+		int length = transport->receive(buffer, sizeof(buffer));
+		// Reception time, for time responses.
+		uint64_t received_us = now_us();
+		if (length < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				ESP_LOGE(TAG, "Error from receive: %d", errno);
+			}
+			return;
+		}
+		if (!frame_decode_header(buffer, length, &header)) {
+			ESP_LOGW(TAG, "Unexpected datagram received - %d", length);
+			continue;
+		}
+		if (header.type == FRAME_ACK && frame_decode_ack(buffer, length, &ack)) {
+			reliable_process_ack(&ack, now_ms());
+			continue;
+		}
+		if (header.type == FRAME_TIME_RESPONSE) {
+			if (!time_sync_process_response(buffer, length, received_us)) {
+				ESP_LOGW(TAG, "Unexpected time response");
+			}
+			continue;
+		}
+		ESP_LOGW(TAG, "Unexpected frame received - %d", header.type);
+	}
+
+}
+
+/**
+ * Waits for the response to the time request that has just been sent. The
+ * time response is processed as soon as it is received, so that its
+ * reception time is accurate.
+ */
+static void wait_time_response(void) {
+
+	const transport_t *transport = send_path_transport();
+	if (transport == NULL || (transport->caps & TRANSPORT_CAP_RECEIVE) == 0) {
+		return;
+	}
+	uint64_t deadline_us = now_us() + (uint64_t)TIME_SYNC_WAIT_MS * 1000;
+
+	while (time_sync_is_pending()) {
+		uint64_t now = now_us();
+		if (now >= deadline_us) {
+			ESP_LOGW(TAG, "No time response");
+			return;
+		}
+		int rs = transport->wait(deadline_us - now);
+		if (rs < 0) {
+			ESP_LOGE(TAG, "Error from wait: %d", errno);
+			return;
+		}
+		receive_frames();
+	}
+
+}
+
+/**
+ * Retransmits the reliable datagrams whose timeout expired, or that were
+ * reported missing by the remote host.
+ */
+static void retransmit(void) {
+
+	uint8_t *frame;
+	uint16_t frame_length;
+	traffic_class_t traffic_class;
+
+	// The same time for the whole pass: timeouts are checked against the
+	// RTO in force at the expiry.
+	uint32_t pass_ms = now_ms();
+	while (reliable_next_retransmit(pass_ms, &frame, &frame_length, &traffic_class)) {
+		ESP_LOGD(TAG, "Retransmitting a datagram - %d", frame_length);
+		// No retry queue for reliable frames: they stay in the retransmit window.
+		send_frame(frame, frame_length, traffic_class, false, 0, NULL);
+	}
+
+}
+
+/**
+ * Starts the send timer if some reliable datagrams are in flight, if some
+ * datagrams are waiting in the retry queue, or if some FEC blocks are
+ * pending. Returns false on timer error.
+ */
+static bool schedule_send_timer(fsm_timer_t *timer) {
+
+	uint32_t delay_ms = RELIABLE_POLL_PERIOD_MS;
+	uint32_t retry_delay_ms;
+	uint32_t flush_delay_ms = 0;
+
+	bool in_flight = reliable_next_deadline(now_ms(), &delay_ms);
+	bool queued = send_path_next_deadline(now_ms(), &retry_delay_ms);
+#if CONFIG_UDPSENDER_FEC
+	bool pending = fec_next_deadline(now_ms(), &flush_delay_ms);
+#else
+	bool pending = false;
+#endif
+	if (!in_flight && !queued && !pending) {
+		return true;
+	}
+	if (delay_ms > RELIABLE_POLL_PERIOD_MS) {
+		delay_ms = RELIABLE_POLL_PERIOD_MS;
+	}
+	if (queued && retry_delay_ms < delay_ms) {
+		delay_ms = retry_delay_ms;
+	}
+	if (pending && flush_delay_ms < delay_ms) {
+		delay_ms = flush_delay_ms;
+	}
+	trace_record(TRACE_TIMER_START, CW_SEND_TIMEOUT, delay_ms);
+	BaseType_t fr_rs = fsm_timer_change_period(timer, delay_ms);
+	if (fr_rs != pdPASS) {
+		ESP_LOGE(TAG, "Error from fsm_timer_change_period: %d", fr_rs);
+		return false;
+	}
+	return true;
+
+}
+
+/**
+ * Returns the length of the longest frame that can be sent in one
+ * datagram of the transport.
+ */
+static uint16_t max_frame_length(void) {
+
+	uint16_t max_length = transport_get()->max_length;
+	if (max_length > MAX_FRAGMENT_LENGTH) {
+		max_length = MAX_FRAGMENT_LENGTH;
+	}
+#if CONFIG_UDPSENDER_AEAD
+	max_length -= AEAD_OVERHEAD;
+#endif
+	return max_length;
+
+}
+
+/**
+ * Sends a data frame longer than a datagram as fragments (see
+ * fragment.h). Fragments are not queued: the burst is paced by the
+ * transport, the task waiting whenever it is short of buffers. Sending
+ * stops at the first fragment dropped, the record being lost anyway.
+ * Returns SEND_PATH_DROPPED if a fragment was dropped.
+ */
+static send_path_rs_t send_fragments(const uint8_t *frame, uint32_t frame_length,
+		                             traffic_class_t traffic_class) {
+
+	uint16_t max_length = max_frame_length();
+	uint16_t count = fragment_count(frame_length - FRAME_HEADER_LENGTH, max_length);
+	if (count == 0) {
+		ESP_LOGE(TAG, "Record too long - %u", frame_length);
+		return SEND_PATH_DROPPED;
+	}
+	for (uint16_t index = 0; index < count; index++) {
+		uint16_t fragment_length = fragment_build(frame, frame_length, max_length,
+				                                  index, fragment_frame);
+		if (send_fragment(fragment_frame, fragment_length, traffic_class) == SEND_PATH_DROPPED) {
+			return SEND_PATH_DROPPED;
+		}
+	}
+	return SEND_PATH_OK;
+
+}
+
+/**
+ * Sends the frame of a CW_SEND_DATAGRAM message, in reliable mode if
+ * requested, as fragments if it does not fit in one datagram, and
+ * completes it.
+ */
+static void process_datagram(const cw_send_datagram_t *datagram, uint64_t dequeued_us) {
+
+	ESP_LOGI(TAG, "Sending a datagram - %u", datagram->payload_length);
+	uint32_t tag = pending_begin(datagram, dequeued_us);
+	if (datagram->unnumbered) {
+		// Its sequence number, and nonce, could be used twice.
+		ESP_LOGD(TAG, "Datagram of stream %u not numbered", datagram->stream_id);
+		pending_end(datagram, tag, CW_DATAGRAM_REJECTED, dequeued_us);
+		return;
+	}
+	if (!datagram->reliable && datagram->payload_length > max_frame_length()) {
+		// payload is not needed anymore once send_fragments() returns.
+		send_path_rs_t sp_rs = send_fragments(datagram->payload, datagram->payload_length,
+				                              datagram->traffic_class);
+		pending_end(datagram, tag, path_status(sp_rs), dequeued_us);
+		return;
+	}
+	// Unless sent in reliable mode, the payload starts with a header.
+	uint8_t *frame = datagram->payload;
+	uint16_t frame_length = datagram->payload_length;
+	if (datagram->reliable) {
+		// The frame is a copy, kept in the retransmit window.
+		reliable_rs_t rel_rs = datagram->payload_length > UINT16_MAX ? RELIABLE_TOO_LONG :
+				reliable_prepare(datagram->stream_id, datagram->traffic_class,
+						         datagram->payload, datagram->payload_length,
+								 tag, now_ms(), &frame, &frame_length);
+		if (rel_rs != RELIABLE_OK) {
+			// A failed stream is logged once by seq_store.
+			if (rel_rs != RELIABLE_NO_SEQUENCE) {
+				ESP_LOGE(TAG, "Error from reliable_prepare: %d", rel_rs);
+			}
+			pending_end(datagram, tag, CW_DATAGRAM_REJECTED, dequeued_us);
+			return;
+		}
+		if (tag != 0) {
+			// Held by the retransmit window until acknowledged or given up.
+			pending_entry(tag)->holders++;
+		}
+	}
+	bool time_request = frame_length >= FRAME_HEADER_LENGTH &&
+			            frame[1] == FRAME_TIME_REQUEST;
+	uint64_t sent_us;
+	// A reliable datagram stays in the window, it does not need the
+	// retry queue. A time request sent late would carry a stale t1: it is
+	// dropped, the next period sends another one. In all cases, payload is
+	// not needed anymore once send_frame() returns.
+	bool retry = !datagram->reliable && !time_request;
+	send_path_rs_t sp_rs = send_frame(frame, frame_length,
+			                          datagram->traffic_class,
+									  retry, retry ? tag : 0, &sent_us);
+	// A reliable datagram stays in the retransmit window, sent or not: its
+	// outcome is known once acknowledged or given up.
+	pending_end(datagram, tag,
+			    datagram->reliable ? CW_DATAGRAM_QUEUED : path_status(sp_rs), dequeued_us);
+	if (time_request && sp_rs == SEND_PATH_OK) {
+		time_sync_request_sent(sent_us);
+		wait_time_response();
+	}
+	if (datagram->reliable) {
+		receive_frames();
+	}
+
+}
+
+/**
+ * Starts a scan of all channels. WIFI_EVENT_SCAN_DONE is posted at its end.
+ * Returns false on error.
+ */
+static bool start_scan(void) {
+
+	wifi_scan_config_t scan_config;
+	memset(&scan_config, 0, sizeof(wifi_scan_config_t));
+	esp_err_t esp_rs = esp_wifi_scan_start(&scan_config, false);
+	if (esp_rs != ESP_OK) {
+		ESP_LOGE(TAG, "Error from esp_wifi_scan_start: %d", esp_rs);
+		return false;
+	}
+	scanning = true;
+	return true;
+
+}
+
+/**
+ * Gives the results of the scan that has just ended to the roaming module.
+ */
+static void read_scan_results(void) {
+
+	uint16_t count = MAX_SCAN_RECORDS;
+	esp_err_t esp_rs = esp_wifi_scan_get_ap_records(&count, scan_records);
+	if (esp_rs != ESP_OK) {
+		ESP_LOGE(TAG, "Error from esp_wifi_scan_get_ap_records: %d", esp_rs);
+		count = 0;
+	}
+	roaming_scan_begin();
+	for (uint16_t i = 0; i < count; i++) {
+		roaming_scan_result((const char *)scan_records[i].ssid, scan_records[i].bssid,
+				            scan_records[i].primary, scan_records[i].rssi);
+	}
+	ESP_LOGI(TAG, "Scan done - %d access points", count);
+
+}
+
+/**
+ * Associates with the given access point. Returns false on error.
+ */
+static bool connect_to(const roaming_target_t *target) {
+
+	ESP_LOGI(TAG, "Connecting to %s - %02x:%02x:%02x:%02x:%02x:%02x, channel %d, RSSI %d",
+			 target->ssid, target->bssid[0], target->bssid[1], target->bssid[2],
+			 target->bssid[3], target->bssid[4], target->bssid[5],
+			 target->channel, target->rssi);
+	wifi_config_t wifi_config;
+	memset(&wifi_config, 0, sizeof(wifi_config_t));
+	strncpy((char *)wifi_config.sta.ssid, target->ssid, 32);
+	strncpy((char *)wifi_config.sta.password, target->password, 64);
+	// Known BSSID and channel: no scan before association.
+	wifi_config.sta.bssid_set = true;
+	memcpy(wifi_config.sta.bssid, target->bssid, sizeof(wifi_config.sta.bssid));
+	wifi_config.sta.channel = target->channel;
+	wifi_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
+	wifi_config.sta.pmf_cfg.capable = true;
+	wifi_config.sta.pmf_cfg.required = false;
+	esp_err_t esp_rs = esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config);
+	if (esp_rs != ESP_OK) {
+		ESP_LOGE(TAG, "Error from esp_wifi_set_config: %d", esp_rs);
+		return false;
+	}
+	esp_rs = esp_wifi_connect();
+	if (esp_rs != ESP_OK) {
+		ESP_LOGE(TAG, "Error from esp_wifi_connect: %d", esp_rs);
+		return false;
+	}
+	return true;
+
+}
+
+/**
+ * Starts the timer, a new scan is started at its expiry. Returns the next
+ * state.
+ */
+static state_t wait_and_scan(fsm_timer_t *timer) {
+
+	trace_record(TRACE_TIMER_START, CW_TIMEOUT, CONNECT_RETRY_PERIOD_MS);
+	BaseType_t fr_rs = fsm_timer_start(timer);
+	if (fr_rs != pdPASS) {
+		ESP_LOGE(TAG, "Error from fsm_timer_start: %d", fr_rs);
+		send_error(CW_TIMER_ERR, TAG);
+		return CW_ERROR_ST;
+	}
+	return CW_WAIT_AND_CONNECT_ST;
+
+}
+
+/**
+ * Starts a scan, unless one is already in progress. Returns the next state.
+ */
+static state_t scan(fsm_timer_t *timer) {
+
+	if (!scanning && !start_scan()) {
+		// Try again later.
+		return wait_and_scan(timer);
+	}
+	return CW_WAIT_SCAN_ST;
+
+}
+
+/**
+ * Associates with the best candidate not tried since the last scan. If
+ * there is none, waits before scanning again. Returns the next state.
+ */
+static state_t connect_next(fsm_timer_t *timer) {
+
+	roaming_target_t target;
+	if (!roaming_select(now_ms(), &target)) {
+		ESP_LOGI(TAG, "No access point available");
+		return wait_and_scan(timer);
+	}
+	if (!connect_to(&target)) {
+		send_error(CW_CONNECT_ERR, TAG);
+		return CW_ERROR_ST;
+	}
+	// Now, we wait either for IP_EVENT_STA_GOT_IP or for WIFI_EVENT_STA_DISCONNECTED.
+	return CW_WAIT_IP_ST;
+
+}
+
+/**
+ * Opens the transport, publishes the link state, and informs send_datagram
+ * task. Returns false on error, once the error has been reported to the
+ * supervisor.
+ */
+static bool open_data_path(fsm_timer_t *send_timer, fsm_timer_t *rssi_timer) {
+
+	// The socket created for a previous lease may be bound to a stale
+	// address: always open the transport again.
+	if (!send_path_open()) {
+		send_error(CW_INIT_ERR, TAG);
+		return false;
+	}
+	roaming_connected();
+	roaming_data_path_up(now_us());
+	link_state_publish_up(needs_ip ? __atomic_load_n(&station_ip, __ATOMIC_RELAXED) : 0);
 	message_t message_to_send;
+	message_to_send.message = SD_CONNECTION_STATUS;
+	message_to_send.sd_connection_status.connected = true;
+	BaseType_t fr_rs = send_to_queue(sd_input_queue, &message_to_send, TAG);
+	if (fr_rs != pdTRUE) {
+		// Not fatal: send_datagram task reads the link state at its next
+		// timeout.
+		ESP_LOGW(TAG, "Error on sending message to send_datagram - %d", fr_rs);
+	}
+	// Resume retransmissions of reliable datagrams still in flight,
+	// and retries of queued datagrams, if any.
+	if (!schedule_send_timer(send_timer)) {
+		send_error(CW_TIMER_ERR, TAG);
+		return false;
+	}
+	if ((transport_get()->caps & TRANSPORT_CAP_NEEDS_IP) == 0) {
+		// No access point: nothing to roam from.
+		return true;
+	}
+	// Monitor the RSSI, to roam before the link fails.
+	fr_rs = fsm_timer_start(rssi_timer);
+	if (fr_rs != pdPASS) {
+		ESP_LOGE(TAG, "Error from fsm_timer_start: %d", fr_rs);
+		send_error(CW_TIMER_ERR, TAG);
+		return false;
+	}
+	return true;
+
+}
+
+/**
+ * Closes the transport, publishes the link state, and informs send_datagram
+ * task.
+ */
+static void close_data_path(fsm_timer_t *send_timer, fsm_timer_t *rssi_timer) {
+
+	fsm_timer_stop(send_timer);
+	fsm_timer_stop(rssi_timer);
+#if CONFIG_UDPSENDER_FEC
+	// Last chance for the data frames of the pending blocks.
+	fec_flush(now_ms(), true);
+#endif
+	send_path_close();
+	roaming_data_path_down(now_us());
+	link_state_publish_down();
+	message_t message_to_send;
+	message_to_send.message = SD_CONNECTION_STATUS;
+	message_to_send.sd_connection_status.connected = false;
+	BaseType_t fr_rs = send_to_queue(sd_input_queue, &message_to_send, TAG);
+	if (fr_rs != pdTRUE) {
+		// Not fatal: send_datagram task reads the link state at its next
+		// timeout.
+		ESP_LOGW(TAG, "Error on sending message to send_datagram - %d", fr_rs);
+	}
+
+}
+
+static void log_stats(void) {
+
+	send_path_stats_t sp_stats;
+	send_path_get_stats(&sp_stats);
+	ESP_LOGI(TAG, "Send path - sent: %u, queued: %u, retried: %u, dropped: %u, delayed: %u, "
+			 "ENOMEM: %u, ENOBUFS: %u, EAGAIN: %u, EHOSTUNREACH: %u, other: %u",
+			 sp_stats.sent, sp_stats.queued, sp_stats.retried, sp_stats.dropped, sp_stats.delayed,
+			 sp_stats.errors[SEND_PATH_ERRNO_ENOMEM],
+			 sp_stats.errors[SEND_PATH_ERRNO_ENOBUFS],
+			 sp_stats.errors[SEND_PATH_ERRNO_EAGAIN],
+			 sp_stats.errors[SEND_PATH_ERRNO_EHOSTUNREACH],
+			 sp_stats.errors[SEND_PATH_ERRNO_OTHER]);
+	time_sync_stats_t ts_stats;
+	time_sync_get_stats(&ts_stats);
+	ESP_LOGI(TAG, "Time sync - requests: %u, samples: %u, rejected: %u, "
+			 "offset us: %lld, drift ppb: %d, delay us: %u",
+			 ts_stats.requests, ts_stats.samples, ts_stats.rejected,
+			 (long long)ts_stats.offset_us, ts_stats.drift_ppb, ts_stats.delay_us);
+	for (uint8_t i = 0; i < PRODUCER_MAX_SOURCES; i++) {
+		producer_source_t *source = producer_get_source(i);
+		if (source == NULL) {
+			continue;
+		}
+		producer_stats_t pr_stats;
+		producer_get_stats(source, &pr_stats);
+		ESP_LOGI(TAG, "Source %d - pushed: %u, overruns: %u, sent: %u, queued: %u, dropped: %u, "
+				 "latency us p50: %u, p99: %u, max: %u, "
+				 "p99 us pipeline: %u, queue: %u, send: %u",
+				 i, pr_stats.pushed, pr_stats.overruns, pr_stats.sent, pr_stats.queued,
+				 pr_stats.dropped,
+				 latency_stats_percentile(&pr_stats.latency, 50),
+				 latency_stats_percentile(&pr_stats.latency, 99),
+				 pr_stats.latency.max_us,
+				 latency_stats_percentile(&pr_stats.pipeline_wait, 99),
+				 latency_stats_percentile(&pr_stats.queue_wait, 99),
+				 latency_stats_percentile(&pr_stats.send_time, 99));
+	}
+	for (traffic_class_t tc = 0; tc < TRAFFIC_CLASS_COUNT; tc++) {
+		producer_stats_t pr_stats;
+		producer_get_class_stats(tc, &pr_stats);
+		if (pr_stats.pushed == 0) {
+			continue;
+		}
+		ESP_LOGI(TAG, "Class %d - sent: %u, dropped: %u, "
+				 "latency us p50: %u, p90: %u, p99: %u, max: %u",
+				 tc, pr_stats.sent, pr_stats.dropped,
+				 latency_stats_percentile(&pr_stats.latency, 50),
+				 latency_stats_percentile(&pr_stats.latency, 90),
+				 latency_stats_percentile(&pr_stats.latency, 99),
+				 pr_stats.latency.max_us);
+	}
+	ESP_LOGI(TAG, "Datagrams - sent: %u, queued: %u, dropped: %u, rejected: %u, expired: %u, "
+			 "queue wait us p50: %u, p99: %u, send time us p50: %u, p99: %u",
+			 datagram_stats.completed[CW_DATAGRAM_SENT],
+			 datagram_stats.completed[CW_DATAGRAM_QUEUED],
+			 datagram_stats.completed[CW_DATAGRAM_DROPPED],
+			 datagram_stats.completed[CW_DATAGRAM_REJECTED],
+			 datagram_stats.completed[CW_DATAGRAM_EXPIRED],
+			 latency_stats_percentile(&datagram_stats.queue_wait, 50),
+			 latency_stats_percentile(&datagram_stats.queue_wait, 99),
+			 latency_stats_percentile(&datagram_stats.send_time, 50),
+			 latency_stats_percentile(&datagram_stats.send_time, 99));
+	for (uint16_t stream_id = 0; stream_id <= UINT8_MAX; stream_id++) {
+		reliable_stats_t rel_stats;
+		if (!reliable_get_stats((uint8_t)stream_id, &rel_stats)) {
+			continue;
+		}
+		ESP_LOGI(TAG, "Reliable stream %u - in flight: %u, sent: %u, retransmits: %u, "
+				 "acked: %u, expired: %u, window full: %u, srtt ms: %u, rto ms: %u",
+				 stream_id, rel_stats.in_flight, rel_stats.sent, rel_stats.retransmits,
+				 rel_stats.acked, rel_stats.expired, rel_stats.window_full,
+				 rel_stats.srtt_ms, rel_stats.rto_ms);
+	}
+#if CONFIG_UDPSENDER_TRANSPORT_RAW
+	if (transport_get() == &transport_raw) {
+		transport_raw_stats_t tr_stats;
+		transport_raw_get_stats(&tr_stats);
+		ESP_LOGI(TAG, "Raw transport - sent: %u, pool empty: %u, mailbox full: %u, "
+				 "send errors: %u, completion us p50: %u, p99: %u",
+				 tr_stats.sent, tr_stats.pool_empty, tr_stats.mailbox_full,
+				 tr_stats.send_errors,
+				 latency_stats_percentile(&tr_stats.completion, 50),
+				 latency_stats_percentile(&tr_stats.completion, 99));
+	}
+#endif
+#if CONFIG_UDPSENDER_FEC
+	ESP_LOGI(TAG, "FEC - protected: %u, unprotected: %u, blocks: %u, flushed: %u, "
+			 "parity sent: %u, parity dropped: %u",
+			 fec_stats.protected, fec_stats.unprotected, fec_stats.blocks,
+			 fec_stats.flushed, fec_stats.parity_sent, fec_stats.parity_dropped);
+#endif
+	for (uint8_t i = 0; i < sizeof(task_names) / sizeof(task_names[0]); i++) {
+		TaskHandle_t task = xTaskGetHandle(task_names[i]);
+		if (task == NULL) {
+			continue;
+		}
+		ESP_LOGI(TAG, "Task %s - stack high-water mark: %u bytes", task_names[i],
+				 (unsigned int)uxTaskGetStackHighWaterMark(task));
+	}
+	roaming_stats_t ro_stats;
+	roaming_get_stats(&ro_stats);
+	ESP_LOGI(TAG, "Roaming - scans: %u, background: %u, connects: %u, failures: %u, "
+			 "roams: %u, losses: %u, RSSI: %d, "
+			 "roam interruption us p50: %u, max: %u, loss interruption us p50: %u, max: %u",
+			 ro_stats.scans, ro_stats.background_scans, ro_stats.connects,
+			 ro_stats.failures, ro_stats.roams, ro_stats.losses, ro_stats.rssi,
+			 latency_stats_percentile(&ro_stats.roam_interruption, 50),
+			 ro_stats.roam_interruption.max_us,
+			 latency_stats_percentile(&ro_stats.loss_interruption, 50),
+			 ro_stats.loss_interruption.max_us);
+
+}
+
+#if CONFIG_UDPSENDER_TRACE
+/**
+ * Sends the trace to the remote host, as FRAME_TRACE frames.
+ */
+static void send_trace(void) {
+
+	static uint8_t frame[FRAME_HEADER_LENGTH + TRACE_CHUNK_LENGTH];
+
+	trace_freeze();
+	uint32_t length = trace_dump_length();
+	uint32_t chunk_count = (length + TRACE_CHUNK_LENGTH - 1) / TRACE_CHUNK_LENGTH;
+	for (uint32_t i = 0; i < chunk_count; i++) {
+		frame_header_t header = {
+			.version = FRAME_VERSION,
+			.type = FRAME_TRACE,
+			.flags = 0,
+			.stream_id = TRACE_STREAM_ID,
+			.seq = i,
+		};
+		frame_encode_header(&header, frame);
+		uint16_t frame_length = FRAME_HEADER_LENGTH +
+				trace_dump_read(i * TRACE_CHUNK_LENGTH, &frame[FRAME_HEADER_LENGTH],
+						        TRACE_CHUNK_LENGTH);
+		// Queued for retry if lwIP is short of buffers.
+		send_frame(frame, frame_length, TRAFFIC_CLASS_BULK, true, 0, NULL);
+	}
+	trace_unfreeze();
+	ESP_LOGI(TAG, "Trace sent - %u bytes", length);
+
+}
+#endif
+
+void connect_wifi_init(void) {
 
 	current_state = CW_WAIT_CONNECT_MSG_ST;
 
-	// Prepare UDP context.
-	ESP_LOGI(TAG, "Preparing for sending datagrams to %s - %d", DEST_IPV4_ADDR, DEST_PORT);
-	int addr_family = AF_INET;
-	int ip_protocol = IPPROTO_IP;
-	int rs = inet_aton(DEST_IPV4_ADDR, &dest_addr.sin_addr.s_addr);
-	if (rs == 0) {
-		ESP_LOGE(TAG, "Incorrect IPv4 address: %s", DEST_IPV4_ADDR);
-		send_error(CW_INIT_ERR, TAG);
-		current_state = CW_ERROR_ST;
+	reliable_init(window_done);
+	send_path_init(retry_done);
+	memset(pending_datagrams, 0, sizeof(pending_datagrams));
+	time_sync_init();
+	latency_stats_reset(&datagram_stats.queue_wait);
+	latency_stats_reset(&datagram_stats.send_time);
+
+	needs_ip = (transport_get()->caps & TRANSPORT_CAP_NEEDS_IP) != 0;
+	ESP_LOGI(TAG, "Transport: %s", transport_get()->name);
+
+	// Create our input queues. They are made visible to other tasks once
+	// in their set. In reactor mode, they belong to the reactor, and are
+	// already created.
+	QueueHandle_t control_queue;
+	QueueHandle_t data_queue;
+	if (cw_input_queue == NULL) {
+		if (create_queue_set(CW_INPUT_QUEUE_LENGTH, CW_DATA_QUEUE_LENGTH,
+				             &queue_set, &control_queue, &data_queue)) {
+			vQueueAddToRegistry(queue_set, "cw_set");
+			vQueueAddToRegistry(control_queue, "cw_control");
+			vQueueAddToRegistry(data_queue, "cw_data");
+			cw_input_queue = control_queue;
+			cw_data_queue = data_queue;
+		} else {
+			ESP_LOGE(TAG, "Error from create_queue_set");
+			send_error(CW_INIT_ERR, TAG);
+			current_state = CW_ERROR_ST;
+		}
 	}
+
+	// Create the timer we'll use to reconnect to the access point.
 	if (current_state != CW_ERROR_ST) {
-		dest_addr.sin_family = AF_INET;
-		dest_addr.sin_port = htons(DEST_PORT);
-		sock = socket(addr_family, SOCK_DGRAM, ip_protocol);
-		if (sock < 0) {
-			ESP_LOGE(TAG, "Error from socket: %d", sock);
+		if (!fsm_timer_init(&timer, "CW_TIMER", CW_TIMEOUT, &cw_input_queue,
+				            CONNECT_RETRY_PERIOD_MS, false, TAG)) {
+			ESP_LOGE(TAG, "Error from fsm_timer_init");
 			send_error(CW_INIT_ERR, TAG);
 			current_state = CW_ERROR_ST;
 		}
 	}
 
-	// Create our input queue.
-	cw_input_queue = xQueueCreate(INPUT_QUEUE_LENGTH, sizeof(message_t));
-	if (cw_input_queue == 0) {
-		ESP_LOGE(TAG, "Error from xQueueCreate");
-		send_error(CW_INIT_ERR, TAG);
-		current_state = CW_ERROR_ST;
+	// Create the timer used for retransmissions and retries.
+	if (current_state != CW_ERROR_ST) {
+		if (!fsm_timer_init(&send_timer, "CW_SEND_TIMER", CW_SEND_TIMEOUT, &cw_input_queue,
+				            RELIABLE_POLL_PERIOD_MS, false, TAG)) {
+			ESP_LOGE(TAG, "Error from fsm_timer_init");
+			send_error(CW_INIT_ERR, TAG);
+			current_state = CW_ERROR_ST;
+		}
 	}
 
-	// Create the timer we'll use to reconnect to the access point.
+	// Create the timer used to sample the RSSI while connected.
 	if (current_state != CW_ERROR_ST) {
-		uint8_t timerID = 0;
-		timer = xTimerCreate("CW_TIMER",
-				pdMS_TO_TICKS(CONNECT_RETRY_PERIOD_MS),
-				pdFALSE,  // uxAutoReload.
-				&timerID,
-				timer_handler);
-		if (timer == NULL) {
-			ESP_LOGE(TAG, "Error from xTimerCreate");
+		if (!fsm_timer_init(&rssi_timer, "CW_RSSI_TIMER", CW_RSSI_TIMEOUT, &cw_input_queue,
+				            RSSI_PERIOD_MS, true, TAG)) {
+			ESP_LOGE(TAG, "Error from fsm_timer_init");
 			send_error(CW_INIT_ERR, TAG);
 			current_state = CW_ERROR_ST;
 		}
@@ -229,187 +1404,329 @@ void connect_wifi_task(void *pvParameters) {
 		}
 	}
 
-	while (true) {
+#if CONFIG_UDPSENDER_AEAD
+	// Datagrams are never sent in clear when encryption is enabled.
+	if (current_state != CW_ERROR_ST && !init_aead()) {
+		send_error(CW_INIT_ERR, TAG);
+		current_state = CW_ERROR_ST;
+	}
+#endif
 
-		// Wait for an incoming message.
-		fr_rs = xQueueReceive(cw_input_queue, &received_message, delay_60s);
-		if (fr_rs != pdTRUE) {
-			// Timeout. Go back to receive.
-			ESP_LOGI(TAG, "Queue receive timeout");
-			continue;
+}
+
+void connect_wifi_handle(const message_t *received_message) {
+
+	esp_err_t esp_rs;  // Return status for ESP-IDF calls.
+
+	uint64_t dequeued_us = now_us();
+	state_t previous_state = current_state;
+
+	// The trace can be sent only when connected.
+	if (received_message->message == CW_TRACE_DUMP) {
+#if CONFIG_UDPSENDER_TRACE
+		if (current_state == CW_WAIT_DISCONNECT_MSG_ST) {
+			send_trace();
 		}
+#endif
+		return;
+	}
 
-		switch (current_state) {
+	// A scan may end after the state it was started in has been left.
+	if (received_message->message == CW_SCAN_DONE) {
+		scanning = false;
+		if (current_state != CW_WAIT_SCAN_ST && current_state != CW_WAIT_DISCONNECT_MSG_ST) {
+			return;
+		}
+	}
 
-		case CW_WAIT_CONNECT_MSG_ST:
-			if (received_message.message != CW_CONNECT) {
-				// Unexpected message, ignore it, stay in this state.
-				ESP_LOGE(TAG, "CW_CONNECT_ST - unexpected message received: %d", received_message.message);
+	// The RSSI is sampled only when connected.
+	if (received_message->message == CW_RSSI_TIMEOUT &&
+		(current_state != CW_WAIT_DISCONNECT_MSG_ST || roam_pending)) {
+		return;
+	}
+
+	// Datagrams can be sent only when connected. In any other state, they
+	// are dropped, and their producer is told so.
+	if (received_message->message == CW_SEND_DATAGRAM &&
+		(current_state != CW_WAIT_DISCONNECT_MSG_ST || roam_pending)) {
+		ESP_LOGW(TAG, "Not connected, datagram dropped");
+		datagram_done(&received_message->cw_send_datagram, CW_DATAGRAM_DROPPED, dequeued_us);
+		return;
+	}
+
+	switch (current_state) {
+
+	case CW_WAIT_CONNECT_MSG_ST:
+		if (received_message->message != CW_CONNECT) {
+			// Unexpected message, ignore it, stay in this state.
+			ESP_LOGE(TAG, "CW_CONNECT_ST - unexpected message received: %d", received_message->message);
+			break;
+		}
+		ESP_LOGI(TAG, "CW_WAIT_CONNECT_MSG_T - connect message received");
+		// At this stage, connect message was received.
+		roaming_init(received_message->cw_connect.networks,
+				     received_message->cw_connect.network_count);
+		if (needs_ip && roaming_network_count() == 0) {
+			ESP_LOGE(TAG, "No network");
+			send_error(CW_START_ERR, TAG);
+			current_state = CW_ERROR_ST;
+			break;
+		}
+		for (uint8_t i = 0; i < received_message->cw_connect.network_count; i++) {
+			const roaming_network_t *network = &received_message->cw_connect.networks[i];
+			if (network->ssid != NULL && network->ssid[0] != '\0') {
+				ESP_LOGI(TAG, "AP SSID: %s", network->ssid);
+			}
+		}
+		if (sta_started && !needs_ip) {
+			if (!open_data_path(&send_timer, &rssi_timer)) {
+				current_state = CW_ERROR_ST;
 				break;
 			}
-			ESP_LOGI(TAG, "CW_WAIT_CONNECT_MSG_T - connect message received");
-			// At this stage, connect message was received.
-			ESP_LOGI(TAG, "AP SSID: %s", received_message.cw_connect.ssid);
-			ESP_LOGI(TAG, "AP password: %s", received_message.cw_connect.password);
-			// Try to connect to related access point.
-			wifi_config_t wifi_config;
-			strncpy((char *)wifi_config.sta.ssid, received_message.cw_connect.ssid, 32);
-			strncpy((char *)wifi_config.sta.password, received_message.cw_connect.password, 64);
-			wifi_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK,
-			wifi_config.sta.pmf_cfg.capable = true;
-			wifi_config.sta.pmf_cfg.required = false;
-			esp_rs = esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config);
-			if (esp_rs != ESP_OK) {
-				ESP_LOGE(TAG, "Error from esp_wifi_set_config: %d", esp_rs);
-				send_error(CW_START_ERR, TAG);
+			current_state = CW_WAIT_DISCONNECT_MSG_ST;
+			break;
+		}
+		if (sta_started) {
+			// Look for the access points of the networks.
+			current_state = scan(&timer);
+			break;
+		}
+		esp_rs = esp_wifi_start();
+		if (esp_rs != ESP_OK) {
+			ESP_LOGE(TAG, "Error from esp_wifi_start: %d", esp_rs);
+			send_error(CW_START_ERR, TAG);
+			current_state = CW_ERROR_ST;
+			break;
+		}
+		// Now, we wait for the WIFI_EVENT_STA_START event (see the event handler).
+		current_state = CW_WAIT_STA_ST;
+		break;
+
+	case CW_WAIT_STA_ST:
+		if (received_message->message != CW_STA_OK) {
+			// Unexpected message, ignore it, stay in this state.
+			ESP_LOGE(TAG, "CW_WAIT_STA_ST - unexpected message received: %d", received_message->message);
+			break;
+		}
+		ESP_LOGI(TAG, "CW_WAIT_STA_ST - STA started");
+		sta_started = true;
+		if (!needs_ip) {
+			// No association: the transport can be used right away.
+			if (!open_data_path(&send_timer, &rssi_timer)) {
 				current_state = CW_ERROR_ST;
 				break;
 			}
-			esp_rs = esp_wifi_start();
-			if (esp_rs != ESP_OK) {
-				ESP_LOGE(TAG, "Error from esp_wifi_start: %d", esp_rs);
-				send_error(CW_START_ERR, TAG);
+			current_state = CW_WAIT_DISCONNECT_MSG_ST;
+			break;
+		}
+		// Look for the access points of the networks.
+		current_state = scan(&timer);
+		break;
+
+	case CW_WAIT_SCAN_ST:
+		if (received_message->message != CW_SCAN_DONE) {
+			// Unexpected message, ignore it, stay in this state.
+			ESP_LOGE(TAG, "CW_WAIT_SCAN_ST - unexpected message received: %d", received_message->message);
+			break;
+		}
+		read_scan_results();
+		current_state = connect_next(&timer);
+		break;
+
+	case CW_WAIT_IP_ST:
+		if (received_message->message == CW_AP_NOK) {
+			// Connection to the AP failed. Try the next candidate, if any.
+			ESP_LOGI(TAG, "CW_WAIT_IP_ST - connection failed");
+			roaming_connect_failed(now_ms());
+			current_state = connect_next(&timer);
+			break;
+		}
+		if (received_message->message == CW_IP_OK) {
+			// Connection to the AP succeeded and we got an IP address.
+			ESP_LOGI(TAG, "CW_WAIT_IP_ST - got an IP address");
+			if (!open_data_path(&send_timer, &rssi_timer)) {
 				current_state = CW_ERROR_ST;
 				break;
 			}
-			// Now, we wait for the WIFI_EVENT_STA_START event (see the event handler).
-			current_state = CW_WAIT_STA_ST;
+			current_state = CW_WAIT_DISCONNECT_MSG_ST;
+			break;
+		}
+		// At this stage, we got another type of message.
+		ESP_LOGE(TAG, "CW_WAIT_STA_ST - unexpected message received: %d", received_message->message);
+		break;
+
+	case CW_WAIT_AND_CONNECT_ST:
+		if (received_message->message != CW_TIMEOUT) {
+			// Unexpected message, ignore it, stay in this state.
+			ESP_LOGE(TAG, "CW_WAIT_AND_CONNECT_ST - unexpected message received: %d", received_message->message);
 			break;
+		}
+		// At this stage, we can try to reconnect.
+		ESP_LOGI(TAG, "CW_WAIT_AND_CONNECT_ST - trying to reconnect");
+		current_state = scan(&timer);
+		break;
 
-		case CW_WAIT_STA_ST:
-			if (received_message.message != CW_STA_OK) {
-				// Unexpected message, ignore it, stay in this state.
-				ESP_LOGE(TAG, "CW_WAIT_STA_ST - unexpected message received: %d", received_message.message);
+	case CW_WAIT_DISCONNECT_MSG_ST:
+		if (received_message->message == CW_DISCONNECT) {
+			// Already closed when a roam started.
+			if (!roam_pending) {
+				close_data_path(&send_timer, &rssi_timer);
+			}
+			roam_pending = false;
+			current_state = CW_WAIT_CONNECT_MSG_ST;
+			if (!needs_ip) {
 				break;
 			}
-			ESP_LOGI(TAG, "CW_WAIT_STA_ST - STA started");
-			esp_rs = esp_wifi_connect();
+			esp_rs = esp_wifi_disconnect();
 			if (esp_rs != ESP_OK) {
-				ESP_LOGE(TAG, "Error from esp_wifi_connect: %d", esp_rs);
+				ESP_LOGE(TAG, "Error from esp_wifi_disconnect: %d", esp_rs);
+				send_error(CW_DISCONNECT_ERR, TAG);
+				current_state = CW_ERROR_ST;
+			}
+			break;
+		}
+		if (received_message->message == CW_AP_NOK && roam_pending) {
+			// Disconnected from the previous access point, associate
+			// with the new one.
+			roam_pending = false;
+			if (!connect_to(&roam_target)) {
 				send_error(CW_CONNECT_ERR, TAG);
 				current_state = CW_ERROR_ST;
 				break;
 			}
-			// Now, we wait either for IP_EVENT_STA_GOT_IP or for WIFI_EVENT_STA_DISCONNECTED.
 			current_state = CW_WAIT_IP_ST;
 			break;
-
-		case CW_WAIT_IP_ST:
-			if (received_message.message == CW_AP_NOK) {
-				// Connection to the AP failed.
-				// Can we still retry?
-				ESP_LOGI(TAG, "CW_WAIT_IP_ST - connection failed");
-				// Wait for some time before retrying. The event handler
-				// called at timer timeout will send the CW_TIMEOUT message.
-				fr_rs = xTimerStart(timer, delay_500ms);
-				if (fr_rs != pdPASS) {
-					ESP_LOGE(TAG, "Error from xTimerStart: %d", fr_rs);
-					send_error(CW_TIMER_ERR, TAG);
-					current_state = CW_ERROR_ST;
-					break;
-				}
-				current_state = CW_WAIT_AND_CONNECT_ST;
+		}
+		if (received_message->message == CW_AP_NOK) {
+			// We got disconnected. Inform send_datagram task.
+			ESP_LOGI(TAG, "CW_WAIT_DISCONNECT_ST - disconnected");
+			roaming_link_lost(now_ms());
+			close_data_path(&send_timer, &rssi_timer);
+			// Look for an access point again, without waiting.
+			current_state = scan(&timer);
+			break;
+		}
+		if (received_message->message == CW_RSSI_TIMEOUT) {
+			wifi_ap_record_t ap_info;
+			esp_rs = esp_wifi_sta_get_ap_info(&ap_info);
+			if (esp_rs != ESP_OK) {
+				ESP_LOGW(TAG, "Error from esp_wifi_sta_get_ap_info: %d", esp_rs);
 				break;
 			}
-			if (received_message.message == CW_IP_OK) {
-				// Connection to the AP succeeded and we got an IP address.
-				ESP_LOGI(TAG, "CW_WAIT_IP_ST - got an IP address");
-				message_to_send.message = SD_CONNECTION_STATUS;
-				message_to_send.sd_connection_status.connected = true;
-				fr_rs = send_to_queue(sd_input_queue, &message_to_send, TAG);
-				if (fr_rs != pdTRUE) {
-					ESP_LOGE(TAG, "Error on sending message to send_datagram - %d", fr_rs);
-					send_error(CW_QUEUE_ERR, TAG);
-					current_state = CW_ERROR_ST;
-					break;
-				}
-				current_state = CW_WAIT_DISCONNECT_MSG_ST;
-				break;
+			link_state_publish_rssi(ap_info.rssi);
+			if (roaming_rssi_sample(ap_info.rssi, now_ms()) && !scanning) {
+				ESP_LOGI(TAG, "Low RSSI, scanning - %d", ap_info.rssi);
+				// On error, the next low RSSI sample triggers another scan.
+				start_scan();
 			}
-			// At this stage, we got another type of message.
-			ESP_LOGE(TAG, "CW_WAIT_STA_ST - unexpected message received: %d", received_message.message);
+			// Stay in same state.
 			break;
-
-		case CW_WAIT_AND_CONNECT_ST:
-			if (received_message.message != CW_TIMEOUT) {
-				// Unexpected message, ignore it, stay in this state.
-				ESP_LOGE(TAG, "CW_WAIT_AND_CONNECT_ST - unexpected message received: %d", received_message.message);
+		}
+		if (received_message->message == CW_SCAN_DONE) {
+			read_scan_results();
+			if (!roaming_should_roam(now_ms(), &roam_target)) {
+				// Stay in same state.
 				break;
 			}
-			// At this stage, we can try to reconnect.
-			ESP_LOGI(TAG, "CW_WAIT_AND_CONNECT_ST - trying to reconnect");
-			esp_rs = esp_wifi_connect();
+			ESP_LOGI(TAG, "Roaming to a better access point");
+			close_data_path(&send_timer, &rssi_timer);
+			// The association with the new access point is started once
+			// disconnected (CW_AP_NOK).
+			roam_pending = true;
+			esp_rs = esp_wifi_disconnect();
 			if (esp_rs != ESP_OK) {
-				ESP_LOGE(TAG, "Error from esp_wifi_connect: %d", esp_rs);
-				send_error(CW_CONNECT_ERR, TAG);
+				ESP_LOGE(TAG, "Error from esp_wifi_disconnect: %d", esp_rs);
+				send_error(CW_DISCONNECT_ERR, TAG);
 				current_state = CW_ERROR_ST;
 				break;
 			}
-			// Now, we wait either for IP_EVENT_STA_GOT_IP or for WIFI_EVENT_STA_DISCONNECTED.
-			current_state = CW_WAIT_IP_ST;
+			// Stay in same state.
 			break;
-
-		case CW_WAIT_DISCONNECT_MSG_ST:
-			if (received_message.message == CW_DISCONNECT) {
-				esp_rs = esp_wifi_disconnect();
-				if (esp_rs != ESP_OK) {
-					ESP_LOGE(TAG, "Error from esp_wifi_disconnect: %d", esp_rs);
-					send_error(CW_DISCONNECT_ERR, TAG);
-					current_state = CW_ERROR_ST;
-					break;
-				}
-				current_state = CW_WAIT_CONNECT_MSG_ST;
-			}
-			if (received_message.message == CW_AP_NOK) {
-				// We got disconnected. Inform send_datagram task.
-				ESP_LOGI(TAG, "CW_WAIT_DISCONNECT_ST - disconnected");
-				message_to_send.message = SD_CONNECTION_STATUS;
-				message_to_send.sd_connection_status.connected = false;
-				fr_rs = send_to_queue(sd_input_queue, &message_to_send, TAG);
-				if (fr_rs != pdTRUE) {
-					ESP_LOGE(TAG, "Error on sending message to send_datagram - %d", fr_rs);
-					send_error(CW_QUEUE_ERR, TAG);
-					current_state = CW_ERROR_ST;
-					break;
-				}
-				// Wait a bit and try to reconnect.
-				fr_rs = xTimerStart(timer, delay_500ms);
-				if (fr_rs != pdPASS) {
-					ESP_LOGE(TAG, "Error from xTimerStart: %d", fr_rs);
-					send_error(CW_TIMER_ERR, TAG);
-					current_state = CW_ERROR_ST;
-					break;
-				}
-				current_state = CW_WAIT_AND_CONNECT_ST;
+		}
+		if (received_message->message == CW_SEND_DATAGRAM) {
+			process_datagram(&received_message->cw_send_datagram, dequeued_us);
+			if (!schedule_send_timer(&send_timer)) {
+				send_error(CW_TIMER_ERR, TAG);
+				current_state = CW_ERROR_ST;
 				break;
 			}
-			if (received_message.message == CW_SEND_DATAGRAM) {
-				uint16_t payload_length = received_message.cw_send_datagram.payload_length;
-				ESP_LOGI(TAG, "Sending a datagram - %d", payload_length);
-				int err = sendto(sock, received_message.cw_send_datagram.payload,
-						         payload_length, 0, (struct sockaddr *)&dest_addr,
-								 sizeof(dest_addr));
-				if (err < 0) {
-					ESP_LOGE(TAG, "Error from sendto: %d", errno);
-					break;
-				}
-				// Stay in same state.
+			datagram_count++;
+			if (datagram_count % STATS_LOG_PERIOD == 0) {
+				log_stats();
+			}
+			// Stay in same state.
+			break;
+		}
+		if (received_message->message == CW_SEND_TIMEOUT) {
+			send_path_flush(now_ms());
+#if CONFIG_UDPSENDER_FEC
+			fec_flush(now_ms(), false);
+#endif
+			receive_frames();
+			retransmit();
+			if (!schedule_send_timer(&send_timer)) {
+				send_error(CW_TIMER_ERR, TAG);
+				current_state = CW_ERROR_ST;
 				break;
 			}
-			// At this stage, unexpected message.
-			ESP_LOGE(TAG, "CW_WAIT_DISCONNECT_ST - unexpected message received: %d", received_message.message);
+			// Stay in same state.
 			break;
+		}
+		// At this stage, unexpected message.
+		ESP_LOGE(TAG, "CW_WAIT_DISCONNECT_ST - unexpected message received: %d", received_message->message);
+		break;
 
-		case CW_ERROR_ST:
-			// Once we enter this state, we stay in it.
-			ESP_LOGI(TAG, "CW_ERROR_ST");
-			break;
+	case CW_ERROR_ST:
+		// Once we enter this state, we stay in it.
+		ESP_LOGI(TAG, "CW_ERROR_ST");
+		break;
 
-		default:
-			ESP_LOGE(TAG, "Unknown state: %d", current_state);
-			send_error(CW_UKNOWN_STATE_ERR, TAG);
-			current_state = CW_ERROR_ST;
+	default:
+		ESP_LOGE(TAG, "Unknown state: %d", current_state);
+		send_error(CW_UKNOWN_STATE_ERR, TAG);
+		current_state = CW_ERROR_ST;
+	}
+
+	trace_state(previous_state, current_state);
+
+}
+
+void connect_wifi_task(void *pvParameters) {
+
+	// Delay used for xTicksToWait when calling xQueueReceive().
+	const TickType_t delay_60s = pdMS_TO_TICKS(60000);
+
+	BaseType_t fr_rs;  // Return status for FreeRTOS calls.
+
+	message_t received_message;
+
+	connect_wifi_init();
+
+	while (true) {
+
+		// Wait for an incoming message.
+		trace_record(TRACE_WAIT, 0, 0);
+		fr_rs = receive_from_set(queue_set, cw_input_queue, cw_data_queue,
+				                 &received_message, delay_60s);
+		if (fr_rs != pdTRUE) {
+			// Timeout. Go back to receive.
+			ESP_LOGI(TAG, "Queue receive timeout");
+			continue;
 		}
+		trace_record(TRACE_DEQUEUE, received_message.message, 0);
+		connect_wifi_handle(&received_message);
 
 	}
 }
+
+BaseType_t connect_wifi_send_datagram(message_t *message, const char *tag) {
+
+	message->cw_send_datagram.handle = __atomic_add_fetch(&last_handle, 1, __ATOMIC_RELAXED);
+	message->cw_send_datagram.enqueued_us = now_us();
+	return send_to_queue(cw_data_queue, message, tag);
+
+}
+
+void connect_wifi_get_datagram_stats(cw_datagram_stats_t *stats) {
+	*stats = datagram_stats;
+}
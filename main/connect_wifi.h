@@ -20,10 +20,50 @@
 #ifndef MAIN_CONNECT_WIFI_H_
 #define MAIN_CONNECT_WIFI_H_
 
+#include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 
+#include "latency_stats.h"
+#include "messages.h"
+
+// Control messages.
+#define CW_INPUT_QUEUE_LENGTH 6
 extern QueueHandle_t cw_input_queue;
 
+// CW_SEND_DATAGRAM messages.
+#define CW_DATA_QUEUE_LENGTH 3
+extern QueueHandle_t cw_data_queue;
+
+// Datagram completions, from all producers. Datagrams completed as queued
+// are counted again with their outcome.
+typedef struct {
+	uint32_t completed[CW_DATAGRAM_STATUS_COUNT];  // Per status.
+	latency_stats_t queue_wait;  // From enqueue to dequeue.
+	latency_stats_t send_time;   // From dequeue to the return of the last send call.
+} cw_datagram_stats_t;
+
 void connect_wifi_task(void *pvParameters);
 
+/**
+ * State machine of connect_wifi_task(), for the reactor (see reactor.h).
+ * connect_wifi_init() creates cw_input_queue and cw_data_queue, unless
+ * they have already been set. Control messages must be handled before
+ * waiting datagrams.
+ */
+void connect_wifi_init(void);
+void connect_wifi_handle(const message_t *received_message);
+
+/**
+ * Gives a handle to the datagram of a CW_SEND_DATAGRAM message, stamps it
+ * with the current time, and sends the message to cw_data_queue, without
+ * waiting. Returns the result of the send operation. Can be called by any
+ * task.
+ */
+BaseType_t connect_wifi_send_datagram(message_t *message, const char *tag);
+
+/**
+ * Provides the datagram completion counters.
+ */
+void connect_wifi_get_datagram_stats(cw_datagram_stats_t *stats);
+
 #endif /* MAIN_CONNECT_WIFI_H_ */
@@ -0,0 +1,226 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fec.h"
+#include "frame.h"
+
+// GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1, generator 2.
+#define GF_POLYNOMIAL 0x11d
+
+static uint8_t gf_exp[512];
+static uint8_t gf_log[256];
+static bool tables_ready = false;
+
+static void init_tables(void) {
+
+	if (tables_ready) {
+		return;
+	}
+	uint16_t x = 1;
+	for (uint16_t i = 0; i < 255; i++) {
+		gf_exp[i] = (uint8_t)x;
+		gf_log[x] = (uint8_t)i;
+		x <<= 1;
+		if (x & 0x100) {
+			x ^= GF_POLYNOMIAL;
+		}
+	}
+	// No modulo needed for the sum of two logarithms.
+	for (uint16_t i = 255; i < 512; i++) {
+		gf_exp[i] = gf_exp[i - 255];
+	}
+	tables_ready = true;
+
+}
+
+uint8_t fec_gf_mul(uint8_t a, uint8_t b) {
+
+	if (a == 0 || b == 0) {
+		return 0;
+	}
+	init_tables();
+	return gf_exp[gf_log[a] + gf_log[b]];
+
+}
+
+uint8_t fec_gf_inv(uint8_t a) {
+
+	if (a == 0) {
+		return 0;
+	}
+	init_tables();
+	return gf_exp[255 - gf_log[a]];
+
+}
+
+void fec_gf_mul_add(uint8_t *destination, const uint8_t *source, uint8_t coefficient,
+		            uint16_t length) {
+
+	if (coefficient == 0) {
+		return;
+	}
+	if (coefficient == 1) {
+		for (uint16_t i = 0; i < length; i++) {
+			destination[i] ^= source[i];
+		}
+		return;
+	}
+	init_tables();
+	uint16_t log_coefficient = gf_log[coefficient];
+	for (uint16_t i = 0; i < length; i++) {
+		if (source[i] != 0) {
+			destination[i] ^= gf_exp[gf_log[source[i]] + log_coefficient];
+		}
+	}
+
+}
+
+uint8_t fec_coefficient(fec_scheme_t scheme, uint8_t m, uint8_t j, uint8_t i) {
+
+	if (scheme == FEC_XOR) {
+		return 1;
+	}
+	return fec_gf_inv(j ^ (uint8_t)(m + i));
+
+}
+
+bool fec_encoder_init(fec_encoder_t *encoder, fec_scheme_t scheme, uint8_t k, uint8_t m,
+		              uint16_t max_length, uint8_t *parity) {
+
+	if (k < 2 || k > FEC_MAX_K || m < 1 || m > FEC_MAX_M ||
+		(scheme == FEC_XOR && m != 1) || (scheme != FEC_XOR && scheme != FEC_RS)) {
+		return false;
+	}
+	init_tables();
+	encoder->scheme = scheme;
+	encoder->k = k;
+	encoder->m = m;
+	encoder->max_length = max_length;
+	encoder->parity = parity;
+	fec_encoder_reset(encoder);
+	return true;
+
+}
+
+bool fec_encoder_accepts(const fec_encoder_t *encoder, uint32_t seq, uint16_t length) {
+
+	if (length > encoder->max_length) {
+		return false;
+	}
+	if (encoder->count == 0) {
+		return true;
+	}
+	// Offsets are on one byte, and increase.
+	uint32_t offset = seq - encoder->first_seq;
+	return offset > encoder->offsets[encoder->count - 1] && offset <= UINT8_MAX;
+
+}
+
+bool fec_encoder_add(fec_encoder_t *encoder, uint32_t seq, const uint8_t *frame,
+		             uint16_t length, uint32_t now_ms) {
+
+	if (encoder->count == 0) {
+		encoder->first_seq = seq;
+		encoder->started_ms = now_ms;
+	}
+	uint8_t i = encoder->count;
+	encoder->offsets[i] = (uint8_t)(seq - encoder->first_seq);
+	uint8_t prefix[FEC_SYMBOL_OVERHEAD] = { (uint8_t)(length >> 8), (uint8_t)length };
+	uint16_t symbol_size = FEC_SYMBOL_OVERHEAD + encoder->max_length;
+	for (uint8_t j = 0; j < encoder->m; j++) {
+		uint8_t coefficient = fec_coefficient(encoder->scheme, encoder->m, j, i);
+		uint8_t *symbol = &encoder->parity[j * symbol_size];
+		fec_gf_mul_add(symbol, prefix, coefficient, FEC_SYMBOL_OVERHEAD);
+		fec_gf_mul_add(&symbol[FEC_SYMBOL_OVERHEAD], frame, coefficient, length);
+	}
+	if (FEC_SYMBOL_OVERHEAD + length > encoder->symbol_length) {
+		encoder->symbol_length = FEC_SYMBOL_OVERHEAD + length;
+	}
+	encoder->count++;
+	return encoder->count == encoder->k;
+
+}
+
+uint8_t fec_encoder_pending(const fec_encoder_t *encoder) {
+	return encoder->count;
+}
+
+uint16_t fec_encoder_build(const fec_encoder_t *encoder, uint8_t stream_id, uint8_t index,
+		                   uint8_t *buffer) {
+
+	frame_header_t header = {
+		.version = FRAME_VERSION,
+		.type = FRAME_PARITY,
+		.flags = 0,
+		.stream_id = stream_id,
+		.seq = encoder->first_seq,
+		.epoch = 0,
+		.timestamp_us = 0,
+	};
+	frame_encode_header(&header, buffer);
+	uint8_t *fec_header = &buffer[FRAME_HEADER_LENGTH];
+	fec_header[0] = (uint8_t)encoder->scheme;
+	fec_header[1] = encoder->count;
+	fec_header[2] = encoder->m;
+	fec_header[3] = index;
+	memcpy(&fec_header[4], encoder->offsets, encoder->count);
+	uint16_t symbol_size = FEC_SYMBOL_OVERHEAD + encoder->max_length;
+	// Parity bytes beyond the longest symbol of the block are zeros.
+	memcpy(&fec_header[FEC_HEADER_LENGTH(encoder->count)],
+		   &encoder->parity[index * symbol_size], encoder->symbol_length);
+	return FRAME_HEADER_LENGTH + FEC_HEADER_LENGTH(encoder->count) + encoder->symbol_length;
+
+}
+
+void fec_encoder_reset(fec_encoder_t *encoder) {
+
+	encoder->count = 0;
+	encoder->symbol_length = 0;
+	memset(encoder->parity, 0, (size_t)encoder->m * (FEC_SYMBOL_OVERHEAD + encoder->max_length));
+
+}
+
+bool fec_decode_parity(const uint8_t *buffer, uint16_t length, fec_parity_t *parity) {
+
+	if (!frame_decode_header(buffer, length, &parity->header) ||
+		parity->header.type != FRAME_PARITY ||
+		length < FRAME_HEADER_LENGTH + FEC_HEADER_LENGTH(0)) {
+		return false;
+	}
+	const uint8_t *fec_header = &buffer[FRAME_HEADER_LENGTH];
+	parity->scheme = (fec_scheme_t)fec_header[0];
+	parity->k = fec_header[1];
+	parity->m = fec_header[2];
+	parity->index = fec_header[3];
+	if ((parity->scheme != FEC_XOR && parity->scheme != FEC_RS) ||
+		parity->k == 0 || parity->k > FEC_MAX_K || parity->m == 0 || parity->m > FEC_MAX_M ||
+		parity->index >= parity->m ||
+		length < FRAME_HEADER_LENGTH + FEC_HEADER_LENGTH(parity->k) + FEC_SYMBOL_OVERHEAD) {
+		return false;
+	}
+	memcpy(parity->offsets, &fec_header[4], parity->k);
+	parity->symbol = &fec_header[FEC_HEADER_LENGTH(parity->k)];
+	parity->symbol_length = length - FRAME_HEADER_LENGTH - FEC_HEADER_LENGTH(parity->k);
+	return true;
+
+}
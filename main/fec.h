@@ -0,0 +1,166 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef MAIN_FEC_H_
+#define MAIN_FEC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "frame.h"
+
+// Forward error correction.
+//
+// Datagrams of a stream are protected by blocks: for every k data frames,
+// m parity frames are sent, from which the remote host can rebuild up to m
+// lost data frames of the block, without feedback. A data frame is
+// protected as it is sent: stamped, and sealed if encryption is enabled.
+//
+// Every data frame of a block is seen as a symbol: its length (2 bytes),
+// followed by its bytes, padded with zeros to the longest frame of the
+// block. Parity symbol j is the sum over the block of c(j, i) * symbol i,
+// in GF(2^8):
+// - XOR: m is 1, and all coefficients are 1
+// - Reed-Solomon: coefficients come from a Cauchy matrix, c(j, i) =
+//   1 / (j + (m + i)), addition being XOR, so that any k of the k + m
+//   symbols give the block back
+//
+// Parity frame: a header with type FRAME_PARITY, the stream of the block,
+// and the sequence number of the first data frame of the block, followed
+// by (network byte order):
+//
+//  0       1       2       3       4                4 + k
+//  +-------+-------+-------+-------+------ ... ------+----------- ... -----------+
+//  |scheme |   k   |   m   | index |  seq offsets    |      parity symbol        |
+//  +-------+-------+-------+-------+------ ... ------+----------- ... -----------+
+//
+// Seq offset i gives the sequence number of data frame i of the block,
+// from the sequence number of the header. k can be lower than configured,
+// for a block flushed before it was full.
+//
+// An encoder must be used by one task only. This file does not depend on
+// FreeRTOS or ESP-IDF, so that it can be used by host tools.
+
+#define FEC_MAX_K 16
+#define FEC_MAX_M 4
+
+// Bytes added to a protected frame in its symbol.
+#define FEC_SYMBOL_OVERHEAD 2
+
+// Length of the header of a parity frame, after the frame header.
+#define FEC_HEADER_LENGTH(k) (4 + (k))
+
+// Longest parity frame, for a longest protected frame of max_length.
+#define FEC_PARITY_LENGTH(k, max_length) \
+	(FRAME_HEADER_LENGTH + FEC_HEADER_LENGTH(k) + FEC_SYMBOL_OVERHEAD + (max_length))
+
+typedef enum {
+	FEC_XOR = 1,
+	FEC_RS = 2,
+} fec_scheme_t;
+
+typedef struct {
+	fec_scheme_t scheme;
+	uint8_t k;
+	uint8_t m;
+	uint16_t max_length;       // Longest frame that can be protected.
+	uint8_t *parity;           // m symbols of FEC_SYMBOL_OVERHEAD + max_length bytes.
+	uint8_t count;             // Data frames in the current block.
+	uint32_t first_seq;
+	uint8_t offsets[FEC_MAX_K];
+	uint16_t symbol_length;    // Longest symbol of the current block.
+	uint32_t started_ms;       // Time the first data frame of the block was added.
+} fec_encoder_t;
+
+// Parity frame.
+typedef struct {
+	frame_header_t header;
+	fec_scheme_t scheme;
+	uint8_t k;
+	uint8_t m;
+	uint8_t index;
+	uint8_t offsets[FEC_MAX_K];
+	const uint8_t *symbol;
+	uint16_t symbol_length;
+} fec_parity_t;
+
+/**
+ * Returns the coefficient of data symbol i in parity symbol j.
+ */
+uint8_t fec_coefficient(fec_scheme_t scheme, uint8_t m, uint8_t j, uint8_t i);
+
+/**
+ * Product and inverse in GF(2^8). The inverse of 0 is 0.
+ */
+uint8_t fec_gf_mul(uint8_t a, uint8_t b);
+uint8_t fec_gf_inv(uint8_t a);
+
+/**
+ * destination ^= coefficient * source, over length bytes.
+ */
+void fec_gf_mul_add(uint8_t *destination, const uint8_t *source, uint8_t coefficient,
+		            uint16_t length);
+
+/**
+ * Initializes an encoder. parity must hold m * (FEC_SYMBOL_OVERHEAD +
+ * max_length) bytes. Returns false if the parameters are invalid: k not
+ * in 2..FEC_MAX_K, m not in 1..FEC_MAX_M, or m not 1 with XOR.
+ */
+bool fec_encoder_init(fec_encoder_t *encoder, fec_scheme_t scheme, uint8_t k, uint8_t m,
+		              uint16_t max_length, uint8_t *parity);
+
+/**
+ * Returns true if the data frame with the given sequence number can be
+ * added to the current block. Otherwise, the parity frames of the block
+ * must be sent first.
+ */
+bool fec_encoder_accepts(const fec_encoder_t *encoder, uint32_t seq, uint16_t length);
+
+/**
+ * Adds a data frame, as sent, to the current block. Returns true if the
+ * block is full: its parity frames must then be sent.
+ */
+bool fec_encoder_add(fec_encoder_t *encoder, uint32_t seq, const uint8_t *frame,
+		             uint16_t length, uint32_t now_ms);
+
+/**
+ * Returns the number of data frames in the current block.
+ */
+uint8_t fec_encoder_pending(const fec_encoder_t *encoder);
+
+/**
+ * Writes parity frame index (0 to m - 1) of the current block into buffer,
+ * which must be at least FEC_PARITY_LENGTH(k, max_length) long, and
+ * returns its length. Epoch and timestamp are left to 0.
+ */
+uint16_t fec_encoder_build(const fec_encoder_t *encoder, uint8_t stream_id, uint8_t index,
+		                   uint8_t *buffer);
+
+/**
+ * Starts a new block.
+ */
+void fec_encoder_reset(fec_encoder_t *encoder);
+
+/**
+ * Reads a parity frame. symbol points into buffer. Returns false if
+ * buffer does not contain a valid parity frame.
+ */
+bool fec_decode_parity(const uint8_t *buffer, uint16_t length, fec_parity_t *parity);
+
+#endif /* MAIN_FEC_H_ */
@@ -0,0 +1,105 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fragment.h"
+#include "frame.h"
+
+/**
+ * Returns the number of payload bytes carried by every fragment but the
+ * last one, or 0 if max_datagram is too short.
+ */
+static uint32_t chunk_length(uint16_t max_datagram) {
+
+	if (max_datagram <= FRAGMENT_OVERHEAD) {
+		return 0;
+	}
+	return max_datagram - FRAGMENT_OVERHEAD;
+
+}
+
+uint16_t fragment_count(uint32_t payload_length, uint16_t max_datagram) {
+
+	uint32_t chunk = chunk_length(max_datagram);
+	if (chunk == 0) {
+		return 0;
+	}
+	uint32_t count = (payload_length + chunk - 1) / chunk;
+	if (count == 0) {
+		// An empty record still needs one datagram.
+		count = 1;
+	}
+	return count > UINT16_MAX ? 0 : (uint16_t)count;
+
+}
+
+uint16_t fragment_build(const uint8_t *frame, uint32_t frame_length,
+		                uint16_t max_datagram, uint16_t index, uint8_t *buffer) {
+
+	if (frame_length < FRAME_HEADER_LENGTH) {
+		return 0;
+	}
+	uint32_t payload_length = frame_length - FRAME_HEADER_LENGTH;
+	uint16_t count = fragment_count(payload_length, max_datagram);
+	if (index >= count) {
+		return 0;
+	}
+	uint32_t chunk = chunk_length(max_datagram);
+	uint32_t offset = index * chunk;
+	uint32_t length = payload_length - offset;
+	if (length > chunk) {
+		length = chunk;
+	}
+	memcpy(buffer, frame, FRAME_HEADER_LENGTH);
+	buffer[2] |= FRAME_FLAG_FRAGMENT;
+	uint8_t *fragment_header = &buffer[FRAME_HEADER_LENGTH];
+	frame_put_u16(&fragment_header[0], index);
+	frame_put_u16(&fragment_header[2], count);
+	frame_put_u32(&fragment_header[4], offset);
+	frame_put_u32(&fragment_header[8], payload_length);
+	memcpy(&buffer[FRAGMENT_OVERHEAD], &frame[FRAME_HEADER_LENGTH + offset], length);
+	return (uint16_t)(FRAGMENT_OVERHEAD + length);
+
+}
+
+bool fragment_decode_header(const uint8_t *frame, uint16_t frame_length,
+		                    fragment_header_t *header) {
+
+	if (frame_length < FRAGMENT_OVERHEAD) {
+		return false;
+	}
+	const uint8_t *fragment_header = &frame[FRAME_HEADER_LENGTH];
+	header->index = frame_get_u16(&fragment_header[0]);
+	header->count = frame_get_u16(&fragment_header[2]);
+	header->offset = frame_get_u32(&fragment_header[4]);
+	header->record_length = frame_get_u32(&fragment_header[8]);
+	uint32_t length = frame_length - FRAGMENT_OVERHEAD;
+	if (header->count == 0 || header->index >= header->count) {
+		return false;
+	}
+	if (header->offset > header->record_length ||
+		length > header->record_length - header->offset) {
+		return false;
+	}
+	return true;
+
+}
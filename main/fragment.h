@@ -0,0 +1,87 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef MAIN_FRAGMENT_H_
+#define MAIN_FRAGMENT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "frame.h"
+
+// Fragmentation of records longer than a datagram.
+//
+// A data frame that does not fit in one datagram of the transport is sent
+// as several fragments. Every fragment is a frame of its own: the header
+// of the record, with FRAME_FLAG_FRAGMENT set, followed by a fragment
+// header and a part of the record payload. All fragments of a record carry
+// its sequence number: the remote host reassembles the record from the
+// fragments with the same stream, epoch and sequence number. A record is
+// lost if any of its fragments is lost.
+//
+// Fragment header, after the frame header (network byte order):
+//
+//  0               2               4                               8                              12
+//  +---------------+---------------+-------------------------------+------------------------------+
+//  |     index     |     count     |            offset             |        record length         |
+//  +---------------+---------------+-------------------------------+------------------------------+
+//
+// offset and record length are counted in payload bytes, frame header
+// excluded.
+//
+// This file does not depend on FreeRTOS or ESP-IDF, so that it can be
+// used by host tools.
+
+#define FRAGMENT_HEADER_LENGTH 12
+
+// Header and fragment header.
+#define FRAGMENT_OVERHEAD (FRAME_HEADER_LENGTH + FRAGMENT_HEADER_LENGTH)
+
+typedef struct {
+	uint16_t index;
+	uint16_t count;
+	uint32_t offset;
+	uint32_t record_length;
+} fragment_header_t;
+
+/**
+ * Returns the number of fragments needed to send a record payload of the
+ * given length in datagrams of at most max_datagram bytes, or 0 if
+ * max_datagram is too short or if more than UINT16_MAX fragments would be
+ * needed.
+ */
+uint16_t fragment_count(uint32_t payload_length, uint16_t max_datagram);
+
+/**
+ * Writes fragment index of the record held by frame (header followed by
+ * payload) into buffer, which must be at least max_datagram long. Returns
+ * the length of the fragment, or 0 if index is out of range.
+ */
+uint16_t fragment_build(const uint8_t *frame, uint32_t frame_length,
+		                uint16_t max_datagram, uint16_t index, uint8_t *buffer);
+
+/**
+ * Reads the fragment header of a frame with FRAME_FLAG_FRAGMENT set.
+ * Returns false if the frame is too short or if the fragment header is not
+ * consistent with the length of the frame.
+ */
+bool fragment_decode_header(const uint8_t *frame, uint16_t frame_length,
+		                    fragment_header_t *header);
+
+#endif /* MAIN_FRAGMENT_H_ */
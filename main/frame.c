@@ -0,0 +1,148 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "frame.h"
+
+void frame_put_u16(uint8_t *buffer, uint16_t value) {
+	buffer[0] = (uint8_t)(value >> 8);
+	buffer[1] = (uint8_t)value;
+}
+
+void frame_put_u32(uint8_t *buffer, uint32_t value) {
+	buffer[0] = (uint8_t)(value >> 24);
+	buffer[1] = (uint8_t)(value >> 16);
+	buffer[2] = (uint8_t)(value >> 8);
+	buffer[3] = (uint8_t)value;
+}
+
+void frame_put_u64(uint8_t *buffer, uint64_t value) {
+	frame_put_u32(buffer, (uint32_t)(value >> 32));
+	frame_put_u32(&buffer[4], (uint32_t)value);
+}
+
+uint16_t frame_get_u16(const uint8_t *buffer) {
+	return ((uint16_t)buffer[0] << 8) | buffer[1];
+}
+
+uint32_t frame_get_u32(const uint8_t *buffer) {
+	return ((uint32_t)buffer[0] << 24) | ((uint32_t)buffer[1] << 16) |
+		   ((uint32_t)buffer[2] << 8) | buffer[3];
+}
+
+uint64_t frame_get_u64(const uint8_t *buffer) {
+	return ((uint64_t)frame_get_u32(buffer) << 32) | frame_get_u32(&buffer[4]);
+}
+
+void frame_encode_header(const frame_header_t *header, uint8_t *buffer) {
+
+	buffer[0] = header->version;
+	buffer[1] = header->type;
+	buffer[2] = header->flags;
+	buffer[3] = header->stream_id;
+	frame_put_u32(&buffer[4], header->seq);
+	frame_put_u32(&buffer[FRAME_EPOCH_OFFSET], header->epoch);
+	frame_put_u64(&buffer[FRAME_TIMESTAMP_OFFSET], header->timestamp_us);
+
+}
+
+bool frame_decode_header(const uint8_t *buffer, uint16_t length,
+		                 frame_header_t *header) {
+
+	if (length < FRAME_HEADER_LENGTH) {
+		return false;
+	}
+	if (buffer[0] != FRAME_VERSION) {
+		return false;
+	}
+	header->version = buffer[0];
+	header->type = buffer[1];
+	header->flags = buffer[2];
+	header->stream_id = buffer[3];
+	header->seq = frame_get_u32(&buffer[4]);
+	header->epoch = frame_get_u32(&buffer[FRAME_EPOCH_OFFSET]);
+	header->timestamp_us = frame_get_u64(&buffer[FRAME_TIMESTAMP_OFFSET]);
+	return true;
+
+}
+
+void frame_stamp(uint8_t *buffer, uint64_t timestamp_us, bool synced) {
+
+	if (synced) {
+		buffer[2] |= FRAME_FLAG_TIME_SYNCED;
+	} else {
+		buffer[2] &= ~FRAME_FLAG_TIME_SYNCED;
+	}
+	frame_put_u64(&buffer[FRAME_TIMESTAMP_OFFSET], timestamp_us);
+
+}
+
+void frame_encode_ack(const frame_ack_t *ack, uint8_t *buffer) {
+
+	frame_encode_header(&ack->header, buffer);
+	frame_put_u32(&buffer[FRAME_HEADER_LENGTH], ack->bitmap);
+
+}
+
+bool frame_decode_ack(const uint8_t *buffer, uint16_t length, frame_ack_t *ack) {
+
+	if (length < FRAME_ACK_LENGTH) {
+		return false;
+	}
+	if (!frame_decode_header(buffer, length, &ack->header)) {
+		return false;
+	}
+	if (ack->header.type != FRAME_ACK) {
+		return false;
+	}
+	ack->bitmap = frame_get_u32(&buffer[FRAME_HEADER_LENGTH]);
+	return true;
+
+}
+
+void frame_encode_time_response(const frame_time_response_t *response,
+		                        uint8_t *buffer) {
+
+	frame_encode_header(&response->header, buffer);
+	frame_put_u64(&buffer[FRAME_HEADER_LENGTH], response->t1_us);
+	frame_put_u64(&buffer[FRAME_HEADER_LENGTH + 8], response->t2_us);
+	frame_put_u64(&buffer[FRAME_HEADER_LENGTH + 16], response->t3_us);
+
+}
+
+bool frame_decode_time_response(const uint8_t *buffer, uint16_t length,
+		                        frame_time_response_t *response) {
+
+	if (length < FRAME_TIME_RESPONSE_LENGTH) {
+		return false;
+	}
+	if (!frame_decode_header(buffer, length, &response->header)) {
+		return false;
+	}
+	if (response->header.type != FRAME_TIME_RESPONSE) {
+		return false;
+	}
+	response->t1_us = frame_get_u64(&buffer[FRAME_HEADER_LENGTH]);
+	response->t2_us = frame_get_u64(&buffer[FRAME_HEADER_LENGTH + 8]);
+	response->t3_us = frame_get_u64(&buffer[FRAME_HEADER_LENGTH + 16]);
+	return true;
+
+}
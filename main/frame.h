@@ -0,0 +1,172 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef MAIN_FRAME_H_
+#define MAIN_FRAME_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Datagram header. All fields are transmitted in network byte order (big
+// endian).
+//
+//  0       1       2       3       4               8               12                             20
+//  +-------+-------+-------+-------+---------------+---------------+------------------------------+
+//  |version| type  | flags |stream |   sequence    |  boot epoch   |       timestamp (us)         |
+//  +-------+-------+-------+-------+---------------+---------------+------------------------------+
+//
+// The boot epoch is incremented at every start of the sender, and is
+// written when the datagram is handed over to lwIP (see seq_store.h). 0
+// means unknown. Sequence numbers go on across restarts, the epoch tells
+// a restart from duplicated or replayed datagrams. The timestamp is
+// written when the datagram is handed over to lwIP. It is the time of the
+// remote host if FRAME_FLAG_TIME_SYNCED is set, the local time (time since
+// boot) otherwise.
+//
+// Data frames longer than a datagram are fragmented, see fragment.h.
+//
+// This file does not depend on FreeRTOS or ESP-IDF, so that it can be
+// used by host tools.
+
+#define FRAME_VERSION 2
+
+#define FRAME_HEADER_LENGTH 20
+
+// Offset of the boot epoch in the header.
+#define FRAME_EPOCH_OFFSET 8
+
+// Offset of the timestamp in the header.
+#define FRAME_TIMESTAMP_OFFSET 12
+
+// Length of an ACK frame: header, followed by a 32-bit bitmap.
+#define FRAME_ACK_LENGTH (FRAME_HEADER_LENGTH + 4)
+
+// Number of sequence numbers covered by the bitmap of an ACK frame.
+#define FRAME_ACK_BITMAP_BITS 32
+
+// Length of a time response frame: header, followed by t1, t2 and t3.
+#define FRAME_TIME_RESPONSE_LENGTH (FRAME_HEADER_LENGTH + 24)
+
+typedef enum {
+	FRAME_DATA = 1,
+	FRAME_ACK = 2,
+	FRAME_TIME_REQUEST = 3,
+	FRAME_TIME_RESPONSE = 4,
+	FRAME_TRACE = 5,
+	FRAME_PARITY = 6,   // See fec.h.
+} frame_type_t;
+
+// Flags.
+#define FRAME_FLAG_RELIABLE 0x01
+#define FRAME_FLAG_RETRANSMIT 0x02
+#define FRAME_FLAG_TIME_SYNCED 0x04
+#define FRAME_FLAG_ENCRYPTED 0x08  // Payload sealed, see aead.h.
+#define FRAME_FLAG_FRAGMENT 0x10   // Fragment header follows, see fragment.h.
+
+typedef struct {
+	uint8_t version;
+	uint8_t type;
+	uint8_t flags;
+	uint8_t stream_id;
+	uint32_t seq;
+	uint32_t epoch;
+	uint64_t timestamp_us;
+} frame_header_t;
+
+// ACK frame. In the header, seq is the cumulative ACK: all sequence numbers
+// lower than seq have been received. Bit i of bitmap is set if sequence
+// number seq + 1 + i has been received.
+typedef struct {
+	frame_header_t header;
+	uint32_t bitmap;
+} frame_ack_t;
+
+/**
+ * Writes header into buffer, which must be at least FRAME_HEADER_LENGTH long.
+ */
+void frame_encode_header(const frame_header_t *header, uint8_t *buffer);
+
+/**
+ * Reads a header from buffer. Returns false if length is too short or if
+ * the version is not supported.
+ */
+bool frame_decode_header(const uint8_t *buffer, uint16_t length,
+		                 frame_header_t *header);
+
+// Time response frame, sent by the remote host in reply to a time request
+// frame. t1 is the timestamp of the request, t2 the time of reception of
+// the request by the remote host, and t3 the time of transmission of the
+// response.
+typedef struct {
+	frame_header_t header;
+	uint64_t t1_us;
+	uint64_t t2_us;
+	uint64_t t3_us;
+} frame_time_response_t;
+
+/**
+ * Writes the timestamp into the header held by buffer, and sets or clears
+ * FRAME_FLAG_TIME_SYNCED.
+ */
+void frame_stamp(uint8_t *buffer, uint64_t timestamp_us, bool synced);
+
+/**
+ * Writes ack into buffer, which must be at least FRAME_ACK_LENGTH long.
+ */
+void frame_encode_ack(const frame_ack_t *ack, uint8_t *buffer);
+
+/**
+ * Reads an ACK frame from buffer. Returns false if buffer does not contain
+ * a valid ACK frame.
+ */
+bool frame_decode_ack(const uint8_t *buffer, uint16_t length, frame_ack_t *ack);
+
+/**
+ * Writes response into buffer, which must be at least
+ * FRAME_TIME_RESPONSE_LENGTH long.
+ */
+void frame_encode_time_response(const frame_time_response_t *response,
+		                        uint8_t *buffer);
+
+/**
+ * Reads a time response frame from buffer. Returns false if buffer does
+ * not contain a valid time response frame.
+ */
+bool frame_decode_time_response(const uint8_t *buffer, uint16_t length,
+		                        frame_time_response_t *response);
+
+/**
+ * Big endian helpers.
+ */
+void frame_put_u16(uint8_t *buffer, uint16_t value);
+void frame_put_u32(uint8_t *buffer, uint32_t value);
+void frame_put_u64(uint8_t *buffer, uint64_t value);
+uint16_t frame_get_u16(const uint8_t *buffer);
+uint32_t frame_get_u32(const uint8_t *buffer);
+uint64_t frame_get_u64(const uint8_t *buffer);
+
+/**
+ * Returns true if sequence number a is before sequence number b, taking
+ * wrap-around into account.
+ */
+static inline bool frame_seq_before(uint32_t a, uint32_t b) {
+	return (int32_t)(a - b) < 0;
+}
+
+#endif /* MAIN_FRAME_H_ */
@@ -0,0 +1,212 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+
+#include "esp_log.h"
+
+#include "fsm_timer.h"
+#include "messages.h"
+#include "trace.h"
+#include "utilities.h"
+
+/**
+ * Periods shorter than a tick are rounded up to one tick.
+ */
+static TickType_t to_ticks(uint32_t period_ms) {
+
+	TickType_t ticks = pdMS_TO_TICKS(period_ms);
+	return ticks == 0 ? 1 : ticks;
+
+}
+
+#if CONFIG_UDPSENDER_REACTOR
+
+fsm_timer_list_t fsm_timer_reactor_list = {
+	.first = NULL,
+};
+
+/**
+ * Returns true if tick a comes before tick b, across counter wrap-around.
+ */
+static bool before(TickType_t a, TickType_t b) {
+	return (int32_t)(a - b) < 0;
+}
+
+static void unlink_timer(fsm_timer_t *timer) {
+
+	if (!timer->active) {
+		return;
+	}
+	fsm_timer_t **link = &timer->list->first;
+	while (*link != timer) {
+		link = &(*link)->next;
+	}
+	*link = timer->next;
+	timer->active = false;
+
+}
+
+static void insert_timer(fsm_timer_t *timer, TickType_t expiry) {
+
+	// Timers with the same expiry time fire in start order.
+	fsm_timer_t **link = &timer->list->first;
+	while (*link != NULL && !before(expiry, (*link)->expiry)) {
+		link = &(*link)->next;
+	}
+	timer->expiry = expiry;
+	timer->next = *link;
+	timer->active = true;
+	*link = timer;
+
+}
+
+bool fsm_timer_init(fsm_timer_t *timer, const char *name, message_type_t message,
+		            QueueHandle_t *queue, uint32_t period_ms, bool auto_reload,
+					const char *tag) {
+
+	timer->tag = tag;
+	timer->message = message;
+	timer->queue = queue;
+	timer->period = to_ticks(period_ms);
+	timer->auto_reload = auto_reload;
+	timer->active = false;
+	timer->list = &fsm_timer_reactor_list;
+	timer->next = NULL;
+	return true;
+
+}
+
+void fsm_timer_set_list(fsm_timer_t *timer, fsm_timer_list_t *list) {
+	timer->list = list;
+}
+
+BaseType_t fsm_timer_start(fsm_timer_t *timer) {
+
+	unlink_timer(timer);
+	insert_timer(timer, xTaskGetTickCount() + timer->period);
+	return pdPASS;
+
+}
+
+BaseType_t fsm_timer_change_period(fsm_timer_t *timer, uint32_t period_ms) {
+
+	timer->period = to_ticks(period_ms);
+	return fsm_timer_start(timer);
+
+}
+
+void fsm_timer_stop(fsm_timer_t *timer) {
+	unlink_timer(timer);
+}
+
+bool fsm_timer_next_expiry(fsm_timer_list_t *list, TickType_t *ticks) {
+
+	fsm_timer_t *first = list->first;
+	if (first == NULL) {
+		return false;
+	}
+	TickType_t now = xTaskGetTickCount();
+	*ticks = before(now, first->expiry) ? first->expiry - now : 0;
+	return true;
+
+}
+
+bool fsm_timer_expired(fsm_timer_list_t *list, message_t *message, TickType_t *late_ticks) {
+
+	fsm_timer_t *timer = list->first;
+	TickType_t now = xTaskGetTickCount();
+	if (timer == NULL || before(now, timer->expiry)) {
+		return false;
+	}
+	*late_ticks = now - timer->expiry;
+	unlink_timer(timer);
+	if (timer->auto_reload) {
+		// Same drift-free behavior as FreeRTOS auto-reload timers.
+		insert_timer(timer, timer->expiry + timer->period);
+	}
+	trace_record(TRACE_TIMER_EXPIRY, timer->message, 0);
+	message->message = timer->message;
+	message->no_payload.nothing = 0;
+	return true;
+
+}
+
+#else
+
+// Delay used for xTicksToWait when sending commands to the timer task.
+#define TIMER_COMMAND_DELAY_MS 500
+
+/**
+ * Event handler for all timers.
+ */
+static void timer_handler(TimerHandle_t handle) {
+
+	fsm_timer_t *timer = (fsm_timer_t *)pvTimerGetTimerID(handle);
+	trace_record(TRACE_TIMER_EXPIRY, timer->message, 0);
+	message_t message_to_send;
+	message_to_send.message = timer->message;
+	message_to_send.no_payload.nothing = 0;
+	BaseType_t rs = send_to_queue(*timer->queue, &message_to_send, timer->tag);
+	if (rs != pdTRUE) {
+		ESP_LOGE(timer->tag, "timer_handler - error on sending message to myself - %d", rs);
+	}
+
+}
+
+bool fsm_timer_init(fsm_timer_t *timer, const char *name, message_type_t message,
+		            QueueHandle_t *queue, uint32_t period_ms, bool auto_reload,
+					const char *tag) {
+
+	timer->tag = tag;
+	timer->message = message;
+	timer->queue = queue;
+	timer->period = to_ticks(period_ms);
+	timer->auto_reload = auto_reload;
+	timer->handle = xTimerCreate(name, timer->period, auto_reload ? pdTRUE : pdFALSE,
+			                     timer, timer_handler);
+	return timer->handle != NULL;
+
+}
+
+BaseType_t fsm_timer_start(fsm_timer_t *timer) {
+	return xTimerStart(timer->handle, pdMS_TO_TICKS(TIMER_COMMAND_DELAY_MS));
+}
+
+BaseType_t fsm_timer_change_period(fsm_timer_t *timer, uint32_t period_ms) {
+
+	timer->period = to_ticks(period_ms);
+	// xTimerChangePeriod() starts the timer.
+	return xTimerChangePeriod(timer->handle, timer->period,
+			                  pdMS_TO_TICKS(TIMER_COMMAND_DELAY_MS));
+
+}
+
+void fsm_timer_stop(fsm_timer_t *timer) {
+	xTimerStop(timer->handle, pdMS_TO_TICKS(TIMER_COMMAND_DELAY_MS));
+}
+
+#endif
@@ -0,0 +1,114 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+
+#ifndef MAIN_FSM_TIMER_H_
+#define MAIN_FSM_TIMER_H_
+
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/timers.h"
+
+#include "messages.h"
+
+// Timers of the state machines.
+//
+// At expiry, a timer delivers a message with no payload to its state
+// machine. When every state machine has its own task, a timer is a
+// FreeRTOS timer, whose handler sends the message to the input queue of
+// the state machine. In reactor mode (see reactor.h), timers form
+// deadline lists, ordered by expiry time, and the task servicing a list
+// handles the message itself: no timer control block, and no room taken
+// in the input queue. Timers are in the list of the reactor, unless moved
+// to the list of another task with fsm_timer_set_list().
+//
+// A timer must be used by the task running its state machine only.
+
+#if CONFIG_UDPSENDER_REACTOR
+typedef struct fsm_timer_list {
+	struct fsm_timer *first;  // Active timers, by expiry time.
+} fsm_timer_list_t;
+#endif
+
+typedef struct fsm_timer {
+	const char *tag;
+	message_type_t message;
+	QueueHandle_t *queue;     // Input queue of the state machine.
+	TickType_t period;
+	bool auto_reload;
+#if CONFIG_UDPSENDER_REACTOR
+	bool active;
+	TickType_t expiry;
+	fsm_timer_list_t *list;
+	struct fsm_timer *next;   // Next active timer, by expiry time.
+#else
+	TimerHandle_t handle;
+#endif
+} fsm_timer_t;
+
+/**
+ * Initializes timer, which is not started. queue is read at every expiry.
+ * Returns false on error.
+ */
+bool fsm_timer_init(fsm_timer_t *timer, const char *name, message_type_t message,
+		            QueueHandle_t *queue, uint32_t period_ms, bool auto_reload,
+					const char *tag);
+
+/**
+ * Starts timer, or starts it again if it is active. Returns pdPASS on
+ * success.
+ */
+BaseType_t fsm_timer_start(fsm_timer_t *timer);
+
+/**
+ * Changes the period of timer, and starts it. Periods shorter than a tick
+ * are rounded up to one tick. Returns pdPASS on success.
+ */
+BaseType_t fsm_timer_change_period(fsm_timer_t *timer, uint32_t period_ms);
+
+void fsm_timer_stop(fsm_timer_t *timer);
+
+#if CONFIG_UDPSENDER_REACTOR
+// List of the reactor task.
+extern fsm_timer_list_t fsm_timer_reactor_list;
+
+/**
+ * Moves timer, which must not be active, to list.
+ */
+void fsm_timer_set_list(fsm_timer_t *timer, fsm_timer_list_t *list);
+
+/**
+ * Returns false if no timer of list is active. Otherwise, returns true and
+ * provides the number of ticks before the first expiry, 0 if it is due.
+ */
+bool fsm_timer_next_expiry(fsm_timer_list_t *list, TickType_t *ticks);
+
+/**
+ * Returns true if a timer of list is due, and provides its message and the
+ * number of ticks elapsed since its expiry. Auto-reload timers are started
+ * again. Must be called until it returns false.
+ */
+bool fsm_timer_expired(fsm_timer_list_t *list, message_t *message, TickType_t *late_ticks);
+#endif
+
+#endif /* MAIN_FSM_TIMER_H_ */
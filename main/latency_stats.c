@@ -0,0 +1,100 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "latency_stats.h"
+
+void latency_stats_reset(latency_stats_t *stats) {
+
+	memset(stats, 0, sizeof(latency_stats_t));
+	stats->min_us = UINT32_MAX;
+
+}
+
+void latency_stats_add(latency_stats_t *stats, uint32_t value_us) {
+
+	uint8_t bucket = 0;
+	uint32_t value = value_us;
+	while (value > 1 && bucket < LATENCY_STATS_BUCKETS - 1) {
+		value >>= 1;
+		bucket++;
+	}
+	stats->buckets[bucket]++;
+	stats->count++;
+	stats->sum_us += value_us;
+	if (value_us < stats->min_us) {
+		stats->min_us = value_us;
+	}
+	if (value_us > stats->max_us) {
+		stats->max_us = value_us;
+	}
+
+}
+
+void latency_stats_merge(latency_stats_t *stats, const latency_stats_t *other) {
+
+	for (uint8_t i = 0; i < LATENCY_STATS_BUCKETS; i++) {
+		stats->buckets[i] += other->buckets[i];
+	}
+	stats->count += other->count;
+	stats->sum_us += other->sum_us;
+	if (other->min_us < stats->min_us) {
+		stats->min_us = other->min_us;
+	}
+	if (other->max_us > stats->max_us) {
+		stats->max_us = other->max_us;
+	}
+
+}
+
+uint32_t latency_stats_percentile(const latency_stats_t *stats, uint8_t percent) {
+
+	if (stats->count == 0) {
+		return 0;
+	}
+	// Rank of the sample, rounded up.
+	uint64_t rank = ((uint64_t)stats->count * percent + 99) / 100;
+	if (rank == 0) {
+		rank = 1;
+	}
+	uint64_t cumulated = 0;
+	for (uint8_t i = 0; i < LATENCY_STATS_BUCKETS; i++) {
+		cumulated += stats->buckets[i];
+		if (cumulated >= rank) {
+			if (i == LATENCY_STATS_BUCKETS - 1) {
+				return stats->max_us;
+			}
+			uint32_t upper = (uint32_t)1 << (i + 1);
+			return upper < stats->max_us ? upper : stats->max_us;
+		}
+	}
+	return stats->max_us;
+
+}
+
+uint32_t latency_stats_mean(const latency_stats_t *stats) {
+
+	if (stats->count == 0) {
+		return 0;
+	}
+	return (uint32_t)(stats->sum_us / stats->count);
+
+}
@@ -0,0 +1,63 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef MAIN_LATENCY_STATS_H_
+#define MAIN_LATENCY_STATS_H_
+
+#include <stdint.h>
+
+// Latency histogram with power of two buckets, in microseconds: bucket i
+// counts values in [2^i, 2^(i+1)), bucket 0 also counts 0. Fixed memory,
+// constant time per sample. Percentiles are given as the upper bound of
+// the bucket holding them.
+//
+// This file does not depend on FreeRTOS or ESP-IDF, so that it can be
+// used by host tools.
+
+#define LATENCY_STATS_BUCKETS 32
+
+typedef struct {
+	uint32_t count;
+	uint32_t min_us;
+	uint32_t max_us;
+	uint64_t sum_us;
+	uint32_t buckets[LATENCY_STATS_BUCKETS];
+} latency_stats_t;
+
+void latency_stats_reset(latency_stats_t *stats);
+
+void latency_stats_add(latency_stats_t *stats, uint32_t value_us);
+
+/**
+ * Adds the samples of other to stats.
+ */
+void latency_stats_merge(latency_stats_t *stats, const latency_stats_t *other);
+
+/**
+ * Returns the upper bound of the bucket holding the given percentile
+ * (0 - 100), or 0 if there is no sample.
+ */
+uint32_t latency_stats_percentile(const latency_stats_t *stats, uint8_t percent);
+
+/**
+ * Returns the mean value, or 0 if there is no sample.
+ */
+uint32_t latency_stats_mean(const latency_stats_t *stats);
+
+#endif /* MAIN_LATENCY_STATS_H_ */
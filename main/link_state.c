@@ -0,0 +1,174 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "link_state.h"
+
+// Level bits: exactly one of them is set.
+#define UP_BIT (1 << 0)
+#define DOWN_BIT (1 << 1)
+
+static const char *TAG = "LS";
+
+// Odd while the snapshot is written.
+static uint32_t sequence = 0;
+static link_state_t snapshot = {
+	.connected = false,
+	.ip = 0,
+	.rssi = 0,
+	.generation = 0,
+	.changed_us = 0,
+};
+// Copy of snapshot.connected, for link_state_is_connected().
+static bool connected = false;
+
+static portMUX_TYPE write_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static EventGroupHandle_t event_group = NULL;
+
+/**
+ * Must be followed by write_end().
+ */
+static void write_begin(void) {
+
+	portENTER_CRITICAL(&write_lock);
+	__atomic_store_n(&sequence, sequence + 1, __ATOMIC_RELAXED);
+	// The snapshot must not be modified before the sequence is odd.
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+}
+
+static void write_end(void) {
+
+	__atomic_store_n(&sequence, sequence + 1, __ATOMIC_RELEASE);
+	portEXIT_CRITICAL(&write_lock);
+
+}
+
+void link_state_init(void) {
+
+	event_group = xEventGroupCreate();
+	if (event_group == NULL) {
+		ESP_LOGE(TAG, "Error from xEventGroupCreate");
+		return;
+	}
+	xEventGroupSetBits(event_group, DOWN_BIT);
+
+}
+
+void link_state_publish_up(uint32_t ip) {
+
+	int64_t now_us = esp_timer_get_time();
+	write_begin();
+	snapshot.connected = true;
+	snapshot.ip = ip;
+	snapshot.generation++;
+	snapshot.changed_us = now_us;
+	__atomic_store_n(&connected, true, __ATOMIC_RELAXED);
+	write_end();
+	if (event_group != NULL) {
+		xEventGroupClearBits(event_group, DOWN_BIT);
+		xEventGroupSetBits(event_group, UP_BIT);
+	}
+
+}
+
+void link_state_publish_down(void) {
+
+	if (!snapshot.connected) {
+		return;
+	}
+	int64_t now_us = esp_timer_get_time();
+	write_begin();
+	snapshot.connected = false;
+	snapshot.ip = 0;
+	snapshot.generation++;
+	snapshot.changed_us = now_us;
+	__atomic_store_n(&connected, false, __ATOMIC_RELAXED);
+	write_end();
+	if (event_group != NULL) {
+		xEventGroupClearBits(event_group, UP_BIT);
+		xEventGroupSetBits(event_group, DOWN_BIT);
+	}
+
+}
+
+void link_state_publish_rssi(int8_t rssi) {
+
+	write_begin();
+	snapshot.rssi = rssi;
+	write_end();
+
+}
+
+void link_state_read(link_state_t *state) {
+
+	while (true) {
+		uint32_t begin = __atomic_load_n(&sequence, __ATOMIC_ACQUIRE);
+		if ((begin & 1) != 0) {
+			// Being written, on the other core.
+			continue;
+		}
+		*state = snapshot;
+		// The copy must be complete before the sequence is read again.
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&sequence, __ATOMIC_RELAXED) == begin) {
+			return;
+		}
+	}
+
+}
+
+bool link_state_is_connected(void) {
+	return __atomic_load_n(&connected, __ATOMIC_RELAXED);
+}
+
+bool link_state_wait(uint32_t generation, uint32_t timeout_ms, link_state_t *state) {
+
+	TickType_t start = xTaskGetTickCount();
+	TickType_t timeout = pdMS_TO_TICKS(timeout_ms);
+	while (true) {
+		link_state_read(state);
+		if (state->generation != generation) {
+			return true;
+		}
+		TickType_t elapsed = xTaskGetTickCount() - start;
+		if (elapsed >= timeout) {
+			return false;
+		}
+		if (event_group == NULL) {
+			vTaskDelay(timeout - elapsed);
+			continue;
+		}
+		// The bit of the other level. Two transitions between the read above
+		// and this wait are only seen at the timeout.
+		EventBits_t bit = state->connected ? DOWN_BIT : UP_BIT;
+		xEventGroupWaitBits(event_group, bit, pdFALSE, pdFALSE, timeout - elapsed);
+	}
+
+}
@@ -0,0 +1,98 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef MAIN_LINK_STATE_H_
+#define MAIN_LINK_STATE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Connectivity snapshot.
+//
+// The connect_wifi task publishes the state of the data path here, and any
+// task or interrupt handler can read it without sending a message: a
+// producer can check the link on its hot path, and a task can find out the
+// state it missed when an SD_CONNECTION_STATUS message was lost.
+//
+// The snapshot is protected by a sequence lock: the sequence counter is
+// odd while the snapshot is written, and a reader copies the snapshot
+// again when the counter was odd or has changed during the copy. The
+// connect_wifi task is the only writer. It writes in a critical section,
+// so that a reader never waits for a preempted writer. Reading never
+// blocks and never fails.
+//
+// The generation is incremented when the data path goes up and when it
+// goes down: the data path is up when the generation is odd. A reader
+// that keeps the generation of its last snapshot can tell that the link
+// went down and up again in between.
+
+typedef struct {
+	bool connected;      // Data path up.
+	uint32_t ip;         // Station IPv4 address, network byte order. 0 when
+	                     // disconnected, or when the transport does not use IP.
+	int8_t rssi;         // Last RSSI sample, in dBm. 0 when unknown.
+	uint32_t generation; // Link transitions since startup.
+	int64_t changed_us;  // esp_timer_get_time() at the last transition.
+} link_state_t;
+
+/**
+ * Creates the event group used by link_state_wait(). Must be called before
+ * the tasks are created. On error, link_state_wait() does not wait for a
+ * transition, only for its timeout.
+ */
+void link_state_init(void);
+
+/**
+ * Publishes a data path up transition. To be called by the connect_wifi
+ * task only.
+ */
+void link_state_publish_up(uint32_t ip);
+
+/**
+ * Publishes a data path down transition. Does nothing if the data path is
+ * already down. To be called by the connect_wifi task only.
+ */
+void link_state_publish_down(void);
+
+/**
+ * Publishes an RSSI sample, without changing the generation. To be called
+ * by the connect_wifi task only.
+ */
+void link_state_publish_rssi(int8_t rssi);
+
+/**
+ * Copies the current snapshot. Can be called from an interrupt handler.
+ */
+void link_state_read(link_state_t *state);
+
+/**
+ * Returns true if the data path is up. A single load: the cheapest check.
+ * Can be called from an interrupt handler.
+ */
+bool link_state_is_connected(void);
+
+/**
+ * Waits until the generation differs from the given one, or until the
+ * timeout expires, and copies the current snapshot. Returns false on
+ * timeout. Blocks the calling task: must not be called from a state
+ * machine handler in reactor mode (see reactor.h).
+ */
+bool link_state_wait(uint32_t generation, uint32_t timeout_ms, link_state_t *state);
+
+#endif /* MAIN_LINK_STATE_H_ */
@@ -23,6 +23,9 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "roaming.h"
+#include "traffic_class.h"
+
 // List of message types.
 typedef enum {
 	CW_CONNECT,
@@ -32,25 +35,72 @@ typedef enum {
 	CW_IP_OK,  // For internal use.
 	CW_AP_NOK, // For internal use.
 	CW_TIMEOUT, // For internal use.
+	CW_SEND_TIMEOUT, // For internal use.
+	CW_SCAN_DONE, // For internal use.
+	CW_RSSI_TIMEOUT, // For internal use.
+	CW_TRACE_DUMP,
 	SD_CONNECTION_STATUS,
 	SD__SEND_ERROR,
 	SD_TIMEOUT,  // For internal used.
 	SV_TIMEOUT,  // For internal use.
 	SV_INTERNAL_ERROR,
+	PL_DATA_READY,
+	PL_TIMEOUT,  // For internal use.
+	PL_SYNC_TIMEOUT,  // For internal use.
 } message_type_t;
 
 //========================================
 // For CW_CONNECT message.
+// Candidate networks, the array must remain valid after the message is sent.
 typedef struct {
-	char *ssid;
-	char *password;
+	const roaming_network_t *networks;
+	uint8_t network_count;
 } cw_connect_t;
 
 //========================================
 // For CW_SEND_DATAGRAM message.
+// Every datagram gets a handle when its message is queued (see
+// connect_wifi_send_datagram()), and is completed by connect_wifi task,
+// in order, when its payload is not used anymore. A datagram completed as
+// CW_DATAGRAM_QUEUED is completed a second time, deferred, once the retry
+// queue or the retransmit window holding it has reached its outcome: sent
+// (acknowledged in reliable mode), dropped or expired.
+typedef uint32_t cw_datagram_handle_t;
+
+typedef enum {
+	CW_DATAGRAM_SENT,      // Handed over to the transport, or acknowledged in reliable mode.
+	CW_DATAGRAM_QUEUED,    // Left in the send path: retry queue, or retransmit window.
+	CW_DATAGRAM_DROPPED,   // Dropped by the send path, or while not connected.
+	CW_DATAGRAM_REJECTED,  // Cannot be sent: reliable window full, or too long.
+	CW_DATAGRAM_EXPIRED,   // Given up after too many retransmissions.
+	CW_DATAGRAM_STATUS_COUNT
+} cw_datagram_status_t;
+
+// Local times, in microseconds.
+typedef struct {
+	cw_datagram_handle_t handle;
+	cw_datagram_status_t status;
+	bool deferred;          // Outcome of a datagram completed as queued before.
+	uint64_t enqueued_us;   // Message sent to connect_wifi task.
+	uint64_t dequeued_us;   // Message received by connect_wifi task.
+	uint64_t completed_us;  // Return of the last send call, or outcome if deferred.
+} cw_datagram_completion_t;
+
+// Called by connect_wifi task once payload is not used anymore, and again
+// with deferred set for the outcome of a queued datagram. Must not block.
+typedef void (*cw_datagram_done_t)(void *arg, const cw_datagram_completion_t *completion);
+
 typedef struct {
 	uint8_t *payload;
-	uint16_t payload_length;
+	uint32_t payload_length;  // Longer than a datagram: see fragment.h.
+	uint8_t stream_id;
+	bool reliable;  // If true, the datagram is sent in reliable mode.
+	bool unnumbered;  // No sequence number could be given: rejected.
+	traffic_class_t traffic_class;
+	cw_datagram_done_t done;  // Can be NULL.
+	void *done_arg;
+	cw_datagram_handle_t handle;  // Set by connect_wifi_send_datagram().
+	uint64_t enqueued_us;         // Set by connect_wifi_send_datagram().
 } cw_send_datagram_t;
 
 //========================================
@@ -60,13 +110,10 @@ typedef struct {
 } sd_connection_status_t;
 
 //========================================
-// For SD_SEND_ERROR message.
-typedef enum {
-	CW_ERR_1,
-} sd_send_error_type_t;
-
+// For SD__SEND_ERROR message: a datagram of send_datagram task was dropped
+// or rejected.
 typedef struct {
-	sd_send_error_type_t error;
+	cw_datagram_completion_t completion;
 } sd_send_error_t;
 
 //========================================
@@ -84,6 +131,9 @@ typedef enum {
 	SD_QUEUE_ERR,
 	SD_TIMER_ERR,
 	SD_UKNOWN_STATE_ERR,
+	PL_INIT_ERR,
+	PL_TIMER_ERR,
+	PL_UKNOWN_STATE_ERR,
 } sv_internal_error_type_t;
 
 typedef struct {
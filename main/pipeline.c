@@ -0,0 +1,506 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "esp_log.h"
+
+#include "connect_wifi.h"
+#include "frame.h"
+#include "fsm_timer.h"
+#include "messages.h"
+#include "producer.h"
+#include "time_sync.h"
+#include "trace.h"
+#include "utilities.h"
+
+// Control messages.
+#define INPUT_QUEUE_LENGTH 3
+
+// PL_DATA_READY messages, at most one is pending.
+#define DATA_QUEUE_LENGTH 1
+
+// When the data queue of connect_wifi task is full, wait for this period
+// before trying again.
+#define RETRY_PERIOD_MS 10
+
+#define MAX_SOURCES CONFIG_UDPSENDER_PRODUCER_MAX_SOURCES
+
+// Period of time requests. 0 disables time synchronization.
+#define TIME_SYNC_PERIOD_MS CONFIG_UDPSENDER_TIME_SYNC_PERIOD_MS
+
+// Slots of connect_wifi task data queue that only urgent records can use,
+// so that they do not wait behind a full queue of other records.
+#define URGENT_RESERVED_SLOTS 1
+
+// Records forwarded per round of the weighted round robin, by traffic
+// class. The urgent class is not part of it: it is always served first.
+static const uint32_t class_weights[TRAFFIC_CLASS_COUNT] = {
+	[TRAFFIC_CLASS_URGENT] = 0,
+	[TRAFFIC_CLASS_NORMAL] = CONFIG_UDPSENDER_TC_NORMAL_WEIGHT,
+	[TRAFFIC_CLASS_BULK] = CONFIG_UDPSENDER_TC_BULK_WEIGHT,
+};
+
+static const char *TAG = "PL";
+
+// Input queues, and the set they belong to.
+QueueHandle_t pl_input_queue = NULL;
+QueueHandle_t pl_data_queue = NULL;
+static QueueSetHandle_t queue_set;
+
+#if CONFIG_UDPSENDER_REACTOR
+// Timers of the task: the reactor services its own list only.
+static fsm_timer_list_t timers = {
+	.first = NULL,
+};
+#endif
+
+typedef enum {
+	PL_WAIT_DATA_ST,
+	PL_WAIT_RETRY_ST,
+	PL_ERROR_ST,
+} state_t;
+
+static state_t current_state;
+
+// True when a PL_DATA_READY message has been sent and not processed yet.
+// Avoids sending one message per record.
+static bool wakeup_pending = false;
+
+// Time request frame. The timestamp is written by connect_wifi task.
+static uint8_t time_request[FRAME_HEADER_LENGTH];
+static uint32_t time_request_seq = 0;
+// True while connect_wifi task uses time_request. Written by the pipeline
+// task when set, and by connect_wifi task when cleared.
+static bool time_request_busy = false;
+
+void IRAM_ATTR pipeline_wakeup_from_isr(void) {
+
+	if (pl_data_queue == NULL) {
+		return;
+	}
+	if (__atomic_exchange_n(&wakeup_pending, true, __ATOMIC_ACQ_REL)) {
+		return;
+	}
+	message_t message_to_send;
+	message_to_send.message = PL_DATA_READY;
+	message_to_send.no_payload.nothing = 0;
+	BaseType_t higher_priority_task_woken = pdFALSE;
+	if (xQueueSendFromISR(pl_data_queue, &message_to_send,
+			              &higher_priority_task_woken) != pdTRUE) {
+		// Let the next record try again, otherwise the pipeline would never
+		// be woken up anymore.
+		__atomic_store_n(&wakeup_pending, false, __ATOMIC_RELEASE);
+	}
+	portYIELD_FROM_ISR(higher_priority_task_woken);
+
+}
+
+void pipeline_wakeup(void) {
+
+	if (pl_data_queue == NULL) {
+		return;
+	}
+	if (__atomic_exchange_n(&wakeup_pending, true, __ATOMIC_ACQ_REL)) {
+		return;
+	}
+	message_t message_to_send;
+	message_to_send.message = PL_DATA_READY;
+	message_to_send.no_payload.nothing = 0;
+	if (send_to_queue(pl_data_queue, &message_to_send, TAG) != pdTRUE) {
+		// See pipeline_wakeup_from_isr().
+		__atomic_store_n(&wakeup_pending, false, __ATOMIC_RELEASE);
+	}
+
+}
+
+static void time_request_done(void *arg, const cw_datagram_completion_t *completion) {
+
+	// A deferred completion comes once the buffer has been released, maybe
+	// while the next request is in use.
+	if (completion->deferred) {
+		return;
+	}
+	__atomic_store_n(&time_request_busy, false, __ATOMIC_RELEASE);
+
+}
+
+/**
+ * Hands a time request over to connect_wifi task. Time requests form their
+ * own stream. If the previous request is still in use, or if connect_wifi
+ * task input queue is full, this period is skipped.
+ */
+static void send_time_request(void) {
+
+	if (__atomic_load_n(&time_request_busy, __ATOMIC_ACQUIRE)) {
+		ESP_LOGW(TAG, "Previous time request still in use");
+		return;
+	}
+	frame_header_t header = {
+		.version = FRAME_VERSION,
+		.type = FRAME_TIME_REQUEST,
+		.flags = 0,
+		.stream_id = TIME_SYNC_STREAM_ID,
+		.seq = time_request_seq,
+	};
+	frame_encode_header(&header, time_request);
+
+	message_t message_to_send;
+	message_to_send.message = CW_SEND_DATAGRAM;
+	message_to_send.cw_send_datagram.payload = time_request;
+	message_to_send.cw_send_datagram.payload_length = FRAME_HEADER_LENGTH;
+	message_to_send.cw_send_datagram.stream_id = TIME_SYNC_STREAM_ID;
+	message_to_send.cw_send_datagram.reliable = false;
+	message_to_send.cw_send_datagram.unnumbered = false;
+	// Queueing delay on the device adds to the measured round trip.
+	message_to_send.cw_send_datagram.traffic_class = TRAFFIC_CLASS_URGENT;
+	message_to_send.cw_send_datagram.done = time_request_done;
+	message_to_send.cw_send_datagram.done_arg = NULL;
+	time_request_busy = true;
+	BaseType_t fr_rs = connect_wifi_send_datagram(&message_to_send, TAG);
+	if (fr_rs != pdTRUE) {
+		ESP_LOGW(TAG, "Time request skipped - %d", fr_rs);
+		time_request_busy = false;
+		return;
+	}
+	time_request_seq++;
+
+}
+
+/**
+ * Frames one record in place, and hands it over to connect_wifi task.
+ * Returns false if connect_wifi task data queue is full, or has no room
+ * left but for urgent records.
+ */
+static bool forward_record(producer_source_t *source, uint8_t *buffer,
+		                   uint32_t record_length, uint8_t stream_id,
+						   bool reliable, uint32_t seq, bool numbered) {
+
+	traffic_class_t traffic_class = producer_get_class(source);
+	if (traffic_class != TRAFFIC_CLASS_URGENT &&
+		uxQueueSpacesAvailable(cw_data_queue) <= URGENT_RESERVED_SLOTS) {
+		return false;
+	}
+	message_t message_to_send;
+	message_to_send.message = CW_SEND_DATAGRAM;
+	if (reliable) {
+		// The reliable delivery mode adds its own header.
+		message_to_send.cw_send_datagram.payload = &buffer[FRAME_HEADER_LENGTH];
+		message_to_send.cw_send_datagram.payload_length = record_length;
+	} else {
+		frame_header_t header = {
+			.version = FRAME_VERSION,
+			.type = FRAME_DATA,
+			.flags = 0,
+			.stream_id = stream_id,
+			.seq = seq,
+		};
+		frame_encode_header(&header, buffer);
+		message_to_send.cw_send_datagram.payload = buffer;
+		message_to_send.cw_send_datagram.payload_length = FRAME_HEADER_LENGTH + record_length;
+	}
+	message_to_send.cw_send_datagram.stream_id = stream_id;
+	message_to_send.cw_send_datagram.reliable = reliable;
+	message_to_send.cw_send_datagram.unnumbered = !numbered;
+	message_to_send.cw_send_datagram.traffic_class = traffic_class;
+	message_to_send.cw_send_datagram.done = producer_release_record;
+	message_to_send.cw_send_datagram.done_arg = source;
+	BaseType_t fr_rs = connect_wifi_send_datagram(&message_to_send, TAG);
+	return fr_rs == pdTRUE;
+
+}
+
+/**
+ * Forwards at most max_records waiting records of a traffic class, one
+ * record per source of the class in turn. Returns the number of records
+ * forwarded, or -1 if connect_wifi task data queue became full.
+ */
+static int32_t process_class(traffic_class_t traffic_class, uint32_t max_records) {
+
+	uint8_t *buffer;
+	uint32_t record_length;
+	uint8_t stream_id;
+	bool reliable;
+	uint32_t seq;
+	bool numbered;
+	uint32_t forwarded = 0;
+
+	bool progress = true;
+	while (progress && forwarded < max_records) {
+		progress = false;
+		for (uint8_t i = 0; i < MAX_SOURCES && forwarded < max_records; i++) {
+			producer_source_t *source = producer_get_source(i);
+			if (source == NULL || producer_get_class(source) != traffic_class) {
+				continue;
+			}
+			if (!producer_next_record(source, &buffer, &record_length,
+					                  &stream_id, &reliable, &seq, &numbered)) {
+				continue;
+			}
+			if (!forward_record(source, buffer, record_length, stream_id,
+					            reliable, seq, numbered)) {
+				return -1;
+			}
+			producer_commit_record(source);
+			forwarded++;
+			progress = true;
+		}
+	}
+	return (int32_t)forwarded;
+
+}
+
+/**
+ * Forwards waiting records. Urgent records are forwarded first, the other
+ * classes share what is left with a weighted round robin, urgent records
+ * being checked again after every turn. Returns false if connect_wifi
+ * task data queue became full.
+ */
+static bool process_sources(void) {
+
+	// Records pushed from now on will trigger a new PL_DATA_READY message.
+	__atomic_store_n(&wakeup_pending, false, __ATOMIC_RELEASE);
+
+	bool progress = true;
+	while (progress) {
+		progress = false;
+		if (process_class(TRAFFIC_CLASS_URGENT, UINT32_MAX) < 0) {
+			return false;
+		}
+		for (traffic_class_t tc = TRAFFIC_CLASS_URGENT + 1; tc < TRAFFIC_CLASS_COUNT; tc++) {
+			int32_t forwarded = process_class(tc, class_weights[tc]);
+			if (forwarded < 0) {
+				return false;
+			}
+			if (forwarded > 0) {
+				progress = true;
+			}
+			if (process_class(TRAFFIC_CLASS_URGENT, UINT32_MAX) < 0) {
+				return false;
+			}
+		}
+	}
+	return true;
+
+}
+
+/**
+ * Receives the next message, waiting for ticks_to_wait at most. In reactor
+ * mode, the timers of the task are in its own deadline list (see
+ * fsm_timer.h): due timers come first, and the wait ends at the next
+ * expiry. Returns pdTRUE if a message was received.
+ */
+static BaseType_t next_message(message_t *message, TickType_t ticks_to_wait) {
+
+#if CONFIG_UDPSENDER_REACTOR
+	TickType_t late_ticks;
+	TickType_t ticks_to_expiry;
+	while (!fsm_timer_expired(&timers, message, &late_ticks)) {
+		if (!fsm_timer_next_expiry(&timers, &ticks_to_expiry) ||
+			ticks_to_expiry > ticks_to_wait) {
+			return receive_from_set(queue_set, pl_input_queue, pl_data_queue,
+					                message, ticks_to_wait);
+		}
+		if (receive_from_set(queue_set, pl_input_queue, pl_data_queue,
+				             message, ticks_to_expiry) == pdTRUE) {
+			return pdTRUE;
+		}
+	}
+	return pdTRUE;
+#else
+	return receive_from_set(queue_set, pl_input_queue, pl_data_queue,
+			                message, ticks_to_wait);
+#endif
+
+}
+
+/**
+ * Initializes timer. In reactor mode, it is moved to the deadline list of
+ * the task.
+ */
+static bool init_timer(fsm_timer_t *timer, const char *name, message_type_t message,
+		               uint32_t period_ms, bool auto_reload) {
+
+	if (!fsm_timer_init(timer, name, message, &pl_input_queue, period_ms,
+			            auto_reload, TAG)) {
+		return false;
+	}
+#if CONFIG_UDPSENDER_REACTOR
+	fsm_timer_set_list(timer, &timers);
+#endif
+	return true;
+
+}
+
+void pipeline_task(void *pvParameters) {
+
+	// Delay used for xTicksToWait when calling xQueueReceive().
+	const TickType_t delay_60s = pdMS_TO_TICKS(60000);
+
+	fsm_timer_t timer;
+	fsm_timer_t sync_timer;
+	bool sync = TIME_SYNC_PERIOD_MS > 0;
+
+	BaseType_t fr_rs;  // Return status for FreeRTOS calls.
+
+	message_t received_message;
+
+	current_state = PL_WAIT_DATA_ST;
+
+	// Create our input queues, even if we are in error state. They are made
+	// visible to other tasks once in their set.
+	QueueHandle_t control_queue;
+	QueueHandle_t data_queue;
+	if (create_queue_set(INPUT_QUEUE_LENGTH, DATA_QUEUE_LENGTH,
+			             &queue_set, &control_queue, &data_queue)) {
+		vQueueAddToRegistry(queue_set, "pl_set");
+		vQueueAddToRegistry(control_queue, "pl_control");
+		vQueueAddToRegistry(data_queue, "pl_data");
+		pl_input_queue = control_queue;
+		pl_data_queue = data_queue;
+	} else {
+		ESP_LOGE(TAG, "Error from create_queue_set");
+		send_error(PL_INIT_ERR, TAG);
+		current_state = PL_ERROR_ST;
+	}
+
+	// Create the timer we'll use to retry when connect_wifi queue is full.
+	if (current_state != PL_ERROR_ST) {
+		if (!init_timer(&timer, "PL_TIMER", PL_TIMEOUT, RETRY_PERIOD_MS, false)) {
+			ESP_LOGE(TAG, "Error from fsm_timer_init");
+			send_error(PL_INIT_ERR, TAG);
+			current_state = PL_ERROR_ST;
+		}
+	}
+
+	// Create the periodic timer used for time synchronization.
+	if (current_state != PL_ERROR_ST && sync) {
+		if (!init_timer(&sync_timer, "PL_SYNC_TIMER", PL_SYNC_TIMEOUT,
+				        TIME_SYNC_PERIOD_MS, true)) {
+			ESP_LOGE(TAG, "Error from fsm_timer_init");
+			send_error(PL_INIT_ERR, TAG);
+			current_state = PL_ERROR_ST;
+		}
+	}
+	if (current_state != PL_ERROR_ST && sync) {
+		trace_record(TRACE_TIMER_START, PL_SYNC_TIMEOUT, TIME_SYNC_PERIOD_MS);
+		fr_rs = fsm_timer_start(&sync_timer);
+		if (fr_rs != pdPASS) {
+			ESP_LOGE(TAG, "Error from fsm_timer_start: %d", fr_rs);
+			send_error(PL_TIMER_ERR, TAG);
+			current_state = PL_ERROR_ST;
+		}
+	}
+
+	// Records may have been pushed before the queue was created.
+	if (current_state != PL_ERROR_ST) {
+		pipeline_wakeup();
+	}
+
+	while (true) {
+
+		// Wait for an incoming message.
+		trace_record(TRACE_WAIT, 0, 0);
+		fr_rs = next_message(&received_message, delay_60s);
+		if (fr_rs != pdTRUE) {
+			// Timeout. Go back to receive.
+			ESP_LOGI(TAG, "Queue receive timeout");
+			continue;
+		}
+		trace_record(TRACE_DEQUEUE, received_message.message, 0);
+		state_t previous_state = current_state;
+
+		// Time requests are sent in any state but the error one.
+		if (received_message.message == PL_SYNC_TIMEOUT) {
+			if (current_state != PL_ERROR_ST) {
+				send_time_request();
+			}
+			continue;
+		}
+
+		switch (current_state) {
+
+		case PL_WAIT_DATA_ST:
+			if (received_message.message != PL_DATA_READY) {
+				// Unexpected message, ignore it, stay in this state.
+				ESP_LOGE(TAG, "PL_WAIT_DATA_ST - unexpected message received: %d",
+						 received_message.message);
+				break;
+			}
+			if (process_sources()) {
+				// Stay in same state.
+				break;
+			}
+			// connect_wifi data queue is full. Try again later.
+			trace_record(TRACE_TIMER_START, PL_TIMEOUT, RETRY_PERIOD_MS);
+			fr_rs = fsm_timer_start(&timer);
+			if (fr_rs != pdPASS) {
+				ESP_LOGE(TAG, "Error from fsm_timer_start: %d", fr_rs);
+				send_error(PL_TIMER_ERR, TAG);
+				current_state = PL_ERROR_ST;
+				break;
+			}
+			current_state = PL_WAIT_RETRY_ST;
+			break;
+
+		case PL_WAIT_RETRY_ST:
+			if (received_message.message == PL_DATA_READY) {
+				// Records will be processed at timeout.
+				break;
+			}
+			if (received_message.message != PL_TIMEOUT) {
+				ESP_LOGE(TAG, "PL_WAIT_RETRY_ST - unexpected message received: %d",
+						 received_message.message);
+				break;
+			}
+			if (process_sources()) {
+				current_state = PL_WAIT_DATA_ST;
+				break;
+			}
+			trace_record(TRACE_TIMER_START, PL_TIMEOUT, RETRY_PERIOD_MS);
+			fr_rs = fsm_timer_start(&timer);
+			if (fr_rs != pdPASS) {
+				ESP_LOGE(TAG, "Error from fsm_timer_start: %d", fr_rs);
+				send_error(PL_TIMER_ERR, TAG);
+				current_state = PL_ERROR_ST;
+				break;
+			}
+			// Stay in same state.
+			break;
+
+		case PL_ERROR_ST:
+			// Once we enter this state, we stay in it.
+			ESP_LOGI(TAG, "PL_ERROR_ST");
+			break;
+
+		default:
+			ESP_LOGE(TAG, "Unknown state: %d", current_state);
+			send_error(PL_UKNOWN_STATE_ERR, TAG);
+			current_state = PL_ERROR_ST;
+		}
+
+		trace_state(previous_state, current_state);
+
+	}
+
+}
@@ -0,0 +1,46 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef MAIN_PIPELINE_H_
+#define MAIN_PIPELINE_H_
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+// Control messages.
+extern QueueHandle_t pl_input_queue;
+
+// PL_DATA_READY messages.
+extern QueueHandle_t pl_data_queue;
+
+void pipeline_task(void *pvParameters);
+
+/**
+ * Tells the pipeline task that some records are available. To be called
+ * from an interrupt handler.
+ */
+void pipeline_wakeup_from_isr(void);
+
+/**
+ * Tells the pipeline task that some records are available. To be called
+ * from a task.
+ */
+void pipeline_wakeup(void);
+
+#endif /* MAIN_PIPELINE_H_ */
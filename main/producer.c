@@ -0,0 +1,273 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "esp_timer.h"
+
+#include "frame.h"
+#include "pipeline.h"
+#include "producer.h"
+#include "seq_store.h"
+
+#define MAX_SOURCES CONFIG_UDPSENDER_PRODUCER_MAX_SOURCES
+#define RING_SLOTS CONFIG_UDPSENDER_PRODUCER_RING_SLOTS
+#define MAX_RECORD_LENGTH CONFIG_UDPSENDER_PRODUCER_MAX_RECORD
+
+// Room left in front of every record, for the datagram header.
+#define HEADER_ROOM FRAME_HEADER_LENGTH
+
+typedef struct {
+	int64_t pushed_us;
+	uint32_t length;
+	uint8_t buffer[HEADER_ROOM + MAX_RECORD_LENGTH];
+} slot_t;
+
+// Ring indexes are free running. Each of them is written by one side only:
+// head by the producer, next by the pipeline task, tail by the connect_wifi
+// task. Slots from tail to next are owned by the send path, slots from next
+// to head are waiting for the pipeline task.
+struct producer_source {
+	bool used;
+	producer_kind_t kind;
+	uint8_t stream_id;
+	bool reliable;
+	traffic_class_t traffic_class;
+	SemaphoreHandle_t mutex;    // Task sources only.
+	uint32_t head;
+	uint32_t next;
+	uint32_t tail;
+	producer_stats_t stats;
+	slot_t slots[RING_SLOTS];
+};
+
+static producer_source_t sources[MAX_SOURCES];
+
+static portMUX_TYPE sources_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Common part of push operations. Caller guarantees a single producer.
+ */
+static bool IRAM_ATTR push_record(producer_source_t *source, const void *data,
+		                          uint32_t length) {
+
+	if (length > MAX_RECORD_LENGTH) {
+		source->stats.overruns++;
+		return false;
+	}
+	uint32_t head = source->head;
+	uint32_t tail = __atomic_load_n(&source->tail, __ATOMIC_ACQUIRE);
+	if (head - tail >= RING_SLOTS) {
+		source->stats.overruns++;
+		return false;
+	}
+	slot_t *slot = &source->slots[head % RING_SLOTS];
+	memcpy(&slot->buffer[HEADER_ROOM], data, length);
+	slot->length = length;
+	slot->pushed_us = esp_timer_get_time();
+	// Publish the slot.
+	__atomic_store_n(&source->head, head + 1, __ATOMIC_RELEASE);
+	source->stats.pushed++;
+	return true;
+
+}
+
+producer_source_t *producer_register_source(uint8_t stream_id, bool reliable,
+		                                    traffic_class_t traffic_class,
+											producer_kind_t kind) {
+
+	producer_source_t *source = NULL;
+
+	portENTER_CRITICAL(&sources_lock);
+	for (uint8_t i = 0; i < MAX_SOURCES; i++) {
+		if (!sources[i].used) {
+			source = &sources[i];
+			source->used = true;
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&sources_lock);
+	if (source == NULL) {
+		return NULL;
+	}
+
+	source->kind = kind;
+	source->stream_id = stream_id;
+	source->reliable = reliable;
+	source->traffic_class = traffic_class;
+	source->head = 0;
+	source->next = 0;
+	source->tail = 0;
+	memset(&source->stats, 0, sizeof(producer_stats_t));
+	latency_stats_reset(&source->stats.latency);
+	latency_stats_reset(&source->stats.pipeline_wait);
+	latency_stats_reset(&source->stats.queue_wait);
+	latency_stats_reset(&source->stats.send_time);
+	source->mutex = NULL;
+	if (kind == PRODUCER_TASK) {
+		source->mutex = xSemaphoreCreateMutex();
+		if (source->mutex == NULL) {
+			source->used = false;
+			return NULL;
+		}
+	}
+	return source;
+
+}
+
+bool IRAM_ATTR producer_push_from_isr(producer_source_t *source, const void *data,
+		                              uint32_t length) {
+
+	bool rs = push_record(source, data, length);
+	if (rs) {
+		pipeline_wakeup_from_isr();
+	}
+	return rs;
+
+}
+
+bool producer_push(producer_source_t *source, const void *data, uint32_t length) {
+
+	xSemaphoreTake(source->mutex, portMAX_DELAY);
+	bool rs = push_record(source, data, length);
+	xSemaphoreGive(source->mutex);
+	if (rs) {
+		pipeline_wakeup();
+	}
+	return rs;
+
+}
+
+void producer_get_stats(const producer_source_t *source, producer_stats_t *stats) {
+	*stats = source->stats;
+}
+
+void producer_get_class_stats(traffic_class_t traffic_class, producer_stats_t *stats) {
+
+	memset(stats, 0, sizeof(producer_stats_t));
+	latency_stats_reset(&stats->latency);
+	latency_stats_reset(&stats->pipeline_wait);
+	latency_stats_reset(&stats->queue_wait);
+	latency_stats_reset(&stats->send_time);
+	for (uint8_t i = 0; i < MAX_SOURCES; i++) {
+		const producer_source_t *source = &sources[i];
+		if (!source->used || source->traffic_class != traffic_class) {
+			continue;
+		}
+		stats->pushed += source->stats.pushed;
+		stats->overruns += source->stats.overruns;
+		stats->sent += source->stats.sent;
+		stats->queued += source->stats.queued;
+		stats->dropped += source->stats.dropped;
+		latency_stats_merge(&stats->latency, &source->stats.latency);
+		latency_stats_merge(&stats->pipeline_wait, &source->stats.pipeline_wait);
+		latency_stats_merge(&stats->queue_wait, &source->stats.queue_wait);
+		latency_stats_merge(&stats->send_time, &source->stats.send_time);
+	}
+
+}
+
+producer_source_t *producer_get_source(uint8_t index) {
+
+	if (index >= MAX_SOURCES || !sources[index].used) {
+		return NULL;
+	}
+	return &sources[index];
+
+}
+
+traffic_class_t producer_get_class(const producer_source_t *source) {
+	return source->traffic_class;
+}
+
+bool producer_next_record(producer_source_t *source, uint8_t **buffer,
+		                  uint32_t *record_length, uint8_t *stream_id,
+						  bool *reliable, uint32_t *seq, bool *numbered) {
+
+	uint32_t next = source->next;
+	uint32_t head = __atomic_load_n(&source->head, __ATOMIC_ACQUIRE);
+	if (next == head) {
+		return false;
+	}
+	slot_t *slot = &source->slots[next % RING_SLOTS];
+	*buffer = slot->buffer;
+	*record_length = slot->length;
+	*stream_id = source->stream_id;
+	*reliable = source->reliable;
+	// The reliable delivery mode numbers its datagrams itself.
+	*seq = 0;
+	*numbered = source->reliable || seq_store_peek(source->stream_id, seq);
+	return true;
+
+}
+
+void producer_commit_record(producer_source_t *source) {
+
+	uint32_t seq;
+	if (!source->reliable) {
+		// Fails again if the record was not numbered.
+		seq_store_next(source->stream_id, &seq);
+	}
+	__atomic_store_n(&source->next, source->next + 1, __ATOMIC_RELEASE);
+
+}
+
+void producer_release_record(void *arg, const cw_datagram_completion_t *completion) {
+
+	producer_source_t *source = (producer_source_t *)arg;
+	if (completion->deferred) {
+		// Outcome of a record released as queued before.
+		source->stats.queued--;
+		if (completion->status == CW_DATAGRAM_SENT) {
+			source->stats.sent++;
+		} else {
+			source->stats.dropped++;
+		}
+		return;
+	}
+	// Datagrams are sent in order: the released record is the oldest one.
+	uint32_t tail = source->tail;
+	slot_t *slot = &source->slots[tail % RING_SLOTS];
+	uint64_t pushed_us = (uint64_t)slot->pushed_us;
+	latency_stats_add(&source->stats.latency, (uint32_t)(completion->completed_us - pushed_us));
+	latency_stats_add(&source->stats.pipeline_wait,
+			          (uint32_t)(completion->enqueued_us - pushed_us));
+	latency_stats_add(&source->stats.queue_wait,
+			          (uint32_t)(completion->dequeued_us - completion->enqueued_us));
+	latency_stats_add(&source->stats.send_time,
+			          (uint32_t)(completion->completed_us - completion->dequeued_us));
+	switch (completion->status) {
+	case CW_DATAGRAM_SENT:
+		source->stats.sent++;
+		break;
+	case CW_DATAGRAM_QUEUED:
+		source->stats.queued++;
+		break;
+	default:
+		source->stats.dropped++;
+		break;
+	}
+	__atomic_store_n(&source->tail, tail + 1, __ATOMIC_RELEASE);
+
+}
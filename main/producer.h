@@ -0,0 +1,140 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef MAIN_PRODUCER_H_
+#define MAIN_PRODUCER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "latency_stats.h"
+#include "messages.h"
+#include "traffic_class.h"
+
+// Producer API.
+//
+// A data source registers itself once, and then pushes records. Every
+// source owns a ring of statically allocated record slots. A record is
+// copied once into a slot, with some room left in front of it for the
+// datagram header. The pipeline task writes the header in place, and the
+// connect_wifi task sends the slot content directly. The slot is freed
+// once the datagram has been completed by the connect_wifi task (see
+// cw_datagram_completion_t): its status and the time spent in each stage
+// are added to the counters of the source.
+//
+// Records longer than a datagram are fragmented by the connect_wifi task
+// (see fragment.h), unless their source is reliable.
+//
+// Every source belongs to a traffic class (see traffic_class.h), which
+// gives the priority of its records in the pipeline and send path.
+//
+// An ISR source has a single producer: one interrupt handler, calling
+// producer_push_from_isr(). A task source can be shared by several tasks,
+// calling producer_push(). A source must not be used both ways.
+
+typedef enum {
+	PRODUCER_ISR,
+	PRODUCER_TASK,
+} producer_kind_t;
+
+typedef struct producer_source producer_source_t;
+
+// Latencies in microseconds.
+typedef struct {
+	uint32_t pushed;      // Records accepted.
+	uint32_t overruns;    // Records rejected because the ring was full.
+	uint32_t sent;        // Records handed over to the transport.
+	uint32_t queued;      // Records in the retry queue or retransmit window.
+	uint32_t dropped;     // Records dropped, rejected or expired.
+	latency_stats_t latency;        // From push to send.
+	latency_stats_t pipeline_wait;  // From push to connect_wifi task queue.
+	latency_stats_t queue_wait;     // In connect_wifi task queue.
+	latency_stats_t send_time;      // From dequeue to the return of the send call.
+} producer_stats_t;
+
+/**
+ * Registers a new source, whose records will be sent on the given stream,
+ * with the given traffic class. Returns NULL if no more source can be
+ * registered.
+ */
+producer_source_t *producer_register_source(uint8_t stream_id, bool reliable,
+		                                    traffic_class_t traffic_class,
+											producer_kind_t kind);
+
+/**
+ * Copies a record into the ring of an ISR source. To be called from an
+ * interrupt handler. Returns false if the ring is full or if the record is
+ * too long.
+ */
+bool producer_push_from_isr(producer_source_t *source, const void *data,
+		                    uint32_t length);
+
+/**
+ * Copies a record into the ring of a task source. Can be called by several
+ * tasks concurrently. Returns false if the ring is full or if the record
+ * is too long.
+ */
+bool producer_push(producer_source_t *source, const void *data, uint32_t length);
+
+/**
+ * Provides the counters of a source.
+ */
+void producer_get_stats(const producer_source_t *source, producer_stats_t *stats);
+
+/**
+ * Provides the counters of all the sources of a traffic class, added up.
+ */
+void producer_get_class_stats(traffic_class_t traffic_class, producer_stats_t *stats);
+
+//========================================
+// For the pipeline task only.
+
+/**
+ * Returns the source with the given index, or NULL.
+ */
+producer_source_t *producer_get_source(uint8_t index);
+
+/**
+ * Returns the traffic class of a source.
+ */
+traffic_class_t producer_get_class(const producer_source_t *source);
+
+/**
+ * Returns the next record of the source not handed over to the send path
+ * yet, or NULL. buffer points to the room reserved for the header, followed
+ * by the record. numbered is false if the stream failed in seq_store.h:
+ * the record must be rejected.
+ */
+bool producer_next_record(producer_source_t *source, uint8_t **buffer,
+		                  uint32_t *record_length, uint8_t *stream_id,
+						  bool *reliable, uint32_t *seq, bool *numbered);
+
+/**
+ * Marks the record returned by the last call to producer_next_record() as
+ * handed over to the send path.
+ */
+void producer_commit_record(producer_source_t *source);
+
+/**
+ * Frees the oldest record handed over to the send path. Called by the
+ * connect_wifi task once the datagram has been completed.
+ */
+void producer_release_record(void *source, const cw_datagram_completion_t *completion);
+
+#endif /* MAIN_PRODUCER_H_ */
@@ -0,0 +1,165 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+
+#if CONFIG_UDPSENDER_REACTOR
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+
+#include "connect_wifi.h"
+#include "fsm_timer.h"
+#include "latency_stats.h"
+#include "messages.h"
+#include "reactor.h"
+#include "send_datagram.h"
+#include "supervisor.h"
+#include "trace.h"
+#include "utilities.h"
+
+// Shared by the three state machines.
+#define CONTROL_QUEUE_LENGTH (SV_INPUT_QUEUE_LENGTH + CW_INPUT_QUEUE_LENGTH + \
+		                      SD_INPUT_QUEUE_LENGTH)
+
+static const char *TAG = "RE";
+
+static reactor_stats_t stats;
+
+/**
+ * Calls the handler of the state machine the message is for.
+ */
+static void dispatch(const message_t *message) {
+
+	switch (message->message) {
+
+	case CW_CONNECT:
+	case CW_DISCONNECT:
+	case CW_SEND_DATAGRAM:
+	case CW_STA_OK:
+	case CW_IP_OK:
+	case CW_AP_NOK:
+	case CW_TIMEOUT:
+	case CW_SEND_TIMEOUT:
+	case CW_SCAN_DONE:
+	case CW_RSSI_TIMEOUT:
+	case CW_TRACE_DUMP:
+		connect_wifi_handle(message);
+		break;
+
+	case SD_CONNECTION_STATUS:
+	case SD__SEND_ERROR:
+	case SD_TIMEOUT:
+		send_datagram_handle(message);
+		break;
+
+	case SV_TIMEOUT:
+	case SV_INTERNAL_ERROR:
+		supervisor_handle(message);
+		break;
+
+	default:
+		ESP_LOGE(TAG, "Unexpected message received: %d", message->message);
+	}
+
+}
+
+void reactor_task(void *pvParameters) {
+
+	// Delay used for xTicksToWait when calling receive_from_set(), if no
+	// timer is active.
+	const TickType_t delay_60s = pdMS_TO_TICKS(60000);
+
+	QueueSetHandle_t queue_set;
+	QueueHandle_t control_queue;
+	QueueHandle_t data_queue;
+
+	BaseType_t fr_rs;  // Return status for FreeRTOS calls.
+
+	message_t received_message;
+	TickType_t late_ticks;
+
+	latency_stats_reset(&stats.timer_lateness);
+
+	// The queues must exist before the state machines are initialized:
+	// they do not create their own ones then.
+	if (!create_queue_set(CONTROL_QUEUE_LENGTH, CW_DATA_QUEUE_LENGTH,
+			              &queue_set, &control_queue, &data_queue)) {
+		ESP_LOGE(TAG, "Error from create_queue_set");
+		// Nothing can be done without queues.
+		while (true) {
+			vTaskDelay(portMAX_DELAY);
+		}
+	}
+	vQueueAddToRegistry(queue_set, "reactor_set");
+	vQueueAddToRegistry(control_queue, "reactor_control");
+	vQueueAddToRegistry(data_queue, "cw_data");
+	sv_input_queue = control_queue;
+	cw_input_queue = control_queue;
+	sd_input_queue = control_queue;
+	cw_data_queue = data_queue;
+
+	supervisor_init();
+	connect_wifi_init();
+	send_datagram_init();
+
+	while (true) {
+
+		// Timers that are due come first.
+		while (fsm_timer_expired(&fsm_timer_reactor_list, &received_message, &late_ticks)) {
+			stats.timer_expiries++;
+			latency_stats_add(&stats.timer_lateness, late_ticks * portTICK_PERIOD_MS * 1000);
+			dispatch(&received_message);
+		}
+
+		// Wait for an incoming message, or for the next timer expiry.
+		TickType_t ticks_to_wait;
+		bool timer_active = fsm_timer_next_expiry(&fsm_timer_reactor_list, &ticks_to_wait);
+		if (!timer_active || ticks_to_wait > delay_60s) {
+			ticks_to_wait = delay_60s;
+		}
+		trace_record(TRACE_WAIT, 0, 0);
+		fr_rs = receive_from_set(queue_set, control_queue, data_queue,
+				                 &received_message, ticks_to_wait);
+		if (fr_rs != pdTRUE) {
+			if (!timer_active) {
+				// Timeout. Go back to receive.
+				ESP_LOGI(TAG, "Queue receive timeout");
+			}
+			continue;
+		}
+		trace_record(TRACE_DEQUEUE, received_message.message, 0);
+		stats.messages++;
+		dispatch(&received_message);
+
+	}
+
+}
+
+void reactor_get_stats(reactor_stats_t *stats_copy) {
+	*stats_copy = stats;
+}
+
+#endif
@@ -0,0 +1,58 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+
+#ifndef MAIN_REACTOR_H_
+#define MAIN_REACTOR_H_
+
+#include <stdint.h>
+
+#include "latency_stats.h"
+
+// Reactor mode (CONFIG_UDPSENDER_REACTOR).
+//
+// The supervisor, connect_wifi and send_datagram state machines run as
+// handlers of a single task, instead of a task each. The handlers are
+// the ones called by the tasks: supervisor_handle(), connect_wifi_handle()
+// and send_datagram_handle() process one message each, run to completion
+// and return.
+//
+// The reactor owns a control queue, designated by sv_input_queue,
+// cw_input_queue and sd_input_queue, and cw_data_queue, both members of
+// a queue set. Messages are dispatched to the handlers according to their
+// type, control messages before waiting datagrams, as in connect_wifi
+// task. Timers form a deadline list (see fsm_timer.h): the reactor waits
+// for messages until the first expiry, and handles due timers before
+// waiting messages.
+//
+// A handler must never block: a message it waits for could only be
+// handled by the reactor itself. The pipeline task is kept: it services
+// a deadline list of its own for its timers.
+
+typedef struct {
+	uint32_t messages;                // Received from the queues.
+	uint32_t timer_expiries;
+	latency_stats_t timer_lateness;   // From expiry to dispatch, tick resolution.
+} reactor_stats_t;
+
+void reactor_task(void *pvParameters);
+
+void reactor_get_stats(reactor_stats_t *stats);
+
+#endif /* MAIN_REACTOR_H_ */
@@ -0,0 +1,114 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "record.h"
+
+#define RECORD_DESCRIBE_FIELD(type, name) \
+	{ #name, RECORD_TYPE_##type, offsetof(wire_t, name) },
+
+#define RECORD_COUNT_FIELD(type, name) + 1
+
+// One function per schema, holding its descriptors: the wire layout type
+// is only known inside.
+#define RECORD_DESCRIBE(name, NAME, id) \
+	static const record_schema_t *describe_##name(void) { \
+		typedef record_##name##_wire_t wire_t; \
+		static const record_field_t fields[] = { \
+			RECORD_##NAME##_FIELDS(RECORD_DESCRIBE_FIELD) \
+		}; \
+		/* Positional: name and id are macro parameters. */ \
+		static const record_schema_t schema = { \
+			#name, (id), RECORD_##NAME##_LENGTH, \
+			0 RECORD_##NAME##_FIELDS(RECORD_COUNT_FIELD), fields, \
+		}; \
+		return &schema; \
+	}
+
+RECORD_SCHEMAS(RECORD_DESCRIBE)
+
+#define RECORD_FIND(name, NAME, id) \
+	case (id): \
+		return describe_##name();
+
+const record_schema_t *record_find_schema(uint8_t id) {
+
+	switch (id) {
+	RECORD_SCHEMAS(RECORD_FIND)
+	default:
+		return NULL;
+	}
+
+}
+
+int record_format(const uint8_t *buffer, uint32_t length, char *text, size_t size) {
+
+	if (length == 0) {
+		return -1;
+	}
+	const record_schema_t *schema = record_find_schema(buffer[0]);
+	if (schema == NULL || length < schema->length) {
+		return -1;
+	}
+	int total = snprintf(text, size, "%s", schema->name);
+	for (uint8_t i = 0; i < schema->field_count && total >= 0; i++) {
+		const record_field_t *field = &schema->fields[i];
+		const uint8_t *value = &buffer[field->offset];
+		size_t used = (size_t)total < size ? (size_t)total : size;
+		char *end = size == 0 ? text : &text[used];
+		size_t left = size - used;
+		int n = 0;
+		switch (field->type) {
+		case RECORD_TYPE_u8:
+			n = snprintf(end, left, " %s=%u", field->name, record_get_u8(value));
+			break;
+		case RECORD_TYPE_i8:
+			n = snprintf(end, left, " %s=%d", field->name, record_get_i8(value));
+			break;
+		case RECORD_TYPE_u16:
+			n = snprintf(end, left, " %s=%u", field->name, record_get_u16(value));
+			break;
+		case RECORD_TYPE_i16:
+			n = snprintf(end, left, " %s=%d", field->name, record_get_i16(value));
+			break;
+		case RECORD_TYPE_u32:
+			n = snprintf(end, left, " %s=%" PRIu32, field->name, record_get_u32(value));
+			break;
+		case RECORD_TYPE_i32:
+			n = snprintf(end, left, " %s=%" PRId32, field->name, record_get_i32(value));
+			break;
+		case RECORD_TYPE_u64:
+			n = snprintf(end, left, " %s=%" PRIu64, field->name, record_get_u64(value));
+			break;
+		case RECORD_TYPE_i64:
+			n = snprintf(end, left, " %s=%" PRId64, field->name, record_get_i64(value));
+			break;
+		case RECORD_TYPE_f32:
+			n = snprintf(end, left, " %s=%g", field->name, (double)record_get_f32(value));
+			break;
+		}
+		total = n < 0 ? n : total + n;
+	}
+	return total;
+
+}
@@ -0,0 +1,228 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef MAIN_RECORD_H_
+#define MAIN_RECORD_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "record_schemas.h"
+
+// Records with a fixed layout, generated from the schemas of
+// record_schemas.h.
+//
+// Record of schema NAME (network byte order, no padding):
+//
+//  0       1
+//  +-------+------- ... -------+
+//  |  id   |      fields       |
+//  +-------+------- ... -------+
+//
+// Fields follow in declaration order. For every schema name, this file
+// provides:
+// - record_<name>_t, the record with its fields as C types
+// - RECORD_<NAME>_ID, and RECORD_<NAME>_LENGTH, its length on the wire
+// - record_<name>_encode(), which writes the record into a buffer of
+//   RECORD_<NAME>_LENGTH bytes and returns its length
+// - record_<name>_decode(), which reads it back
+// Field offsets are resolved at compile time: encoding is one store per
+// field byte, without any formatting.
+//
+// This file does not depend on FreeRTOS or ESP-IDF, so that it can be used
+// by host tools.
+
+typedef uint8_t record_u8_t;
+typedef int8_t record_i8_t;
+typedef uint16_t record_u16_t;
+typedef int16_t record_i16_t;
+typedef uint32_t record_u32_t;
+typedef int32_t record_i32_t;
+typedef uint64_t record_u64_t;
+typedef int64_t record_i64_t;
+typedef float record_f32_t;
+
+#define RECORD_SIZE_u8 1
+#define RECORD_SIZE_i8 1
+#define RECORD_SIZE_u16 2
+#define RECORD_SIZE_i16 2
+#define RECORD_SIZE_u32 4
+#define RECORD_SIZE_i32 4
+#define RECORD_SIZE_u64 8
+#define RECORD_SIZE_i64 8
+#define RECORD_SIZE_f32 4
+
+#define RECORD_TYPES(TYPE) \
+	TYPE(u8) TYPE(i8) TYPE(u16) TYPE(i16) TYPE(u32) TYPE(i32) TYPE(u64) TYPE(i64) TYPE(f32)
+
+#define RECORD_TYPE_ENUM(type) RECORD_TYPE_##type,
+typedef enum {
+	RECORD_TYPES(RECORD_TYPE_ENUM)
+} record_type_t;
+#undef RECORD_TYPE_ENUM
+
+static inline void record_put_u8(uint8_t *buffer, uint8_t value) {
+	buffer[0] = value;
+}
+
+static inline void record_put_u16(uint8_t *buffer, uint16_t value) {
+	buffer[0] = (uint8_t)(value >> 8);
+	buffer[1] = (uint8_t)value;
+}
+
+static inline void record_put_u32(uint8_t *buffer, uint32_t value) {
+	buffer[0] = (uint8_t)(value >> 24);
+	buffer[1] = (uint8_t)(value >> 16);
+	buffer[2] = (uint8_t)(value >> 8);
+	buffer[3] = (uint8_t)value;
+}
+
+static inline void record_put_u64(uint8_t *buffer, uint64_t value) {
+	record_put_u32(buffer, (uint32_t)(value >> 32));
+	record_put_u32(&buffer[4], (uint32_t)value);
+}
+
+static inline uint8_t record_get_u8(const uint8_t *buffer) {
+	return buffer[0];
+}
+
+static inline uint16_t record_get_u16(const uint8_t *buffer) {
+	return (uint16_t)(((uint16_t)buffer[0] << 8) | buffer[1]);
+}
+
+static inline uint32_t record_get_u32(const uint8_t *buffer) {
+	return ((uint32_t)buffer[0] << 24) | ((uint32_t)buffer[1] << 16) |
+		   ((uint32_t)buffer[2] << 8) | buffer[3];
+}
+
+static inline uint64_t record_get_u64(const uint8_t *buffer) {
+	return ((uint64_t)record_get_u32(buffer) << 32) | record_get_u32(&buffer[4]);
+}
+
+// Signed fields are sent as two's complement, floats as IEEE 754 bits.
+static inline void record_put_i8(uint8_t *buffer, int8_t value) {
+	record_put_u8(buffer, (uint8_t)value);
+}
+static inline void record_put_i16(uint8_t *buffer, int16_t value) {
+	record_put_u16(buffer, (uint16_t)value);
+}
+static inline void record_put_i32(uint8_t *buffer, int32_t value) {
+	record_put_u32(buffer, (uint32_t)value);
+}
+static inline void record_put_i64(uint8_t *buffer, int64_t value) {
+	record_put_u64(buffer, (uint64_t)value);
+}
+static inline void record_put_f32(uint8_t *buffer, float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	record_put_u32(buffer, bits);
+}
+
+static inline int8_t record_get_i8(const uint8_t *buffer) {
+	return (int8_t)record_get_u8(buffer);
+}
+static inline int16_t record_get_i16(const uint8_t *buffer) {
+	return (int16_t)record_get_u16(buffer);
+}
+static inline int32_t record_get_i32(const uint8_t *buffer) {
+	return (int32_t)record_get_u32(buffer);
+}
+static inline int64_t record_get_i64(const uint8_t *buffer) {
+	return (int64_t)record_get_u64(buffer);
+}
+static inline float record_get_f32(const uint8_t *buffer) {
+	uint32_t bits = record_get_u32(buffer);
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+// Generators. The wire layout of a schema is a struct of byte arrays:
+// it has no padding, so that offsetof() gives the offset of every field.
+#define RECORD_MEMBER(type, name) record_##type##_t name;
+#define RECORD_WIRE_MEMBER(type, name) uint8_t name[RECORD_SIZE_##type];
+#define RECORD_WIRE_SIZE(type, name) + RECORD_SIZE_##type
+#define RECORD_ENCODE_FIELD(type, name) \
+	record_put_##type(&buffer[offsetof(wire_t, name)], record->name);
+#define RECORD_DECODE_FIELD(type, name) \
+	record->name = record_get_##type(&buffer[offsetof(wire_t, name)]);
+
+#define RECORD_DECLARE(name, NAME, id) \
+	typedef struct { \
+		RECORD_##NAME##_FIELDS(RECORD_MEMBER) \
+	} record_##name##_t; \
+	typedef struct { \
+		uint8_t schema_id; \
+		RECORD_##NAME##_FIELDS(RECORD_WIRE_MEMBER) \
+	} record_##name##_wire_t; \
+	enum { \
+		RECORD_##NAME##_ID = (id), \
+		RECORD_##NAME##_LENGTH = 1 RECORD_##NAME##_FIELDS(RECORD_WIRE_SIZE), \
+	}; \
+	_Static_assert(sizeof(record_##name##_wire_t) == RECORD_##NAME##_LENGTH, \
+			       "padding in the wire layout of " #name); \
+	static inline uint16_t record_##name##_encode(const record_##name##_t *record, \
+			                                      uint8_t *buffer) { \
+		typedef record_##name##_wire_t wire_t; \
+		buffer[0] = (id); \
+		RECORD_##NAME##_FIELDS(RECORD_ENCODE_FIELD) \
+		return RECORD_##NAME##_LENGTH; \
+	} \
+	static inline bool record_##name##_decode(const uint8_t *buffer, uint32_t length, \
+			                                  record_##name##_t *record) { \
+		typedef record_##name##_wire_t wire_t; \
+		if (length < RECORD_##NAME##_LENGTH || buffer[0] != (id)) { \
+			return false; \
+		} \
+		RECORD_##NAME##_FIELDS(RECORD_DECODE_FIELD) \
+		return true; \
+	}
+
+RECORD_SCHEMAS(RECORD_DECLARE)
+
+// Descriptors, for decoders that do not know the schema in advance.
+typedef struct {
+	const char *name;
+	record_type_t type;
+	uint16_t offset;
+} record_field_t;
+
+typedef struct {
+	const char *name;
+	uint8_t id;
+	uint16_t length;
+	uint8_t field_count;
+	const record_field_t *fields;
+} record_schema_t;
+
+/**
+ * Returns the schema of a record, from its first byte, or NULL if unknown.
+ */
+const record_schema_t *record_find_schema(uint8_t id);
+
+/**
+ * Writes a record as text, "name field=value ...", into text, as
+ * snprintf() does. Returns -1 if the schema is unknown or the record too
+ * short. Fields appended to the schema after this build are ignored.
+ */
+int record_format(const uint8_t *buffer, uint32_t length, char *text, size_t size);
+
+#endif /* MAIN_RECORD_H_ */
@@ -0,0 +1,58 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef MAIN_RECORD_SCHEMAS_H_
+#define MAIN_RECORD_SCHEMAS_H_
+
+// Record schemas, declared once: record.h generates from them the record
+// types, their encode and decode functions and their field offsets, and
+// record.c the descriptors used by host tools to decode any record.
+//
+// A schema is a field list macro, RECORD_<NAME>_FIELDS(FIELD), giving
+// FIELD(type, name) for every field, and an entry of RECORD_SCHEMAS,
+// RECORD(name, NAME, id), id being the first byte of the record. Field
+// types: u8, i8, u16, i16, u32, i32, u64, i64 and f32.
+//
+// The wire layout of a schema must not change once records have been
+// sent: fields may only be appended, older decoders ignoring them. A
+// schema that changes otherwise gets a new identifier.
+
+// Periodic datagram of the send_datagram task.
+#define RECORD_SD_COUNTER_FIELDS(FIELD) \
+	FIELD(u32, counter) \
+	FIELD(u32, uptime_ms)
+
+// Measurement of an environmental sensor, as an example of a wider record.
+#define RECORD_SENSOR_SAMPLE_FIELDS(FIELD) \
+	FIELD(u32, sample_ms) \
+	FIELD(u16, sensor_id) \
+	FIELD(i32, temperature_mc) \
+	FIELD(u16, humidity_pm) \
+	FIELD(u32, pressure_pa) \
+	FIELD(i16, accel_x_mg) \
+	FIELD(i16, accel_y_mg) \
+	FIELD(i16, accel_z_mg) \
+	FIELD(f32, battery_v) \
+	FIELD(u8, status)
+
+#define RECORD_SCHEMAS(RECORD) \
+	RECORD(sd_counter, SD_COUNTER, 1) \
+	RECORD(sensor_sample, SENSOR_SAMPLE, 2)
+
+#endif /* MAIN_RECORD_SCHEMAS_H_ */
@@ -0,0 +1,388 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#include "frame.h"
+#include "reliable.h"
+#include "seq_store.h"
+
+#define WINDOW_SIZE CONFIG_UDPSENDER_RELIABLE_WINDOW
+#define MAX_PAYLOAD_LENGTH CONFIG_UDPSENDER_RELIABLE_MAX_PAYLOAD
+#define MAX_STREAMS CONFIG_UDPSENDER_RELIABLE_MAX_STREAMS
+#define INITIAL_RTO_MS CONFIG_UDPSENDER_RELIABLE_INITIAL_RTO_MS
+#define MAX_RETRIES CONFIG_UDPSENDER_RELIABLE_MAX_RETRIES
+
+#define MIN_RTO_MS 50
+#define MAX_RTO_MS 8000
+
+// Number of ACKs reporting later datagrams as received before a missing
+// datagram is retransmitted without waiting for its timeout.
+#define GAP_THRESHOLD 3
+
+typedef struct {
+	bool used;
+	bool due;            // Gap detected, retransmit as soon as possible.
+	uint8_t retries;
+	uint8_t gap_count;
+	uint32_t seq;
+	uint32_t sent_ms;
+	uint32_t tag;
+	uint16_t length;
+	uint8_t frame[FRAME_HEADER_LENGTH + MAX_PAYLOAD_LENGTH];
+} slot_t;
+
+typedef struct {
+	bool used;
+	uint8_t stream_id;
+	traffic_class_t traffic_class;
+	uint32_t next_seq;   // Sequence number of next new datagram.
+	uint32_t base_seq;   // Oldest sequence number not acknowledged yet.
+	bool rtt_valid;
+	bool backoff;        // A datagram timed out during the current retransmission pass.
+	reliable_stats_t stats;
+	slot_t slots[WINDOW_SIZE];
+} stream_t;
+
+static stream_t streams[MAX_STREAMS];
+
+static reliable_done_t done_callback = NULL;
+
+static stream_t *find_stream(uint8_t stream_id) {
+
+	for (uint8_t i = 0; i < MAX_STREAMS; i++) {
+		if (streams[i].used && streams[i].stream_id == stream_id) {
+			return &streams[i];
+		}
+	}
+	return NULL;
+
+}
+
+static stream_t *find_or_create_stream(uint8_t stream_id, uint32_t next_seq) {
+
+	stream_t *stream = find_stream(stream_id);
+	if (stream != NULL) {
+		return stream;
+	}
+	for (uint8_t i = 0; i < MAX_STREAMS; i++) {
+		if (!streams[i].used) {
+			stream = &streams[i];
+			memset(stream, 0, sizeof(stream_t));
+			stream->used = true;
+			stream->stream_id = stream_id;
+			stream->stats.rto_ms = INITIAL_RTO_MS;
+			stream->next_seq = next_seq;
+			stream->base_seq = stream->next_seq;
+			return stream;
+		}
+	}
+	return NULL;
+
+}
+
+/**
+ * Doubles the RTO of the streams where a datagram timed out during the
+ * retransmission pass that has just ended: the RTO is backed off once per
+ * timer expiry, whatever the number of datagrams that timed out (RFC 6298,
+ * 5.5).
+ */
+static void apply_backoff(void) {
+
+	for (uint8_t s = 0; s < MAX_STREAMS; s++) {
+		stream_t *stream = &streams[s];
+		if (!stream->used || !stream->backoff) {
+			continue;
+		}
+		stream->backoff = false;
+		stream->stats.rto_ms *= 2;
+		if (stream->stats.rto_ms > MAX_RTO_MS) {
+			stream->stats.rto_ms = MAX_RTO_MS;
+		}
+	}
+
+}
+
+/**
+ * Moves base_seq forward, over datagrams that are no more in the window.
+ */
+static void advance_base(stream_t *stream) {
+
+	while (stream->base_seq != stream->next_seq &&
+		   !stream->slots[stream->base_seq % WINDOW_SIZE].used) {
+		stream->base_seq++;
+	}
+
+}
+
+/**
+ * RFC 6298 estimator, in milliseconds.
+ */
+static void update_rtt(stream_t *stream, uint32_t rtt_ms) {
+
+	reliable_stats_t *stats = &stream->stats;
+	if (!stream->rtt_valid) {
+		stats->srtt_ms = rtt_ms;
+		stats->rttvar_ms = rtt_ms / 2;
+		stream->rtt_valid = true;
+	} else {
+		uint32_t delta = stats->srtt_ms > rtt_ms ?
+				         stats->srtt_ms - rtt_ms : rtt_ms - stats->srtt_ms;
+		stats->rttvar_ms = (3 * stats->rttvar_ms + delta) / 4;
+		stats->srtt_ms = (7 * stats->srtt_ms + rtt_ms) / 8;
+	}
+	uint32_t rto = stats->srtt_ms + 4 * stats->rttvar_ms;
+	if (rto < MIN_RTO_MS) {
+		rto = MIN_RTO_MS;
+	}
+	if (rto > MAX_RTO_MS) {
+		rto = MAX_RTO_MS;
+	}
+	stats->rto_ms = rto;
+
+}
+
+static void release_slot(stream_t *stream, slot_t *slot, bool acked) {
+
+	slot->used = false;
+	stream->stats.in_flight--;
+	if (slot->tag != 0 && done_callback != NULL) {
+		done_callback(slot->tag, acked);
+	}
+
+}
+
+void reliable_init(reliable_done_t done) {
+
+	done_callback = done;
+	memset(streams, 0, sizeof(streams));
+
+}
+
+reliable_rs_t reliable_prepare(uint8_t stream_id, traffic_class_t traffic_class,
+		                       const uint8_t *payload, uint16_t payload_length,
+							   uint32_t tag, uint32_t now_ms,
+							   uint8_t **frame, uint16_t *frame_length) {
+
+	if (payload_length > MAX_PAYLOAD_LENGTH) {
+		return RELIABLE_TOO_LONG;
+	}
+	uint32_t seq;
+	if (!seq_store_peek(stream_id, &seq)) {
+		return RELIABLE_NO_SEQUENCE;
+	}
+	stream_t *stream = find_or_create_stream(stream_id, seq);
+	if (stream == NULL) {
+		return RELIABLE_NO_STREAM;
+	}
+	stream->traffic_class = traffic_class;
+	// The store is ahead of the stream if the stream identifier was also
+	// used without reliable delivery. Values in between are never sent.
+	if (stream->base_seq == stream->next_seq) {
+		stream->base_seq = seq;
+	}
+	if (seq - stream->base_seq >= WINDOW_SIZE) {
+		stream->stats.window_full++;
+		return RELIABLE_WINDOW_FULL;
+	}
+	// Returns the value peeked above: the frame carries the sequence number
+	// consumed in the store.
+	seq_store_next(stream_id, &seq);
+
+	slot_t *slot = &stream->slots[seq % WINDOW_SIZE];
+	frame_header_t header = {
+		.version = FRAME_VERSION,
+		.type = FRAME_DATA,
+		.flags = FRAME_FLAG_RELIABLE,
+		.stream_id = stream_id,
+		.seq = seq,
+	};
+	frame_encode_header(&header, slot->frame);
+	memcpy(&slot->frame[FRAME_HEADER_LENGTH], payload, payload_length);
+	slot->used = true;
+	slot->due = false;
+	slot->retries = 0;
+	slot->gap_count = 0;
+	slot->seq = seq;
+	slot->sent_ms = now_ms;
+	slot->tag = tag;
+	slot->length = FRAME_HEADER_LENGTH + payload_length;
+	stream->next_seq = seq + 1;
+	stream->stats.in_flight++;
+	stream->stats.sent++;
+
+	*frame = slot->frame;
+	*frame_length = slot->length;
+	return RELIABLE_OK;
+
+}
+
+void reliable_process_ack(const frame_ack_t *ack, uint32_t now_ms) {
+
+	stream_t *stream = find_stream(ack->header.stream_id);
+	if (stream == NULL) {
+		return;
+	}
+	uint32_t cumulative = ack->header.seq;
+
+	// Highest sequence number reported as received by the bitmap, if any.
+	bool selective = ack->bitmap != 0;
+	uint32_t highest_selective = cumulative;
+	for (uint32_t bit = 0; bit < FRAME_ACK_BITMAP_BITS; bit++) {
+		if ((ack->bitmap & (1u << bit)) != 0) {
+			highest_selective = cumulative + 1 + bit;
+		}
+	}
+
+	for (uint32_t i = 0; i < WINDOW_SIZE; i++) {
+		slot_t *slot = &stream->slots[i];
+		if (!slot->used) {
+			continue;
+		}
+		bool acked = frame_seq_before(slot->seq, cumulative);
+		if (!acked) {
+			uint32_t offset = slot->seq - cumulative - 1;
+			if (slot->seq != cumulative && offset < FRAME_ACK_BITMAP_BITS &&
+				(ack->bitmap & (1u << offset)) != 0) {
+				acked = true;
+			}
+		}
+		if (!acked) {
+			continue;
+		}
+		// Karn's algorithm: no RTT sample from retransmitted datagrams.
+		if (slot->retries == 0) {
+			update_rtt(stream, now_ms - slot->sent_ms);
+		}
+		release_slot(stream, slot, true);
+		stream->stats.acked++;
+	}
+
+	// Gap detection: datagrams older than a selectively acknowledged one.
+	if (selective) {
+		for (uint32_t i = 0; i < WINDOW_SIZE; i++) {
+			slot_t *slot = &stream->slots[i];
+			if (!slot->used || !frame_seq_before(slot->seq, highest_selective)) {
+				continue;
+			}
+			slot->gap_count++;
+			if (slot->gap_count >= GAP_THRESHOLD) {
+				slot->gap_count = 0;
+				slot->due = true;
+			}
+		}
+	}
+
+	advance_base(stream);
+
+}
+
+bool reliable_next_retransmit(uint32_t now_ms,
+		                      uint8_t **frame, uint16_t *frame_length,
+							  traffic_class_t *traffic_class) {
+
+	for (uint8_t s = 0; s < MAX_STREAMS; s++) {
+		stream_t *stream = &streams[s];
+		if (!stream->used || stream->stats.in_flight == 0) {
+			continue;
+		}
+		for (uint32_t i = 0; i < WINDOW_SIZE; i++) {
+			slot_t *slot = &stream->slots[i];
+			if (!slot->used) {
+				continue;
+			}
+			bool timed_out = now_ms - slot->sent_ms >= stream->stats.rto_ms;
+			if (!slot->due && !timed_out) {
+				continue;
+			}
+			if (slot->retries >= MAX_RETRIES) {
+				// Give up.
+				release_slot(stream, slot, false);
+				stream->stats.expired++;
+				advance_base(stream);
+				continue;
+			}
+			if (timed_out && !slot->due) {
+				// Exponential backoff, once the pass is over: the other
+				// slots are compared with the same RTO.
+				stream->backoff = true;
+			}
+			slot->due = false;
+			slot->retries++;
+			slot->sent_ms = now_ms;
+			slot->frame[2] |= FRAME_FLAG_RETRANSMIT;
+			stream->stats.retransmits++;
+			*frame = slot->frame;
+			*frame_length = slot->length;
+			*traffic_class = stream->traffic_class;
+			return true;
+		}
+	}
+	apply_backoff();
+	return false;
+
+}
+
+bool reliable_next_deadline(uint32_t now_ms, uint32_t *delay_ms) {
+
+	bool found = false;
+	uint32_t min_delay = UINT32_MAX;
+
+	for (uint8_t s = 0; s < MAX_STREAMS; s++) {
+		stream_t *stream = &streams[s];
+		if (!stream->used || stream->stats.in_flight == 0) {
+			continue;
+		}
+		for (uint32_t i = 0; i < WINDOW_SIZE; i++) {
+			slot_t *slot = &stream->slots[i];
+			if (!slot->used) {
+				continue;
+			}
+			found = true;
+			uint32_t elapsed = now_ms - slot->sent_ms;
+			uint32_t delay = 0;
+			if (!slot->due && elapsed < stream->stats.rto_ms) {
+				delay = stream->stats.rto_ms - elapsed;
+			}
+			if (delay < min_delay) {
+				min_delay = delay;
+			}
+		}
+	}
+	if (found) {
+		*delay_ms = min_delay;
+	}
+	return found;
+
+}
+
+bool reliable_get_stats(uint8_t stream_id, reliable_stats_t *stats) {
+
+	stream_t *stream = find_stream(stream_id);
+	if (stream == NULL) {
+		return false;
+	}
+	*stats = stream->stats;
+	return true;
+
+}
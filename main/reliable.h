@@ -0,0 +1,116 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef MAIN_RELIABLE_H_
+#define MAIN_RELIABLE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "frame.h"
+#include "traffic_class.h"
+
+// Selective repeat reliable delivery.
+//
+// Every reliable stream owns a retransmit window of sent datagrams, keyed
+// by sequence number. All windows are statically allocated. The receiver
+// acknowledges datagrams with ACK frames (cumulative ACK plus bitmap, see
+// frame.h). A datagram is retransmitted when its retransmission timeout
+// expires, or when later datagrams have been acknowledged while it has not
+// (gap detection).
+//
+// Sequence numbers are taken from seq_store.h, so that they go on across
+// restarts.
+//
+// A datagram can be given a tag. When a datagram with a tag leaves the
+// window, acknowledged or given up, the callback given to reliable_init()
+// is called with its tag.
+//
+// This module is not thread safe: it must be used by one task only. It
+// does not depend on FreeRTOS, time is provided by the caller.
+
+typedef enum {
+	RELIABLE_OK,
+	RELIABLE_WINDOW_FULL,
+	RELIABLE_TOO_LONG,
+	RELIABLE_NO_STREAM,
+	RELIABLE_NO_SEQUENCE,  // The stream failed in seq_store.h.
+} reliable_rs_t;
+
+typedef struct {
+	uint32_t in_flight;    // Datagrams sent and not acknowledged yet.
+	uint32_t sent;         // New datagrams sent.
+	uint32_t retransmits;  // Retransmissions.
+	uint32_t acked;        // Datagrams acknowledged.
+	uint32_t expired;      // Datagrams dropped after too many retransmissions.
+	uint32_t window_full;  // Datagrams rejected because the window was full.
+	uint32_t srtt_ms;      // Smoothed round-trip time.
+	uint32_t rttvar_ms;    // Round-trip time variation.
+	uint32_t rto_ms;       // Current retransmission timeout.
+} reliable_stats_t;
+
+// Called when a datagram with a non-zero tag leaves the window: acked is
+// false if it has been given up after too many retransmissions.
+typedef void (*reliable_done_t)(uint32_t tag, bool acked);
+
+/**
+ * Resets all streams. done can be NULL.
+ */
+void reliable_init(reliable_done_t done);
+
+/**
+ * Assigns the next sequence number of the stream to the payload, and stores
+ * a copy of the resulting frame in the retransmit window, with its tag (0:
+ * none). On success, frame and frame_length give the frame to be sent. The
+ * stream is created on first use. Retransmissions use the traffic class
+ * given here.
+ */
+reliable_rs_t reliable_prepare(uint8_t stream_id, traffic_class_t traffic_class,
+		                       const uint8_t *payload, uint16_t payload_length,
+							   uint32_t tag, uint32_t now_ms,
+							   uint8_t **frame, uint16_t *frame_length);
+
+/**
+ * Processes an ACK frame received from the remote host.
+ */
+void reliable_process_ack(const frame_ack_t *ack, uint32_t now_ms);
+
+/**
+ * Returns true if a frame has to be retransmitted now, and provides it,
+ * with the traffic class of its stream. Must be called until it returns
+ * false, with the same time: the RTO of a stream where datagrams timed out
+ * is backed off once, when the pass is over.
+ */
+bool reliable_next_retransmit(uint32_t now_ms,
+		                      uint8_t **frame, uint16_t *frame_length,
+							  traffic_class_t *traffic_class);
+
+/**
+ * Returns false if no datagram is in flight. Otherwise, returns true and
+ * provides the delay before the next retransmission deadline.
+ */
+bool reliable_next_deadline(uint32_t now_ms, uint32_t *delay_ms);
+
+/**
+ * Provides the counters of a stream. Returns false if the stream does not
+ * exist.
+ */
+bool reliable_get_stats(uint8_t stream_id, reliable_stats_t *stats);
+
+#endif /* MAIN_RELIABLE_H_ */
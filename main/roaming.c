@@ -0,0 +1,349 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#include "latency_stats.h"
+#include "roaming.h"
+
+#define THRESHOLD_DBM CONFIG_UDPSENDER_ROAM_THRESHOLD_DBM
+#define HYSTERESIS_DB CONFIG_UDPSENDER_ROAM_HYSTERESIS_DB
+#define SCAN_INTERVAL_MS CONFIG_UDPSENDER_ROAM_SCAN_INTERVAL_MS
+#define FAILURE_PENALTY_DB CONFIG_UDPSENDER_ROAM_FAILURE_PENALTY_DB
+
+// Failures beyond this number do not lower the score anymore, so that a
+// candidate that failed often is still used when it is the only one.
+#define MAX_PENALIZED_FAILURES 3
+
+// One failure is forgotten per period.
+#define FAILURE_DECAY_MS 60000
+
+// Each background scan that does not find a better candidate doubles the
+// interval before the next one, up to 2^MAX_SCAN_BACKOFF times.
+#define MAX_SCAN_BACKOFF 4
+
+// Smoothed RSSI: rssi += (sample - rssi) / RSSI_SMOOTHING, kept in 1/8 dB.
+#define RSSI_SMOOTHING 4
+#define RSSI_SCALE 8
+
+typedef struct {
+	bool used;
+	bool seen;           // Found by the last scan.
+	bool tried;          // Selected since the last scan.
+	uint8_t network;
+	uint8_t bssid[6];
+	uint8_t channel;
+	int8_t rssi;         // RSSI given by the last scan.
+	uint8_t failures;    // Recent failures.
+	uint32_t failure_ms; // Time of the last failure.
+} candidate_t;
+
+static roaming_network_t networks[ROAMING_MAX_NETWORKS];
+static uint8_t network_count;
+
+static candidate_t candidates[ROAMING_MAX_CANDIDATES];
+
+// Candidate selected last, -1 if none.
+static int8_t current;
+static bool connected;
+static int32_t rssi_scaled;
+static bool scanned;
+static uint32_t last_scan_ms;
+static uint8_t scan_backoff;
+
+// A roam was decided, and its interruption has not ended yet.
+static bool roaming;
+static bool path_down;
+static uint64_t down_us;
+
+static roaming_stats_t stats;
+
+static int16_t score(const candidate_t *candidate, uint32_t now_ms) {
+
+	uint32_t forgotten = (now_ms - candidate->failure_ms) / FAILURE_DECAY_MS;
+	uint32_t failures = candidate->failures > forgotten ? candidate->failures - forgotten : 0;
+	if (failures > MAX_PENALIZED_FAILURES) {
+		failures = MAX_PENALIZED_FAILURES;
+	}
+	return candidate->rssi - (int16_t)failures * FAILURE_PENALTY_DB;
+
+}
+
+static void add_failure(candidate_t *candidate, uint32_t now_ms) {
+
+	if (candidate->failures < UINT8_MAX) {
+		candidate->failures++;
+	}
+	candidate->failure_ms = now_ms;
+
+}
+
+/**
+ * Returns true if entry a must be replaced before entry b: free entries
+ * first, then entries not seen by the last scan, then the weakest ones.
+ */
+static bool replace_before(const candidate_t *a, const candidate_t *b) {
+
+	if (a->used != b->used) {
+		return !a->used;
+	}
+	if (a->seen != b->seen) {
+		return !a->seen;
+	}
+	return a->rssi < b->rssi;
+
+}
+
+static void fill_target(int8_t index, roaming_target_t *target) {
+
+	const candidate_t *candidate = &candidates[index];
+	target->ssid = networks[candidate->network].ssid;
+	target->password = networks[candidate->network].password;
+	memcpy(target->bssid, candidate->bssid, sizeof(target->bssid));
+	target->channel = candidate->channel;
+	target->rssi = candidate->rssi;
+
+}
+
+void roaming_init(const roaming_network_t *network_list, uint8_t count) {
+
+	network_count = 0;
+	for (uint8_t i = 0; i < count && network_count < ROAMING_MAX_NETWORKS; i++) {
+		if (network_list[i].ssid == NULL || network_list[i].ssid[0] == '\0') {
+			continue;
+		}
+		networks[network_count] = network_list[i];
+		network_count++;
+	}
+	memset(candidates, 0, sizeof(candidates));
+	current = -1;
+	connected = false;
+	scanned = false;
+	roaming = false;
+	path_down = false;
+	memset(&stats, 0, sizeof(roaming_stats_t));
+	latency_stats_reset(&stats.roam_interruption);
+	latency_stats_reset(&stats.loss_interruption);
+
+}
+
+uint8_t roaming_network_count(void) {
+	return network_count;
+}
+
+void roaming_scan_begin(void) {
+
+	stats.scans++;
+	for (uint8_t i = 0; i < ROAMING_MAX_CANDIDATES; i++) {
+		candidates[i].seen = false;
+		candidates[i].tried = false;
+	}
+
+}
+
+void roaming_scan_result(const char *ssid, const uint8_t *bssid, uint8_t channel,
+		                 int8_t rssi) {
+
+	uint8_t network;
+	for (network = 0; network < network_count; network++) {
+		if (strcmp(ssid, networks[network].ssid) == 0) {
+			break;
+		}
+	}
+	if (network == network_count) {
+		return;
+	}
+	// Known candidate, or entry to be replaced. The current candidate is
+	// never replaced.
+	int8_t index = -1;
+	int8_t victim = -1;
+	for (uint8_t i = 0; i < ROAMING_MAX_CANDIDATES; i++) {
+		if (candidates[i].used && memcmp(candidates[i].bssid, bssid, 6) == 0) {
+			index = i;
+			break;
+		}
+		if (i != current && (victim < 0 || replace_before(&candidates[i], &candidates[victim]))) {
+			victim = i;
+		}
+	}
+	if (index < 0) {
+		// An entry seen by this scan is replaced only by a stronger one.
+		if (victim < 0 ||
+			(candidates[victim].used && candidates[victim].seen &&
+			 candidates[victim].rssi >= rssi)) {
+			return;
+		}
+		index = victim;
+		memset(&candidates[index], 0, sizeof(candidate_t));
+		candidates[index].used = true;
+		memcpy(candidates[index].bssid, bssid, 6);
+	}
+	candidate_t *candidate = &candidates[index];
+	candidate->seen = true;
+	candidate->network = network;
+	candidate->channel = channel;
+	candidate->rssi = rssi;
+
+}
+
+bool roaming_select(uint32_t now_ms, roaming_target_t *target) {
+
+	int8_t best = -1;
+	for (uint8_t i = 0; i < ROAMING_MAX_CANDIDATES; i++) {
+		const candidate_t *candidate = &candidates[i];
+		if (!candidate->used || !candidate->seen || candidate->tried) {
+			continue;
+		}
+		if (best < 0 || score(candidate, now_ms) > score(&candidates[best], now_ms)) {
+			best = i;
+		}
+	}
+	if (best < 0) {
+		return false;
+	}
+	candidates[best].tried = true;
+	current = best;
+	connected = false;
+	stats.connects++;
+	fill_target(best, target);
+	return true;
+
+}
+
+void roaming_connect_failed(uint32_t now_ms) {
+
+	stats.failures++;
+	if (current >= 0) {
+		add_failure(&candidates[current], now_ms);
+	}
+	connected = false;
+
+}
+
+void roaming_connected(void) {
+
+	if (current < 0) {
+		return;
+	}
+	candidates[current].failures = 0;
+	connected = true;
+	scanned = false;
+	scan_backoff = 0;
+	rssi_scaled = candidates[current].rssi * RSSI_SCALE;
+	stats.rssi = candidates[current].rssi;
+
+}
+
+bool roaming_rssi_sample(int8_t rssi, uint32_t now_ms) {
+
+	if (!connected) {
+		return false;
+	}
+	rssi_scaled += (rssi * RSSI_SCALE - rssi_scaled) / RSSI_SMOOTHING;
+	stats.rssi = (int8_t)(rssi_scaled / RSSI_SCALE);
+	if (rssi_scaled >= THRESHOLD_DBM * RSSI_SCALE) {
+		return false;
+	}
+	if (scanned && now_ms - last_scan_ms < ((uint32_t)SCAN_INTERVAL_MS << scan_backoff)) {
+		return false;
+	}
+	scanned = true;
+	last_scan_ms = now_ms;
+	stats.background_scans++;
+	return true;
+
+}
+
+bool roaming_should_roam(uint32_t now_ms, roaming_target_t *target) {
+
+	if (!connected || current < 0) {
+		return false;
+	}
+	int8_t best = -1;
+	for (uint8_t i = 0; i < ROAMING_MAX_CANDIDATES; i++) {
+		const candidate_t *candidate = &candidates[i];
+		if (i == current || !candidate->used || !candidate->seen) {
+			continue;
+		}
+		if (best < 0 || score(candidate, now_ms) > score(&candidates[best], now_ms)) {
+			best = i;
+		}
+	}
+	if (best < 0 ||
+		score(&candidates[best], now_ms) * RSSI_SCALE < rssi_scaled + HYSTERESIS_DB * RSSI_SCALE) {
+		if (scan_backoff < MAX_SCAN_BACKOFF) {
+			scan_backoff++;
+		}
+		return false;
+	}
+	candidates[best].tried = true;
+	current = best;
+	connected = false;
+	roaming = true;
+	stats.roams++;
+	stats.connects++;
+	fill_target(best, target);
+	return true;
+
+}
+
+void roaming_link_lost(uint32_t now_ms) {
+
+	if (!connected) {
+		return;
+	}
+	stats.losses++;
+	add_failure(&candidates[current], now_ms);
+	connected = false;
+
+}
+
+void roaming_data_path_down(uint64_t now_us) {
+
+	if (path_down) {
+		return;
+	}
+	path_down = true;
+	down_us = now_us;
+
+}
+
+void roaming_data_path_up(uint64_t now_us) {
+
+	if (!path_down) {
+		return;
+	}
+	uint64_t interruption_us = now_us - down_us;
+	if (interruption_us > UINT32_MAX) {
+		interruption_us = UINT32_MAX;
+	}
+	latency_stats_add(roaming ? &stats.roam_interruption : &stats.loss_interruption,
+			          (uint32_t)interruption_us);
+	roaming = false;
+	path_down = false;
+
+}
+
+void roaming_get_stats(roaming_stats_t *roaming_stats) {
+	*roaming_stats = stats;
+}
@@ -0,0 +1,140 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef MAIN_ROAMING_H_
+#define MAIN_ROAMING_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "latency_stats.h"
+
+// Access point selection and roaming.
+//
+// The device is given a list of networks (SSID and password). Scans
+// provide candidates: access points (BSSID and channel) of these networks,
+// with their RSSI. A candidate score is its scan RSSI, lowered by a penalty
+// for each recent failure on it (failed association or link loss). Failures
+// are forgotten over time, and a successful connection clears them.
+// Candidates not seen by the last scan are never selected.
+//
+// While connected, the RSSI of the access point is sampled periodically
+// and smoothed. When it falls below a threshold, a background scan is
+// requested, no more often than a given interval, which grows while scans
+// find nothing better. The device then roams to the best candidate if its
+// score exceeds the smoothed RSSI by a hysteresis margin, before the link
+// fails.
+//
+// This module is not thread safe: it must be used by one task only. It
+// does not depend on FreeRTOS or ESP-IDF, so that it can be used on host.
+
+// Maximum number of networks.
+#define ROAMING_MAX_NETWORKS 3
+
+// Maximum number of candidates.
+#define ROAMING_MAX_CANDIDATES 8
+
+typedef struct {
+	const char *ssid;       // Empty or NULL: entry not used.
+	const char *password;
+} roaming_network_t;
+
+// Access point to connect to.
+typedef struct {
+	const char *ssid;
+	const char *password;
+	uint8_t bssid[6];
+	uint8_t channel;
+	int8_t rssi;
+} roaming_target_t;
+
+typedef struct {
+	uint32_t scans;              // Scans completed.
+	uint32_t background_scans;   // Scans requested while connected.
+	uint32_t connects;           // Association attempts.
+	uint32_t failures;           // Failed associations.
+	uint32_t roams;              // Proactive roams.
+	uint32_t losses;             // Link losses.
+	int8_t rssi;                 // Smoothed RSSI of the current access point.
+	latency_stats_t roam_interruption;   // Data path down during a roam.
+	latency_stats_t loss_interruption;   // Data path down after a link loss.
+} roaming_stats_t;
+
+/**
+ * Sets the networks, and forgets all candidates. Networks with an empty
+ * SSID are ignored.
+ */
+void roaming_init(const roaming_network_t *networks, uint8_t network_count);
+
+/**
+ * Returns the number of networks in use.
+ */
+uint8_t roaming_network_count(void);
+
+/**
+ * Must be called before the results of a scan are given.
+ */
+void roaming_scan_begin(void);
+
+/**
+ * Gives one access point found by the scan. Access points of other
+ * networks are ignored.
+ */
+void roaming_scan_result(const char *ssid, const uint8_t *bssid, uint8_t channel,
+		                 int8_t rssi);
+
+/**
+ * Provides the best candidate not tried since the last scan, and marks it
+ * as tried. Returns false if there is none.
+ */
+bool roaming_select(uint32_t now_ms, roaming_target_t *target);
+
+/**
+ * Reports the result of the association with the last selected candidate.
+ */
+void roaming_connect_failed(uint32_t now_ms);
+void roaming_connected(void);
+
+/**
+ * Processes an RSSI sample of the current access point. Returns true if
+ * a background scan must be started.
+ */
+bool roaming_rssi_sample(int8_t rssi, uint32_t now_ms);
+
+/**
+ * To be called once the results of a background scan have been given.
+ * Returns true, and provides the target, if the device must roam.
+ */
+bool roaming_should_roam(uint32_t now_ms, roaming_target_t *target);
+
+/**
+ * Reports that the link with the current access point has been lost.
+ */
+void roaming_link_lost(uint32_t now_ms);
+
+/**
+ * Report the times the data path goes down and up again. The interruption
+ * is accounted as a roam interruption if a roam was decided in between.
+ */
+void roaming_data_path_down(uint64_t now_us);
+void roaming_data_path_up(uint64_t now_us);
+
+void roaming_get_stats(roaming_stats_t *stats);
+
+#endif /* MAIN_ROAMING_H_ */
@@ -18,22 +18,35 @@
  */
 
 #include <stdbool.h>
-#include <string.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
-#include "freertos/timers.h"
 
 #include "esp_log.h"
+#include "esp_timer.h"
 
+#include "frame.h"
+#include "fsm_timer.h"
+#include "link_state.h"
 #include "messages.h"
+#include "record.h"
+#include "seq_store.h"
+#include "trace.h"
 #include "utilities.h"
 #include "connect_wifi.h"
-
-#define INPUT_QUEUE_LENGTH 3
+#include "send_datagram.h"
 
 #define SEND_PERIOD_MS 30000
 
+// Stream identifier of the datagrams sent by this task.
+#define SD_STREAM_ID 0
+
+#ifdef CONFIG_UDPSENDER_SD_RELIABLE
+#define SD_RELIABLE true
+#else
+#define SD_RELIABLE false
+#endif
+
 static const char *TAG = "SD";
 
 // Input queue.
@@ -47,20 +60,74 @@ typedef enum {
 
 static state_t current_state;
 
-static void send_and_wait(uint8_t *payload_data, uint8_t payload_length,
-		                  TimerHandle_t timer,
-						  state_t *current_state) {
+static fsm_timer_t timer;
 
+// The datagram payload is an sd_counter record (see record_schemas.h). It
+// follows the room reserved for the datagram header.
+#define PAYLOAD_LENGTH RECORD_SD_COUNTER_LENGTH
+static uint8_t datagram[FRAME_HEADER_LENGTH + PAYLOAD_LENGTH];
+static record_sd_counter_t record;
+
+/**
+ * Completion of a datagram, called by connect_wifi task. Datagrams dropped,
+ * rejected or expired are reported with a SD__SEND_ERROR message.
+ */
+static void datagram_done(void *arg, const cw_datagram_completion_t *completion) {
+
+	if (completion->status != CW_DATAGRAM_DROPPED &&
+		completion->status != CW_DATAGRAM_REJECTED &&
+		completion->status != CW_DATAGRAM_EXPIRED) {
+		return;
+	}
 	message_t message_to_send;
+	message_to_send.message = SD__SEND_ERROR;
+	message_to_send.sd_send_error.completion = *completion;
+	BaseType_t rs = send_to_queue(sd_input_queue, &message_to_send, TAG);
+	if (rs != pdTRUE) {
+		ESP_LOGE(TAG, "datagram_done - error on sending message to myself - %d", rs);
+	}
 
-	// Delay used for xTicksToWait when calling xTimerStart().
-	const TickType_t delay_500ms = pdMS_TO_TICKS(500);
+}
+
+/**
+ * datagram holds the room reserved for the header, followed by the payload.
+ */
+static void send_and_wait(uint8_t *datagram, uint32_t payload_length,
+		                  fsm_timer_t *timer,
+						  state_t *current_state) {
+
+	message_t message_to_send;
 
 	// Send the send_datagram to connect_wifi task.
 	message_to_send.message = CW_SEND_DATAGRAM;
-	message_to_send.cw_send_datagram.payload = payload_data;
-	message_to_send.cw_send_datagram.payload_length = payload_length;
-	BaseType_t fr_rs = send_to_queue(cw_input_queue, &message_to_send, TAG);
+	message_to_send.cw_send_datagram.unnumbered = false;
+	if (SD_RELIABLE) {
+		// The reliable delivery mode adds its own header.
+		message_to_send.cw_send_datagram.payload = &datagram[FRAME_HEADER_LENGTH];
+		message_to_send.cw_send_datagram.payload_length = payload_length;
+	} else {
+		uint32_t seq = 0;
+		if (!seq_store_next(SD_STREAM_ID, &seq)) {
+			message_to_send.cw_send_datagram.unnumbered = true;
+		}
+		frame_header_t header = {
+			.version = FRAME_VERSION,
+			.type = FRAME_DATA,
+			.flags = 0,
+			.stream_id = SD_STREAM_ID,
+			.seq = seq,
+		};
+		frame_encode_header(&header, datagram);
+		message_to_send.cw_send_datagram.payload = datagram;
+		message_to_send.cw_send_datagram.payload_length = FRAME_HEADER_LENGTH + payload_length;
+	}
+	message_to_send.cw_send_datagram.stream_id = SD_STREAM_ID;
+	message_to_send.cw_send_datagram.reliable = SD_RELIABLE;
+	message_to_send.cw_send_datagram.traffic_class = TRAFFIC_CLASS_NORMAL;
+	// The payload is never modified while the datagram is waiting.
+	message_to_send.cw_send_datagram.done = datagram_done;
+	message_to_send.cw_send_datagram.done_arg = NULL;
+	BaseType_t fr_rs = connect_wifi_send_datagram(&message_to_send, TAG);
 	if (fr_rs != pdTRUE) {
 		ESP_LOGE(TAG, "Error on sending message to connect_wifi - %d", fr_rs);
 		send_error(SD_QUEUE_ERR, TAG);
@@ -69,9 +136,10 @@ static void send_and_wait(uint8_t *payload_data, uint8_t payload_length,
 	}
 	// Then, wait for some time before sending another datagram. The event handler
 	// called at timer timeout will send the CW_TIMEOUT message.
-	fr_rs = xTimerStart(timer, delay_500ms);
+	trace_record(TRACE_TIMER_START, SD_TIMEOUT, SEND_PERIOD_MS);
+	fr_rs = fsm_timer_start(timer);
 	if (fr_rs != pdPASS) {
-		ESP_LOGE(TAG, "Error from xTimerStart: %d", fr_rs);
+		ESP_LOGE(TAG, "Error from fsm_timer_start: %d", fr_rs);
 		send_error(SD_TIMER_ERR, TAG);
 		*current_state = SD_ERROR_ST;
 		return;
@@ -79,155 +147,201 @@ static void send_and_wait(uint8_t *payload_data, uint8_t payload_length,
 
 }
 
-/**
- * Event handler for the timer.
- */
-static void timer_handler(TimerHandle_t timer) {
-
-	message_t message_to_send;
-	message_to_send.message = SD_TIMEOUT;
-	message_to_send.no_payload.nothing = 0;
-    BaseType_t rs = send_to_queue(sd_input_queue, &message_to_send, TAG);
-    if (rs != pdTRUE) {
-    	ESP_LOGE(TAG, "timer_handler - error on sending message to myself - %d", rs);
-    }
-
-}
-
-void send_datagram_task(void *pvParameters) {
-
-	// Delay used for xTicksToWait when calling xQueueReceive().
-	const TickType_t delay_60s = pdMS_TO_TICKS(60000);
-
-	// The datagram payload is an ASCII message containing a counter.
-	char payload_data[] = "This is message 000.";
-	const uint8_t payload_counter_index = 16;
-	const uint8_t payload_length = strlen(payload_data);
-	uint8_t payload_counter;
-
-	TimerHandle_t timer = NULL;
-
-	BaseType_t fr_rs;  // Return status for FreeRTOS calls.
-
-	message_t received_message;
+void send_datagram_init(void) {
 
 	current_state = SD_WAIT_CONN_STATUS_ST;
 
-	// Create our input queue, even if we are in error state.
-	sd_input_queue = xQueueCreate(INPUT_QUEUE_LENGTH, sizeof(message_t));
-	if (sd_input_queue == 0) {
-		ESP_LOGE(TAG, "Error from xQueueCreate");
-		send_error(SD_INIT_ERR, TAG);
-		current_state = SD_ERROR_ST;
+	// Create our input queue, even if we are in error state. In reactor
+	// mode, the input queue is shared, and already created.
+	if (sd_input_queue == NULL) {
+		sd_input_queue = xQueueCreate(SD_INPUT_QUEUE_LENGTH, sizeof(message_t));
+		if (sd_input_queue == 0) {
+			ESP_LOGE(TAG, "Error from xQueueCreate");
+			send_error(SD_INIT_ERR, TAG);
+			current_state = SD_ERROR_ST;
+		}
 	}
 
 	// Create the timer we'll use to send a datagram on a periodic basis.
 	if (current_state != SD_ERROR_ST) {
-		uint8_t timerID = 0;
-		timer = xTimerCreate("SD_TIMER",
-				pdMS_TO_TICKS(SEND_PERIOD_MS),
-				pdFALSE,  // uxAutoReload.
-				&timerID,
-				timer_handler);
-		if (timer == NULL) {
-			ESP_LOGE(TAG, "Error from xTimerCreate");
+		if (!fsm_timer_init(&timer, "SD_TIMER", SD_TIMEOUT, &sd_input_queue,
+				            SEND_PERIOD_MS, false, TAG)) {
+			ESP_LOGE(TAG, "Error from fsm_timer_init");
 			send_error(SD_INIT_ERR, TAG);
 			current_state = SD_ERROR_ST;
 		}
 	}
 
-	payload_counter = 0;
+	// The timer also runs while disconnected, so that a lost
+	// SD_CONNECTION_STATUS message is made up for by the link state.
+	if (current_state != SD_ERROR_ST) {
+		BaseType_t fr_rs = fsm_timer_start(&timer);
+		if (fr_rs != pdPASS) {
+			ESP_LOGE(TAG, "Error from fsm_timer_start: %d", fr_rs);
+			send_error(SD_TIMER_ERR, TAG);
+			current_state = SD_ERROR_ST;
+		}
+	}
 
-	while (true) {
+	record.counter = 0;
 
-		// Wait for an incoming message.
-		fr_rs = xQueueReceive(sd_input_queue, &received_message, delay_60s);
-		if (fr_rs != pdTRUE) {
-			// Timeout. Go back to receive.
-			ESP_LOGI(TAG, "Queue receive timeout");
-			continue;
-		}
+}
+
+void send_datagram_handle(const message_t *received_message) {
+
+	// A datagram was not sent, whatever the state. It is not sent again:
+	// the next period sends a new one.
+	if (received_message->message == SD__SEND_ERROR) {
+		const cw_datagram_completion_t *completion =
+				&received_message->sd_send_error.completion;
+		ESP_LOGW(TAG, "Datagram %u not sent - status: %d, queue wait us: %u, send time us: %u",
+				 completion->handle, completion->status,
+				 (uint32_t)(completion->dequeued_us - completion->enqueued_us),
+				 (uint32_t)(completion->completed_us - completion->dequeued_us));
+		return;
+	}
+
+	state_t previous_state = current_state;
 
-		switch (current_state) {
+	switch (current_state) {
 
-		case SD_WAIT_CONN_STATUS_ST:
-			if (received_message.message == SD_TIMEOUT) {
-				// When the connection to the Internet is lost while we were already connected,
-				// we go back to this state, and we can receive the timeout message related to
-				// the send datagram period.
+	case SD_WAIT_CONN_STATUS_ST:
+		if (received_message->message == SD_TIMEOUT) {
+			// Either the connection to the Internet was lost while we were already
+			// connected, or we are still waiting for it. If its SD_CONNECTION_STATUS
+			// message was lost, the link state tells it.
+			if (!link_state_is_connected()) {
 				ESP_LOGI(TAG, "SD_WAIT_CONN_STATUS_ST - timeout");
+				BaseType_t fr_rs = fsm_timer_start(&timer);
+				if (fr_rs != pdPASS) {
+					ESP_LOGE(TAG, "Error from fsm_timer_start: %d", fr_rs);
+					send_error(SD_TIMER_ERR, TAG);
+					current_state = SD_ERROR_ST;
+				}
 				break;
 			}
-			if (received_message.message == SD_CONNECTION_STATUS) {
-				bool connected = received_message.sd_connection_status.connected;
-				ESP_LOGI(TAG, "SD_WAIT_CONN_STATUS_ST - connection_status message received - %d",
-						(uint8_t)connected);
-				if (connected) {
-					ESP_LOGI(TAG, "SD_WAIT_SEND_PERIOD_ST - sending a datagram - %03d", payload_counter);
-					send_and_wait((uint8_t *)payload_data, payload_length,
-							      timer, &current_state);
-					if (current_state == SD_ERROR_ST) {
-						break;
-					}
-					current_state = SD_WAIT_SEND_PERIOD_ST;
-					break;
-				}
-				// At this stage, the message contains disconnected. Ignore it.
-				ESP_LOGE(TAG, "SD_WAIT_CONN_STATUS_T - unexpected disconnected connection_status message");
+			ESP_LOGW(TAG, "SD_WAIT_CONN_STATUS_ST - connected, no connection_status message received");
+			ESP_LOGI(TAG, "SD_WAIT_CONN_STATUS_ST - sending a datagram - %u", record.counter);
+			record.uptime_ms = (uint32_t)(esp_timer_get_time() / 1000);
+			record_sd_counter_encode(&record, &datagram[FRAME_HEADER_LENGTH]);
+			send_and_wait(datagram, PAYLOAD_LENGTH,
+					      &timer, &current_state);
+			if (current_state == SD_ERROR_ST) {
 				break;
 			}
-			ESP_LOGE(TAG, "SD_WAIT_CONN_STATUS_T - unexpected message received: %d",
-					 received_message.message);
+			current_state = SD_WAIT_SEND_PERIOD_ST;
 			break;
-
-		case SD_WAIT_SEND_PERIOD_ST:
-			if (received_message.message == SD_TIMEOUT) {
-				// End of wait period, send a new datagram.
-				if (payload_counter == 0xff) {
-					payload_counter = 0;
-				} else {
-					payload_counter++;
-				}
-				ESP_LOGI(TAG, "SD_WAIT_SEND_PERIOD_ST - sending a datagram - %03d", payload_counter);
-				payload_data[payload_counter_index + 2] = (uint8_t)'0' + payload_counter % 10;
-				payload_data[payload_counter_index + 1] = (uint8_t)'0' + (payload_counter / 10) % 10;
-				payload_data[payload_counter_index] = (uint8_t)'0' + (payload_counter / 100) % 10;
-				send_and_wait((uint8_t *)payload_data, payload_length,
-						      timer, &current_state);
+		}
+		if (received_message->message == SD_CONNECTION_STATUS) {
+			bool connected = received_message->sd_connection_status.connected;
+			ESP_LOGI(TAG, "SD_WAIT_CONN_STATUS_ST - connection_status message received - %d",
+					(uint8_t)connected);
+			if (connected) {
+				ESP_LOGI(TAG, "SD_WAIT_SEND_PERIOD_ST - sending a datagram - %u", record.counter);
+				record.uptime_ms = (uint32_t)(esp_timer_get_time() / 1000);
+				record_sd_counter_encode(&record, &datagram[FRAME_HEADER_LENGTH]);
+				send_and_wait(datagram, PAYLOAD_LENGTH,
+						      &timer, &current_state);
 				if (current_state == SD_ERROR_ST) {
 					break;
 				}
+				current_state = SD_WAIT_SEND_PERIOD_ST;
 				break;
-				// Stay in same state.
 			}
-			if (received_message.message == SD_CONNECTION_STATUS) {
-				bool connected = received_message.sd_connection_status.connected;
-				ESP_LOGI(TAG, "SD_WAIT_CONN_STATUS_ST - connection_status message received - %d",
-									(uint8_t)connected);
-				if (!connected) {
-					// Connection to the Internet is no more available.
-					current_state = SD_WAIT_CONN_STATUS_ST;
+			// At this stage, the message contains disconnected. The link state
+			// may have told it already. Ignore it.
+			ESP_LOGI(TAG, "SD_WAIT_CONN_STATUS_T - disconnected connection_status message ignored");
+			break;
+		}
+		ESP_LOGE(TAG, "SD_WAIT_CONN_STATUS_T - unexpected message received: %d",
+				 received_message->message);
+		break;
+
+	case SD_WAIT_SEND_PERIOD_ST:
+		if (received_message->message == SD_TIMEOUT) {
+			if (!link_state_is_connected()) {
+				// The disconnected connection_status message was lost, or is late.
+				ESP_LOGW(TAG, "SD_WAIT_SEND_PERIOD_ST - disconnected, no connection_status message received");
+				BaseType_t fr_rs = fsm_timer_start(&timer);
+				if (fr_rs != pdPASS) {
+					ESP_LOGE(TAG, "Error from fsm_timer_start: %d", fr_rs);
+					send_error(SD_TIMER_ERR, TAG);
+					current_state = SD_ERROR_ST;
 					break;
 				}
-				// At this stage, the message contains connected. Ignore it.
-				ESP_LOGE(TAG, "SD_WAIT_SEND_PERIOD_ST - unexpected connected conntection_status message.");
+				current_state = SD_WAIT_CONN_STATUS_ST;
+				break;
+			}
+			// End of wait period, send a new datagram.
+			record.counter++;
+			record.uptime_ms = (uint32_t)(esp_timer_get_time() / 1000);
+			ESP_LOGI(TAG, "SD_WAIT_SEND_PERIOD_ST - sending a datagram - %u", record.counter);
+			record_sd_counter_encode(&record, &datagram[FRAME_HEADER_LENGTH]);
+			send_and_wait(datagram, PAYLOAD_LENGTH,
+					      &timer, &current_state);
+			if (current_state == SD_ERROR_ST) {
 				break;
 			}
-			// At this stage, unexpected message.
-			ESP_LOGE(TAG, "SD_WAIT_SEND_PERIOD_ST - unexpected message received: %d",
-					received_message.message);
 			break;
-
-		case SD_ERROR_ST:
-			// Once we enter this state, we stay in it.
-			ESP_LOGI(TAG, "SD_ERROR_ST");
+			// Stay in same state.
+		}
+		if (received_message->message == SD_CONNECTION_STATUS) {
+			bool connected = received_message->sd_connection_status.connected;
+			ESP_LOGI(TAG, "SD_WAIT_CONN_STATUS_ST - connection_status message received - %d",
+								(uint8_t)connected);
+			if (!connected) {
+				// Connection to the Internet is no more available.
+				current_state = SD_WAIT_CONN_STATUS_ST;
+				break;
+			}
+			// At this stage, the message contains connected. The link state
+			// may have told it already. Ignore it.
+			ESP_LOGI(TAG, "SD_WAIT_SEND_PERIOD_ST - connected connection_status message ignored");
 			break;
+		}
+		// At this stage, unexpected message.
+		ESP_LOGE(TAG, "SD_WAIT_SEND_PERIOD_ST - unexpected message received: %d",
+				received_message->message);
+		break;
+
+	case SD_ERROR_ST:
+		// Once we enter this state, we stay in it.
+		ESP_LOGI(TAG, "SD_ERROR_ST");
+		break;
+
+	default:
+		ESP_LOGE(TAG, "Unknown state: %d", current_state);
+		send_error(SD_UKNOWN_STATE_ERR, TAG);
+		current_state = SD_ERROR_ST;
+	}
 
-		default:
-			ESP_LOGE(TAG, "Unknown state: %d", current_state);
-			send_error(SD_UKNOWN_STATE_ERR, TAG);
-			current_state = SD_ERROR_ST;
+	trace_state(previous_state, current_state);
+
+}
+
+void send_datagram_task(void *pvParameters) {
+
+	// Delay used for xTicksToWait when calling xQueueReceive().
+	const TickType_t delay_60s = pdMS_TO_TICKS(60000);
+
+	BaseType_t fr_rs;  // Return status for FreeRTOS calls.
+
+	message_t received_message;
+
+	send_datagram_init();
+
+	while (true) {
+
+		// Wait for an incoming message.
+		trace_record(TRACE_WAIT, 0, 0);
+		fr_rs = xQueueReceive(sd_input_queue, &received_message, delay_60s);
+		if (fr_rs != pdTRUE) {
+			// Timeout. Go back to receive.
+			ESP_LOGI(TAG, "Queue receive timeout");
+			continue;
 		}
+		trace_record(TRACE_DEQUEUE, received_message.message, 0);
+		send_datagram_handle(&received_message);
 
 	}
 
@@ -21,8 +21,20 @@
 
 #include "freertos/queue.h"
 
+#include "messages.h"
+
+#define SD_INPUT_QUEUE_LENGTH 3
+
 extern QueueHandle_t sd_input_queue;
 
 void send_datagram_task(void *pvParameters);
 
+/**
+ * State machine of send_datagram_task(), for the reactor (see reactor.h).
+ * send_datagram_init() creates sd_input_queue, unless it has already been
+ * set.
+ */
+void send_datagram_init(void);
+void send_datagram_handle(const message_t *received_message);
+
 #endif /* MAIN_SEND_DATAGRAM_H_ */
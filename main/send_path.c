@@ -0,0 +1,363 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lwip/errno.h"
+
+#include "esp_log.h"
+
+#include "send_path.h"
+#include "trace.h"
+
+#define RETRY_DEPTH CONFIG_UDPSENDER_SEND_RETRY_DEPTH
+#define RETRY_MAX_DATAGRAM CONFIG_UDPSENDER_SEND_RETRY_MAX_DATAGRAM
+
+#define BACKOFF_MIN_MS 5
+#define BACKOFF_MAX_MS 320
+
+// A queued datagram is dropped after this number of failed attempts.
+#define MAX_ATTEMPTS 8
+
+static const char *TAG = "SP";
+
+typedef struct {
+	uint16_t length;
+	uint8_t attempts;
+	uint32_t tag;
+	uint8_t data[RETRY_MAX_DATAGRAM];
+} retry_entry_t;
+
+typedef struct {
+	retry_entry_t entries[RETRY_DEPTH];
+	uint8_t head;
+	uint8_t count;
+} retry_queue_t;
+
+// Transport, NULL when not open.
+static const transport_t *transport = NULL;
+
+// Retry queues, one per traffic class. Transport buffers are shared by all
+// classes: so is the backoff.
+static retry_queue_t retry_queues[TRAFFIC_CLASS_COUNT];
+static uint8_t retry_count;  // All classes.
+static uint32_t next_retry_ms;
+static uint32_t backoff_ms;
+
+static send_path_stats_t stats;
+
+static send_path_done_t done_callback = NULL;
+
+static bool is_transient(int error) {
+	return error == ENOMEM || error == ENOBUFS ||
+		   error == EAGAIN || error == EWOULDBLOCK;
+}
+
+static void count_error(int error) {
+
+	send_path_errno_t index;
+	switch (error) {
+	case ENOMEM:
+		index = SEND_PATH_ERRNO_ENOMEM;
+		break;
+	case ENOBUFS:
+		index = SEND_PATH_ERRNO_ENOBUFS;
+		break;
+	case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+	case EWOULDBLOCK:
+#endif
+		index = SEND_PATH_ERRNO_EAGAIN;
+		break;
+	case EHOSTUNREACH:
+		index = SEND_PATH_ERRNO_EHOSTUNREACH;
+		break;
+	default:
+		index = SEND_PATH_ERRNO_OTHER;
+	}
+	stats.errors[index]++;
+
+}
+
+/**
+ * Removes the datagram at the head of the queue, once sent or dropped.
+ */
+static void pop_retry(retry_queue_t *queue, bool sent) {
+
+	uint32_t tag = queue->entries[queue->head].tag;
+	if (tag != 0 && done_callback != NULL) {
+		done_callback(tag, sent);
+	}
+	queue->head = (queue->head + 1) % RETRY_DEPTH;
+	queue->count--;
+	retry_count--;
+
+}
+
+static send_path_rs_t push_retry(const uint8_t *data, uint16_t length,
+		                         traffic_class_t traffic_class, uint32_t tag,
+								 uint32_t now_ms) {
+
+	retry_queue_t *queue = &retry_queues[traffic_class];
+	if (queue->count == RETRY_DEPTH || length > RETRY_MAX_DATAGRAM) {
+		stats.dropped++;
+		return SEND_PATH_DROPPED;
+	}
+	if (retry_count == 0) {
+		backoff_ms = BACKOFF_MIN_MS;
+		next_retry_ms = now_ms + backoff_ms;
+	}
+	retry_entry_t *entry = &queue->entries[(queue->head + queue->count) % RETRY_DEPTH];
+	memcpy(entry->data, data, length);
+	entry->length = length;
+	entry->attempts = 0;
+	entry->tag = tag;
+	queue->count++;
+	retry_count++;
+	stats.queued++;
+	return SEND_PATH_QUEUED;
+
+}
+
+void send_path_init(send_path_done_t done) {
+
+	done_callback = done;
+	transport = NULL;
+	memset(retry_queues, 0, sizeof(retry_queues));
+	retry_count = 0;
+	backoff_ms = BACKOFF_MIN_MS;
+	memset(&stats, 0, sizeof(stats));
+
+}
+
+bool send_path_open(void) {
+
+	send_path_close();
+
+	const transport_t *selected = transport_get();
+	if (!selected->open()) {
+		return false;
+	}
+	transport = selected;
+	stats.opened++;
+	return true;
+
+}
+
+void send_path_close(void) {
+
+	if (transport != NULL) {
+		transport->close();
+		transport = NULL;
+	}
+
+}
+
+const transport_t *send_path_transport(void) {
+	return transport;
+}
+
+/**
+ * Calls send() for a datagram of the given traffic class, and records the
+ * call in the trace. errno is preserved.
+ */
+static int traced_send(const uint8_t *data, uint16_t length,
+		               traffic_class_t traffic_class) {
+
+	if (length > transport->max_length) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	trace_record(TRACE_SEND_BEGIN, length, 0);
+	int rs = transport->send(data, length, traffic_class);
+	int error = errno;
+	trace_record(TRACE_SEND_END, length, rs < 0 ? (uint32_t)error : 0);
+	errno = error;
+	return rs;
+
+}
+
+/**
+ * Sends the datagrams queued for a class, at most RETRY_DEPTH, in one
+ * batch. Returns the number of datagrams sent, or -1 if the first one could
+ * not be sent. errno is preserved.
+ */
+static int traced_send_queue(const retry_queue_t *queue, traffic_class_t traffic_class) {
+
+	transport_datagram_t batch[RETRY_DEPTH];
+	uint32_t bytes = 0;
+	for (uint8_t i = 0; i < queue->count; i++) {
+		const retry_entry_t *entry = &queue->entries[(queue->head + i) % RETRY_DEPTH];
+		batch[i].data = entry->data;
+		batch[i].length = entry->length;
+		bytes += entry->length;
+	}
+	// Entries are not longer than the transport accepts.
+	uint16_t traced_bytes = bytes > UINT16_MAX ? UINT16_MAX : bytes;
+	trace_record(TRACE_SEND_BEGIN, traced_bytes, 0);
+	int rs = transport->send_batch(batch, queue->count, traffic_class);
+	int error = errno;
+	trace_record(TRACE_SEND_END, traced_bytes, rs < 0 ? (uint32_t)error : 0);
+	errno = error;
+	return rs;
+
+}
+
+void send_path_flush(uint32_t now_ms) {
+
+	if (transport == NULL || retry_count == 0) {
+		return;
+	}
+	if ((int32_t)(now_ms - next_retry_ms) < 0) {
+		return;
+	}
+	// Highest priority class first.
+	for (traffic_class_t tc = 0; tc < TRAFFIC_CLASS_COUNT; tc++) {
+		retry_queue_t *queue = &retry_queues[tc];
+		while (queue->count > 0) {
+			int rs = traced_send_queue(queue, tc);
+			int error = errno;
+			for (int i = 0; i < rs; i++) {
+				stats.retried++;
+				backoff_ms = BACKOFF_MIN_MS;
+				pop_retry(queue, true);
+			}
+			if (queue->count == 0) {
+				break;
+			}
+			// The batch stopped at an error, on the datagram now at the
+			// head of the queue.
+			retry_entry_t *entry = &queue->entries[queue->head];
+			count_error(error);
+			if (!is_transient(error)) {
+				ESP_LOGE(TAG, "Error from send: %d", error);
+				stats.dropped++;
+				pop_retry(queue, false);
+				continue;
+			}
+			entry->attempts++;
+			if (entry->attempts >= MAX_ATTEMPTS) {
+				ESP_LOGW(TAG, "Queued datagram dropped after %d attempts", entry->attempts);
+				stats.dropped++;
+				pop_retry(queue, false);
+			}
+			// The transport is still short of buffers: back off.
+			backoff_ms *= 2;
+			if (backoff_ms > BACKOFF_MAX_MS) {
+				backoff_ms = BACKOFF_MAX_MS;
+			}
+			next_retry_ms = now_ms + backoff_ms;
+			return;
+		}
+	}
+
+}
+
+send_path_rs_t send_path_send(const uint8_t *data, uint16_t length,
+		                      traffic_class_t traffic_class, bool retry,
+							  uint32_t tag, uint32_t now_ms) {
+
+	if (transport == NULL) {
+		if (retry) {
+			return push_retry(data, length, traffic_class, tag, now_ms);
+		}
+		stats.dropped++;
+		return SEND_PATH_DROPPED;
+	}
+	send_path_flush(now_ms);
+	if (retry && retry_queues[traffic_class].count > 0) {
+		// Keep datagram order within the class.
+		return push_retry(data, length, traffic_class, tag, now_ms);
+	}
+	int rs = traced_send(data, length, traffic_class);
+	if (rs >= 0) {
+		stats.sent++;
+		return SEND_PATH_OK;
+	}
+	int error = errno;
+	count_error(error);
+	if (retry && is_transient(error)) {
+		return push_retry(data, length, traffic_class, tag, now_ms);
+	}
+	ESP_LOGE(TAG, "Error from send: %d", error);
+	stats.dropped++;
+	return SEND_PATH_DROPPED;
+
+}
+
+send_path_rs_t send_path_try_send(const uint8_t *data, uint16_t length,
+		                          traffic_class_t traffic_class, uint8_t attempts,
+								  uint32_t now_ms, uint32_t *delay_ms) {
+
+	if (transport == NULL) {
+		stats.dropped++;
+		return SEND_PATH_DROPPED;
+	}
+	send_path_flush(now_ms);
+	if (retry_queues[traffic_class].count > 0) {
+		// Keep datagram order within the class.
+		send_path_next_deadline(now_ms, delay_ms);
+		stats.delayed++;
+		return SEND_PATH_BUSY;
+	}
+	int rs = traced_send(data, length, traffic_class);
+	if (rs >= 0) {
+		stats.sent++;
+		backoff_ms = BACKOFF_MIN_MS;
+		return SEND_PATH_OK;
+	}
+	int error = errno;
+	count_error(error);
+	if (!is_transient(error)) {
+		ESP_LOGE(TAG, "Error from send: %d", error);
+		stats.dropped++;
+		return SEND_PATH_DROPPED;
+	}
+	if (attempts + 1 >= MAX_ATTEMPTS) {
+		ESP_LOGW(TAG, "Datagram dropped after %d attempts", attempts + 1);
+		stats.dropped++;
+		return SEND_PATH_DROPPED;
+	}
+	// Same backoff as the retry queues, the buffers being shared.
+	*delay_ms = backoff_ms;
+	backoff_ms *= 2;
+	if (backoff_ms > BACKOFF_MAX_MS) {
+		backoff_ms = BACKOFF_MAX_MS;
+	}
+	stats.delayed++;
+	return SEND_PATH_BUSY;
+
+}
+
+bool send_path_next_deadline(uint32_t now_ms, uint32_t *delay_ms) {
+
+	if (retry_count == 0) {
+		return false;
+	}
+	int32_t delay = (int32_t)(next_retry_ms - now_ms);
+	*delay_ms = delay > 0 ? (uint32_t)delay : 0;
+	return true;
+
+}
+
+void send_path_get_stats(send_path_stats_t *stats_out) {
+	*stats_out = stats;
+}
@@ -0,0 +1,143 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef MAIN_SEND_PATH_H_
+#define MAIN_SEND_PATH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "traffic_class.h"
+#include "transport.h"
+
+// Send path of the connect_wifi task.
+//
+// Datagrams are sent with the selected transport (see transport.h). A
+// transport which needs an IP address must be (re)opened each time a new
+// one is obtained. When the transport is short of buffers (ENOMEM,
+// ENOBUFS, EAGAIN), the datagram is copied into a short retry queue, and
+// sent again later with an exponential backoff. Queued datagrams of a
+// class are sent again in one batch.
+//
+// Every traffic class has its own retry queue, queues of higher priority
+// classes being flushed first.
+//
+// Datagrams longer than the queue entries, such as the fragments of a
+// record, are sent with send_path_try_send() instead: on a transient error
+// they are not queued, the caller sends them again after the backoff delay.
+//
+// A datagram can be given a tag. When a queued datagram with a tag is
+// eventually sent or dropped, the callback given to send_path_init() is
+// called with its tag.
+//
+// This module is not thread safe: it must be used by one task only.
+
+typedef enum {
+	SEND_PATH_OK,
+	SEND_PATH_QUEUED,    // Transient error, datagram queued for retry.
+	SEND_PATH_DROPPED,   // Datagram dropped.
+	SEND_PATH_BUSY,      // Transient error, datagram to be sent again (send_path_try_send()).
+} send_path_rs_t;
+
+// Error counters, by errno value.
+typedef enum {
+	SEND_PATH_ERRNO_ENOMEM,
+	SEND_PATH_ERRNO_ENOBUFS,
+	SEND_PATH_ERRNO_EAGAIN,
+	SEND_PATH_ERRNO_EHOSTUNREACH,
+	SEND_PATH_ERRNO_OTHER,
+	SEND_PATH_ERRNO_COUNT
+} send_path_errno_t;
+
+typedef struct {
+	uint32_t sent;          // Datagrams accepted by the transport.
+	uint32_t queued;        // Datagrams put in the retry queue.
+	uint32_t retried;       // Queued datagrams accepted by the transport.
+	uint32_t dropped;       // Datagrams dropped.
+	uint32_t delayed;       // Attempts of send_path_try_send() to be made again.
+	uint32_t opened;        // Transport (re)openings.
+	uint32_t errors[SEND_PATH_ERRNO_COUNT];
+} send_path_stats_t;
+
+// Called when a queued datagram with a non-zero tag leaves the retry
+// queue: sent is false if it has been dropped.
+typedef void (*send_path_done_t)(uint32_t tag, bool sent);
+
+/**
+ * Resets the send path. Must be called once, before any other function.
+ * done can be NULL.
+ */
+void send_path_init(send_path_done_t done);
+
+/**
+ * Closes the transport, if open, and opens the selected one. Queued
+ * datagrams are kept. Returns false on error.
+ */
+bool send_path_open(void);
+
+/**
+ * Closes the transport, if open. Queued datagrams are kept.
+ */
+void send_path_close(void);
+
+/**
+ * Returns the transport, or NULL if it is not open.
+ */
+const transport_t *send_path_transport(void);
+
+/**
+ * Sends a datagram of the given traffic class. If retry is true and the
+ * transport reports a transient error, the datagram is copied into the retry queue
+ * of the class, with its tag (0: none). Datagrams of the class queued
+ * before are sent first, in order to keep datagram order.
+ */
+send_path_rs_t send_path_send(const uint8_t *data, uint16_t length,
+		                      traffic_class_t traffic_class, bool retry,
+							  uint32_t tag, uint32_t now_ms);
+
+/**
+ * Sends a datagram of the given traffic class, without using the retry
+ * queue. Datagrams of the class queued before are sent first. If they could
+ * not all be sent, or if the transport reports a transient error, returns
+ * SEND_PATH_BUSY and provides the delay before the next attempt: the caller
+ * keeps the datagram, and calls the function again with attempts, the
+ * number of attempts already made, increased by one. The datagram is
+ * dropped after as many attempts as a queued one.
+ */
+send_path_rs_t send_path_try_send(const uint8_t *data, uint16_t length,
+		                          traffic_class_t traffic_class, uint8_t attempts,
+								  uint32_t now_ms, uint32_t *delay_ms);
+
+/**
+ * Sends queued datagrams whose backoff delay elapsed.
+ */
+void send_path_flush(uint32_t now_ms);
+
+/**
+ * Returns false if the retry queue is empty. Otherwise, returns true and
+ * provides the delay before the next retry.
+ */
+bool send_path_next_deadline(uint32_t now_ms, uint32_t *delay_ms);
+
+/**
+ * Provides the counters of the send path.
+ */
+void send_path_get_stats(send_path_stats_t *stats);
+
+#endif /* MAIN_SEND_PATH_H_ */
@@ -0,0 +1,185 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+#include "seq_store.h"
+
+#define BLOCK CONFIG_UDPSENDER_SEQ_BLOCK
+
+#define NAMESPACE "seq_store"
+#define EPOCH_KEY "epoch"
+
+static const char *TAG = "SQ";
+
+typedef struct {
+	bool loaded;
+	bool failed;
+	uint32_t next;
+	uint32_t ceiling;    // First value not reserved in NVS.
+} counter_t;
+
+// Indexed by stream identifier. Each entry is written by the task using
+// the stream only.
+static counter_t counters[256];
+
+static bool opened = false;
+static nvs_handle_t handle;
+
+static seq_store_stats_t stats;
+
+/**
+ * Writes value and commits it. Returns false on error.
+ */
+static bool store(const char *key, uint32_t value) {
+
+	if (!opened) {
+		return false;
+	}
+	esp_err_t esp_rs = nvs_set_u32(handle, key, value);
+	if (esp_rs == ESP_OK) {
+		esp_rs = nvs_commit(handle);
+	}
+	if (esp_rs != ESP_OK) {
+		ESP_LOGE(TAG, "Error on writing %s: %d", key, esp_rs);
+		stats.errors++;
+		return false;
+	}
+	return true;
+
+}
+
+/**
+ * Marks the stream as failed.
+ */
+static void fail(uint8_t stream_id, counter_t *counter) {
+
+	ESP_LOGE(TAG, "Stream %u failed, its datagrams are not numbered anymore", stream_id);
+	counter->failed = true;
+	stats.failed++;
+
+}
+
+/**
+ * Makes sure that the next value of the stream is reserved. Returns NULL if
+ * the stream has failed.
+ */
+static counter_t *reserve(uint8_t stream_id) {
+
+	counter_t *counter = &counters[stream_id];
+	if (counter->failed) {
+		return NULL;
+	}
+	char key[8];
+	snprintf(key, sizeof(key), "s%u", stream_id);
+	if (!counter->loaded) {
+		if (!opened) {
+			fail(stream_id, counter);
+			return NULL;
+		}
+		uint32_t ceiling = 0;
+		esp_err_t esp_rs = nvs_get_u32(handle, key, &ceiling);
+		if (esp_rs != ESP_OK && esp_rs != ESP_ERR_NVS_NOT_FOUND) {
+			ESP_LOGE(TAG, "Error on reading %s: %d", key, esp_rs);
+			stats.errors++;
+			fail(stream_id, counter);
+			return NULL;
+		}
+		counter->loaded = true;
+		counter->next = ceiling;
+		counter->ceiling = ceiling;
+	}
+	if (counter->next == counter->ceiling) {
+		// A block not written could be used again after a restart.
+		if (!store(key, counter->ceiling + BLOCK)) {
+			fail(stream_id, counter);
+			return NULL;
+		}
+		counter->ceiling += BLOCK;
+		stats.reservations++;
+	}
+	return counter;
+
+}
+
+void seq_store_init(void) {
+
+	esp_err_t esp_rs = nvs_open(NAMESPACE, NVS_READWRITE, &handle);
+	if (esp_rs != ESP_OK) {
+		ESP_LOGE(TAG, "Error from nvs_open: %d", esp_rs);
+		stats.errors++;
+		return;
+	}
+	opened = true;
+	uint32_t epoch = 0;
+	esp_rs = nvs_get_u32(handle, EPOCH_KEY, &epoch);
+	if (esp_rs != ESP_OK && esp_rs != ESP_ERR_NVS_NOT_FOUND) {
+		// The epoch is left unknown rather than restarted at 1.
+		ESP_LOGE(TAG, "Error on reading %s: %d", EPOCH_KEY, esp_rs);
+		stats.errors++;
+		return;
+	}
+	// 0 is kept for "unknown".
+	epoch++;
+	if (epoch == 0) {
+		epoch = 1;
+	}
+	if (store(EPOCH_KEY, epoch)) {
+		stats.epoch = epoch;
+	}
+	ESP_LOGI(TAG, "Boot epoch: %u", stats.epoch);
+
+}
+
+uint32_t seq_store_epoch(void) {
+	return stats.epoch;
+}
+
+bool seq_store_peek(uint8_t stream_id, uint32_t *seq) {
+
+	counter_t *counter = reserve(stream_id);
+	if (counter == NULL) {
+		return false;
+	}
+	*seq = counter->next;
+	return true;
+
+}
+
+bool seq_store_next(uint8_t stream_id, uint32_t *seq) {
+
+	counter_t *counter = reserve(stream_id);
+	if (counter == NULL) {
+		return false;
+	}
+	*seq = counter->next++;
+	return true;
+
+}
+
+void seq_store_get_stats(seq_store_stats_t *store_stats) {
+	*store_stats = stats;
+}
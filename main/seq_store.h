@@ -0,0 +1,79 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef MAIN_SEQ_STORE_H_
+#define MAIN_SEQ_STORE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Sequence numbers that survive restarts.
+//
+// Every stream has a 32-bit sequence counter. Writing it to NVS for every
+// datagram would wear the flash out and stall the send path, so blocks of
+// CONFIG_UDPSENDER_SEQ_BLOCK values are reserved instead: the ceiling of
+// the block is written to NVS before its first value is used, and after a
+// restart the counter resumes from the stored ceiling. At most one block of
+// values is skipped per restart, and a value is never used twice.
+//
+// A stream fails when its ceiling cannot be read from NVS, or a new block
+// cannot be written: the values it would give out may have been used
+// before the restart, and sequence numbers also make AEAD nonces. A failed
+// stream gives out no value until the next restart.
+//
+// The boot epoch, the number of times seq_store_init() has been called
+// since NVS was erased, is written into the header of every frame, so that
+// the remote host can tell a restart from duplicated or replayed frames.
+//
+// Each stream must be used by one task only. NVS must be initialized
+// before seq_store_init() is called.
+
+typedef struct {
+	uint32_t epoch;
+	uint32_t reservations;  // Blocks reserved.
+	uint32_t errors;        // NVS errors.
+	uint32_t failed;        // Failed streams.
+} seq_store_stats_t;
+
+/**
+ * Opens the NVS namespace and increments the boot epoch. On error, the
+ * epoch is 0, and if NVS could not be opened, every stream fails.
+ */
+void seq_store_init(void);
+
+/**
+ * Returns the boot epoch.
+ */
+uint32_t seq_store_epoch(void);
+
+/**
+ * Gets the next sequence number of the stream, without using it. May write
+ * to NVS. Returns false if the stream has failed.
+ */
+bool seq_store_peek(uint8_t stream_id, uint32_t *seq);
+
+/**
+ * Gets the next sequence number of the stream, and uses it. May write to
+ * NVS. Returns false if the stream has failed.
+ */
+bool seq_store_next(uint8_t stream_id, uint32_t *seq);
+
+void seq_store_get_stats(seq_store_stats_t *stats);
+
+#endif /* MAIN_SEQ_STORE_H_ */
@@ -20,29 +20,32 @@
 #include <stdbool.h>
 
 #include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "freertos/timers.h"
+#include "freertos/queue.h"
 
 #include "esp_log.h"
 
 #include "messages.h"
 #include "connect_wifi.h"
+#include "fsm_timer.h"
+#include "supervisor.h"
+#include "trace.h"
 #include "utilities.h"
 
-#define INPUT_QUEUE_LENGTH 3
-
 #define WAIT_TASKS_DELAY_MS 1000
 
 static const char *TAG = "SV";
 
-// SSID and password of the access point to be used must
+// SSIDs and passwords of the networks to be used must
 // be configured by the configuration utility before building
-// the application.
-static char *SSID = CONFIG_UDPSENDER_WIFI_SSID;
-static char *PASSWORD = CONFIG_UDPSENDER_WIFI_PASSWORD;
+// the application. Networks with an empty SSID are ignored.
+static const roaming_network_t NETWORKS[] = {
+	{ CONFIG_UDPSENDER_WIFI_SSID, CONFIG_UDPSENDER_WIFI_PASSWORD },
+	{ CONFIG_UDPSENDER_WIFI_SSID_2, CONFIG_UDPSENDER_WIFI_PASSWORD_2 },
+	{ CONFIG_UDPSENDER_WIFI_SSID_3, CONFIG_UDPSENDER_WIFI_PASSWORD_3 },
+};
 
 // Input queue.
-QueueHandle_t sv_input_queue;
+QueueHandle_t sv_input_queue = NULL;
 
 typedef enum {
 	SV_WAIT_DELAY_ST,
@@ -52,118 +55,134 @@ typedef enum {
 
 static state_t current_state;
 
-/**
- * Event handler for the timer.
- */
-static void timer_handler(TimerHandle_t timer) {
+#if CONFIG_UDPSENDER_TRACE_DUMP_ON_ERROR
+// The trace is dumped on the first internal error only.
+static bool trace_dumped = false;
+#endif
 
-	message_t message_to_send;
-	message_to_send.message = SV_TIMEOUT;
-	message_to_send.no_payload.nothing = 0;
-    BaseType_t rs = send_to_queue(sv_input_queue, &message_to_send, TAG);
-    if (rs != pdTRUE) {
-    	ESP_LOGE(TAG, "timer_handler - error on sending message to myself - %d", rs);
-    }
+static fsm_timer_t timer;
 
-}
-
-void supervisor_task(void *pvParameters) {
-
-	const TickType_t ready_delay = pdMS_TO_TICKS(WAIT_TASKS_DELAY_MS);
-
-	const TickType_t delay_60s = pdMS_TO_TICKS(60000);
-
-	const TickType_t block_delay = pdMS_TO_TICKS(500);
-
-	TimerHandle_t timer = NULL;
-
-	message_t received_message;
-	message_t message_to_send;
+void supervisor_init(void) {
 
 	BaseType_t fr_rs;   // Return status for FreeRTOS calls.
-	BaseType_t esp_rs;  // Return status for ESP-IDF calls.
 
 	current_state = SV_WAIT_DELAY_ST;
 
-	sv_input_queue = xQueueCreate(INPUT_QUEUE_LENGTH, sizeof(message_t));
-	if (sv_input_queue == 0) {
-		ESP_LOGE(TAG, "Error from xQueueCreate");
-		current_state = SV_ERROR_ST;
+	// In reactor mode, the input queue is shared, and already created.
+	if (sv_input_queue == NULL) {
+		sv_input_queue = xQueueCreate(SV_INPUT_QUEUE_LENGTH, sizeof(message_t));
+		if (sv_input_queue == 0) {
+			ESP_LOGE(TAG, "Error from xQueueCreate");
+			current_state = SV_ERROR_ST;
+		}
 	}
 
 	if (current_state != SV_ERROR_ST) {
 		// Prepare to wait for some time, for other tasks to be created by FreeRTOS.
-		uint8_t timerID = 0;
-		timer = xTimerCreate("SV_TIMER",
-				ready_delay,
-				pdFALSE,  // uxAutoReload.
-				&timerID,
-				timer_handler);
-		if (timer == NULL) {
-			ESP_LOGE(TAG, "Error from xTimerCreate");
+		if (!fsm_timer_init(&timer, "SV_TIMER", SV_TIMEOUT, &sv_input_queue,
+				            WAIT_TASKS_DELAY_MS, false, TAG)) {
+			ESP_LOGE(TAG, "Error from fsm_timer_init");
 			current_state = SV_ERROR_ST;
 		}
 	}
 	if (current_state != SV_ERROR_ST) {
-		fr_rs = xTimerStart(timer, block_delay);
+		trace_record(TRACE_TIMER_START, SV_TIMEOUT, WAIT_TASKS_DELAY_MS);
+		fr_rs = fsm_timer_start(&timer);
 		if (fr_rs != pdPASS) {
-			ESP_LOGE(TAG, "Error from xTimerStart: %d", fr_rs);
+			ESP_LOGE(TAG, "Error from fsm_timer_start: %d", fr_rs);
 			current_state = SV_ERROR_ST;
 		}
 	}
 
-	while (true) {
+}
 
-		// Wait for an incoming message.
-		fr_rs = xQueueReceive(sv_input_queue, &received_message, delay_60s);
-		if (fr_rs != pdTRUE) {
-			// Timeout. Go back to receive.
-			ESP_LOGI(TAG, "Queue receive timeout");
-			continue;
-		}
+void supervisor_handle(const message_t *received_message) {
 
-		switch (current_state) {
+	message_t message_to_send;
 
-		case SV_WAIT_DELAY_ST:
-			if (received_message.message != SV_TIMEOUT) {
-				// Unexpected message, ignore it, stay in this state.
-				ESP_LOGE(TAG, "SV_WAIT_DELAY_ST - unexpected message received: %d", received_message.message);
-				break;
-			}
-			// Tell connect_wifi task to connect to the AP.
-			message_to_send.message = CW_CONNECT;
-			message_to_send.cw_connect.ssid = SSID;
-			message_to_send.cw_connect.password = PASSWORD;
-			// Send message to connect_wifi task. Send operation
-			// performs a copy. We do not wait (xTicksToWait = 0).
-			esp_rs = send_to_queue(cw_input_queue, &message_to_send, TAG);
-			if (esp_rs != pdTRUE) {
-				ESP_LOGE(TAG, "Error on sending message to connect_wifi - %d", esp_rs);
-				current_state = SV_ERROR_ST;
-				break;
-			}
-			// At this stage, message sent to connect_wifi task.
-			ESP_LOGI(TAG, "Message sent");
-			current_state = SV_WAIT_MSG_ST;
-			break;
+	BaseType_t esp_rs;  // Return status for ESP-IDF calls.
 
-		case SV_WAIT_MSG_ST:
-			if (received_message.message == SV_INTERNAL_ERROR) {
-				ESP_LOGI(TAG, "SV_INTERNAL_ERROR message: %d", received_message.sv_internal_error.error);
-				break;
+	state_t previous_state = current_state;
+
+	switch (current_state) {
+
+	case SV_WAIT_DELAY_ST:
+		if (received_message->message != SV_TIMEOUT) {
+			// Unexpected message, ignore it, stay in this state.
+			ESP_LOGE(TAG, "SV_WAIT_DELAY_ST - unexpected message received: %d", received_message->message);
+			break;
+		}
+		// Tell connect_wifi task to connect to the AP.
+		message_to_send.message = CW_CONNECT;
+		message_to_send.cw_connect.networks = NETWORKS;
+		message_to_send.cw_connect.network_count = sizeof(NETWORKS) / sizeof(NETWORKS[0]);
+		// Send message to connect_wifi task. Send operation
+		// performs a copy. We do not wait (xTicksToWait = 0).
+		esp_rs = send_to_queue(cw_input_queue, &message_to_send, TAG);
+		if (esp_rs != pdTRUE) {
+			ESP_LOGE(TAG, "Error on sending message to connect_wifi - %d", esp_rs);
+			current_state = SV_ERROR_ST;
+			break;
+		}
+		// At this stage, message sent to connect_wifi task.
+		ESP_LOGI(TAG, "Message sent");
+		current_state = SV_WAIT_MSG_ST;
+		break;
+
+	case SV_WAIT_MSG_ST:
+		if (received_message->message == SV_INTERNAL_ERROR) {
+			ESP_LOGI(TAG, "SV_INTERNAL_ERROR message: %d", received_message->sv_internal_error.error);
+#if CONFIG_UDPSENDER_TRACE_DUMP_ON_ERROR
+			if (!trace_dumped) {
+				trace_dumped = true;
+				trace_dump_uart();
+				// And over UDP, if connected.
+				message_to_send.message = CW_TRACE_DUMP;
+				message_to_send.no_payload.nothing = 0;
+				send_to_queue(cw_input_queue, &message_to_send, TAG);
 			}
-			ESP_LOGE(TAG, "SV_WAIT_MSG_ST - unexpected message received: %d", received_message.message);
+#endif
 			break;
+		}
+		ESP_LOGE(TAG, "SV_WAIT_MSG_ST - unexpected message received: %d", received_message->message);
+		break;
 
-		case SV_ERROR_ST:
-			// This state is entered after the occurrence of an internal error,
-			// not of an error from another task.
-			break;
+	case SV_ERROR_ST:
+		// This state is entered after the occurrence of an internal error,
+		// not of an error from another task.
+		break;
 
-		default:
-			ESP_LOGE(TAG, "Unknown state: %d", current_state);
-			current_state = SV_ERROR_ST;
+	default:
+		ESP_LOGE(TAG, "Unknown state: %d", current_state);
+		current_state = SV_ERROR_ST;
+	}
+
+	trace_state(previous_state, current_state);
+
+}
+
+void supervisor_task(void *pvParameters) {
+
+	const TickType_t delay_60s = pdMS_TO_TICKS(60000);
+
+	message_t received_message;
+
+	BaseType_t fr_rs;   // Return status for FreeRTOS calls.
+
+	supervisor_init();
+
+	while (true) {
+
+		// Wait for an incoming message.
+		trace_record(TRACE_WAIT, 0, 0);
+		fr_rs = xQueueReceive(sv_input_queue, &received_message, delay_60s);
+		if (fr_rs != pdTRUE) {
+			// Timeout. Go back to receive.
+			ESP_LOGI(TAG, "Queue receive timeout");
+			continue;
 		}
+		trace_record(TRACE_DEQUEUE, received_message.message, 0);
+		supervisor_handle(&received_message);
 
 	}
 
@@ -20,8 +20,23 @@
 #ifndef MAIN_SUPERVISOR_H_
 #define MAIN_SUPERVISOR_H_
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "messages.h"
+
+#define SV_INPUT_QUEUE_LENGTH 3
+
 extern QueueHandle_t sv_input_queue;
 
 void supervisor_task(void *pvParameters);
 
+/**
+ * State machine of supervisor_task(), for the reactor (see reactor.h).
+ * supervisor_init() creates sv_input_queue, unless it has already been
+ * set.
+ */
+void supervisor_init(void);
+void supervisor_handle(const message_t *received_message);
+
 #endif /* MAIN_SUPERVISOR_H_ */
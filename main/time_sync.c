@@ -0,0 +1,201 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "frame.h"
+#include "time_sync.h"
+
+// Number of samples kept by the filter.
+#define FILTER_LENGTH 8
+
+// Samples whose delay is greater than the lowest one plus this margin, or
+// plus half the lowest one if greater, are not used for the drift.
+#define DELAY_MARGIN_US 200
+
+// Minimum time span of the samples used for the drift.
+#define MIN_DRIFT_SPAN_US 1000000
+
+typedef struct {
+	uint64_t local_us;   // Local time of the sample (t4).
+	int64_t offset_us;
+	uint32_t delay_us;
+} sample_t;
+
+static sample_t samples[FILTER_LENGTH];
+static uint8_t sample_count;
+static uint8_t next_sample;
+
+static bool pending;
+static uint64_t pending_t1_us;
+
+static bool synced;
+// Estimate: offset at local time ref_local_us, and drift.
+static uint64_t ref_local_us;
+static int64_t ref_offset_us;
+static double drift;
+
+static time_sync_stats_t stats;
+
+/**
+ * Updates the estimate from the samples of the filter.
+ */
+static void update_estimate(void) {
+
+	// Lowest delay sample.
+	uint8_t best = 0;
+	for (uint8_t i = 1; i < sample_count; i++) {
+		if (samples[i].delay_us < samples[best].delay_us) {
+			best = i;
+		}
+	}
+	ref_local_us = samples[best].local_us;
+	ref_offset_us = samples[best].offset_us;
+	stats.delay_us = samples[best].delay_us;
+
+	// Least squares fit of offset versus local time, over good samples.
+	uint32_t margin = samples[best].delay_us / 2;
+	if (margin < DELAY_MARGIN_US) {
+		margin = DELAY_MARGIN_US;
+	}
+	uint32_t max_delay = samples[best].delay_us + margin;
+	uint8_t n = 0;
+	double sum_x = 0, sum_y = 0;
+	uint64_t min_x = UINT64_MAX, max_x = 0;
+	for (uint8_t i = 0; i < sample_count; i++) {
+		if (samples[i].delay_us > max_delay) {
+			continue;
+		}
+		// Relative to the reference, to keep precision.
+		sum_x += (double)(int64_t)(samples[i].local_us - ref_local_us);
+		sum_y += (double)(samples[i].offset_us - ref_offset_us);
+		if (samples[i].local_us < min_x) {
+			min_x = samples[i].local_us;
+		}
+		if (samples[i].local_us > max_x) {
+			max_x = samples[i].local_us;
+		}
+		n++;
+	}
+	if (n < 3 || max_x - min_x < MIN_DRIFT_SPAN_US) {
+		// Keep previous drift.
+		return;
+	}
+	double mean_x = sum_x / n;
+	double mean_y = sum_y / n;
+	double sxx = 0, sxy = 0;
+	for (uint8_t i = 0; i < sample_count; i++) {
+		if (samples[i].delay_us > max_delay) {
+			continue;
+		}
+		double dx = (double)(int64_t)(samples[i].local_us - ref_local_us) - mean_x;
+		double dy = (double)(samples[i].offset_us - ref_offset_us) - mean_y;
+		sxx += dx * dx;
+		sxy += dx * dy;
+	}
+	if (sxx > 0) {
+		drift = sxy / sxx;
+		// The offset decreases when the local clock is fast.
+		stats.drift_ppb = (int32_t)(-drift * 1e9);
+	}
+
+}
+
+void time_sync_init(void) {
+
+	sample_count = 0;
+	next_sample = 0;
+	pending = false;
+	synced = false;
+	drift = 0;
+	memset(&stats, 0, sizeof(stats));
+
+}
+
+void time_sync_request_sent(uint64_t t1_us) {
+
+	pending = true;
+	pending_t1_us = t1_us;
+	stats.requests++;
+
+}
+
+bool time_sync_is_pending(void) {
+	return pending;
+}
+
+bool time_sync_process_response(const uint8_t *buffer, uint16_t length,
+		                        uint64_t t4_us) {
+
+	frame_time_response_t response;
+	if (!frame_decode_time_response(buffer, length, &response)) {
+		return false;
+	}
+	if (!pending || response.t1_us != pending_t1_us) {
+		// Late or duplicated response.
+		stats.rejected++;
+		return false;
+	}
+	pending = false;
+	if (t4_us < response.t1_us || response.t3_us < response.t2_us) {
+		stats.rejected++;
+		return false;
+	}
+	uint64_t round_trip = t4_us - response.t1_us;
+	uint64_t remote_processing = response.t3_us - response.t2_us;
+	uint32_t delay = round_trip > remote_processing ?
+			         (uint32_t)(round_trip - remote_processing) : 0;
+	int64_t offset = ((int64_t)(response.t2_us - response.t1_us) +
+			          (int64_t)(response.t3_us - t4_us)) / 2;
+
+	samples[next_sample].local_us = t4_us;
+	samples[next_sample].offset_us = offset;
+	samples[next_sample].delay_us = delay;
+	next_sample = (next_sample + 1) % FILTER_LENGTH;
+	if (sample_count < FILTER_LENGTH) {
+		sample_count++;
+	}
+	stats.samples++;
+	stats.offset_us = offset;
+	update_estimate();
+	synced = true;
+	return true;
+
+}
+
+bool time_sync_is_synced(void) {
+	return synced;
+}
+
+uint64_t time_sync_to_remote(uint64_t local_us) {
+
+	if (!synced) {
+		return local_us;
+	}
+	int64_t elapsed = (int64_t)(local_us - ref_local_us);
+	int64_t offset = ref_offset_us + (int64_t)(drift * (double)elapsed);
+	return local_us + offset;
+
+}
+
+void time_sync_get_stats(time_sync_stats_t *stats_out) {
+	*stats_out = stats;
+}
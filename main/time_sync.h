@@ -0,0 +1,85 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef MAIN_TIME_SYNC_H_
+#define MAIN_TIME_SYNC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Time synchronization with the remote host.
+//
+// A time request frame is a header whose timestamp is the local time t1 of
+// its transmission. The remote host answers with a time response frame
+// holding t1, its time of reception t2 and its time of transmission t3. The
+// local time of reception of the response is t4. Every exchange gives an
+// offset sample ((t2 - t1) + (t3 - t4)) / 2 and a round-trip delay
+// (t4 - t1) - (t3 - t2).
+//
+// The offset is taken from the sample with the lowest delay among the last
+// ones, as the NTP clock filter does. The drift is the slope of a least
+// squares fit over the samples whose delay is close to the lowest one.
+//
+// This module is not thread safe: it must be used by one task only. It
+// does not depend on FreeRTOS, so that it can be used by host tools.
+
+// Stream identifier used by time request frames.
+#define TIME_SYNC_STREAM_ID 0xff
+
+typedef struct {
+	uint32_t requests;     // Time requests sent.
+	uint32_t samples;      // Valid time responses received.
+	uint32_t rejected;     // Unexpected or invalid time responses.
+	int64_t offset_us;     // Remote time minus local time, at last sample.
+	int32_t drift_ppb;     // Local clock drift, in parts per billion.
+	uint32_t delay_us;     // Lowest round-trip delay of the filter.
+} time_sync_stats_t;
+
+void time_sync_init(void);
+
+/**
+ * Records the transmission of a time request, at local time t1_us.
+ */
+void time_sync_request_sent(uint64_t t1_us);
+
+/**
+ * Returns true if a time request is waiting for its response.
+ */
+bool time_sync_is_pending(void);
+
+/**
+ * Processes a received frame. Returns false if it is not the time response
+ * to the pending request.
+ */
+bool time_sync_process_response(const uint8_t *buffer, uint16_t length,
+		                        uint64_t t4_us);
+
+/**
+ * Returns true once at least one time response has been processed.
+ */
+bool time_sync_is_synced(void);
+
+/**
+ * Converts a local time into remote time. Returns local_us if not synced.
+ */
+uint64_t time_sync_to_remote(uint64_t local_us);
+
+void time_sync_get_stats(time_sync_stats_t *stats);
+
+#endif /* MAIN_TIME_SYNC_H_ */
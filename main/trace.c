@@ -0,0 +1,219 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "xtensa/hal.h"
+
+#include "frame.h"
+#include "trace.h"
+
+#if CONFIG_UDPSENDER_TRACE
+
+#define RECORDS CONFIG_UDPSENDER_TRACE_RECORDS
+#define MAX_TASKS 15
+
+// Bytes per line of a console dump.
+#define UART_LINE_LENGTH 32
+
+typedef struct {
+	uint32_t ccount;
+	uint32_t tick;
+	uint8_t task;
+	uint8_t type;
+	uint16_t a;
+	uint32_t b;
+} record_t;
+
+typedef struct {
+	TaskHandle_t handle;
+	char name[TRACE_TASK_NAME_LENGTH + 1];
+} task_t;
+
+static record_t records[RECORDS];
+// Free running.
+static uint32_t head = 0;
+static uint32_t frozen = 0;
+
+static task_t tasks[MAX_TASKS];
+static uint8_t task_count = 0;
+
+static portMUX_TYPE trace_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Returns the identifier of the calling task, registering it if needed.
+ * Must be called with trace_lock taken.
+ */
+static uint8_t task_id(void) {
+
+	TaskHandle_t handle = xTaskGetCurrentTaskHandle();
+	for (uint8_t i = 0; i < task_count; i++) {
+		if (tasks[i].handle == handle) {
+			return i + 1;
+		}
+	}
+	if (task_count == MAX_TASKS) {
+		return TRACE_UNKNOWN_TASK;
+	}
+	tasks[task_count].handle = handle;
+	strncpy(tasks[task_count].name, pcTaskGetTaskName(handle), TRACE_TASK_NAME_LENGTH);
+	tasks[task_count].name[TRACE_TASK_NAME_LENGTH] = '\0';
+	task_count++;
+	return task_count;
+
+}
+
+void trace_record(trace_type_t type, uint16_t a, uint32_t b) {
+
+	portENTER_CRITICAL(&trace_lock);
+	if (frozen == 0) {
+		record_t *record = &records[head % RECORDS];
+		record->ccount = xthal_get_ccount();
+		record->tick = xTaskGetTickCount();
+		record->task = task_id();
+		record->type = (uint8_t)type;
+		record->a = a;
+		record->b = b;
+		head++;
+	}
+	portEXIT_CRITICAL(&trace_lock);
+
+}
+
+void trace_freeze(void) {
+
+	portENTER_CRITICAL(&trace_lock);
+	frozen++;
+	portEXIT_CRITICAL(&trace_lock);
+
+}
+
+void trace_unfreeze(void) {
+
+	portENTER_CRITICAL(&trace_lock);
+	if (frozen > 0) {
+		frozen--;
+	}
+	portEXIT_CRITICAL(&trace_lock);
+
+}
+
+static uint32_t record_count(void) {
+	return head < RECORDS ? head : RECORDS;
+}
+
+uint32_t trace_dump_length(void) {
+
+	return TRACE_HEADER_LENGTH + task_count * TRACE_TASK_LENGTH +
+		   record_count() * TRACE_RECORD_LENGTH;
+
+}
+
+/**
+ * Writes the element of the dump starting at element_offset into element,
+ * and returns its length. Elements are the header, the tasks and the
+ * records.
+ */
+static uint16_t encode_element(uint32_t offset, uint8_t *element,
+		                       uint32_t *element_offset) {
+
+	uint32_t tasks_end = TRACE_HEADER_LENGTH + task_count * TRACE_TASK_LENGTH;
+
+	if (offset < TRACE_HEADER_LENGTH) {
+		*element_offset = 0;
+		memcpy(element, TRACE_MAGIC, 4);
+		element[4] = TRACE_VERSION;
+		element[5] = task_count;
+		frame_put_u16(&element[6], CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ);
+		frame_put_u16(&element[8], configTICK_RATE_HZ);
+		frame_put_u16(&element[10], 0);
+		frame_put_u32(&element[12], record_count());
+		return TRACE_HEADER_LENGTH;
+	}
+	if (offset < tasks_end) {
+		uint32_t index = (offset - TRACE_HEADER_LENGTH) / TRACE_TASK_LENGTH;
+		*element_offset = TRACE_HEADER_LENGTH + index * TRACE_TASK_LENGTH;
+		memset(element, 0, TRACE_TASK_LENGTH);
+		element[0] = (uint8_t)(index + 1);
+		memcpy(&element[1], tasks[index].name, strlen(tasks[index].name));
+		return TRACE_TASK_LENGTH;
+	}
+	uint32_t index = (offset - tasks_end) / TRACE_RECORD_LENGTH;
+	*element_offset = tasks_end + index * TRACE_RECORD_LENGTH;
+	// Oldest record first.
+	const record_t *record = &records[(head - record_count() + index) % RECORDS];
+	frame_put_u32(&element[0], record->ccount);
+	frame_put_u32(&element[4], record->tick);
+	element[8] = record->task;
+	element[9] = record->type;
+	frame_put_u16(&element[10], record->a);
+	frame_put_u32(&element[12], record->b);
+	return TRACE_RECORD_LENGTH;
+
+}
+
+uint16_t trace_dump_read(uint32_t offset, uint8_t *buffer, uint16_t length) {
+
+	uint32_t dump_length = trace_dump_length();
+	uint16_t copied = 0;
+	uint8_t element[TRACE_RECORD_LENGTH];
+
+	while (copied < length && offset < dump_length) {
+		uint32_t element_offset;
+		uint16_t element_length = encode_element(offset, element, &element_offset);
+		uint16_t skip = (uint16_t)(offset - element_offset);
+		uint16_t chunk = element_length - skip;
+		if (chunk > length - copied) {
+			chunk = length - copied;
+		}
+		memcpy(&buffer[copied], &element[skip], chunk);
+		copied += chunk;
+		offset += chunk;
+	}
+	return copied;
+
+}
+
+void trace_dump_uart(void) {
+
+	uint8_t line[UART_LINE_LENGTH];
+
+	trace_freeze();
+	uint32_t length = trace_dump_length();
+	printf("TRACE BEGIN %u\n", length);
+	for (uint32_t offset = 0; offset < length; offset += UART_LINE_LENGTH) {
+		uint16_t line_length = trace_dump_read(offset, line, UART_LINE_LENGTH);
+		printf("TRACE %08x ", offset);
+		for (uint16_t i = 0; i < line_length; i++) {
+			printf("%02x", line[i]);
+		}
+		printf("\n");
+	}
+	printf("TRACE END\n");
+	trace_unfreeze();
+
+}
+
+#endif
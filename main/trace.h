@@ -0,0 +1,95 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef MAIN_TRACE_H_
+#define MAIN_TRACE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#include "trace_format.h"
+
+// Trace recorder.
+//
+// Tasks record their activity in a RAM ring: message dequeues, state
+// transitions, timer starts and expirations, Wi-Fi events and sendto()
+// calls. Every record holds the CPU cycle counter, the tick count and an
+// identifier of the recording task. When the ring is full, the oldest
+// records are overwritten. Records are discarded while the trace is
+// frozen.
+//
+// The trace can be dumped on the console (hex lines, see
+// trace_dump_uart()) or over UDP (FRAME_TRACE frames sent by connect_wifi
+// task). host/trace_convert.c converts a dump into Chrome trace JSON.
+//
+// The cycle counters of the two cores are not synchronized, and cycles
+// are converted into time with the default CPU frequency: timestamps are
+// accurate to a few microseconds across tasks, to the cycle within a task
+// that does not migrate.
+
+#if CONFIG_UDPSENDER_TRACE
+
+/**
+ * Adds a record. Must be called from a task, not from an ISR.
+ */
+void trace_record(trace_type_t type, uint16_t a, uint32_t b);
+
+/**
+ * Stops and restarts recording. Calls can be nested.
+ */
+void trace_freeze(void);
+void trace_unfreeze(void);
+
+/**
+ * Returns the length of the dump, in bytes. The trace must be frozen.
+ */
+uint32_t trace_dump_length(void);
+
+/**
+ * Copies at most length bytes of the dump, starting from offset, into
+ * buffer. Returns the number of bytes copied. The trace must be frozen.
+ */
+uint16_t trace_dump_read(uint32_t offset, uint8_t *buffer, uint16_t length);
+
+/**
+ * Prints the dump on the console, between "TRACE BEGIN <length>" and
+ * "TRACE END" lines.
+ */
+void trace_dump_uart(void);
+
+#else
+
+static inline void trace_record(trace_type_t type, uint16_t a, uint32_t b) {}
+
+#endif
+
+/**
+ * Records a state transition, if there is one.
+ */
+static inline void trace_state(int previous_state, int current_state) {
+
+	if (current_state != previous_state) {
+		trace_record(TRACE_STATE, (uint16_t)current_state, (uint32_t)previous_state);
+	}
+
+}
+
+#endif /* MAIN_TRACE_H_ */
@@ -0,0 +1,80 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef MAIN_TRACE_FORMAT_H_
+#define MAIN_TRACE_FORMAT_H_
+
+// Trace dump format. All fields are in network byte order (big endian).
+//
+// A dump is a header, followed by the task table, followed by the records,
+// oldest first.
+//
+//  Header:
+//  0               4       5       6       8       10      12              16
+//  +---------------+-------+-------+-------+-------+-------+---------------+
+//  |  magic "UTRC" |version| tasks |CPU MHz|tick Hz|   0   |    records    |
+//  +---------------+-------+-------+-------+-------+-------+---------------+
+//
+//  Task:
+//  0       1                                                               16
+//  +-------+---------------------------------------------------------------+
+//  |  id   |                   name, NUL padded                            |
+//  +-------+---------------------------------------------------------------+
+//
+//  Record:
+//  0               4               8       9       10      12              16
+//  +---------------+---------------+-------+-------+-------+---------------+
+//  | cycle counter |  tick count   | task  | type  |   a   |       b       |
+//  +---------------+---------------+-------+-------+-------+---------------+
+//
+// The cycle counter wraps around every few seconds. The tick count tells
+// how many times it wrapped between two records.
+//
+// This file does not depend on FreeRTOS or ESP-IDF, so that it can be
+// used by host tools.
+
+#define TRACE_MAGIC "UTRC"
+#define TRACE_VERSION 1
+
+#define TRACE_HEADER_LENGTH 16
+#define TRACE_TASK_LENGTH 16
+#define TRACE_TASK_NAME_LENGTH (TRACE_TASK_LENGTH - 1)
+#define TRACE_RECORD_LENGTH 16
+
+// Task identifier of records made by a task missing from the task table.
+#define TRACE_UNKNOWN_TASK 0
+
+// Stream identifier of FRAME_TRACE frames. The sequence number of a frame
+// is its chunk index: the frame holds the dump bytes from
+// seq x TRACE_CHUNK_LENGTH.
+#define TRACE_STREAM_ID 0xfe
+#define TRACE_CHUNK_LENGTH 448
+
+typedef enum {
+	TRACE_WAIT = 1,       // The task waits for a message.
+	TRACE_DEQUEUE,        // a: message type.
+	TRACE_STATE,          // a: new state, b: previous state.
+	TRACE_TIMER_START,    // a: message sent at expiry, b: period in ms.
+	TRACE_TIMER_EXPIRY,   // a: message sent at expiry.
+	TRACE_WIFI_EVENT,     // a: event identifier, b: 0 for WIFI_EVENT, 1 for IP_EVENT.
+	TRACE_SEND_BEGIN,     // a: datagram length.
+	TRACE_SEND_END,       // a: datagram length, b: 0 or errno.
+} trace_type_t;
+
+#endif /* MAIN_TRACE_FORMAT_H_ */
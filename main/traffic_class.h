@@ -0,0 +1,39 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef MAIN_TRAFFIC_CLASS_H_
+#define MAIN_TRAFFIC_CLASS_H_
+
+// Traffic classes, from the highest priority to the lowest.
+//
+// Every producer source belongs to one class. The pipeline task forwards
+// urgent records first, and shares what is left between the other classes
+// with a weighted round robin. The send path keeps one retry queue per
+// class, and marks the datagrams of each class with its own DSCP value:
+// the Wi-Fi driver maps it to a WMM access category (see Traffic classes
+// configuration menu).
+
+typedef enum {
+	TRAFFIC_CLASS_URGENT,
+	TRAFFIC_CLASS_NORMAL,
+	TRAFFIC_CLASS_BULK,
+	TRAFFIC_CLASS_COUNT
+} traffic_class_t;
+
+#endif /* MAIN_TRAFFIC_CLASS_H_ */
@@ -0,0 +1,56 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#include "transport.h"
+
+#if CONFIG_UDPSENDER_TRANSPORT_ESPNOW
+static const transport_t *selected = &transport_espnow;
+#elif CONFIG_UDPSENDER_TRANSPORT_RAW
+static const transport_t *selected = &transport_raw;
+#elif CONFIG_UDPSENDER_TRANSPORT_LOOPBACK
+static const transport_t *selected = &transport_loopback;
+#else
+static const transport_t *selected = &transport_udp;
+#endif
+
+const transport_t *transport_get(void) {
+	return selected;
+}
+
+void transport_set(const transport_t *transport) {
+	selected = transport;
+}
+
+int transport_send_each(const transport_t *transport,
+		                const transport_datagram_t *datagrams, uint16_t count,
+						traffic_class_t traffic_class) {
+
+	for (uint16_t i = 0; i < count; i++) {
+		if (transport->send(datagrams[i].data, datagrams[i].length, traffic_class) < 0) {
+			// errno is set by send().
+			return i > 0 ? i : -1;
+		}
+	}
+	return count;
+
+}
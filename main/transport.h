@@ -0,0 +1,164 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#ifndef MAIN_TRANSPORT_H_
+#define MAIN_TRANSPORT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#include "latency_stats.h"
+#include "traffic_class.h"
+
+// Transports carry frames between the send path and the remote host.
+//
+// A transport is a set of operations, and capability flags which tell the
+// connect_wifi task what it can expect from it. Operations report errors
+// like socket calls: -1, with errno set. ENOMEM, ENOBUFS and EAGAIN are
+// transient errors, the datagram can be sent again later.
+//
+// Backends:
+// - transport_udp: lwIP UDP socket, connected to the remote host given by
+//   the configuration. It uses the BSD socket API only, and runs unchanged
+//   over the sockets of the simulator
+// - transport_espnow: ESP-NOW frames to a gateway, without association
+//   with an access point (CONFIG_UDPSENDER_TRANSPORT_ESPNOW)
+// - transport_raw: lwIP raw UDP API (CONFIG_UDPSENDER_TRANSPORT_RAW).
+//   send() copies the datagram into a pooled pbuf, posts it to the tcpip
+//   thread and returns, instead of waiting for the tcpip thread as a socket
+//   send does. Errors from lwIP are then only counted
+// - transport_loopback: datagrams are counted and discarded, for
+//   benchmarks of the stages before the transport
+//
+// The transport is selected by the configuration, and can be changed with
+// transport_set() before the tasks are started. Transports are used by the
+// connect_wifi task only.
+
+// The transport can only be opened once an IP address has been obtained.
+// Otherwise, it is opened as soon as the Wi-Fi station is started, without
+// association.
+#define TRANSPORT_CAP_NEEDS_IP 0x01
+
+// Frames sent by the remote host (ACK frames, time responses) can be
+// received. Reliable delivery and time synchronization need it.
+#define TRANSPORT_CAP_RECEIVE 0x02
+
+// Traffic classes are mapped to transmission priorities.
+#define TRANSPORT_CAP_CLASSES 0x04
+
+// send_batch() costs less than one send() per datagram.
+#define TRANSPORT_CAP_BATCH 0x08
+
+typedef struct {
+	const uint8_t *data;
+	uint16_t length;
+} transport_datagram_t;
+
+typedef struct {
+	const char *name;
+	uint32_t caps;
+	uint16_t max_length;       // Longest datagram.
+
+	/**
+	 * Returns false on error.
+	 */
+	bool (*open)(void);
+	void (*close)(void);
+
+	/**
+	 * Returns length, or -1 on error.
+	 */
+	int (*send)(const uint8_t *data, uint16_t length, traffic_class_t traffic_class);
+
+	/**
+	 * Sends datagrams in order, and stops at the first error. Returns the
+	 * number of datagrams sent, or -1 if the first one could not be sent.
+	 */
+	int (*send_batch)(const transport_datagram_t *datagrams, uint16_t count,
+			          traffic_class_t traffic_class);
+
+	/**
+	 * Returns the length of the frame copied into buffer, or -1 with errno
+	 * set to EAGAIN if no frame is waiting. Does not block.
+	 */
+	int (*receive)(uint8_t *buffer, uint16_t size);
+
+	/**
+	 * Waits at most timeout_us for a frame to be received. Returns 1 if a
+	 * frame is waiting, 0 on timeout, -1 on error.
+	 */
+	int (*wait)(uint32_t timeout_us);
+} transport_t;
+
+extern const transport_t transport_udp;
+#if CONFIG_UDPSENDER_TRANSPORT_ESPNOW
+extern const transport_t transport_espnow;
+#endif
+#if CONFIG_UDPSENDER_TRANSPORT_RAW
+extern const transport_t transport_raw;
+#endif
+extern const transport_t transport_loopback;
+
+typedef struct {
+	uint32_t datagrams;
+	uint32_t bytes;
+} transport_loopback_stats_t;
+
+typedef struct {
+	uint32_t sent;               // Datagrams posted to the tcpip thread.
+	uint32_t pool_empty;         // ENOBUFS: no free payload buffer.
+	uint32_t mailbox_full;       // ENOMEM: the tcpip thread mailbox was full.
+	uint32_t send_errors;        // Errors from udp_send(), in the tcpip thread.
+	latency_stats_t completion;  // From send() to the release of the buffer.
+} transport_raw_stats_t;
+
+/**
+ * Returns the selected transport.
+ */
+const transport_t *transport_get(void);
+
+/**
+ * Selects another transport. Must be called before the tasks are started.
+ */
+void transport_set(const transport_t *transport);
+
+/**
+ * send_batch() for transports without batch operation: calls send() for
+ * every datagram.
+ */
+int transport_send_each(const transport_t *transport,
+		                const transport_datagram_t *datagrams, uint16_t count,
+						traffic_class_t traffic_class);
+
+/**
+ * Provides the counters of the loopback transport.
+ */
+void transport_loopback_get_stats(transport_loopback_stats_t *stats);
+
+#if CONFIG_UDPSENDER_TRANSPORT_RAW
+/**
+ * Provides the counters of the raw transport, without waiting for the
+ * tcpip thread. Must be called by the task sending datagrams.
+ */
+void transport_raw_get_stats(transport_raw_stats_t *stats);
+#endif
+
+#endif /* MAIN_TRANSPORT_H_ */
@@ -0,0 +1,202 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include "sdkconfig.h"
+
+#if CONFIG_UDPSENDER_TRANSPORT_ESPNOW
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "lwip/errno.h"
+
+#include "esp_log.h"
+#include "esp_now.h"
+#include "esp_wifi.h"
+
+#include "transport.h"
+
+#define PEER CONFIG_UDPSENDER_ESPNOW_PEER
+#define CHANNEL CONFIG_UDPSENDER_ESPNOW_CHANNEL
+
+// Frames received and not read yet.
+#define RX_QUEUE_LENGTH 4
+
+static const char *TAG = "TE";
+
+typedef struct {
+	uint8_t length;
+	uint8_t data[ESP_NOW_MAX_DATA_LEN];
+} rx_frame_t;
+
+static uint8_t peer_addr[ESP_NOW_ETH_ALEN];
+
+// Written by the Wi-Fi task, read by the connect_wifi task. Created once.
+static QueueHandle_t rx_queue = NULL;
+
+static bool opened = false;
+
+/**
+ * Called by the Wi-Fi task. Frames from other stations are ignored.
+ */
+static void receive_callback(const uint8_t *mac_addr, const uint8_t *data, int data_len) {
+
+	if (memcmp(mac_addr, peer_addr, ESP_NOW_ETH_ALEN) != 0 ||
+		data_len <= 0 || data_len > ESP_NOW_MAX_DATA_LEN) {
+		return;
+	}
+	rx_frame_t frame;
+	frame.length = (uint8_t)data_len;
+	memcpy(frame.data, data, data_len);
+	// Dropped if the connect_wifi task is late, as lwIP would do.
+	xQueueSend(rx_queue, &frame, 0);
+
+}
+
+static void espnow_close(void) {
+
+	if (opened) {
+		esp_now_deinit();
+		opened = false;
+	}
+
+}
+
+/**
+ * The Wi-Fi station must have been started.
+ */
+static bool espnow_open(void) {
+
+	espnow_close();
+
+	if (sscanf(PEER, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &peer_addr[0], &peer_addr[1],
+			   &peer_addr[2], &peer_addr[3], &peer_addr[4], &peer_addr[5]) != ESP_NOW_ETH_ALEN) {
+		ESP_LOGE(TAG, "Incorrect MAC address: %s", PEER);
+		return false;
+	}
+	if (rx_queue == NULL) {
+		rx_queue = xQueueCreate(RX_QUEUE_LENGTH, sizeof(rx_frame_t));
+		if (rx_queue == NULL) {
+			ESP_LOGE(TAG, "Error from xQueueCreate");
+			return false;
+		}
+	}
+	xQueueReset(rx_queue);
+	esp_err_t esp_rs = esp_wifi_set_channel(CHANNEL, WIFI_SECOND_CHAN_NONE);
+	if (esp_rs != ESP_OK) {
+		ESP_LOGE(TAG, "Error from esp_wifi_set_channel: %d", esp_rs);
+		return false;
+	}
+	esp_rs = esp_now_init();
+	if (esp_rs != ESP_OK) {
+		ESP_LOGE(TAG, "Error from esp_now_init: %d", esp_rs);
+		return false;
+	}
+	opened = true;
+	esp_rs = esp_now_register_recv_cb(receive_callback);
+	if (esp_rs != ESP_OK) {
+		ESP_LOGE(TAG, "Error from esp_now_register_recv_cb: %d", esp_rs);
+		espnow_close();
+		return false;
+	}
+	esp_now_peer_info_t peer;
+	memset(&peer, 0, sizeof(peer));
+	memcpy(peer.peer_addr, peer_addr, ESP_NOW_ETH_ALEN);
+	peer.channel = CHANNEL;
+	peer.ifidx = ESP_IF_WIFI_STA;
+	peer.encrypt = false;
+	esp_rs = esp_now_add_peer(&peer);
+	if (esp_rs != ESP_OK) {
+		ESP_LOGE(TAG, "Error from esp_now_add_peer: %d", esp_rs);
+		espnow_close();
+		return false;
+	}
+	ESP_LOGI(TAG, "Sending frames to %s on channel %d", PEER, CHANNEL);
+	return true;
+
+}
+
+static int espnow_send(const uint8_t *data, uint16_t length, traffic_class_t traffic_class) {
+
+	if (!opened) {
+		errno = ENOTCONN;
+		return -1;
+	}
+	if (length > ESP_NOW_MAX_DATA_LEN) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	esp_err_t esp_rs = esp_now_send(peer_addr, data, length);
+	if (esp_rs == ESP_OK) {
+		return length;
+	}
+	// The driver queue is full: transient, as ENOMEM with lwIP.
+	errno = esp_rs == ESP_ERR_ESPNOW_NO_MEM ? ENOMEM : EIO;
+	return -1;
+
+}
+
+static int espnow_send_batch(const transport_datagram_t *datagrams, uint16_t count,
+		                     traffic_class_t traffic_class) {
+	return transport_send_each(&transport_espnow, datagrams, count, traffic_class);
+}
+
+static int espnow_receive(uint8_t *buffer, uint16_t size) {
+
+	rx_frame_t frame;
+	if (rx_queue == NULL || xQueueReceive(rx_queue, &frame, 0) != pdTRUE) {
+		errno = EAGAIN;
+		return -1;
+	}
+	uint16_t length = frame.length < size ? frame.length : size;
+	memcpy(buffer, frame.data, length);
+	return length;
+
+}
+
+static int espnow_wait(uint32_t timeout_us) {
+
+	rx_frame_t frame;
+	if (rx_queue == NULL) {
+		errno = ENOTCONN;
+		return -1;
+	}
+	TickType_t ticks = pdMS_TO_TICKS((timeout_us + 999) / 1000);
+	return xQueuePeek(rx_queue, &frame, ticks) == pdTRUE ? 1 : 0;
+
+}
+
+const transport_t transport_espnow = {
+	.name = "espnow",
+	.caps = TRANSPORT_CAP_RECEIVE,
+	.max_length = ESP_NOW_MAX_DATA_LEN,
+	.open = espnow_open,
+	.close = espnow_close,
+	.send = espnow_send,
+	.send_batch = espnow_send_batch,
+	.receive = espnow_receive,
+	.wait = espnow_wait,
+};
+
+#endif
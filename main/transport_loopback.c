@@ -0,0 +1,97 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lwip/errno.h"
+
+#include "transport.h"
+
+// Same as UDP, so that the same datagrams can be sent.
+#define MAX_LENGTH 1472
+
+static bool opened = false;
+
+static transport_loopback_stats_t stats;
+
+static bool loopback_open(void) {
+
+	opened = true;
+	return true;
+
+}
+
+static void loopback_close(void) {
+	opened = false;
+}
+
+static int loopback_send(const uint8_t *data, uint16_t length, traffic_class_t traffic_class) {
+
+	if (!opened) {
+		errno = ENOTCONN;
+		return -1;
+	}
+	stats.datagrams++;
+	stats.bytes += length;
+	return length;
+
+}
+
+static int loopback_send_batch(const transport_datagram_t *datagrams, uint16_t count,
+		                       traffic_class_t traffic_class) {
+
+	if (!opened) {
+		errno = ENOTCONN;
+		return -1;
+	}
+	for (uint16_t i = 0; i < count; i++) {
+		stats.bytes += datagrams[i].length;
+	}
+	stats.datagrams += count;
+	return count;
+
+}
+
+static int loopback_receive(uint8_t *buffer, uint16_t size) {
+
+	errno = EAGAIN;
+	return -1;
+
+}
+
+static int loopback_wait(uint32_t timeout_us) {
+	return 0;
+}
+
+const transport_t transport_loopback = {
+	.name = "loopback",
+	.caps = TRANSPORT_CAP_BATCH,
+	.max_length = MAX_LENGTH,
+	.open = loopback_open,
+	.close = loopback_close,
+	.send = loopback_send,
+	.send_batch = loopback_send_batch,
+	.receive = loopback_receive,
+	.wait = loopback_wait,
+};
+
+void transport_loopback_get_stats(transport_loopback_stats_t *stats_out) {
+	*stats_out = stats;
+}
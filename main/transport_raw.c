@@ -0,0 +1,396 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+
+#include "sdkconfig.h"
+
+#if CONFIG_UDPSENDER_TRANSPORT_RAW
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "lwip/errno.h"
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+#include "lwip/priv/tcpip_priv.h"
+#include "lwip/tcpip.h"
+#include "lwip/udp.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "transport.h"
+
+#define DEST_IPV4_ADDR CONFIG_UDPSENDER_IPV4_ADDR
+#define DEST_PORT CONFIG_UDPSENDER_PORT
+#define SLOT_COUNT CONFIG_UDPSENDER_RAW_SLOTS
+#define SLOT_SIZE CONFIG_UDPSENDER_RAW_SLOT_SIZE
+
+// Datagrams received and not read yet, as for a socket
+// (CONFIG_LWIP_UDP_RECVMBOX_SIZE).
+#define RX_QUEUE_LENGTH 6
+
+// Room left before the payload, for the UDP, IP and link headers.
+#define SLOT_HEADROOM (PBUF_LINK_ENCAPSULATION_HLEN + PBUF_LINK_HLEN + \
+		               PBUF_IP_HLEN + PBUF_TRANSPORT_HLEN)
+
+static const char *TAG = "TR";
+
+// DSCP values, by traffic class.
+static const uint8_t class_dscp[TRAFFIC_CLASS_COUNT] = {
+	[TRAFFIC_CLASS_URGENT] = CONFIG_UDPSENDER_TC_URGENT_DSCP,
+	[TRAFFIC_CLASS_NORMAL] = CONFIG_UDPSENDER_TC_NORMAL_DSCP,
+	[TRAFFIC_CLASS_BULK] = CONFIG_UDPSENDER_TC_BULK_DSCP,
+};
+
+// A payload buffer, and what is needed to hand it over to the tcpip thread
+// without allocation: a custom pbuf over data, and a callback message
+// posted as it is.
+//
+// The pbuf is a PBUF_RAM one, not a PBUF_REF one: lwIP then writes the
+// headers into the headroom of data, instead of chaining a header pbuf,
+// which the Wi-Fi driver would copy again into a contiguous one. This
+// needs data to follow the pbuf in memory. The pbuf must be the first
+// member, see slot_free().
+typedef struct {
+	struct pbuf_custom pbuf;
+	struct tcpip_callback_msg *message;
+	bool busy;                 // Set by the connect_wifi task, cleared by the tcpip thread.
+	uint8_t tos;
+	int64_t sent_us;           // Time of the send() call.
+	uint8_t data[SLOT_HEADROOM + SLOT_SIZE];
+} slot_t;
+
+// Arguments of the calls run by the tcpip thread with tcpip_api_call().
+typedef struct {
+	struct tcpip_api_call_data call;
+	ip_addr_t address;
+} pcb_call_t;
+
+static slot_t slots[SLOT_COUNT];
+
+// Slots and callback messages are created once.
+static bool created = false;
+
+// Next slot to be tried.
+static uint8_t next_slot = 0;
+
+// Received pbufs. Written by the tcpip thread, read by the connect_wifi
+// task. Created once.
+static QueueHandle_t rx_queue = NULL;
+
+// Used by the tcpip thread only, once opened.
+static struct udp_pcb *pcb = NULL;
+
+// send_errors and completion are written by the tcpip thread, between
+// write_begin() and write_end(), the other counters by the task sending
+// datagrams. That task reads them without waiting for the tcpip thread, as
+// in link_state.c.
+static transport_raw_stats_t stats;
+
+// Odd while the tcpip thread writes its counters.
+static uint32_t sequence = 0;
+
+static portMUX_TYPE write_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Called by the tcpip thread. Must be followed by write_end().
+ */
+static void write_begin(void) {
+
+	portENTER_CRITICAL(&write_lock);
+	__atomic_store_n(&sequence, sequence + 1, __ATOMIC_RELAXED);
+	// The counters must not be modified before the sequence is odd.
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+}
+
+static void write_end(void) {
+
+	__atomic_store_n(&sequence, sequence + 1, __ATOMIC_RELEASE);
+	portEXIT_CRITICAL(&write_lock);
+
+}
+
+/**
+ * Called by the tcpip thread, when the last reference to the pbuf of a
+ * slot has been released: by slot_send(), or later if the datagram was
+ * queued by lwIP or by the Wi-Fi driver.
+ */
+static void slot_free(struct pbuf *p) {
+
+	slot_t *slot = (slot_t *)p;
+	uint32_t completion_us = (uint32_t)(esp_timer_get_time() - slot->sent_us);
+	write_begin();
+	latency_stats_add(&stats.completion, completion_us);
+	write_end();
+	__atomic_store_n(&slot->busy, false, __ATOMIC_RELEASE);
+
+}
+
+/**
+ * Called by the tcpip thread.
+ */
+static void slot_send(void *ctx) {
+
+	slot_t *slot = (slot_t *)ctx;
+	struct pbuf *p = &slot->pbuf.pbuf;
+	if (pcb == NULL) {
+		// Closed meanwhile.
+		write_begin();
+		stats.send_errors++;
+		write_end();
+	} else {
+		pcb->tos = slot->tos;
+		err_t err = udp_send(pcb, p);
+		if (err != ERR_OK) {
+			write_begin();
+			stats.send_errors++;
+			write_end();
+			ESP_LOGD(TAG, "Error from udp_send: %d", err);
+		}
+	}
+	// Releases the slot, unless lwIP still holds the pbuf.
+	pbuf_free(p);
+
+}
+
+/**
+ * Called by the tcpip thread. Datagrams are dropped if the connect_wifi
+ * task is late, as for a socket.
+ */
+static void receive_callback(void *arg, struct udp_pcb *upcb, struct pbuf *p,
+		                     const ip_addr_t *addr, u16_t port) {
+
+	if (xQueueSend(rx_queue, &p, 0) != pdTRUE) {
+		pbuf_free(p);
+	}
+
+}
+
+static err_t pcb_open(struct tcpip_api_call_data *call) {
+
+	pcb_call_t *pcb_call = (pcb_call_t *)call;
+	pcb = udp_new();
+	if (pcb == NULL) {
+		return ERR_MEM;
+	}
+	// Only datagrams from the destination are received.
+	err_t err = udp_connect(pcb, &pcb_call->address, DEST_PORT);
+	if (err != ERR_OK) {
+		udp_remove(pcb);
+		pcb = NULL;
+		return err;
+	}
+	udp_recv(pcb, receive_callback, NULL);
+	return ERR_OK;
+
+}
+
+static err_t pcb_close(struct tcpip_api_call_data *call) {
+
+	if (pcb != NULL) {
+		udp_remove(pcb);
+		pcb = NULL;
+	}
+	return ERR_OK;
+
+}
+
+/**
+ * Creates the slots and the queues, once.
+ */
+static bool create_slots(void) {
+
+	if (created) {
+		return true;
+	}
+	if (rx_queue == NULL) {
+		rx_queue = xQueueCreate(RX_QUEUE_LENGTH, sizeof(struct pbuf *));
+		if (rx_queue == NULL) {
+			ESP_LOGE(TAG, "Error from xQueueCreate");
+			return false;
+		}
+	}
+	for (uint8_t i = 0; i < SLOT_COUNT; i++) {
+		slots[i].pbuf.custom_free_function = slot_free;
+		if (slots[i].message == NULL) {
+			slots[i].message = tcpip_callbackmsg_new(slot_send, &slots[i]);
+			if (slots[i].message == NULL) {
+				ESP_LOGE(TAG, "Error from tcpip_callbackmsg_new");
+				return false;
+			}
+		}
+	}
+	latency_stats_reset(&stats.completion);
+	created = true;
+	return true;
+
+}
+
+static void raw_close(void) {
+
+	pcb_call_t pcb_call;
+	// Run after the datagrams already posted.
+	tcpip_api_call(pcb_close, &pcb_call.call);
+	struct pbuf *p;
+	while (rx_queue != NULL && xQueueReceive(rx_queue, &p, 0) == pdTRUE) {
+		pbuf_free(p);
+	}
+
+}
+
+/**
+ * As for the socket, a new PCB is created for every lease.
+ */
+static bool raw_open(void) {
+
+	raw_close();
+
+	if (!create_slots()) {
+		return false;
+	}
+	pcb_call_t pcb_call;
+	ESP_LOGI(TAG, "Preparing for sending datagrams to %s - %d", DEST_IPV4_ADDR, DEST_PORT);
+	if (ipaddr_aton(DEST_IPV4_ADDR, &pcb_call.address) == 0) {
+		ESP_LOGE(TAG, "Incorrect IPv4 address: %s", DEST_IPV4_ADDR);
+		return false;
+	}
+	err_t err = tcpip_api_call(pcb_open, &pcb_call.call);
+	if (err != ERR_OK) {
+		ESP_LOGE(TAG, "Error on creating the PCB: %d", err);
+		return false;
+	}
+	return true;
+
+}
+
+/**
+ * Copies the datagram into a free slot, and posts it to the tcpip thread.
+ * Returns without waiting for it to be sent: errors reported by lwIP are
+ * only counted.
+ */
+static int raw_send(const uint8_t *data, uint16_t length, traffic_class_t traffic_class) {
+
+	if (!created) {
+		errno = ENOTCONN;
+		return -1;
+	}
+	if (length > SLOT_SIZE) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	slot_t *slot = NULL;
+	for (uint8_t i = 0; i < SLOT_COUNT && slot == NULL; i++) {
+		uint8_t index = (next_slot + i) % SLOT_COUNT;
+		if (!__atomic_load_n(&slots[index].busy, __ATOMIC_ACQUIRE)) {
+			slot = &slots[index];
+			next_slot = (index + 1) % SLOT_COUNT;
+		}
+	}
+	if (slot == NULL) {
+		// Every slot is waiting for the tcpip thread or for the driver.
+		stats.pool_empty++;
+		errno = ENOBUFS;
+		return -1;
+	}
+	struct pbuf *p = pbuf_alloced_custom(PBUF_TRANSPORT, length, PBUF_RAM, &slot->pbuf,
+			                             slot->data, sizeof(slot->data));
+	memcpy(p->payload, data, length);
+	slot->tos = class_dscp[traffic_class] << 2;
+	slot->sent_us = esp_timer_get_time();
+	slot->busy = true;
+	if (tcpip_callbackmsg_trycallback(slot->message) != ERR_OK) {
+		stats.mailbox_full++;
+		slot->busy = false;
+		errno = ENOMEM;
+		return -1;
+	}
+	stats.sent++;
+	return length;
+
+}
+
+static int raw_send_batch(const transport_datagram_t *datagrams, uint16_t count,
+		                  traffic_class_t traffic_class) {
+	return transport_send_each(&transport_raw, datagrams, count, traffic_class);
+}
+
+static int raw_receive(uint8_t *buffer, uint16_t size) {
+
+	struct pbuf *p;
+	if (rx_queue == NULL || xQueueReceive(rx_queue, &p, 0) != pdTRUE) {
+		errno = EAGAIN;
+		return -1;
+	}
+	// The datagram may be split over several pbufs.
+	u16_t length = pbuf_copy_partial(p, buffer, size, 0);
+	pbuf_free(p);
+	return length;
+
+}
+
+static int raw_wait(uint32_t timeout_us) {
+
+	struct pbuf *p;
+	if (rx_queue == NULL) {
+		errno = ENOTCONN;
+		return -1;
+	}
+	TickType_t ticks = pdMS_TO_TICKS((timeout_us + 999) / 1000);
+	return xQueuePeek(rx_queue, &p, ticks) == pdTRUE ? 1 : 0;
+
+}
+
+void transport_raw_get_stats(transport_raw_stats_t *raw_stats) {
+
+	while (true) {
+		uint32_t begin = __atomic_load_n(&sequence, __ATOMIC_ACQUIRE);
+		if ((begin & 1) != 0) {
+			// Being written, on the other core.
+			continue;
+		}
+		*raw_stats = stats;
+		// The copy must be complete before the sequence is read again.
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&sequence, __ATOMIC_RELAXED) == begin) {
+			return;
+		}
+	}
+
+}
+
+const transport_t transport_raw = {
+	.name = "raw",
+	.caps = TRANSPORT_CAP_NEEDS_IP | TRANSPORT_CAP_RECEIVE | TRANSPORT_CAP_CLASSES,
+	.max_length = SLOT_SIZE,
+	.open = raw_open,
+	.close = raw_close,
+	.send = raw_send,
+	.send_batch = raw_send_batch,
+	.receive = raw_receive,
+	.wait = raw_wait,
+};
+
+#endif
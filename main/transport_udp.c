@@ -0,0 +1,186 @@
+/**
+ * This file is part of UdpSender.
+ *
+ * UdpSender is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * UdpSender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with UdpSender.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ * Copyright 2020 Pascal Bodin
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lwip/errno.h"
+#include "lwip/sockets.h"
+
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include "transport.h"
+
+#define DEST_IPV4_ADDR CONFIG_UDPSENDER_IPV4_ADDR
+#define DEST_PORT CONFIG_UDPSENDER_PORT
+#define SEND_BUFFER_SIZE CONFIG_UDPSENDER_SEND_BUFFER_SIZE
+
+// Longest UDP payload in an Ethernet frame.
+#define MAX_LENGTH 1472
+
+// Unknown TOS value: set it before the next send.
+#define TOS_UNKNOWN -1
+
+static const char *TAG = "TU";
+
+// DSCP values, by traffic class.
+static const uint8_t class_dscp[TRAFFIC_CLASS_COUNT] = {
+	[TRAFFIC_CLASS_URGENT] = CONFIG_UDPSENDER_TC_URGENT_DSCP,
+	[TRAFFIC_CLASS_NORMAL] = CONFIG_UDPSENDER_TC_NORMAL_DSCP,
+	[TRAFFIC_CLASS_BULK] = CONFIG_UDPSENDER_TC_BULK_DSCP,
+};
+
+static int sock = -1;
+
+// TOS value of the socket.
+static int current_tos = TOS_UNKNOWN;
+
+static void udp_close(void) {
+
+	if (sock >= 0) {
+		close(sock);
+		sock = -1;
+	}
+
+}
+
+/**
+ * The socket created for a previous lease may be bound to a stale address:
+ * a new one is created every time.
+ */
+static bool udp_open(void) {
+
+	struct sockaddr_in dest_addr;
+
+	udp_close();
+
+	ESP_LOGI(TAG, "Preparing for sending datagrams to %s - %d", DEST_IPV4_ADDR, DEST_PORT);
+	int rs = inet_aton(DEST_IPV4_ADDR, &dest_addr.sin_addr.s_addr);
+	if (rs == 0) {
+		ESP_LOGE(TAG, "Incorrect IPv4 address: %s", DEST_IPV4_ADDR);
+		return false;
+	}
+	dest_addr.sin_family = AF_INET;
+	dest_addr.sin_port = htons(DEST_PORT);
+
+	sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+	if (sock < 0) {
+		ESP_LOGE(TAG, "Error from socket: %d", errno);
+		return false;
+	}
+	int flags = fcntl(sock, F_GETFL, 0);
+	if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+		ESP_LOGE(TAG, "Error from fcntl: %d", errno);
+		udp_close();
+		return false;
+	}
+	// Not supported by all lwIP configurations: failure is not an error.
+	int buffer_size = SEND_BUFFER_SIZE;
+	if (setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size)) < 0) {
+		ESP_LOGD(TAG, "SO_SNDBUF not supported: %d", errno);
+	}
+	current_tos = TOS_UNKNOWN;
+	// Once connected, the destination address is not parsed again by every
+	// send, and only datagrams from the destination are received.
+	if (connect(sock, (const struct sockaddr *)&dest_addr, sizeof(struct sockaddr_in)) < 0) {
+		ESP_LOGE(TAG, "Error from connect: %d", errno);
+		udp_close();
+		return false;
+	}
+	return true;
+
+}
+
+/**
+ * Sets the TOS value of the socket for the given traffic class, if needed.
+ * The Wi-Fi driver takes the WMM access category from it.
+ */
+static void set_class(traffic_class_t traffic_class) {
+
+	int tos = class_dscp[traffic_class] << 2;
+	if (tos == current_tos) {
+		return;
+	}
+	if (setsockopt(sock, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) < 0) {
+		// Datagrams are sent anyway, unmarked.
+		ESP_LOGD(TAG, "Error from setsockopt IP_TOS: %d", errno);
+	}
+	// Not tried again for every datagram if not supported.
+	current_tos = tos;
+
+}
+
+static int udp_send(const uint8_t *data, uint16_t length, traffic_class_t traffic_class) {
+
+	if (sock < 0) {
+		errno = ENOTCONN;
+		return -1;
+	}
+	set_class(traffic_class);
+	return send(sock, data, length, 0);
+
+}
+
+static int udp_send_batch(const transport_datagram_t *datagrams, uint16_t count,
+		                  traffic_class_t traffic_class) {
+	// lwIP has no sendmmsg().
+	return transport_send_each(&transport_udp, datagrams, count, traffic_class);
+}
+
+static int udp_receive(uint8_t *buffer, uint16_t size) {
+
+	if (sock < 0) {
+		errno = ENOTCONN;
+		return -1;
+	}
+	return recv(sock, buffer, size, MSG_DONTWAIT);
+
+}
+
+static int udp_wait(uint32_t timeout_us) {
+
+	if (sock < 0) {
+		errno = ENOTCONN;
+		return -1;
+	}
+	struct timeval timeout = {
+		.tv_sec = timeout_us / 1000000,
+		.tv_usec = timeout_us % 1000000,
+	};
+	fd_set read_set;
+	FD_ZERO(&read_set);
+	FD_SET(sock, &read_set);
+	int rs = select(sock + 1, &read_set, NULL, NULL, &timeout);
+	return rs > 0 ? 1 : rs;
+
+}
+
+const transport_t transport_udp = {
+	.name = "udp",
+	.caps = TRANSPORT_CAP_NEEDS_IP | TRANSPORT_CAP_RECEIVE | TRANSPORT_CAP_CLASSES,
+	.max_length = MAX_LENGTH,
+	.open = udp_open,
+	.close = udp_close,
+	.send = udp_send,
+	.send_batch = udp_send_batch,
+	.receive = udp_receive,
+	.wait = udp_wait,
+};
@@ -24,9 +24,18 @@
 #include "esp_log.h"
 #include "nvs_flash.h"
 #include "esp_netif.h"
+#if CONFIG_UDPSENDER_AEAD_BENCHMARK
+#include "xtensa/hal.h"
+
+#include "aead.h"
+#endif
 
 #include "connect_wifi.h"
+#include "link_state.h"
+#include "pipeline.h"
+#include "reactor.h"
 #include "send_datagram.h"
+#include "seq_store.h"
 #include "supervisor.h"
 
 #define LOOP_PERIOD_MS 180000
@@ -35,6 +44,55 @@ static const char *VERSION = "0.7.0";
 
 static const char *TAG = "US";
 
+#if CONFIG_UDPSENDER_AEAD_BENCHMARK
+#define BENCHMARK_ITERATIONS 200
+
+static uint32_t get_ccount(void) {
+	return xthal_get_ccount();
+}
+
+/**
+ * Logs the cost of sealing and opening datagrams, with a dummy key.
+ */
+static void run_aead_benchmark(void) {
+
+	static const uint8_t key[16] = { 0 };
+	aead_bench_result_t results[AEAD_BENCH_LENGTHS];
+	aead_t aead;
+
+#ifdef CONFIG_UDPSENDER_AEAD_CCM
+	aead_mode_t mode = AEAD_CCM;
+#else
+	aead_mode_t mode = AEAD_GCM;
+#endif
+	if (!aead_init(&aead, mode, key, sizeof(key))) {
+		ESP_LOGE(TAG, "Error from aead_init");
+		return;
+	}
+	if (!aead_benchmark(&aead, get_ccount, BENCHMARK_ITERATIONS, results)) {
+		ESP_LOGE(TAG, "Error from aead_benchmark");
+		aead_free(&aead);
+		return;
+	}
+	aead_free(&aead);
+#if CONFIG_MBEDTLS_HARDWARE_AES
+	const char *aes = "hardware";
+#else
+	const char *aes = "software";
+#endif
+	for (uint8_t i = 0; i < AEAD_BENCH_LENGTHS; i++) {
+		ESP_LOGI(TAG, "AES-%s %s - %u bytes: seal %u cycles (%u us), open %u cycles, "
+				 "%.3f bytes/cycle",
+				 mode == AEAD_GCM ? "GCM" : "CCM", aes, results[i].payload_length,
+				 results[i].seal_cycles,
+				 results[i].seal_cycles / CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+				 results[i].open_cycles,
+				 (double)results[i].payload_length / results[i].seal_cycles);
+	}
+
+}
+#endif
+
 void app_main(void)
 {
 
@@ -48,17 +106,33 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
+    // Sequence numbers go on across restarts.
+    seq_store_init();
+
+    // Before the tasks which publish and read the link state.
+    link_state_init();
+
+#if CONFIG_UDPSENDER_AEAD_BENCHMARK
+    run_aead_benchmark();
+#endif
+
     // Initialize TCP/IP stack.
     ESP_ERROR_CHECK(esp_netif_init());
 
     // Create the default event loop.
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
-    // Task depths have been chosen after the use of uxTaskGetStackHighWaterMark(),
-    // with some margin.
-    xTaskCreate(supervisor_task, "supervisor", 2000, NULL, 5, NULL);
-    xTaskCreate(connect_wifi_task, "connect_wifi", 3000, NULL, 5, NULL);
-    xTaskCreate(send_datagram_task, "send_datagram", 2000, NULL, 5, NULL);
+    // Task depths are set in the Tasks configuration menu, from the stack
+    // high-water marks logged by connect_wifi, with some margin.
+#if CONFIG_UDPSENDER_REACTOR
+    // connect_wifi handler is the deepest one.
+    xTaskCreate(reactor_task, "reactor", CONFIG_UDPSENDER_REACTOR_STACK_SIZE, NULL, 5, NULL);
+#else
+    xTaskCreate(supervisor_task, "supervisor", CONFIG_UDPSENDER_SUPERVISOR_STACK_SIZE, NULL, 5, NULL);
+    xTaskCreate(connect_wifi_task, "connect_wifi", CONFIG_UDPSENDER_CONNECT_WIFI_STACK_SIZE, NULL, 5, NULL);
+    xTaskCreate(send_datagram_task, "send_datagram", CONFIG_UDPSENDER_SEND_DATAGRAM_STACK_SIZE, NULL, 5, NULL);
+#endif
+    xTaskCreate(pipeline_task, "pipeline", CONFIG_UDPSENDER_PIPELINE_STACK_SIZE, NULL, 5, NULL);
 
     // Do not exit from app_main().
     while (true) {
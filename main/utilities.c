@@ -17,6 +17,7 @@
  * Copyright 2020 Pascal Bodin
  */
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "freertos/FreeRTOS.h"
@@ -36,6 +37,39 @@ BaseType_t send_to_queue(QueueHandle_t xQueue, const void * const pvItemToQueue,
 	return xQueueSend(xQueue, pvItemToQueue, 0);
 }
 
+BaseType_t receive_from_set(QueueSetHandle_t queue_set, QueueHandle_t control_queue,
+		                    QueueHandle_t data_queue, void *buffer,
+							TickType_t ticks_to_wait) {
+
+	if (xQueueSelectFromSet(queue_set, ticks_to_wait) == NULL) {
+		return pdFALSE;
+	}
+	// The set holds one handle per waiting message. Receiving exactly one
+	// message per handle keeps them consistent, even if the message is not
+	// taken from the queue the handle designates.
+	if (xQueueReceive(control_queue, buffer, 0) == pdTRUE) {
+		return pdTRUE;
+	}
+	return xQueueReceive(data_queue, buffer, 0);
+
+}
+
+bool create_queue_set(UBaseType_t control_length, UBaseType_t data_length,
+		              QueueSetHandle_t *queue_set, QueueHandle_t *control_queue,
+					  QueueHandle_t *data_queue) {
+
+	*queue_set = xQueueCreateSet(control_length + data_length);
+	*control_queue = xQueueCreate(control_length, sizeof(message_t));
+	*data_queue = xQueueCreate(data_length, sizeof(message_t));
+	if (*queue_set == NULL || *control_queue == NULL || *data_queue == NULL) {
+		return false;
+	}
+	// Queues must be empty when added to the set.
+	return xQueueAddToSet(*control_queue, *queue_set) == pdPASS &&
+		   xQueueAddToSet(*data_queue, *queue_set) == pdPASS;
+
+}
+
 void send_error(sv_internal_error_type_t error, const char *TAG) {
 
 	message_t message_to_send;
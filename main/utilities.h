@@ -20,6 +20,8 @@
 #ifndef MAIN_UTILITIES_H_
 #define MAIN_UTILITIES_H_
 
+#include <stdbool.h>
+
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 
@@ -37,6 +39,24 @@ typedef enum {
 queue_rs_t send_to_queue(QueueHandle_t xQueue, const void * const pvItemToQueue,
 		                 const char *TAG);
 
+/**
+ * Receives the next message of a task that has a control queue and a data
+ * queue, both members of queue_set. Waiting control messages are always
+ * received first. Returns pdFALSE on timeout. The queues must not be
+ * received from in any other way.
+ */
+BaseType_t receive_from_set(QueueSetHandle_t queue_set, QueueHandle_t control_queue,
+		                    QueueHandle_t data_queue, void *buffer,
+							TickType_t ticks_to_wait);
+
+/**
+ * Creates a control queue and a data queue, of message_t items, and the
+ * queue set they belong to. Returns false on error.
+ */
+bool create_queue_set(UBaseType_t control_length, UBaseType_t data_length,
+		              QueueSetHandle_t *queue_set, QueueHandle_t *control_queue,
+					  QueueHandle_t *data_queue);
+
 /**
  * Sends the error to the supervisor task.
  */